@@ -0,0 +1,304 @@
+// devalloc.c
+// Opens a free subdevice of an ALSA rawmidi or PCM device. See
+// devalloc.h.
+//
+// Compile it along with the program that uses it, and mididev.c or pcmdev.c. For example:
+// gcc -o midireplay midireplay.c ../../common/midithin.c ../../common/midiout.c ../../common/mididev.c ../../common/devalloc.c ../../common/midiparse.c ../../common/midilog.c ../../common/timing.c -lasound -lm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "devalloc.h"
+
+// What we know about one device
+typedef struct _DEVALLOC_DEV
+{
+	int				Card;
+	int				Device;
+	unsigned int	Count;		// How many subdevices it has
+	unsigned int	Avail;		// How many of them were free
+} DEVALLOC_DEV;
+
+// Which kind of device we're opening
+#define DEVALLOC_RAWMIDI	0
+#define DEVALLOC_PCM			1
+
+// Bumped for each subdevice we open, so the next open starts looking at
+// a different one. Seeded from our pid, so each process starts
+// somewhere else, too
+static unsigned int	NextStart;
+static unsigned char	Seeded;
+
+
+
+
+
+/********************* get_device_info() *********************
+ * Fills in how many subdevices a device has, and how many
+ * are free.
+ *
+ * RETURNS: 0 if success, or a negative error number (ie,
+ * -ENOENT if the device doesn't have the stream we want).
+ */
+
+static int get_device_info(snd_ctl_t *ctl, register DEVALLOC_DEV *dev, int type, int stream)
+{
+	register int	err;
+
+	if (type == DEVALLOC_RAWMIDI)
+	{
+		snd_rawmidi_info_t	*info;
+
+		snd_rawmidi_info_alloca(&info);
+		memset(info, 0, snd_rawmidi_info_sizeof());
+		snd_rawmidi_info_set_device(info, dev->Device);
+		snd_rawmidi_info_set_subdevice(info, 0);
+		snd_rawmidi_info_set_stream(info, (snd_rawmidi_stream_t)stream);
+		if ((err = snd_ctl_rawmidi_info(ctl, info)) < 0) return(err);
+		dev->Count = snd_rawmidi_info_get_subdevices_count(info);
+		dev->Avail = snd_rawmidi_info_get_subdevices_avail(info);
+	}
+	else
+	{
+		snd_pcm_info_t	*info;
+
+		snd_pcm_info_alloca(&info);
+		memset(info, 0, snd_pcm_info_sizeof());
+		snd_pcm_info_set_device(info, dev->Device);
+		snd_pcm_info_set_subdevice(info, 0);
+		snd_pcm_info_set_stream(info, (snd_pcm_stream_t)stream);
+		if ((err = snd_ctl_pcm_info(ctl, info)) < 0) return(err);
+		dev->Count = snd_pcm_info_get_subdevices_count(info);
+		dev->Avail = snd_pcm_info_get_subdevices_avail(info);
+	}
+
+	return(0);
+}
+
+
+
+
+
+/********************* take_inventory() *********************
+ * Lists the devices in the scope that have the stream we
+ * want.
+ *
+ * devs =	Where to list them. DEVALLOC_MAXDEVS of them.
+ * scope =	"", "C", or "C,D". See devalloc.h.
+ *
+ * RETURNS: How many devices we listed, or a negative error
+ * number.
+ */
+
+static int take_inventory(DEVALLOC_DEV *devs, const char *scope, int type, int stream)
+{
+	char			ctlName[16];
+	snd_ctl_t	*ctl;
+	char			*ptr;
+	int			card, device, onlyCard, onlyDevice;
+	register int	count, err;
+
+	// Which card and device did he ask for? -1 if any
+	onlyCard = onlyDevice = -1;
+	if (*scope)
+	{
+		onlyCard = (int)strtol(scope, &ptr, 10);
+		if (ptr == scope || onlyCard < 0) return(-EINVAL);
+		if (*ptr == ',')
+		{
+			scope = ptr + 1;
+			onlyDevice = (int)strtol(scope, &ptr, 10);
+			if (ptr == scope || onlyDevice < 0) return(-EINVAL);
+		}
+		if (*ptr) return(-EINVAL);
+	}
+
+	count = 0;
+	card = (onlyCard >= 0 ? onlyCard : -1);
+	if (onlyCard < 0 && (err = snd_card_next(&card)) < 0) return(err);
+
+	while (card >= 0)
+	{
+		sprintf(ctlName, "hw:%i", card);
+		if ((err = snd_ctl_open(&ctl, ctlName, 0)) >= 0)
+		{
+			device = -1;
+			while (count < DEVALLOC_MAXDEVS &&
+				(type == DEVALLOC_RAWMIDI ? snd_ctl_rawmidi_next_device(ctl, &device) : snd_ctl_pcm_next_device(ctl, &device)) >= 0 && device >= 0)
+			{
+				if (onlyDevice >= 0 && device != onlyDevice) continue;
+				devs[count].Card = card;
+				devs[count].Device = device;
+
+				// A device may not have the stream we want (ie, a MIDI input
+				// with no output), so skip it
+				if (get_device_info(ctl, &devs[count], type, stream) >= 0 && devs[count].Count) ++count;
+			}
+			snd_ctl_close(ctl);
+		}
+		else if (onlyCard >= 0)
+			return(err);
+
+		if (onlyCard >= 0 || snd_card_next(&card) < 0) break;
+	}
+
+	return(count);
+}
+
+
+
+
+
+/********************* try_open() *********************
+ * Opens one subdevice, non-blocking.
+ *
+ * RETURNS: 0 if success, or a negative error number (-EBUSY
+ * if someone else has it open).
+ */
+
+static int try_open(void **handle, const char *name, int type, int stream, int mode)
+{
+	if (type == DEVALLOC_RAWMIDI)
+	{
+		return(snd_rawmidi_open(stream == SND_RAWMIDI_STREAM_OUTPUT ? 0 : (snd_rawmidi_t **)handle,
+			stream == SND_RAWMIDI_STREAM_OUTPUT ? (snd_rawmidi_t **)handle : 0, name, mode | SND_RAWMIDI_NONBLOCK));
+	}
+
+	return(snd_pcm_open((snd_pcm_t **)handle, name, (snd_pcm_stream_t)stream, mode | SND_PCM_NONBLOCK));
+}
+
+
+
+
+
+/********************* dev_alloc() *********************
+ * Opens the free subdevice we'd most like to have. See
+ * dev_alloc_rawmidi() and dev_alloc_pcm().
+ */
+
+static int dev_alloc(void **handle, char *name, const char *scope, int type, int stream, int mode)
+{
+	DEVALLOC_DEV			devs[DEVALLOC_MAXDEVS];
+	char						devName[DEVALLOC_NAMESIZE];
+	register unsigned int	start, i, j;
+	register int			count, err;
+
+	*handle = 0;
+	if ((count = take_inventory(devs, scope ? scope : "", type, stream)) < 0) return(count);
+	if (!count) return(-ENODEV);
+
+	if (!Seeded)
+	{
+		__atomic_store_n(&NextStart, (unsigned int)getpid(), __ATOMIC_RELAXED);
+		Seeded = 1;
+	}
+	start = __atomic_fetch_add(&NextStart, 1, __ATOMIC_RELAXED);
+
+	// Rotate the list so each open starts at a different device, then
+	// (stable) sort it by how many subdevices are free, most first. So
+	// devices that are equally busy take turns
+	{
+		DEVALLOC_DEV	rotated[DEVALLOC_MAXDEVS];
+
+		for (i = 0; i < (unsigned int)count; i++) rotated[i] = devs[(start + i) % count];
+		for (i = 0; i < (unsigned int)count; i++)
+		{
+			DEVALLOC_DEV	dev;
+
+			dev = rotated[i];
+			for (j = i; j && devs[j - 1].Avail < dev.Avail; j--) devs[j] = devs[j - 1];
+			devs[j] = dev;
+		}
+	}
+
+	// If every device is full, we fail with -EBUSY. (Or the error we got
+	// trying to open one, if that was something else)
+	err = -EBUSY;
+	for (i = 0; i < (unsigned int)count && devs[i].Avail; i++)
+	{
+		for (j = 0; j < devs[i].Count; j++)
+		{
+			register int	ret;
+
+			sprintf(devName, "hw:%i,%i,%u", devs[i].Card, devs[i].Device, (start + j) % devs[i].Count);
+			if (!(ret = try_open(handle, devName, type, stream, mode)))
+			{
+				// If he wanted to wait on reads/writes, turn blocking back on
+				if (type == DEVALLOC_RAWMIDI)
+				{
+					if (!(mode & SND_RAWMIDI_NONBLOCK)) snd_rawmidi_nonblock((snd_rawmidi_t *)*handle, 0);
+				}
+				else if (!(mode & SND_PCM_NONBLOCK))
+					snd_pcm_nonblock((snd_pcm_t *)*handle, 0);
+
+				if (name) strcpy(name, devName);
+				return(0);
+			}
+			*handle = 0;
+
+			// Someone else has this one. Try the next. Any other error is
+			// probably about the whole device, so try the next device
+			if (ret != -EBUSY && ret != -EAGAIN)
+			{
+				err = ret;
+				break;
+			}
+		}
+	}
+
+	return(err);
+}
+
+
+
+
+
+/********************* dev_alloc_rawmidi() *********************
+ * Opens a free rawmidi subdevice.
+ *
+ * handle =	Where to return the handle.
+ * name =	Where to return the subdevice's name ("hw:C,D,S"),
+ *				or 0 if not wanted. DEVALLOC_NAMESIZE chars.
+ * scope =	Which devices to choose from. See devalloc.h.
+ * output =	1 for an output, 0 for an input.
+ * mode =	snd_rawmidi_open()'s mode. We always open
+ *				non-blocking, but if SND_RAWMIDI_NONBLOCK isn't
+ *				given, we then turn blocking reads/writes on.
+ *
+ * RETURNS: 0 if success, -EBUSY if every subdevice is taken,
+ * -ENODEV if there are no such devices, or another negative
+ * error number.
+ */
+
+int dev_alloc_rawmidi(snd_rawmidi_t **handle, char *name, const char *scope, int output, int mode)
+{
+	return(dev_alloc((void **)handle, name, scope, DEVALLOC_RAWMIDI, output ? SND_RAWMIDI_STREAM_OUTPUT : SND_RAWMIDI_STREAM_INPUT, mode));
+}
+
+
+
+
+
+/********************* dev_alloc_pcm() *********************
+ * Opens a free PCM subdevice.
+ *
+ * handle =	Where to return the handle.
+ * name =	Where to return the subdevice's name ("hw:C,D,S"),
+ *				or 0 if not wanted. DEVALLOC_NAMESIZE chars.
+ * scope =	Which devices to choose from. See devalloc.h.
+ * stream =	SND_PCM_STREAM_PLAYBACK or SND_PCM_STREAM_CAPTURE.
+ * mode =	snd_pcm_open()'s mode. We always open non-blocking,
+ *				but if SND_PCM_NONBLOCK isn't given, we then turn
+ *				blocking reads/writes on.
+ *
+ * RETURNS: 0 if success, -EBUSY if every subdevice is taken,
+ * -ENODEV if there are no such devices, or another negative
+ * error number.
+ */
+
+int dev_alloc_pcm(snd_pcm_t **handle, char *name, const char *scope, snd_pcm_stream_t stream, int mode)
+{
+	return(dev_alloc((void **)handle, name, scope, DEVALLOC_PCM, stream, mode));
+}
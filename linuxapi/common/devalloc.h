@@ -0,0 +1,47 @@
+// devalloc.h
+// Picks a free subdevice of an ALSA rawmidi or PCM device, so that
+// several programs (or several streams in one program) don't all
+// try to open "hw:0,0,0", and wait on (or fail with -EBUSY because
+// of) each other.
+//
+// A device can have several subdevices (ie, the ports of a virtual
+// MIDI card, or a card's hardware mixing voices), and each can be
+// opened by only one stream at a time. The driver tells us how many
+// of a device's subdevices are free ("avail"), so we take an
+// inventory of every device the caller lets us use (its "scope"),
+// and try the ones with the most free subdevices first. That
+// spreads the streams over the cards and devices. Among devices
+// with the same number free, and among one device's subdevices, we
+// start at a different one each time (and in each process), so two
+// programs starting at once don't both go for the same one.
+//
+// The inventory can be out of date by the time we open (another
+// program may have beaten us to a subdevice). So we always open
+// non-blocking, which fails with -EBUSY right away instead of
+// waiting, and then we just try the next subdevice.
+//
+// The scope is:
+//
+// ""			Any card's devices.
+// "C"		Any of card C's devices.
+// "C,D"		Any subdevice of card C's device D.
+//
+// NOTE: On some cards, each subdevice is a different physical port
+// (ie, a MIDI interface with 4 outputs). Then any free one won't do,
+// and you should open the port by its own name (ie, "hw:1,0,2").
+
+#ifndef DEVALLOC_H
+#define DEVALLOC_H
+
+#include <alsa/asoundlib.h>
+
+// How big a buffer dev_alloc_xxx() needs for the name of the subdevice it opens
+#define DEVALLOC_NAMESIZE	32
+
+// The most devices we look at
+#define DEVALLOC_MAXDEVS	64
+
+int dev_alloc_rawmidi(snd_rawmidi_t **, char *, const char *, int, int);
+int dev_alloc_pcm(snd_pcm_t **, char *, const char *, snd_pcm_stream_t, int);
+
+#endif
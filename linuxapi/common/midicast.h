@@ -0,0 +1,192 @@
+// midicast.h
+// A lock-free ring buffer for broadcasting fixed-size records
+// from one thread (the writer) to any number of other threads
+// (the readers), each of which gets every record, at its own
+// pace. Ie, the MIDI input thread can hand each message to a
+// recorder, a router, and a display.
+//
+// Unlike midiring.h, the writer never waits for (nor even looks
+// at) the readers. It just keeps writing around the ring. Each
+// reader keeps its own place in the ring (a MIDICAST_READER), so
+// readers don't slow each other down either. If a reader falls
+// so far behind that the writer has written over records it
+// hasn't read yet, the reader notices, skips ahead to records
+// that are still there, and counts how many it missed. So a slow
+// reader loses messages, instead of holding up the input.
+//
+// Each record is numbered (a 64-bit "sequence number", so it never
+// wraps), and each slot of the ring holds its record's number along
+// with the record. The writer zeroes a slot's number before it
+// changes the record, and stores the new number after. A reader
+// copies the record out, then checks that the slot's number is
+// still the one it wanted (the same as a seqlock). So a reader
+// always gets a whole record, or knows it was overwritten.
+//
+// Each slot is padded to a multiple of 64 bytes (a cache line),
+// so the writer filling one slot doesn't disturb a reader
+// copying the one before it. With a record of up to 56 bytes,
+// each slot is one cache line.
+//
+// The number of records must be a power of 2.
+
+#ifndef MIDICAST_H
+#define MIDICAST_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+typedef struct _MIDICAST
+{
+	unsigned long long	Head __attribute__((aligned(64)));	// Sequence number of the next record to write
+	unsigned char			*Slots __attribute__((aligned(64)));
+	unsigned int			Mask;				// Number of records - 1
+	unsigned int			RecordSize;		// Size of each record, in bytes
+	unsigned int			SlotSize;		// Size of each slot (its sequence number, then the record)
+} MIDICAST;
+
+// One reader's place in the ring. Only that reader's thread may use it
+typedef struct _MIDICAST_READER
+{
+	unsigned long long	Next __attribute__((aligned(64)));	// Sequence number of the next record to read
+	unsigned long			Read;				// How many records it read
+	unsigned long			Skipped;			// How many records it missed, because it fell behind
+	unsigned long			Laps;				// How many times it fell behind
+} MIDICAST_READER;
+
+// The sequence number at the start of each slot. 0 while the writer is
+// changing the record, or else 1 + the record's sequence number
+#define MIDICAST_SEQ(slot)	((unsigned long long *)(slot))
+
+
+
+
+
+/********************* midi_cast_init() *********************
+ * Initializes a MIDICAST.
+ *
+ * recordSize =	The size of each record, in bytes.
+ * count =			How many records it holds. Must be a power of 2.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+static inline int midi_cast_init(MIDICAST *cast, unsigned int recordSize, unsigned int count)
+{
+	if (!count || (count & (count - 1))) return(-EINVAL);
+	cast->Head = 0;
+	cast->Mask = count - 1;
+	cast->RecordSize = recordSize;
+	cast->SlotSize = (sizeof(unsigned long long) + recordSize + 63) & ~63;
+	if (posix_memalign((void **)&cast->Slots, 64, (size_t)count * cast->SlotSize)) return(-ENOMEM);
+	memset(cast->Slots, 0, (size_t)count * cast->SlotSize);
+	return(0);
+}
+
+static inline void midi_cast_free(MIDICAST *cast)
+{
+	if (cast->Slots) free(cast->Slots);
+	cast->Slots = 0;
+}
+
+/********************* midi_cast_write_ptr() *********************
+ * Writer: Returns a pointer to the next record to fill in.
+ * There's always one (it may be the oldest record, which
+ * some slow reader hasn't read yet). Fill it in, then call
+ * midi_cast_commit().
+ */
+
+static inline void * midi_cast_write_ptr(MIDICAST *cast)
+{
+	register unsigned char	*slot;
+
+	slot = cast->Slots + (cast->Head & cast->Mask) * cast->SlotSize;
+
+	// Let readers know the old record is going away, before we change it
+	__atomic_store_n(MIDICAST_SEQ(slot), 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return(slot + sizeof(unsigned long long));
+}
+
+static inline void midi_cast_commit(MIDICAST *cast)
+{
+	register unsigned long long	head;
+
+	head = cast->Head;
+	__atomic_store_n(MIDICAST_SEQ(cast->Slots + (head & cast->Mask) * cast->SlotSize), head + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&cast->Head, head + 1, __ATOMIC_RELEASE);
+}
+
+/********************* midi_cast_reader_init() *********************
+ * Initializes a reader, to read the records written from
+ * now on. Call it before the reader's thread starts.
+ */
+
+static inline void midi_cast_reader_init(MIDICAST *cast, MIDICAST_READER *reader)
+{
+	memset(reader, 0, sizeof(MIDICAST_READER));
+	reader->Next = __atomic_load_n(&cast->Head, __ATOMIC_ACQUIRE);
+}
+
+/********************* midi_cast_read() *********************
+ * Reader: Copies the next record to "record".
+ *
+ * RETURNS: 1 if a record was copied, or 0 if there are no
+ * new records.
+ *
+ * NOTE: If the writer has written over records that we
+ * didn't read yet, we skip to half a ring behind the
+ * writer (so we have some room before it catches us again),
+ * and add how many we missed to reader->Skipped.
+ */
+
+static inline int midi_cast_read(MIDICAST *cast, MIDICAST_READER *reader, void *record)
+{
+	for (;;)
+	{
+		register const unsigned char	*slot;
+		register unsigned long long	next, head;
+
+		next = reader->Next;
+		slot = cast->Slots + (next & cast->Mask) * cast->SlotSize;
+
+		if (__atomic_load_n(MIDICAST_SEQ(slot), __ATOMIC_ACQUIRE) == next + 1)
+		{
+			memcpy(record, slot + sizeof(unsigned long long), cast->RecordSize);
+
+			// Make sure the writer didn't start on this slot while we copied
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(MIDICAST_SEQ(slot), __ATOMIC_RELAXED) == next + 1)
+			{
+				reader->Next = next + 1;
+				++reader->Read;
+				return(1);
+			}
+		}
+
+		// The slot doesn't have our record. Either it's not written yet, or
+		// it was written over
+		head = __atomic_load_n(&cast->Head, __ATOMIC_ACQUIRE);
+		if (next >= head) return(0);
+
+		// It's written, but the writer hasn't lapped us. We must have looked at
+		// the slot just before the writer committed it, so look again. Unless the
+		// writer is busy putting the next lap's record there. Then our record is
+		// gone, but we can't tell until it commits that one, so come back later
+		if (head - next <= (unsigned long long)cast->Mask + 1)
+		{
+			if (!__atomic_load_n(MIDICAST_SEQ(slot), __ATOMIC_ACQUIRE)) return(0);
+			continue;
+		}
+
+		reader->Next = head - ((cast->Mask + 1) >> 1);
+		if (reader->Next <= next) reader->Next = next + 1;
+		reader->Skipped += reader->Next - next;
+		++reader->Laps;
+	}
+}
+
+// How many records a reader hasn't read yet. Only a snapshot
+#define midi_cast_lag(cast, reader)	(__atomic_load_n(&(cast)->Head, __ATOMIC_ACQUIRE) - (reader)->Next)
+
+#endif
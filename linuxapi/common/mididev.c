@@ -0,0 +1,361 @@
+// mididev.c
+// A MIDI input or output that is either an ALSA rawmidi device,
+// or an in-memory loopback. See mididev.h.
+//
+// Compile it along with the program that uses it, devalloc.c, and timing.c. For example:
+// gcc -o midischedbench midischedbench.c ../../common/midisched.c ../../common/mididev.c ../../common/devalloc.c ../../common/seqsched.c ../../common/midienc.c ../../common/midiparse.c ../../common/timing.c -lasound -lpthread -lm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "mididev.h"
+#include "devalloc.h"
+#include "timing.h"
+
+
+
+
+
+// The loopbacks. Each is a pipe. We keep both ends open until both the
+// input and output are closed, so that one end never sees the other
+// end closed (which a real MIDI port doesn't do)
+typedef struct _MIDIDEV_LOOP
+{
+	int						Fds[2];		// [0] is the input's end, [1] the output's
+	unsigned char			Opened;		// Bit 0 set if the input is open, bit 1 if the output
+} MIDIDEV_LOOP;
+
+static MIDIDEV_LOOP		Loops[MIDIDEV_MAXLOOPS];
+
+
+
+
+
+/********************* open_loop() *********************
+ * Opens one end of a loopback.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ *
+ * NOTE: Like a rawmidi device, each end can be opened only
+ * once at a time.
+ */
+
+static int open_loop(MIDIDEV *dev, const char *name, unsigned int flags)
+{
+	register MIDIDEV_LOOP	*loop;
+	register unsigned int	num, bit;
+	register int				err;
+	char							*end;
+
+	num = (unsigned int)strtoul(name, &end, 10);
+	if (end == name || *end || num >= MIDIDEV_MAXLOOPS) return(-ENODEV);
+	loop = &Loops[num];
+	bit = (flags & MIDIDEV_OUTPUT) ? 2 : 1;
+	if (loop->Opened & bit) return(-EBUSY);
+
+	if (!loop->Opened && pipe(loop->Fds)) return(-errno);
+	loop->Opened |= bit;
+
+	dev->Loop = (unsigned char)num;
+	dev->Fd = loop->Fds[(flags & MIDIDEV_OUTPUT) ? 1 : 0];
+
+	// There's no driver to timestamp the bytes
+	dev->Timestamps = 0;
+
+	if ((err = midi_dev_nonblock(dev, flags & MIDIDEV_NONBLOCK)) < 0) midi_dev_close(dev);
+	return(err);
+}
+
+
+
+
+
+/********************* midi_dev_attach() *********************
+ * Wraps a rawmidi device that's already open (ie, the one
+ * underneath a UMP endpoint, from snd_ump_rawmidi()), so
+ * that it can be read, written, and polled with the other
+ * midi_dev_xxx() functions.
+ *
+ * handle =	The open device.
+ * flags =	As for midi_dev_open(). MIDIDEV_NONBLOCK is ignored
+ *				(the device stays however it was opened).
+ *
+ * NOTE: Close the device however it was opened (ie, with
+ * snd_ump_close()), not with midi_dev_close().
+ */
+
+void midi_dev_attach(MIDIDEV *dev, snd_rawmidi_t *handle, unsigned int flags)
+{
+	memset(dev, 0, sizeof(MIDIDEV));
+	dev->Fd = -1;
+	dev->Output = (flags & MIDIDEV_OUTPUT) ? 1 : 0;
+	dev->Handle = handle;
+
+#if SND_LIB_VERSION >= 0x010206
+	// Ask the driver to timestamp the input bytes as they arrive (with the
+	// monotonic clock)
+	if (!dev->Output && (flags & MIDIDEV_TSTAMP))
+	{
+		snd_rawmidi_params_t	*params;
+
+		if (snd_rawmidi_params_malloc(&params) >= 0)
+		{
+			if (snd_rawmidi_params_current(dev->Handle, params) >= 0 &&
+				snd_rawmidi_params_set_read_mode(dev->Handle, params, SND_RAWMIDI_READ_TSTAMP) >= 0 &&
+				snd_rawmidi_params_set_clock_type(dev->Handle, params, SND_RAWMIDI_CLOCK_MONOTONIC) >= 0 &&
+				snd_rawmidi_params(dev->Handle, params) >= 0)
+			{
+				dev->Timestamps = 1;
+			}
+			snd_rawmidi_params_free(params);
+		}
+	}
+#endif
+}
+
+
+
+
+
+/********************* midi_dev_open() *********************
+ * Opens a MIDI input or output.
+ *
+ * name =	The device name. See mididev.h.
+ * flags =	MIDIDEV_INPUT or MIDIDEV_OUTPUT, optionally OR'ed
+ *				with MIDIDEV_NONBLOCK, and (for an input)
+ *				MIDIDEV_TSTAMP.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ *
+ * NOTE: If MIDIDEV_TSTAMP is given, dev->Timestamps is set to
+ * 1 if the driver agreed to timestamp the bytes. Otherwise
+ * midi_dev_read() doesn't return times.
+ */
+
+int midi_dev_open(MIDIDEV *dev, const char *name, unsigned int flags)
+{
+	snd_rawmidi_t	*handle;
+	register int	err;
+
+	memset(dev, 0, sizeof(MIDIDEV));
+	dev->Fd = -1;
+	dev->Output = (flags & MIDIDEV_OUTPUT) ? 1 : 0;
+
+	if (!strncmp(name, "loop:", 5)) return(open_loop(dev, name + 5, flags));
+
+	// "free" means any free subdevice
+	if (!strncmp(name, "free", 4) && (!name[4] || name[4] == ':'))
+		err = dev_alloc_rawmidi(&handle, 0, name[4] ? &name[5] : "", dev->Output, (flags & MIDIDEV_NONBLOCK) ? SND_RAWMIDI_NONBLOCK : 0);
+	else
+		err = snd_rawmidi_open(dev->Output ? 0 : &handle, dev->Output ? &handle : 0, name, (flags & MIDIDEV_NONBLOCK) ? SND_RAWMIDI_NONBLOCK : 0);
+	if (err < 0) return(err);
+
+	midi_dev_attach(dev, handle, flags);
+	return(0);
+}
+
+
+
+
+
+/********************* midi_dev_close() *********************
+ * Closes a MIDI input or output opened with midi_dev_open().
+ */
+
+void midi_dev_close(MIDIDEV *dev)
+{
+	if (dev->Handle)
+	{
+		snd_rawmidi_close(dev->Handle);
+		dev->Handle = 0;
+	}
+	else if (dev->Fd != -1)
+	{
+		register MIDIDEV_LOOP	*loop;
+
+		loop = &Loops[dev->Loop];
+		loop->Opened &= ~(dev->Output ? 2 : 1);
+		if (!loop->Opened)
+		{
+			close(loop->Fds[0]);
+			close(loop->Fds[1]);
+		}
+		dev->Fd = -1;
+	}
+}
+
+
+
+
+
+/********************* midi_dev_read() *********************
+ * Reads bytes from a MIDI input.
+ *
+ * time =	If not 0, and the driver timestamps the input, where
+ *				to return the time the bytes arrived (nanoseconds,
+ *				monotonic clock). Otherwise, it's left alone, so
+ *				the caller can set it to its own timestamp first.
+ *
+ * RETURNS: How many bytes read, or a negative error number
+ * (ie, -EAGAIN if none are waiting, and the input is non-
+ * blocking).
+ *
+ * NOTE: When the driver timestamps the input, each read
+ * returns only bytes with the same timestamp.
+ */
+
+int midi_dev_read(MIDIDEV *dev, unsigned char *buffer, unsigned int size, unsigned long long *time)
+{
+	register int	len;
+
+	if (!dev->Handle)
+	{
+		if ((len = (int)read(dev->Fd, buffer, size)) < 0) len = -errno;
+		return(len);
+	}
+
+#if SND_LIB_VERSION >= 0x010206
+	if (dev->Timestamps)
+	{
+		struct timespec	ts;
+
+		if ((len = (int)snd_rawmidi_tread(dev->Handle, &ts, buffer, size)) > 0 && time) *time = timespec_to_ns(&ts);
+		return(len);
+	}
+#endif
+
+	return((int)snd_rawmidi_read(dev->Handle, buffer, size));
+}
+
+
+
+
+
+/********************* midi_dev_write() *********************
+ * Writes bytes to a MIDI output.
+ *
+ * RETURNS: How many bytes written, or a negative error number
+ * (ie, -EAGAIN if there's no room, and the output is non-
+ * blocking).
+ */
+
+int midi_dev_write(MIDIDEV *dev, const unsigned char *buffer, unsigned int len)
+{
+	register int	written;
+
+	if (dev->Handle) return((int)snd_rawmidi_write(dev->Handle, buffer, len));
+
+	if ((written = (int)write(dev->Fd, buffer, len)) < 0) written = -errno;
+	return(written);
+}
+
+
+
+
+
+/********************* midi_dev_drain() *********************
+ * Waits until all bytes written to a MIDI output have been
+ * sent.
+ *
+ * NOTE: A loopback's bytes are "sent" as soon as they're
+ * written, so there's nothing to wait for.
+ */
+
+void midi_dev_drain(MIDIDEV *dev)
+{
+	if (dev->Handle) snd_rawmidi_drain(dev->Handle);
+}
+
+
+
+
+
+/********************* midi_dev_drop() *********************
+ * Throws away any bytes that are waiting to be read from an
+ * input, or sent to an output.
+ */
+
+void midi_dev_drop(MIDIDEV *dev)
+{
+	int		count;
+
+	if (dev->Handle)
+		snd_rawmidi_drop(dev->Handle);
+
+	// A loopback's bytes wait in its pipe whichever end we have, so we read
+	// them from the input's end
+	else if (dev->Fd != -1)
+	{
+		register int	fd;
+		unsigned char	buffer[256];
+
+		fd = Loops[dev->Loop].Fds[0];
+		while (!ioctl(fd, FIONREAD, &count) && count > 0)
+		{
+			if (read(fd, &buffer[0], count < (int)sizeof(buffer) ? count : (int)sizeof(buffer)) <= 0) break;
+		}
+	}
+}
+
+
+
+
+
+/********************* midi_dev_nonblock() *********************
+ * Sets whether reads/writes wait (0), or return -EAGAIN
+ * (1).
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+int midi_dev_nonblock(MIDIDEV *dev, int nonblock)
+{
+	register int	flags;
+
+	if (dev->Handle) return(snd_rawmidi_nonblock(dev->Handle, nonblock));
+
+	if ((flags = fcntl(dev->Fd, F_GETFL)) == -1 || fcntl(dev->Fd, F_SETFL, nonblock ? flags | O_NONBLOCK : flags & ~O_NONBLOCK) == -1) return(-errno);
+	return(0);
+}
+
+
+
+
+
+/****************** midi_dev_poll_descriptors_count() *******************
+ * RETURNS: How many pollfd's midi_dev_poll_descriptors()
+ * needs.
+ */
+
+int midi_dev_poll_descriptors_count(MIDIDEV *dev)
+{
+	return(dev->Handle ? snd_rawmidi_poll_descriptors_count(dev->Handle) : 1);
+}
+
+
+
+
+
+/********************* midi_dev_poll_descriptors() *********************
+ * Fills in the pollfd's to wait on for input bytes (for an
+ * input), or room to write (for an output).
+ *
+ * space =	How many pollfd's "pfds" has room for.
+ *
+ * RETURNS: How many pollfd's filled in.
+ */
+
+int midi_dev_poll_descriptors(MIDIDEV *dev, struct pollfd *pfds, unsigned int space)
+{
+	if (dev->Handle) return(snd_rawmidi_poll_descriptors(dev->Handle, pfds, space));
+
+	if (!space) return(0);
+	pfds->fd = dev->Fd;
+	pfds->events = dev->Output ? POLLOUT : POLLIN;
+	pfds->revents = 0;
+	return(1);
+}
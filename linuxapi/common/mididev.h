@@ -0,0 +1,69 @@
+// mididev.h
+// A thin layer over a MIDI input or output, so that our engines
+// (ie, the MIDI scheduler) and benchmarks can run without a sound
+// card.
+//
+// The device name says which kind of device it is:
+//
+// "hw:1,0"	(or any other ALSA rawmidi name) An ALSA rawmidi device.
+//
+// "free"	Any free subdevice of any card's rawmidi devices.
+// "free:1"	Any free subdevice of card 1's rawmidi devices.
+// "free:1,0"	Any free subdevice of card 1's device 0. So several
+//				programs can each ask for "free:1,0", and each gets its
+//				own subdevice, rather than all waiting on the first.
+//				See devalloc.h.
+//
+// "loop:n"	In-memory loopback number n (0 to MIDIDEV_MAXLOOPS - 1).
+//				Whatever is written to loop:n's output arrives at
+//				loop:n's input, in the same process. It's a pipe, so
+//				it can be polled like a rawmidi device, and it has no
+//				baud rate, so the bytes arrive as soon as written. A
+//				benchmark that opens both ends measures only our own
+//				code, and the OS.
+//
+// The functions mirror the snd_rawmidi_xxx() ones, and return the
+// same negative error numbers.
+//
+// A rawmidi device opened some other way (ie, the one underneath a
+// UMP endpoint, which snd_ump_open() opens) can be wrapped with
+// midi_dev_attach(), to read, write, and poll it the same way.
+
+#ifndef MIDIDEV_H
+#define MIDIDEV_H
+
+#include <poll.h>
+#include <alsa/asoundlib.h>
+
+// midi_dev_open()'s flags
+#define MIDIDEV_INPUT		0x00
+#define MIDIDEV_OUTPUT		0x01
+#define MIDIDEV_NONBLOCK	0x02	// Reads/writes return -EAGAIN instead of waiting
+#define MIDIDEV_TSTAMP		0x04	// Ask the driver to timestamp input bytes
+
+// How many loopbacks there can be
+#define MIDIDEV_MAXLOOPS	8
+
+// A MIDI input or output
+typedef struct _MIDIDEV
+{
+	snd_rawmidi_t			*Handle;			// The ALSA device, or 0 if a loopback
+	int						Fd;				// A loopback's end of its pipe
+	unsigned char			Loop;				// Which loopback
+	unsigned char			Output;			// 1 if an output
+	unsigned char			Timestamps;		// 1 if midi_dev_read() returns the driver's timestamps
+	unsigned char			Pad;
+} MIDIDEV;
+
+int midi_dev_open(MIDIDEV *, const char *, unsigned int);
+void midi_dev_attach(MIDIDEV *, snd_rawmidi_t *, unsigned int);
+void midi_dev_close(MIDIDEV *);
+int midi_dev_read(MIDIDEV *, unsigned char *, unsigned int, unsigned long long *);
+int midi_dev_write(MIDIDEV *, const unsigned char *, unsigned int);
+void midi_dev_drain(MIDIDEV *);
+void midi_dev_drop(MIDIDEV *);
+int midi_dev_nonblock(MIDIDEV *, int);
+int midi_dev_poll_descriptors_count(MIDIDEV *);
+int midi_dev_poll_descriptors(MIDIDEV *, struct pollfd *, unsigned int);
+
+#endif
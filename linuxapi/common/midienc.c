@@ -0,0 +1,136 @@
+// midienc.c
+// A running status encoder for MIDI 1.0 output. See midienc.h.
+//
+// Compile it along with the program that uses it, mididev.c, devalloc.c, and timing.c. For example:
+// gcc -o chord chord.c ../../common/midisched.c ../../common/mididev.c ../../common/devalloc.c ../../common/midienc.c ../../common/timing.c -lasound -lpthread -lm
+
+#include <string.h>
+#include <errno.h>
+#include "midienc.h"
+
+
+
+
+
+/********************* midi_enc_init() *********************
+ * Initializes a MIDIENC.
+ *
+ * flags =	MIDIENC_xxx.
+ * buffer =	Where midi_enc_put() collects encoded bytes, or 0
+ *				if you'll use only midi_enc_message().
+ * size =	The size of the buffer.
+ */
+
+void midi_enc_init(MIDIENC *enc, unsigned int flags, unsigned char *buffer, unsigned int size)
+{
+	memset(enc, 0, sizeof(MIDIENC));
+	enc->Flags = (unsigned char)flags;
+	enc->Buffer = buffer;
+	enc->Size = size;
+}
+
+
+
+
+
+/********************* midi_enc_message() *********************
+ * Encodes one MIDI message.
+ *
+ * out =		Where to put the encoded bytes. It must have room
+ *				for "len" bytes.
+ * msg =		The message, including its status byte.
+ * len =		How many bytes in the message.
+ *
+ * RETURNS: How many bytes were put in "out" (0 to len).
+ */
+
+unsigned int midi_enc_message(MIDIENC *enc, unsigned char *out, const unsigned char *msg, unsigned int len)
+{
+	register unsigned char	status;
+
+	status = msg[0];
+
+	// A channel message?
+	if (status >= 0x80 && status < 0xF0)
+	{
+		register unsigned char	*ptr;
+
+		// A note-off can be sent as a note-on with 0 velocity. Then a run of
+		// notes on one channel needs only one status byte
+		if ((enc->Flags & MIDIENC_NOTEOFFASNOTEON) && (status & 0xF0) == 0x80 && len == 3) status |= 0x10;
+
+		ptr = out;
+		if (status != enc->Status || !(enc->Flags & MIDIENC_RUNNINGSTATUS))
+		{
+			*ptr++ = status;
+			enc->Status = status;
+		}
+		else
+			++enc->Saved;
+
+		if (len > 1) *ptr++ = msg[1];
+		if (len > 2) *ptr++ = (status != msg[0] ? 0 : msg[2]);
+
+		len = (unsigned int)(ptr - out);
+	}
+	else
+	{
+		// System common and SysEx cancel running status. Realtime doesn't
+		if (status < 0xF8) enc->Status = 0;
+		memcpy(out, msg, len);
+	}
+
+	enc->Bytes += len;
+	return(len);
+}
+
+
+
+
+
+/********************* midi_enc_put() *********************
+ * Encodes one MIDI message, and adds the encoded bytes to
+ * the MIDIENC's buffer.
+ *
+ * RETURNS: 0 if success, or -ENOSPC if the buffer doesn't
+ * have room (in which case, call midi_enc_flush() and try
+ * again).
+ */
+
+int midi_enc_put(MIDIENC *enc, const unsigned char *msg, unsigned int len)
+{
+	if (len > enc->Size - enc->Used) return(-ENOSPC);
+	enc->Used += midi_enc_message(enc, enc->Buffer + enc->Used, msg, len);
+	return(0);
+}
+
+
+
+
+
+/********************* midi_enc_flush() *********************
+ * Sends all the bytes in the MIDIENC's buffer with one
+ * midi_dev_write(), and empties the buffer. The output can
+ * be a card's MIDI port, or a virtual one.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+int midi_enc_flush(MIDIENC *enc, MIDIDEV *midiOut)
+{
+	register int	err;
+
+	err = 0;
+	if (enc->Used)
+	{
+		if ((err = midi_dev_write(midiOut, enc->Buffer, enc->Used)) >= 0) err = 0;
+
+		// If the write failed, the receiver may have missed our last status
+		else
+			enc->Status = 0;
+
+		enc->Used = 0;
+	}
+
+	return(err);
+}
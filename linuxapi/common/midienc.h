@@ -0,0 +1,47 @@
+// midienc.h
+// An encoder for MIDI 1.0 output. You give it whole MIDI
+// messages, and it gives back the bytes to send, leaving out
+// the status byte whenever it's the same as the previous
+// channel message's (ie, running status). For a dense stream
+// of 3-byte notes on a 31250 baud cable, that's a third more
+// notes per second.
+//
+// Optionally, note-offs are turned into note-ons with 0
+// velocity, so that notes turning on and off on the same
+// channel all share one running status.
+//
+// The encoder can also collect the encoded bytes of many
+// messages in a buffer, so that they all go to the output in
+// one midi_dev_write().
+
+#ifndef MIDIENC_H
+#define MIDIENC_H
+
+#include "mididev.h"
+
+// Flags for midi_enc_init()
+#define MIDIENC_RUNNINGSTATUS		0x01	// Leave out repeated status bytes
+#define MIDIENC_NOTEOFFASNOTEON	0x02	// Send note-off as note-on with 0 velocity (the release velocity is lost)
+
+typedef struct _MIDIENC
+{
+	unsigned char			*Buffer;		// Where midi_enc_put() collects bytes (0 if not used)
+	unsigned int			Size;			// How big Buffer is
+	unsigned int			Used;			// How many bytes are in Buffer
+	unsigned char			Flags;		// MIDIENC_xxx
+	unsigned char			Status;		// The current running status (0 if none)
+	unsigned long			Bytes;		// How many bytes we've encoded
+	unsigned long			Saved;		// How many status bytes we've left out
+} MIDIENC;
+
+void midi_enc_init(MIDIENC *, unsigned int, unsigned char *, unsigned int);
+unsigned int midi_enc_message(MIDIENC *, unsigned char *, const unsigned char *, unsigned int);
+int midi_enc_put(MIDIENC *, const unsigned char *, unsigned int);
+int midi_enc_flush(MIDIENC *, MIDIDEV *);
+
+// Forgets the running status, so the next channel message is sent
+// with its status byte. Do this if the receiver may have missed
+// the last status (ie, it was just plugged in)
+#define midi_enc_reset(enc)	((enc)->Status = 0)
+
+#endif
@@ -0,0 +1,282 @@
+// midilanes.c
+// Realtime, voice, and bulk output lanes for one MIDI port. See
+// midilanes.h.
+//
+// Compile it along with the program that uses it, mididev.c, devalloc.c, and timing.c. For example:
+// gcc -o sysexbulk sysexbulk.c ../../common/midilanes.c ../../common/mididev.c ../../common/devalloc.c ../../common/midiparse.c ../../common/timing.c -lasound -lm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "midilanes.h"
+
+
+
+
+
+/********************* midi_lanes_init() *********************
+ * Initializes a MIDILANES.
+ *
+ * output =			The (non-blocking) MIDI output.
+ * bytesPerSec =	How many bytes a second the port sends.
+ * chunk =			The most bulk bytes we pass the driver at a
+ *						time, or 0 for MIDILANES_CHUNK.
+ * window =			The most bytes we let wait in the driver's
+ *						buffer, or 0 for MIDILANES_WINDOW.
+ *
+ * NOTE: A realtime byte can go out up to about window bytes
+ * late. But we wake up each time chunk bytes have gone out,
+ * and if window isn't bigger than chunk, the port sits idle
+ * while we do.
+ */
+
+void midi_lanes_init(MIDILANES *lanes, MIDIDEV *output, unsigned int bytesPerSec, unsigned int chunk, unsigned int window)
+{
+	memset(lanes, 0, sizeof(MIDILANES));
+	lanes->Output = output;
+	lanes->BytesPerNs = bytesPerSec / 1000000000.0;
+	lanes->Chunk = (chunk ? chunk : MIDILANES_CHUNK);
+	lanes->Window = (window ? window : MIDILANES_WINDOW);
+	if (lanes->Chunk > lanes->Window) lanes->Chunk = lanes->Window;
+	lanes->Last = get_time_ns();
+	time_hist_init(&lanes->RTDelay);
+}
+
+
+
+
+
+/********************* write_lane() *********************
+ * Passes bytes to the driver.
+ *
+ * RETURNS: How many it took (0 if its buffer is full), or a
+ * negative error number.
+ */
+
+static int write_lane(register MIDILANES *lanes, const unsigned char *data, unsigned int len, unsigned int lane)
+{
+	register int	written;
+
+	if ((written = midi_dev_write(lanes->Output, data, len)) == -EAGAIN) written = 0;
+	if (written > 0)
+	{
+		lanes->Bytes[lane] += written;
+		lanes->InFlight += written;
+	}
+	return(written);
+}
+
+
+
+
+
+/********************* midi_lanes_service() *********************
+ * Passes the driver whatever is due: all queued realtime
+ * bytes, then voice and bulk bytes while the driver's buffer
+ * has fewer than Window bytes waiting.
+ *
+ * now =	The current (monotonic clock) time.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+int midi_lanes_service(MIDILANES *lanes, unsigned long long now)
+{
+	register int	written;
+
+	// Figure how many bytes have gone out the port since we last looked
+	if (now > lanes->Last)
+	{
+		if ((lanes->InFlight -= (now - lanes->Last) * lanes->BytesPerNs) < 0.0) lanes->InFlight = 0.0;
+		lanes->Last = now;
+	}
+
+	// Realtime goes right away, no matter how much is waiting ahead of it. We
+	// note how late each byte will go out the port: how long it waited in
+	// our lane, plus how long the bytes ahead of it in the driver will take
+	while (lanes->RTCount)
+	{
+		register unsigned int	len, i;
+		register double			ahead;
+
+		if ((len = MIDILANES_RTSIZE - lanes->RTHead) > lanes->RTCount) len = lanes->RTCount;
+		ahead = lanes->InFlight;
+		if ((written = write_lane(lanes, &lanes->RT[lanes->RTHead], len, MIDILANES_REALTIME)) < 0) return(written);
+
+		for (i = 0; i < (unsigned int)written; i++)
+		{
+			register unsigned long long	out, due;
+
+			out = now + (unsigned long long)((ahead + i) / lanes->BytesPerNs);
+			due = lanes->RTTimes[lanes->RTHead + i];
+			time_hist_add(&lanes->RTDelay, out > due ? out - due : 0);
+		}
+
+		if ((lanes->RTHead += written) >= MIDILANES_RTSIZE) lanes->RTHead -= MIDILANES_RTSIZE;
+		lanes->RTCount -= written;
+		if ((unsigned int)written < len) return(0);
+	}
+
+	while (lanes->InFlight < lanes->Window)
+	{
+		register unsigned int	room, len;
+
+		room = lanes->Window - (unsigned int)lanes->InFlight;
+
+		// Voice messages can't go in the middle of a SysEx
+		if (lanes->VoiceCount && !lanes->InSysEx)
+		{
+			if ((len = MIDILANES_VOICESIZE - lanes->VoiceHead) > lanes->VoiceCount) len = lanes->VoiceCount;
+			if (len > room) len = room;
+			if ((written = write_lane(lanes, &lanes->Voice[lanes->VoiceHead], len, MIDILANES_VOICE)) <= 0) return(written);
+			if ((lanes->VoiceHead += written) >= MIDILANES_VOICESIZE) lanes->VoiceHead -= MIDILANES_VOICESIZE;
+			lanes->VoiceCount -= written;
+		}
+		else if (lanes->BulkLen)
+		{
+			register const unsigned char	*eox;
+			register unsigned int			i;
+
+			len = (lanes->BulkLen > lanes->Chunk ? lanes->Chunk : (unsigned int)lanes->BulkLen);
+			if (len > room) len = room;
+
+			// End the chunk at a SysEx's end, so voice messages get a turn
+			if ((eox = (const unsigned char *)memchr(lanes->Bulk, 0xF7, len))) len = (unsigned int)(eox - lanes->Bulk) + 1;
+
+			if ((written = write_lane(lanes, lanes->Bulk, len, MIDILANES_BULK)) <= 0) return(written);
+
+			// Keep track of whether we're inside a SysEx
+			for (i = 0; i < (unsigned int)written; i++)
+			{
+				if (lanes->Bulk[i] >= 0x80 && lanes->Bulk[i] < 0xF8) lanes->InSysEx = (lanes->Bulk[i] == 0xF0);
+			}
+			lanes->Bulk += written;
+			lanes->BulkLen -= written;
+		}
+		else
+			break;
+	}
+
+	return(0);
+}
+
+
+
+
+
+/********************* midi_lanes_realtime() *********************
+ * Queues a realtime byte (0xF8 to 0xFF), and sends it right
+ * away if the driver has room.
+ *
+ * due =	The (monotonic clock) time it should go out the port
+ *			(ie, the time of a clock tick). We measure how late
+ *			it is from then.
+ *
+ * RETURNS: 0 if success, -ENOBUFS if the lane is full (the
+ * byte is dropped), or another negative error number.
+ */
+
+int midi_lanes_realtime(MIDILANES *lanes, unsigned char byte, unsigned long long due)
+{
+	register unsigned int	pos;
+
+	if (lanes->RTCount >= MIDILANES_RTSIZE)
+	{
+		++lanes->Dropped;
+		return(-ENOBUFS);
+	}
+
+	if ((pos = lanes->RTHead + lanes->RTCount) >= MIDILANES_RTSIZE) pos -= MIDILANES_RTSIZE;
+	lanes->RT[pos] = byte;
+	lanes->RTTimes[pos] = due;
+	++lanes->RTCount;
+
+	return(midi_lanes_service(lanes, get_time_ns()));
+}
+
+
+
+
+
+/********************* midi_lanes_voice() *********************
+ * Queues a (whole) voice message, and sends it right away if
+ * no SysEx is in the way, and the driver has room.
+ *
+ * RETURNS: 0 if success, -ENOBUFS if the lane is full (the
+ * message is dropped), or another negative error number.
+ */
+
+int midi_lanes_voice(MIDILANES *lanes, const unsigned char *msg, unsigned int len)
+{
+	register unsigned int	tail, part;
+
+	if (len > MIDILANES_VOICESIZE - lanes->VoiceCount)
+	{
+		++lanes->Dropped;
+		return(-ENOBUFS);
+	}
+
+	if ((tail = lanes->VoiceHead + lanes->VoiceCount) >= MIDILANES_VOICESIZE) tail -= MIDILANES_VOICESIZE;
+	if ((part = MIDILANES_VOICESIZE - tail) > len) part = len;
+	memcpy(&lanes->Voice[tail], msg, part);
+	memcpy(&lanes->Voice[0], msg + part, len - part);
+	lanes->VoiceCount += len;
+
+	return(midi_lanes_service(lanes, get_time_ns()));
+}
+
+
+
+
+
+/********************* midi_lanes_bulk() *********************
+ * Gives the bulk lane SysEx to send. We send it straight out
+ * of "data", so it must stay put until midi_lanes_busy()
+ * says we're done. This replaces any bulk data we haven't
+ * sent yet.
+ */
+
+void midi_lanes_bulk(MIDILANES *lanes, const unsigned char *data, unsigned long long len)
+{
+	lanes->Bulk = data;
+	lanes->BulkLen = len;
+}
+
+
+
+
+
+/********************* midi_lanes_due() *********************
+ * RETURNS: The (monotonic clock) time to next call
+ * midi_lanes_service(), or 0 if there's nothing to send.
+ */
+
+unsigned long long midi_lanes_due(MIDILANES *lanes)
+{
+	register double	ahead;
+
+	if (!midi_lanes_busy(lanes)) return(0);
+
+	// If anything is left even though there's room, the driver's buffer is
+	// full (the port is slower than we think). Try again in a millisecond
+	if (lanes->RTCount || lanes->InFlight < lanes->Window) return(lanes->Last + 1000000);
+
+	// Otherwise wake when a whole chunk has gone out
+	ahead = lanes->InFlight - (lanes->Window - lanes->Chunk);
+	return(lanes->Last + (unsigned long long)(ahead / lanes->BytesPerNs) + 1);
+}
+
+
+
+
+
+/********************* midi_lanes_idle() *********************
+ * RETURNS: The (monotonic clock) time when, by our model,
+ * everything we've passed the driver will have gone out.
+ */
+
+unsigned long long midi_lanes_idle(MIDILANES *lanes)
+{
+	return(lanes->Last + (unsigned long long)(lanes->InFlight / lanes->BytesPerNs));
+}
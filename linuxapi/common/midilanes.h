@@ -0,0 +1,90 @@
+// midilanes.h
+// Sends three kinds of MIDI output through one port, each in its
+// own "lane", so that a big SysEx dump doesn't hold up the others:
+//
+// Realtime	(ie, MIDI clock). MIDI lets these single bytes go
+//				anywhere, even in the middle of a SysEx, so they go
+//				ahead of everything.
+// Voice		Notes, controllers, and other short messages. They go
+//				ahead of bulk, but only between SysEx messages (any
+//				status other than realtime would end a SysEx).
+// Bulk		SysEx. We pass it to the driver a small chunk at a
+//				time, ending each chunk at a SysEx's 0xF7, so the
+//				other lanes get a turn between the chunks.
+//
+// That's not enough by itself, because once bytes are in the
+// driver's buffer, whatever we write after them has to wait for
+// them to go out. If we let the driver have a whole dump, a clock
+// byte might wait seconds behind it. So we keep a model of the
+// wire: we know how fast the port sends (BytesPerSec), and how
+// many bytes we've given the driver, so we know about how many
+// are still waiting in its buffer ("InFlight"). We pass voice and
+// bulk bytes only while fewer than Window bytes are waiting. So a
+// realtime byte waits for at most about Window bytes to go out
+// (Window / BytesPerSec seconds) before it does.
+//
+// The output must be non-blocking. Call midi_lanes_service() when
+// midi_lanes_due() says.
+
+#ifndef MIDILANES_H
+#define MIDILANES_H
+
+#include "mididev.h"
+#include "timing.h"
+
+// How many realtime bytes, and voice bytes, we can queue
+#define MIDILANES_RTSIZE		64
+#define MIDILANES_VOICESIZE	1024
+
+// Defaults for how many bulk bytes we pass the driver at a time, and how
+// many bytes we let wait in the driver's buffer
+#define MIDILANES_CHUNK		8
+#define MIDILANES_WINDOW		16
+
+typedef struct _MIDILANES
+{
+	MIDIDEV					*Output;
+
+	// The realtime lane
+	unsigned long long	RTTimes[MIDILANES_RTSIZE];	// When each byte should go out
+	unsigned char			RT[MIDILANES_RTSIZE];
+	unsigned int			RTHead, RTCount;
+
+	// The voice lane
+	unsigned char			Voice[MIDILANES_VOICESIZE];
+	unsigned int			VoiceHead, VoiceCount;
+
+	// The bulk lane. We send straight out of the caller's buffer
+	const unsigned char	*Bulk;
+	unsigned long long	BulkLen;			// How many bytes are left to send
+	unsigned char			InSysEx;			// 1 if we've sent an 0xF0 but not its 0xF7
+
+	// The model of the wire
+	unsigned int			Chunk;
+	unsigned int			Window;
+	double					BytesPerNs;
+	double					InFlight;		// Bytes we figure are still in the driver's buffer
+	unsigned long long	Last;				// When we last figured InFlight
+
+	// What happened
+	unsigned long long	Bytes[3];		// How many bytes each lane sent
+	unsigned long			Dropped;			// How many realtime/voice messages had no room
+	TIMEHIST					RTDelay;			// How late each realtime byte went out the port, by our model
+} MIDILANES;
+
+// Lanes, for Bytes[]
+#define MIDILANES_REALTIME	0
+#define MIDILANES_VOICE		1
+#define MIDILANES_BULK		2
+
+#define midi_lanes_busy(lanes)	((lanes)->RTCount || (lanes)->VoiceCount || (lanes)->BulkLen)
+
+void midi_lanes_init(MIDILANES *, MIDIDEV *, unsigned int, unsigned int, unsigned int);
+int midi_lanes_realtime(MIDILANES *, unsigned char, unsigned long long);
+int midi_lanes_voice(MIDILANES *, const unsigned char *, unsigned int);
+void midi_lanes_bulk(MIDILANES *, const unsigned char *, unsigned long long);
+int midi_lanes_service(MIDILANES *, unsigned long long);
+unsigned long long midi_lanes_due(MIDILANES *);
+unsigned long long midi_lanes_idle(MIDILANES *);
+
+#endif
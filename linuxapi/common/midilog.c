@@ -0,0 +1,444 @@
+// midilog.c
+// A memory-mapped, segment-rotated binary log of timestamped
+// MIDI bytes. See midilog.h.
+//
+// Compile it along with the program that uses it, for example:
+// gcc -o rawmidiinput rawmidiinput.c ../../common/midiparse.c ../../common/ump.c ../../common/mididev.c ../../common/devalloc.c ../../common/timing.c ../../common/midilog.c -lasound -lpthread -lm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <glob.h>
+#include <alloca.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "midilog.h"
+
+
+
+
+
+static const unsigned char MidiLogID[4] = {'M', 'L', 'O', 'G'};
+
+
+
+
+
+/********************** compare_seq() *********************
+ * Compares two segment numbers for qsort().
+ */
+
+static int compare_seq(const void *a, const void *b)
+{
+	return(*(const unsigned int *)a < *(const unsigned int *)b ? -1 : *(const unsigned int *)a > *(const unsigned int *)b);
+}
+
+
+
+
+
+/********************** midi_log_list() *********************
+ * Finds all the segments of a log.
+ *
+ * base =		The name of the log (ie, the segment file names,
+ *					minus ".NNNNNN.mlog").
+ * seqs =		Where to return a malloc'ed array of the segment
+ *					numbers, in ascending order. The caller must
+ *					free() it.
+ *
+ * RETURNS: How many segments, or a negative error number.
+ */
+
+int midi_log_list(const char *base, unsigned int **seqs)
+{
+	glob_t					found;
+	register unsigned int	i, count, baseLen;
+	register char			*pattern;
+
+	*seqs = 0;
+	baseLen = strlen(base);
+	if (!(pattern = (char *)malloc(baseLen + 16))) return(-ENOMEM);
+	sprintf(pattern, "%s.[0-9]*.mlog", base);
+	i = glob(pattern, 0, 0, &found);
+	free(pattern);
+	if (i) return(i == GLOB_NOMATCH ? 0 : -EIO);
+
+	count = 0;
+	if ((*seqs = (unsigned int *)malloc((found.gl_pathc + 1) * sizeof(unsigned int))))
+	{
+		for (i = 0; i < found.gl_pathc; i++)
+		{
+			char	*end;
+
+			(*seqs)[count] = (unsigned int)strtoul(found.gl_pathv[i] + baseLen + 1, &end, 10);
+			if (!strcmp(end, ".mlog")) ++count;
+		}
+		qsort(*seqs, count, sizeof(unsigned int), compare_seq);
+	}
+
+	globfree(&found);
+	return(*seqs ? (int)count : -ENOMEM);
+}
+
+
+
+
+
+/********************** segment_name() *********************
+ * Formats the file name of segment number "seq" of the log
+ * into the passed buffer, which must be at least
+ * strlen(base) + 16 chars.
+ */
+
+static void segment_name(char *buffer, const char *base, unsigned int seq)
+{
+	sprintf(buffer, "%s.%06u.mlog", base, seq);
+}
+
+
+
+
+
+/********************** create_segment() *********************
+ * Creates, and memory-maps, the next segment of a log being
+ * written. If the log is keeping only so many segments,
+ * deletes the oldest one.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+static int create_segment(MIDILOG *log)
+{
+	register MIDILOG_HEADER	*header;
+	register char				*name;
+	register int				err;
+
+	if (!(name = (char *)alloca(strlen(log->Base) + 16))) return(-ENOMEM);
+
+	segment_name(name, log->Base, log->Sequence);
+	if ((log->Handle = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1) return(-errno);
+
+	// Size the file, and map it into memory. We ask for the pages to be faulted
+	// in right away, so that we don't take a page fault in midi_log_write()
+	if (ftruncate(log->Handle, log->SegmentSize) ||
+		(header = (MIDILOG_HEADER *)mmap(0, log->SegmentSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, log->Handle, 0)) == MAP_FAILED)
+	{
+		err = -errno;
+		close(log->Handle);
+		unlink(name);
+		return(err);
+	}
+
+	memset(header, 0, sizeof(MIDILOG_HEADER));
+	memcpy(&header->ID[0], &MidiLogID[0], 4);
+	header->Version = MIDILOG_VERSION;
+	header->Sequence = log->Sequence;
+	header->Size = log->SegmentSize;
+	header->Used = log->NextIndex = MIDILOG_HEADERSIZE;
+	header->MonoBase = log->MonoBase;
+	header->RealBase = log->RealBase;
+	log->Header = header;
+
+	// Throw away the oldest segment if we keep only so many
+	if (log->MaxSegments && log->Sequence >= log->MaxSegments)
+	{
+		segment_name(name, log->Base, log->Sequence - log->MaxSegments);
+		unlink(name);
+	}
+
+	return(0);
+}
+
+
+
+
+
+/********************** close_segment() *********************
+ * Unmaps and closes the current segment of a log.
+ */
+
+static void close_segment(MIDILOG *log)
+{
+	if (log->Header)
+	{
+		munmap(log->Header, log->SegmentSize);
+		close(log->Handle);
+		log->Header = 0;
+	}
+}
+
+
+
+
+
+/********************** midi_log_open() *********************
+ * Opens a log for writing. If the log already has segments,
+ * we start a new one after the last, so nothing already
+ * captured is overwritten. Every segment we write gets this
+ * run's base (see midilog.h).
+ *
+ * log =				The MIDILOG to initialize.
+ * base =			The name of the log (ie, the segment file names,
+ *						minus ".NNNNNN.mlog").
+ * segmentSize =	How big to make each segment file, or 0 for
+ *						MIDILOG_SEGMENTSIZE.
+ * maxSegments =	How many of the most recent segments to keep.
+ *						0 keeps them all.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+int midi_log_open(MIDILOG *log, const char *base, unsigned long long segmentSize, unsigned int maxSegments)
+{
+	unsigned int	*seqs;
+	struct timespec	mono, real;
+	register int	err;
+
+	memset(log, 0, sizeof(MIDILOG));
+
+	// Read both clocks at (as near as we can) the same moment
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &real);
+	log->MonoBase = (unsigned long long)mono.tv_sec * 1000000000ULL + mono.tv_nsec;
+	log->RealBase = (unsigned long long)real.tv_sec * 1000000000ULL + real.tv_nsec;
+
+	log->SegmentSize = (segmentSize ? segmentSize : MIDILOG_SEGMENTSIZE);
+	if (log->SegmentSize < MIDILOG_HEADERSIZE + 4096) log->SegmentSize = MIDILOG_HEADERSIZE + 4096;
+	log->MaxSegments = maxSegments;
+
+	if (!(log->Base = strdup(base))) return(-ENOMEM);
+
+	if ((err = midi_log_list(base, &seqs)) < 0) goto bad;
+	if (err) log->Sequence = seqs[err - 1] + 1;
+	free(seqs);
+
+	if ((err = create_segment(log)) < 0)
+	{
+bad:	free(log->Base);
+		log->Base = 0;
+	}
+
+	return(err);
+}
+
+
+
+
+
+/********************** midi_log_write() *********************
+ * Appends some MIDI bytes to a log.
+ *
+ * time =		When the bytes arrived, in nanoseconds.
+ * port =		Which port the bytes came from. This is just
+ *					stored in the record for the caller's use.
+ * buffer =		The MIDI bytes.
+ * len =			How many bytes.
+ *
+ * RETURNS: 0 if success, or a negative error number (if we
+ * needed to start another segment, and couldn't).
+ *
+ * NOTE: The bytes are normally written as one record. Only
+ * if they're too big to fit in a whole segment are they
+ * split into several records.
+ */
+
+int midi_log_write(MIDILOG *log, unsigned long long time, unsigned int port, const unsigned char *buffer, unsigned int len)
+{
+	register MIDILOG_HEADER	*header;
+	register MIDILOG_RECORD	*record;
+	register unsigned long long	used, size;
+	register unsigned int		chunk;
+	register int				err;
+
+	while (len)
+	{
+		if (!(header = log->Header)) return(-EBADF);
+
+		// The most we can put in one record in an empty segment
+		chunk = len;
+		size = log->SegmentSize - MIDILOG_HEADERSIZE - sizeof(MIDILOG_RECORD);
+		if (chunk > size) chunk = (unsigned int)(size & ~7ULL);
+
+		// Not enough room left in this segment? Start a new one
+		used = header->Used;
+		size = MIDILOG_RECORDSIZE(chunk);
+		if (used + size > log->SegmentSize)
+		{
+			close_segment(log);
+			++log->Sequence;
+			if ((err = create_segment(log)) < 0) return(err);
+			continue;
+		}
+
+		// Add an index entry for this record if we've written another MIDILOG_INDEXSTEP
+		// bytes since the last one
+		if (used >= log->NextIndex && header->IndexCount < MIDILOG_INDEXSIZE)
+		{
+			header->Index[header->IndexCount].Time = time;
+			header->Index[header->IndexCount].Offset = used;
+			++header->IndexCount;
+			log->NextIndex = used + MIDILOG_INDEXSTEP;
+		}
+
+		record = (MIDILOG_RECORD *)((unsigned char *)header + used);
+		record->Time = time;
+		record->Length = chunk;
+		record->Port = port;
+		memcpy(record + 1, buffer, chunk);
+
+		if (!header->FirstTime) header->FirstTime = time;
+		header->LastTime = time;
+		++header->Records;
+
+		// Update "Used" last, so that anyone reading the segment while we write it
+		// never sees a partly written record
+		__atomic_store_n(&header->Used, used + size, __ATOMIC_RELEASE);
+
+		buffer += chunk;
+		len -= chunk;
+	}
+
+	return(0);
+}
+
+
+
+
+
+/********************** midi_log_close() *********************
+ * Closes a log opened with midi_log_open().
+ */
+
+void midi_log_close(MIDILOG *log)
+{
+	close_segment(log);
+	if (log->Base) free(log->Base);
+	log->Base = 0;
+}
+
+
+
+
+
+/********************** midi_log_map() *********************
+ * Opens one segment of a log for reading, and maps it into
+ * memory. The segment's MIDILOG_HEADER is then in
+ * log->Header, and its records follow.
+ *
+ * log =		The MIDILOG to initialize.
+ * base =	The name of the log.
+ * seq =		The number of the segment.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+int midi_log_map(MIDILOG *log, const char *base, unsigned int seq)
+{
+	struct stat		info;
+	register char	*name;
+	register int	err;
+
+	memset(log, 0, sizeof(MIDILOG));
+	name = (char *)alloca(strlen(base) + 16);
+	segment_name(name, base, seq);
+
+	if ((log->Handle = open(name, O_RDONLY)) == -1) return(-errno);
+	if (fstat(log->Handle, &info))
+	{
+		err = -errno;
+		goto bad;
+	}
+
+	err = -EINVAL;
+	if (info.st_size < MIDILOG_HEADERSIZE) goto bad;
+	log->SegmentSize = info.st_size;
+	if ((log->Header = (MIDILOG_HEADER *)mmap(0, log->SegmentSize, PROT_READ, MAP_SHARED, log->Handle, 0)) == MAP_FAILED)
+	{
+		err = -errno;
+		log->Header = 0;
+		goto bad;
+	}
+
+	// Make sure it's really a segment of a MIDI log
+	if (memcmp(&log->Header->ID[0], &MidiLogID[0], 4) || !log->Header->Version || log->Header->Version > MIDILOG_VERSION ||
+		log->Header->Used > log->SegmentSize)
+	{
+		munmap(log->Header, log->SegmentSize);
+		log->Header = 0;
+bad:	close(log->Handle);
+		return(err);
+	}
+
+	log->Sequence = seq;
+	return(0);
+}
+
+
+
+
+
+/********************** midi_log_seek() *********************
+ * Finds the first record in a segment whose time is at
+ * least the specified time.
+ *
+ * header =		The segment's header, as mapped by midi_log_map().
+ * time =		The time to look for.
+ *
+ * RETURNS: The offset of the record, from the start of the
+ * segment, or header->Used if all records are earlier.
+ */
+
+unsigned long long midi_log_seek(const MIDILOG_HEADER *header, unsigned long long time)
+{
+	register unsigned long long	offset, used;
+	register unsigned int		lo, hi;
+
+	// Binary search the index for the last entry before the time we want
+	offset = MIDILOG_HEADERSIZE;
+	lo = 0;
+	hi = header->IndexCount;
+	while (lo < hi)
+	{
+		register unsigned int	mid;
+
+		mid = (lo + hi) / 2;
+		if (header->Index[mid].Time < time)
+		{
+			offset = header->Index[mid].Offset;
+			lo = mid + 1;
+		}
+		else
+			hi = mid;
+	}
+
+	// Then step through the records from there. This is at most
+	// MIDILOG_INDEXSTEP bytes of records
+	used = __atomic_load_n(&header->Used, __ATOMIC_ACQUIRE);
+	while (offset < used)
+	{
+		register const MIDILOG_RECORD	*record;
+
+		record = (const MIDILOG_RECORD *)((const unsigned char *)header + offset);
+		if (record->Time >= time) break;
+		offset += MIDILOG_RECORDSIZE(record->Length);
+	}
+
+	return(offset);
+}
+
+
+
+
+
+/********************** midi_log_unmap() *********************
+ * Closes a segment opened with midi_log_map().
+ */
+
+void midi_log_unmap(MIDILOG *log)
+{
+	close_segment(log);
+}
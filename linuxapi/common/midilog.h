@@ -0,0 +1,107 @@
+// midilog.h
+// A binary log of timestamped MIDI bytes, for round-the-clock
+// capture. The log is a series of "segment" files named
+// <base>.000000.mlog, <base>.000001.mlog, etc. Each segment is
+// a fixed size file that we memory-map, so appending a batch of
+// MIDI bytes costs one memcpy(). When a segment fills, we move
+// on to the next one, and (optionally) delete the oldest.
+//
+// Each segment starts with a MIDILOG_HEADER, which includes a
+// small index of times to file offsets. That lets a reader
+// jump to a given time without scanning the records before it.
+//
+// The records' times are from the monotonic clock, which starts
+// over at each boot. And a log may be appended to by many runs of
+// the program, across reboots. So each run stamps every segment it
+// writes with a "base": the monotonic time when it opened the log,
+// and the real (wall clock) time at that same moment. A reader uses
+// a segment's own base to turn its records' times into real times
+// (MIDILOG_REALTIME). Two segments with different bases came from
+// different runs, so a reader shouldn't compare their records'
+// monotonic times directly.
+
+#ifndef MIDILOG_H
+#define MIDILOG_H
+
+// Default size of a segment file, in bytes
+#define MIDILOG_SEGMENTSIZE	(16 * 1024 * 1024)
+
+// We add an entry to a segment's index each time another
+// MIDILOG_INDEXSTEP bytes of records are written
+#define MIDILOG_INDEXSTEP		(64 * 1024)
+
+// Max entries in a segment's index. This limits a segment to
+// MIDILOG_INDEXSIZE * MIDILOG_INDEXSTEP bytes (64 MB)
+#define MIDILOG_INDEXSIZE		1024
+
+// How much room we leave at the start of a segment for the header.
+// Records start here
+#define MIDILOG_HEADERSIZE		(20 * 1024)
+
+// One index entry
+typedef struct _MIDILOG_INDEX
+{
+	unsigned long long	Time;		// Time of the record at Offset
+	unsigned long long	Offset;	// Offset of a record, from the start of the segment
+} MIDILOG_INDEX;
+
+// The header at the start of each segment
+typedef struct _MIDILOG_HEADER
+{
+	unsigned char			ID[4];		// {'M', 'L', 'O', 'G'}
+	unsigned int			Version;		// MIDILOG_VERSION
+	unsigned int			Sequence;	// This segment's number
+	unsigned int			IndexCount;	// How many entries of Index[] are used
+	unsigned long long	Size;			// Size of the segment file
+	unsigned long long	Used;			// Offset just past the last complete record
+	unsigned long long	FirstTime;	// Time of the first record (0 if none)
+	unsigned long long	LastTime;	// Time of the last record
+	unsigned long long	Records;		// How many records
+	MIDILOG_INDEX			Index[MIDILOG_INDEXSIZE];
+	unsigned long long	MonoBase;	// The monotonic time when the run that wrote this segment opened the log
+	unsigned long long	RealBase;	// The real time (in nanoseconds since 1970) at that same moment
+} MIDILOG_HEADER;
+
+// Version 1 segments have no base (ie, MonoBase and RealBase are 0)
+#define MIDILOG_VERSION		2
+
+// Converts the time of a record in the segment whose header this is,
+// to real time. (Unsigned math wraps, so this is right even if the
+// record's time is a bit before MonoBase)
+#define MIDILOG_REALTIME(header, time)	((header)->RealBase + ((time) - (header)->MonoBase))
+
+// Each record is this header, followed by "Length" MIDI bytes, padded
+// out to a multiple of 8 bytes
+typedef struct _MIDILOG_RECORD
+{
+	unsigned long long	Time;		// When the bytes arrived, in nanoseconds (monotonic clock)
+	unsigned int			Length;	// How many MIDI bytes follow
+	unsigned int			Port;		// Which port they came from (up to the caller)
+} MIDILOG_RECORD;
+
+#define MIDILOG_RECORDSIZE(len)	((sizeof(MIDILOG_RECORD) + (len) + 7) & ~7UL)
+
+// A log opened for writing (or a single segment opened for reading)
+typedef struct _MIDILOG
+{
+	MIDILOG_HEADER		*Header;			// The mapped segment
+	char					*Base;			// The segment file names, minus ".NNNNNN.mlog"
+	unsigned long long	SegmentSize;	// How big to make each new segment
+	unsigned int		MaxSegments;	// Delete older segments beyond this many (0 = keep all)
+	unsigned int		Sequence;		// The current segment's number
+	unsigned long long	NextIndex;	// Offset at which we add the next index entry
+	unsigned long long	MonoBase;	// This run's base, which we put in each segment
+	unsigned long long	RealBase;
+	int					Handle;			// The current segment's file handle
+} MIDILOG;
+
+int midi_log_open(MIDILOG *, const char *, unsigned long long, unsigned int);
+int midi_log_write(MIDILOG *, unsigned long long, unsigned int, const unsigned char *, unsigned int);
+void midi_log_close(MIDILOG *);
+
+int midi_log_list(const char *, unsigned int **);
+int midi_log_map(MIDILOG *, const char *, unsigned int);
+unsigned long long midi_log_seek(const MIDILOG_HEADER *, unsigned long long);
+void midi_log_unmap(MIDILOG *);
+
+#endif
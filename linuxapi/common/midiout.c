@@ -0,0 +1,259 @@
+// midiout.c
+// Non-blocking MIDI output, with a queue for what the driver won't
+// take yet. See midiout.h.
+//
+// Compile it along with the program that uses it, mididev.c, devalloc.c, and timing.c. For example:
+// gcc -o midireplay midireplay.c ../../common/midithin.c ../../common/midiout.c ../../common/mididev.c ../../common/devalloc.c ../../common/midiparse.c ../../common/midilog.c ../../common/timing.c -lasound -lm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include "midiout.h"
+
+
+
+
+
+/********************* midi_out_init() *********************
+ * Initializes a MIDIOUT, and puts the output in non-
+ * blocking mode.
+ *
+ * output =	The MIDI output.
+ * size =	How many bytes we can queue, or 0 for
+ *				MIDIOUT_QUEUESIZE. This must be at least as big
+ *				as the longest message (ie, SysEx) you'll write.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+int midi_out_init(MIDIOUT *out, MIDIDEV *output, unsigned int size)
+{
+	register int	err;
+
+	memset(out, 0, sizeof(MIDIOUT));
+	out->Output = output;
+	out->Size = (size ? size : MIDIOUT_QUEUESIZE);
+	time_hist_init(&out->Drain);
+
+	if ((err = midi_dev_nonblock(output, 1)) < 0) return(err);
+	if (!(out->Queue = (unsigned char *)malloc(out->Size))) return(-ENOMEM);
+
+	return(0);
+}
+
+
+
+
+
+/********************* midi_out_free() *********************
+ * Frees the MIDIOUT's queue. Anything still queued is
+ * thrown away. The output is left open.
+ */
+
+void midi_out_free(MIDIOUT *out)
+{
+	if (out->Queue) free(out->Queue);
+	out->Queue = 0;
+	out->Count = 0;
+}
+
+
+
+
+
+/********************* end_stall() *********************
+ * Called when the queue empties. Records how long the
+ * stall lasted, and how fast the device took the bytes
+ * while it was full.
+ */
+
+static void end_stall(register MIDIOUT *out)
+{
+	register unsigned long long	elapsed;
+
+	elapsed = get_time_ns() - out->StallStart;
+	time_hist_add(&out->Drain, elapsed);
+
+	// The driver's buffer stayed full the whole time, so the device took
+	// bytes only as fast as it could send them
+	if (out->StallBytes)
+	{
+		register double	rate;
+
+		rate = (double)elapsed / out->StallBytes;
+		out->NsPerByte = (out->NsPerByte ? out->NsPerByte * 0.75 + rate * 0.25 : rate);
+	}
+
+	out->StallStart = 0;
+}
+
+
+
+
+
+/********************* midi_out_write() *********************
+ * Sends a MIDI message, or as much of it as the driver has
+ * room for, and queues the rest.
+ *
+ * msg =	The message's bytes. It should be a whole message,
+ *			so that if it's dropped, no part of it is sent.
+ * len =	How many bytes.
+ *
+ * RETURNS: 0 if sent or queued, -ENOBUFS if the queue has no
+ * room (the message is dropped), -EINVAL if the message is
+ * bigger than the queue, or another negative error number
+ * if the write failed.
+ *
+ * NOTE: Never waits.
+ */
+
+int midi_out_write(MIDIOUT *out, const unsigned char *msg, unsigned int len)
+{
+	register unsigned int	tail, part;
+
+	if (out->Error) return(out->Error);
+	if (len > out->Size) return(-EINVAL);
+
+	// If nothing is queued, give it straight to the driver
+	if (!out->Count)
+	{
+		register int	written;
+
+		if ((written = midi_dev_write(out->Output, msg, len)) == -EAGAIN) written = 0;
+		if (written < 0) return(out->Error = written);
+		out->Bytes += written;
+		if ((unsigned int)written >= len) return(0);
+
+		// The driver's full. Queue the rest
+		msg += written;
+		len -= written;
+		out->StallStart = get_time_ns();
+		out->StallBytes = 0;
+		++out->Stalls;
+	}
+
+	// Otherwise, it has to wait its turn behind what's queued
+	else if (len > out->Size - out->Count)
+	{
+		++out->Dropped;
+		return(-ENOBUFS);
+	}
+
+	// Copy it to the queue, wrapping around the end
+	if ((tail = out->Head + out->Count) >= out->Size) tail -= out->Size;
+	if ((part = out->Size - tail) > len) part = len;
+	memcpy(out->Queue + tail, msg, part);
+	memcpy(out->Queue, msg + part, len - part);
+
+	if ((out->Count += len) > out->MaxCount) out->MaxCount = out->Count;
+
+	return(0);
+}
+
+
+
+
+
+/********************* midi_out_flush() *********************
+ * Gives the driver as much of the queue as it has room for.
+ * Call this when poll() says the output is ready (POLLOUT).
+ *
+ * RETURNS: 0 if success (even if some bytes are still
+ * queued), or a negative error number.
+ */
+
+int midi_out_flush(MIDIOUT *out)
+{
+	while (out->Count)
+	{
+		register unsigned int	len;
+		register int			written;
+
+		// Write up to the end of the queue's buffer. If it wraps around, we'll
+		// do the rest next time through the loop
+		if ((len = out->Size - out->Head) > out->Count) len = out->Count;
+		if ((written = midi_dev_write(out->Output, out->Queue + out->Head, len)) == -EAGAIN) break;
+		if (written < 0) return(out->Error = written);
+
+		out->Bytes += written;
+		out->StallBytes += written;
+		out->Count -= written;
+		if ((out->Head += written) >= out->Size) out->Head -= out->Size;
+
+		if ((unsigned int)written < len) break;
+	}
+
+	if (!out->Count && out->StallStart) end_stall(out);
+
+	return(0);
+}
+
+
+
+
+
+/********************* midi_out_drain() *********************
+ * Waits until the queue is empty, and the driver has sent
+ * everything.
+ *
+ * timeout =	How many milliseconds to wait for the queue to
+ *					empty, or -1 to wait as long as it takes.
+ *
+ * RETURNS: 0 if success, -ETIMEDOUT if the queue didn't empty
+ * in time, or another negative error number.
+ */
+
+int midi_out_drain(MIDIOUT *out, int timeout)
+{
+	struct pollfd			*pfds;
+	unsigned long long	end;
+	register int			npfds, err;
+
+	npfds = midi_dev_poll_descriptors_count(out->Output);
+	pfds = (struct pollfd *)alloca(npfds * sizeof(struct pollfd));
+	end = get_time_ns() + (unsigned long long)timeout * 1000000ULL;
+
+	while (out->Count)
+	{
+		register unsigned long long	now;
+
+		if ((err = midi_out_flush(out)) < 0) return(err);
+		if (!out->Count) break;
+
+		now = get_time_ns();
+		if (timeout >= 0 && now >= end) return(-ETIMEDOUT);
+		npfds = midi_out_poll_descriptors(out, pfds, npfds);
+		poll(pfds, npfds, timeout >= 0 ? (int)((end - now) / 1000000ULL) + 1 : -1);
+	}
+
+	midi_dev_drain(out->Output);
+	return(0);
+}
+
+
+
+
+
+/****************** midi_out_poll_descriptors() *******************
+ * Fills in the output's pollfd's. They ask for POLLOUT only
+ * while something is queued, so that poll() doesn't keep
+ * waking the caller while the output has nothing to do. Call
+ * this before each poll().
+ *
+ * space =	How many pollfd's "pfds" has room for. Use
+ *				midi_dev_poll_descriptors_count() to size it.
+ *
+ * RETURNS: How many pollfd's filled in.
+ */
+
+int midi_out_poll_descriptors(MIDIOUT *out, struct pollfd *pfds, unsigned int space)
+{
+	register int	i, count;
+
+	count = midi_dev_poll_descriptors(out->Output, pfds, space);
+	for (i = 0; i < count; i++) pfds[i].events = (out->Count ? POLLOUT : 0);
+
+	return(count);
+}
@@ -0,0 +1,62 @@
+// midiout.h
+// Non-blocking MIDI output that never makes the caller wait.
+//
+// A blocking snd_rawmidi_write() waits whenever the driver's buffer
+// is full, which on a slow device (a 31250 baud cable sends about
+// 3 bytes a millisecond) can be a long time, and holds up whatever
+// else the calling thread should be doing. A non-blocking write
+// returns -EAGAIN, or writes only part of what we gave it, instead.
+//
+// So we open the output in non-blocking mode, and when the driver
+// doesn't take everything, we keep the rest in our own queue. The
+// caller polls the output's descriptors (which ask for POLLOUT only
+// while something is queued), and calls midi_out_flush() when the
+// driver has room. New messages go behind what's queued, so the
+// order is kept. If the queue itself fills, the message is dropped
+// (never half of it), and counted.
+//
+// We also keep track of how long the driver stays full (each
+// "stall", from when we first have to queue, until the queue is
+// empty again), and from that, how fast the device really takes
+// bytes. midi_out_delay() uses that to estimate how long the bytes
+// queued now will take to go out.
+
+#ifndef MIDIOUT_H
+#define MIDIOUT_H
+
+#include "mididev.h"
+#include "timing.h"
+
+// Default for how many bytes we can queue
+#define MIDIOUT_QUEUESIZE	8192
+
+typedef struct _MIDIOUT
+{
+	MIDIDEV					*Output;
+	unsigned char			*Queue;			// The bytes the driver hasn't taken yet
+	unsigned int			Size;				// How big Queue is
+	unsigned int			Head;				// Where the oldest queued byte is
+	unsigned int			Count;			// How many bytes are queued
+	unsigned int			MaxCount;		// The most bytes ever queued at once
+	int						Error;			// The first write error, if any
+	unsigned long long	StallStart;		// When the current stall started (0 if none)
+	unsigned long			StallBytes;		// How many bytes the driver has taken during it
+	unsigned long			Bytes;			// How many bytes the driver has taken
+	unsigned long			Stalls;			// How many times the driver was full
+	unsigned long			Dropped;			// How many messages we threw away, for lack of room
+	double					NsPerByte;		// How fast the device takes bytes, when it's full (0 if not known yet)
+	TIMEHIST					Drain;			// How long each stall lasted
+} MIDIOUT;
+
+// Returns an estimate of how many nanoseconds it'll take the device to
+// take what's queued now
+#define midi_out_delay(out)	((unsigned long long)((out)->Count * (out)->NsPerByte))
+
+int midi_out_init(MIDIOUT *, MIDIDEV *, unsigned int);
+void midi_out_free(MIDIOUT *);
+int midi_out_write(MIDIOUT *, const unsigned char *, unsigned int);
+int midi_out_flush(MIDIOUT *);
+int midi_out_drain(MIDIOUT *, int);
+int midi_out_poll_descriptors(MIDIOUT *, struct pollfd *, unsigned int);
+
+#endif
@@ -0,0 +1,322 @@
+// midiparse.c
+// An incremental, table-driven parser for a MIDI 1.0 byte
+// stream. See midiparse.h.
+//
+// Compile it along with the program that uses it, for example:
+// gcc -o rawmidiinput rawmidiinput.c ../../common/midiparse.c ../../common/ump.c ../../common/mididev.c ../../common/devalloc.c ../../common/timing.c ../../common/midilog.c -lasound -lpthread -lm
+
+#include <string.h>
+#include "midiparse.h"
+
+
+
+
+
+// What each byte means, indexed by the byte value. Data bytes (0x00
+// to 0x7F) are all 0. For a status, the high nibble is its class, and
+// the low nibble is how many data bytes follow it. Note that the
+// undefined system common statuses (0xF4, 0xF5) have no data bytes,
+// but still cancel running status. And the undefined realtime
+// statuses (0xF9, 0xFD) are passed along like any other realtime
+const unsigned char MidiStatusTable[256] = {
+	[0x80 ... 0xBF] = MIDI_CLASS_CHANNEL | 2,	// Note off, note on, aftertouch, controller
+	[0xC0 ... 0xDF] = MIDI_CLASS_CHANNEL | 1,	// Program change, channel pressure
+	[0xE0 ... 0xEF] = MIDI_CLASS_CHANNEL | 2,	// Pitch wheel
+	[0xF0] = MIDI_CLASS_SYSEX,
+	[0xF1] = MIDI_CLASS_COMMON | 1,				// MTC quarter frame
+	[0xF2] = MIDI_CLASS_COMMON | 2,				// Song position pointer
+	[0xF3] = MIDI_CLASS_COMMON | 1,				// Song select
+	[0xF4] = MIDI_CLASS_COMMON,
+	[0xF5] = MIDI_CLASS_COMMON,
+	[0xF6] = MIDI_CLASS_COMMON,					// Tune request
+	[0xF7] = MIDI_CLASS_EOX,
+	[0xF8 ... 0xFF] = MIDI_CLASS_REALTIME,		// Clock, start, continue, stop, active sense, reset
+};
+
+
+
+
+
+/******************** midi_parse_init() *******************
+ * Initializes a MIDIPARSER before its first use, or resets
+ * it (for example, after an input overrun, when whatever
+ * message we were in the middle of is garbage).
+ */
+
+void midi_parse_init(MIDIPARSER *parser)
+{
+	memset(parser, 0, sizeof(MIDIPARSER));
+}
+
+
+
+
+
+/*********************** midi_parse() **********************
+ * Parses MIDI bytes into MIDIEVENTs.
+ *
+ * parser =		The MIDIPARSER. Any message that isn't complete
+ *					at the end of the buffer is remembered here, and
+ *					finished on the next call.
+ * buffer =		The MIDI bytes.
+ * len =			How many bytes are in the buffer.
+ * time =		When those bytes arrived (in nanoseconds). This
+ *					is stored in every MIDIEVENT we return.
+ * events =		Where to put the parsed MIDIEVENTs.
+ * maxEvents =	How many MIDIEVENTs fit in events[].
+ * used =		Where to return how many bytes of buffer were
+ *					consumed. This is "len" unless events[] filled
+ *					up. In that case, call midi_parse() again, passing
+ *					the remainder of the buffer.
+ *
+ * RETURNS: The number of MIDIEVENTs stored in events[].
+ *
+ * NOTE: A SysEx slice points into "buffer", so don't reuse
+ * the buffer until you're done with the events. The slice that
+ * ends an aborted SysEx may be empty (see midiparse.h).
+ */
+
+unsigned int midi_parse(MIDIPARSER *parser, const unsigned char *buffer, unsigned int len, unsigned long long time, MIDIEVENT *events, unsigned int maxEvents, unsigned int *used)
+{
+	register const unsigned char	*ptr, *end, *slice;
+	register MIDIEVENT				*event, *eventEnd;
+	register unsigned char			info, byte;
+
+	ptr = buffer;
+	end = buffer + len;
+	event = events;
+	eventEnd = events + maxEvents;
+	slice = buffer;
+
+	while (ptr < end)
+	{
+		// ============================= Inside a SysEx? ==============================
+		if (parser->InSysEx)
+		{
+			register const unsigned char	*limit;
+
+			// Skip over all the SysEx data bytes. This is the only work we do per
+			// SysEx byte. We don't let a slice get longer than its Length can express
+			limit = (end - slice > 0xFFFF ? slice + 0xFFFF : end);
+			while (ptr < limit && *ptr < 0x80) ++ptr;
+
+			// Ran out of bytes (or the slice is full)? Give the caller what we have so far
+			if (ptr >= limit)
+			{
+				if (ptr == slice) break;
+				if (event >= eventEnd) goto full;
+				info = 0;
+				goto emit;
+			}
+
+			byte = *ptr;
+			info = MidiStatusTable[byte] & 0xF0;
+
+			// A realtime byte may appear in the middle of the SysEx. We end this slice just
+			// before it, pass the realtime, and then start another slice after it
+			if (info == MIDI_CLASS_REALTIME)
+			{
+				if (event + 2 > eventEnd) goto full;
+				if (ptr != slice)
+				{
+					event->SysEx = slice;
+					event->Time = time;
+					event->Length = (unsigned short)(ptr - slice);
+					event->Type = MIDI_TYPE_SYSEX;
+					event->Flags = parser->SysExFirst;
+					event->Status = 0xF0;
+					event++;
+					parser->SysExFirst = 0;
+				}
+				goto realtime;
+			}
+
+			if (event >= eventEnd) goto full;
+
+			// The end of the SysEx? Include the 0xF7 in the slice
+			if (info == MIDI_CLASS_EOX)
+			{
+				++ptr;
+				info = MIDI_SYSEX_END;
+			}
+
+			// Any other status ends the SysEx too (although the device was supposed to
+			// send an 0xF7 first). We process that status below, after the slice. If
+			// we've already returned everything before it, this slice is empty, but we
+			// still return it, so the caller knows the SysEx is over
+			else
+				info = MIDI_SYSEX_END | MIDI_SYSEX_ABORTED;
+
+			parser->InSysEx = 0;
+emit:	event->SysEx = slice;
+			event->Time = time;
+			event->Length = (unsigned short)(ptr - slice);
+			event->Type = MIDI_TYPE_SYSEX;
+			event->Flags = parser->SysExFirst | info;
+			event->Status = 0xF0;
+			event++;
+			parser->SysExFirst = 0;
+			slice = ptr;
+			continue;
+		}
+
+		byte = *ptr;
+		info = MidiStatusTable[byte];
+
+		switch (info & 0xF0)
+		{
+			// ============================= Data byte ==============================
+			case MIDI_CLASS_DATA:
+			{
+				// No status to go with it? Then there's nothing we can do with it
+				if (!parser->Status)
+				{
+					++parser->Discarded;
+					break;
+				}
+
+				// The first of two data bytes?
+				if (parser->Needed > 1 && !parser->Have)
+				{
+					parser->Data1 = byte;
+					parser->Have = 1;
+					break;
+				}
+
+				// This completes the message
+				if (event >= eventEnd) goto full;
+				event->Time = time;
+				event->Status = parser->Status;
+				event->Length = parser->Needed + 1;
+				event->Type = (parser->Status < 0xF0 ? MIDI_TYPE_CHANNEL : MIDI_TYPE_COMMON);
+				event->Flags = 0;
+				if (parser->Have)
+				{
+					event->Data1 = parser->Data1;
+					event->Data2 = byte;
+				}
+				else
+				{
+					event->Data1 = byte;
+					event->Data2 = 0;
+				}
+				event->SysEx = 0;
+				event++;
+
+				// A channel message's status is now the running status, so the next
+				// data byte starts another message of the same kind. System common
+				// messages cancel running status
+				parser->Have = 0;
+				if (parser->Status >= 0xF0) parser->Status = 0;
+				break;
+			}
+
+			// ============================= Channel status ==============================
+			case MIDI_CLASS_CHANNEL:
+			{
+				// NOTE: If we were in the middle of a message, it's incomplete,
+				// and we silently drop it
+				parser->Status = byte;
+				parser->Needed = info & 0x0F;
+				parser->Have = 0;
+				break;
+			}
+
+			// ============================= System common ==============================
+			case MIDI_CLASS_COMMON:
+			{
+				if (!(info & 0x0F))
+				{
+					// A system common without data bytes (ie, Tune Request) is complete
+					if (event >= eventEnd) goto full;
+					event->Time = time;
+					event->Status = byte;
+					event->Length = 1;
+					event->Type = MIDI_TYPE_COMMON;
+					event->Flags = event->Data1 = event->Data2 = 0;
+					event->SysEx = 0;
+					event++;
+					parser->Status = 0;
+				}
+				else
+				{
+					parser->Status = byte;
+					parser->Needed = info & 0x0F;
+					parser->Have = 0;
+				}
+				break;
+			}
+
+			// ============================= Realtime ==============================
+			case MIDI_CLASS_REALTIME:
+			{
+				// A realtime byte doesn't affect running status, or any message
+				// we're in the middle of assembling
+				if (event >= eventEnd) goto full;
+realtime:	event->Time = time;
+				event->Status = byte;
+				event->Length = 1;
+				event->Type = MIDI_TYPE_REALTIME;
+				event->Flags = event->Data1 = event->Data2 = 0;
+				event->SysEx = 0;
+				event++;
+				slice = ptr + 1;
+				break;
+			}
+
+			// ============================= SysEx start ==============================
+			case MIDI_CLASS_SYSEX:
+			{
+				// SysEx cancels running status. Its first slice starts with the 0xF0
+				parser->Status = 0;
+				parser->InSysEx = 1;
+				parser->SysExFirst = MIDI_SYSEX_START;
+				slice = ptr;
+				break;
+			}
+
+			// ============================= Stray EOX ==============================
+			default:
+			{
+				// An 0xF7 outside of a SysEx. Ignore it, except for cancelling running status
+				parser->Status = 0;
+			}
+		}
+
+		++ptr;
+	}
+
+	// Did the buffer end right after an 0xF0? Then give the caller a slice with just the
+	// 0xF0. Otherwise, the next call's first slice would be flagged as the start, but
+	// not begin with the 0xF0
+	if (parser->InSysEx && slice < end)
+	{
+		if (event >= eventEnd) goto full;
+		event->SysEx = slice;
+		event->Time = time;
+		event->Length = (unsigned short)(end - slice);
+		event->Type = MIDI_TYPE_SYSEX;
+		event->Flags = parser->SysExFirst;
+		event->Status = 0xF0;
+		event++;
+		parser->SysExFirst = 0;
+	}
+
+	*used = len;
+	return(event - events);
+
+	// events[] is full. Tell the caller how much of the buffer we used. If we're
+	// in a SysEx, the bytes since the start of the current slice haven't been
+	// passed to the caller yet, so he must pass those again. If we haven't yet
+	// returned the SysEx's first slice, then it starts with the 0xF0, and we'll
+	// see that 0xF0 again on the next call
+full:
+	if (!parser->InSysEx)
+		*used = ptr - buffer;
+	else
+	{
+		if (parser->SysExFirst) parser->InSysEx = 0;
+		*used = slice - buffer;
+	}
+	return(event - events);
+}
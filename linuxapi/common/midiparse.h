@@ -0,0 +1,87 @@
+// midiparse.h
+// An incremental parser for a MIDI 1.0 byte stream (such as
+// what snd_rawmidi_read() gives us). You feed it whatever
+// bytes you have, and it gives you back one fixed-size
+// MIDIEVENT per message. It resolves running status,
+// understands all system common messages, and lets realtime
+// bytes (clock, active sensing, etc) arrive anywhere -- even
+// in the middle of another message or a SysEx.
+//
+// SysEx isn't copied. Instead, you get "slices" that point
+// directly into the buffer that you passed to midi_parse().
+// A SysEx that spans several reads (or is interrupted by a
+// realtime byte) arrives as several slices. The first slice
+// starts with the 0xF0, and the last one ends with the 0xF7.
+//
+// If some other status arrives before the 0xF7, the last slice
+// is flagged MIDI_SYSEX_ABORTED instead. When that status is the
+// first byte after a slice we already returned (ie, it starts the
+// next read, or follows a realtime byte), there's nothing left to
+// put in the last slice, so its Length is 0. Its SysEx then points
+// at that status (which isn't part of the SysEx), so don't look at
+// a slice's bytes without checking its Length. A consumer that
+// sorts out messages by their first byte must treat every
+// MIDI_TYPE_SYSEX slice as 0xF0, and must not skip an empty one,
+// or it will never see that SysEx end.
+
+#ifndef MIDIPARSE_H
+#define MIDIPARSE_H
+
+// What each of the 256 possible byte values means to the
+// parser. The high nibble is the class, and the low nibble
+// is how many data bytes follow that status
+#define MIDI_CLASS_DATA			0x00
+#define MIDI_CLASS_CHANNEL		0x10
+#define MIDI_CLASS_COMMON		0x20
+#define MIDI_CLASS_REALTIME	0x30
+#define MIDI_CLASS_SYSEX			0x40
+#define MIDI_CLASS_EOX			0x50
+
+extern const unsigned char MidiStatusTable[256];
+
+#define MIDI_STATUS_CLASS(b)	(MidiStatusTable[(unsigned char)(b)] & 0xF0)
+#define MIDI_STATUS_DATA(b)	(MidiStatusTable[(unsigned char)(b)] & 0x0F)
+
+// MIDIEVENT's Type
+#define MIDI_TYPE_CHANNEL		0	// Channel voice/mode message (0x80 to 0xEF)
+#define MIDI_TYPE_COMMON		1	// System common (0xF1 to 0xF6)
+#define MIDI_TYPE_REALTIME		2	// System realtime (0xF8 to 0xFF)
+#define MIDI_TYPE_SYSEX			3	// A slice of a System Exclusive
+
+// MIDIEVENT's Flags (for MIDI_TYPE_SYSEX only)
+#define MIDI_SYSEX_START		0x01	// This slice begins with the 0xF0
+#define MIDI_SYSEX_END			0x02	// The SysEx ends with this slice
+#define MIDI_SYSEX_ABORTED		0x04	// ... but because some other status arrived, not an 0xF7
+
+// One parsed message. It's 24 bytes, so 8 fit in 3 cache lines.
+// NOTE: Status, Data1, and Data2 are kept together, in that order,
+// so &Status points to the message's bytes (Length of them)
+typedef struct _MIDIEVENT
+{
+	unsigned long long	Time;		// When the message's last byte arrived, in nanoseconds (0 if unknown)
+	const unsigned char	*SysEx;	// MIDI_TYPE_SYSEX: Points to the slice, within the caller's buffer
+	unsigned short			Length;	// How many bytes in the message (or SysEx slice), including status
+	unsigned char			Type;		// MIDI_TYPE_xxx
+	unsigned char			Flags;	// MIDI_SYSEX_xxx
+	unsigned char			Status;	// Status byte, including the MIDI channel
+	unsigned char			Data1;	// First data byte, if any
+	unsigned char			Data2;	// Second data byte, if any
+	unsigned char			Pad;
+} MIDIEVENT;
+
+// The parser's state, which carries over from one call to the next
+typedef struct _MIDIPARSER
+{
+	unsigned char			Status;	// The status of the message we're assembling (0 if none)
+	unsigned char			Needed;	// How many data bytes that message needs
+	unsigned char			Have;		// How many data bytes we have so far
+	unsigned char			Data1;	// The first data byte, while we wait for the second
+	unsigned char			InSysEx;	// Non-zero if we're inside a SysEx
+	unsigned char			SysExFirst;	// Non-zero if the next SysEx slice is the first
+	unsigned long			Discarded;	// Count of data bytes thrown away (no status for them)
+} MIDIPARSER;
+
+void midi_parse_init(MIDIPARSER *);
+unsigned int midi_parse(MIDIPARSER *, const unsigned char *, unsigned int, unsigned long long, MIDIEVENT *, unsigned int, unsigned int *);
+
+#endif
@@ -0,0 +1,104 @@
+// midiring.h
+// A lock-free ring buffer for passing fixed-size records from
+// one thread (the producer) to one other thread (the consumer).
+// Neither thread ever waits for the other, so a real-time
+// thread can hand off its data without risk of being blocked
+// by a thread doing slow things (like writing to disk).
+//
+// The producer owns "Head", and the consumer owns "Tail". Each
+// only reads the other's, with acquire/release ordering, so
+// that the record's contents are visible before the index
+// that says it's there. The two are kept in separate cache
+// lines, so the threads don't slow each other down.
+//
+// The number of records must be a power of 2.
+
+#ifndef MIDIRING_H
+#define MIDIRING_H
+
+#include <stdlib.h>
+#include <errno.h>
+
+typedef struct _MIDIRING
+{
+	unsigned int			Head __attribute__((aligned(64)));	// Next record to write (producer)
+	unsigned int			Tail __attribute__((aligned(64)));	// Next record to read (consumer)
+	unsigned char			*Buffer __attribute__((aligned(64)));
+	unsigned int			Mask;				// Number of records - 1
+	unsigned int			RecordSize;		// Size of each record, in bytes
+} MIDIRING;
+
+
+
+
+
+/********************* midi_ring_init() *********************
+ * Initializes a MIDIRING.
+ *
+ * recordSize =	The size of each record, in bytes.
+ * count =			How many records it holds. Must be a power of 2.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+static inline int midi_ring_init(MIDIRING *ring, unsigned int recordSize, unsigned int count)
+{
+	if (!count || (count & (count - 1))) return(-EINVAL);
+	ring->Head = ring->Tail = 0;
+	ring->Mask = count - 1;
+	ring->RecordSize = recordSize;
+	if (!(ring->Buffer = (unsigned char *)calloc(count, recordSize))) return(-ENOMEM);
+	return(0);
+}
+
+static inline void midi_ring_free(MIDIRING *ring)
+{
+	if (ring->Buffer) free(ring->Buffer);
+	ring->Buffer = 0;
+}
+
+/********************* midi_ring_write_ptr() *********************
+ * Producer: Returns a pointer to the next free record, or
+ * 0 if the ring is full. Fill it in, then call
+ * midi_ring_commit().
+ */
+
+static inline void * midi_ring_write_ptr(MIDIRING *ring)
+{
+	register unsigned int	head;
+
+	head = ring->Head;
+	if (head - __atomic_load_n(&ring->Tail, __ATOMIC_ACQUIRE) > ring->Mask) return(0);
+	return(ring->Buffer + (head & ring->Mask) * ring->RecordSize);
+}
+
+static inline void midi_ring_commit(MIDIRING *ring)
+{
+	__atomic_store_n(&ring->Head, ring->Head + 1, __ATOMIC_RELEASE);
+}
+
+/********************* midi_ring_read_ptr() *********************
+ * Consumer: Returns a pointer to the oldest record, or 0 if
+ * the ring is empty. When done with it, call
+ * midi_ring_release().
+ */
+
+static inline void * midi_ring_read_ptr(MIDIRING *ring)
+{
+	register unsigned int	tail;
+
+	tail = ring->Tail;
+	if (tail == __atomic_load_n(&ring->Head, __ATOMIC_ACQUIRE)) return(0);
+	return(ring->Buffer + (tail & ring->Mask) * ring->RecordSize);
+}
+
+static inline void midi_ring_release(MIDIRING *ring)
+{
+	__atomic_store_n(&ring->Tail, ring->Tail + 1, __ATOMIC_RELEASE);
+}
+
+// How many records are in the ring. Either thread may call this,
+// but it's only a snapshot
+#define midi_ring_count(ring)	(__atomic_load_n(&(ring)->Head, __ATOMIC_ACQUIRE) - __atomic_load_n(&(ring)->Tail, __ATOMIC_ACQUIRE))
+
+#endif
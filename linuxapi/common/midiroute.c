@@ -0,0 +1,431 @@
+// midiroute.c
+// Compiles MIDI routing rules into lookup tables, and routes
+// messages with them. See midiroute.h.
+//
+// Compile it along with the program that uses it, for example:
+// gcc -o midirouter midirouter.c ../../common/midiroute.c ../../common/midiparse.c ../../common/ump.c ../../common/midienc.c ../../common/mididev.c ../../common/devalloc.c ../../common/midistat.c ../../common/timing.c -lasound -lpthread -lrt -lm
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include "midiroute.h"
+
+// The names that can be used with "type="
+static const struct
+{
+	const char *			Name;
+	unsigned short			Types;
+} TypeNames[] = {{"noteoff", MIDIROUTE_NOTEOFF},
+	{"noteon", MIDIROUTE_NOTEON},
+	{"note", MIDIROUTE_NOTEOFF|MIDIROUTE_NOTEON},
+	{"polypress", MIDIROUTE_POLYPRESS},
+	{"cc", MIDIROUTE_CONTROLLER},
+	{"program", MIDIROUTE_PROGRAM},
+	{"chanpress", MIDIROUTE_CHANPRESS},
+	{"pitch", MIDIROUTE_PITCHWHEEL},
+	{"sysex", MIDIROUTE_SYSEX},
+	{"common", MIDIROUTE_COMMON},
+	{"realtime", MIDIROUTE_REALTIME},
+	{"channel", MIDIROUTE_CHANNEL},
+	{"all", MIDIROUTE_ALL},
+	{0, 0}};
+
+
+
+
+
+/********************* midi_route_rule_init() *********************
+ * Initializes a MIDIROUTE_RULE to route everything from
+ * the specified input to the specified output, unchanged.
+ */
+
+void midi_route_rule_init(MIDIROUTE_RULE *rule, unsigned int input, unsigned int output)
+{
+	memset(rule, 0, sizeof(MIDIROUTE_RULE));
+	rule->Input = (unsigned short)input;
+	rule->Output = (unsigned short)output;
+	rule->Channels = 0xFFFF;
+	rule->Types = MIDIROUTE_ALL;
+	rule->HighNote = 127;
+	rule->LowVel = 1;
+	rule->HighVel = 127;
+	rule->Curve = 1.0f;
+	rule->Channel = 0xFF;
+}
+
+
+
+
+
+/********************* parse_range() *********************
+ * Parses a number, or a range of numbers such as "36-59".
+ *
+ * RETURNS: Pointer to the character after the range, or 0
+ * if it isn't a number, or is outside of min to max.
+ */
+
+static const char * parse_range(const char *str, int min, int max, int *low, int *high)
+{
+	char	*end;
+
+	*low = *high = (int)strtol(str, &end, 10);
+	if (end == str) return(0);
+	if (*end == '-')
+	{
+		str = end + 1;
+		*high = (int)strtol(str, &end, 10);
+		if (end == str) return(0);
+	}
+	if (*low < min || *high > max || *low > *high) return(0);
+	return(end);
+}
+
+
+
+
+
+/********************* midi_route_rule_parse() *********************
+ * Parses the text form of a rule's filters and transforms,
+ * and sets them in the MIDIROUTE_RULE (which the caller has
+ * initialized with midi_route_rule_init()). The text is any
+ * of the following, separated by spaces:
+ *
+ * chan=1-4,10		Route only these MIDI channels (1 to 16).
+ * type=note,cc	Route only these message types (see TypeNames).
+ * notes=36-59		Route only these notes (for note-off, note-on,
+ *						and polyphonic pressure).
+ * transpose=12	Add this to note numbers. Notes that end up
+ *						outside 0 to 127 are dropped.
+ * vel=20-110		Scale note-on velocities to this range.
+ * curve=0.7		Bend the velocity scaling. Less than 1 makes
+ *						soft notes louder, more than 1 makes them softer.
+ * tochan=10		Change the channel of channel messages.
+ *
+ * If "chan=" is given, but not "type=", then only channel
+ * messages are routed.
+ *
+ * RETURNS: 0 if success, or -EINVAL if the text has an error.
+ */
+
+int midi_route_rule_parse(MIDIROUTE_RULE *rule, const char *text)
+{
+	unsigned char	haveChan, haveType;
+	int				low, high;
+
+	haveChan = haveType = 0;
+
+	for (;;)
+	{
+		register const char	*value;
+
+		while (*text == ' ' || *text == '\t') ++text;
+		if (!*text || *text == '\n' || *text == '\r' || *text == '#') break;
+
+		if (!(value = strchr(text, '='))) return(-EINVAL);
+		++value;
+
+		if (!strncmp(text, "chan=", 5))
+		{
+			// Build up a bitmask of the channels, ie "1-4,10"
+			rule->Channels = 0;
+			text = value;
+			do
+			{
+				if (!(text = parse_range(text, 1, 16, &low, &high))) return(-EINVAL);
+				while (low <= high) rule->Channels |= (unsigned short)(1 << (low++ - 1));
+			} while (*text++ == ',');
+			--text;
+			haveChan = 1;
+		}
+
+		else if (!strncmp(text, "type=", 5))
+		{
+			rule->Types = 0;
+			text = value;
+			do
+			{
+				register unsigned int	i, len;
+
+				len = (unsigned int)strcspn(text, ", \t\r\n#");
+				for (i = 0; TypeNames[i].Name; i++)
+				{
+					if (strlen(TypeNames[i].Name) == len && !strncmp(text, TypeNames[i].Name, len)) break;
+				}
+				if (!TypeNames[i].Name) return(-EINVAL);
+				rule->Types |= TypeNames[i].Types;
+				text += len;
+			} while (*text++ == ',');
+			--text;
+			haveType = 1;
+		}
+
+		else if (!strncmp(text, "notes=", 6))
+		{
+			if (!(text = parse_range(value, 0, 127, &low, &high))) return(-EINVAL);
+			rule->LowNote = (unsigned char)low;
+			rule->HighNote = (unsigned char)high;
+		}
+
+		else if (!strncmp(text, "transpose=", 10))
+		{
+			if (!(text = parse_range(value, -127, 127, &low, &high)) || low != high) return(-EINVAL);
+			rule->Transpose = (signed char)low;
+		}
+
+		else if (!strncmp(text, "vel=", 4))
+		{
+			if (!(text = parse_range(value, 1, 127, &low, &high))) return(-EINVAL);
+			rule->LowVel = (unsigned char)low;
+			rule->HighVel = (unsigned char)high;
+		}
+
+		else if (!strncmp(text, "curve=", 6))
+		{
+			char	*end;
+
+			rule->Curve = strtof(value, &end);
+			if (end == value || rule->Curve <= 0.0f) return(-EINVAL);
+			text = end;
+		}
+
+		else if (!strncmp(text, "tochan=", 7))
+		{
+			if (!(text = parse_range(value, 1, 16, &low, &high)) || low != high) return(-EINVAL);
+			rule->Channel = (unsigned char)(low - 1);
+		}
+
+		else
+			return(-EINVAL);
+
+		// Each option must be followed by a space, or the end
+		if (*text && *text != ' ' && *text != '\t' && *text != '\n' && *text != '\r' && *text != '#') return(-EINVAL);
+	}
+
+	if (haveChan && !haveType) rule->Types = MIDIROUTE_CHANNEL;
+
+	return(0);
+}
+
+
+
+
+
+/********************* rule_wants() *********************
+ * Returns non-zero if the rule routes messages with the
+ * specified status.
+ */
+
+static unsigned int rule_wants(const MIDIROUTE_RULE *rule, unsigned int status)
+{
+	if (status < 0xF0) return((rule->Types & (1 << ((status >> 4) - 8))) && (rule->Channels & (1 << (status & 0x0F))));
+	if (status == 0xF0) return(rule->Types & MIDIROUTE_SYSEX);
+	if (status < 0xF7) return(rule->Types & MIDIROUTE_COMMON);
+
+	// 0xF7 is never a message of its own. It's the end of a SysEx
+	if (status == 0xF7) return(0);
+	return(rule->Types & MIDIROUTE_REALTIME);
+}
+
+
+
+
+
+/********************* midi_route_compile() *********************
+ * Compiles rules into a MIDIROUTE.
+ *
+ * rules =		An array of MIDIROUTE_RULEs.
+ * count =		How many rules.
+ * inputs =		How many inputs. Each rule's Input must be less
+ *					than this.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ *
+ * NOTE: Call midi_route_free() when done with the MIDIROUTE,
+ * even if this fails.
+ */
+
+int midi_route_compile(MIDIROUTE *route, const MIDIROUTE_RULE *rules, unsigned int count, unsigned int inputs)
+{
+	register unsigned int	i, status, total;
+
+	memset(route, 0, sizeof(MIDIROUTE));
+	route->Inputs = inputs;
+
+	if (!(route->Start = (unsigned int *)calloc(inputs * 129 + 1, sizeof(unsigned int))) ||
+		!(route->Actions = (MIDIROUTE_ACTION *)calloc(count + 1, sizeof(MIDIROUTE_ACTION))))
+	{
+		return(-ENOMEM);
+	}
+
+	// Count how many rules want each input/status. We count each group in
+	// the Start of the group after it, so after the running total, each
+	// group's Start is where it begins
+	for (i = 0; i < count; i++)
+	{
+		if (rules[i].Input >= inputs) return(-EINVAL);
+		for (status = 0x80; status < 0x100; status++)
+		{
+			if (rule_wants(&rules[i], status)) ++route->Start[rules[i].Input * 129 + status - 0x80 + 1];
+		}
+	}
+	for (total = 0, i = 0; i < inputs * 129; i++)
+	{
+		total += route->Start[i + 1];
+		route->Start[i + 1] = total;
+	}
+
+	// Fill in each group's list of rules. Rules are kept in the order given,
+	// so when several go to one output, the messages come out in that order
+	if (!(route->List = (unsigned short *)malloc((total + 1) * sizeof(unsigned short)))) return(-ENOMEM);
+	{
+	unsigned int	*fill;
+
+	if (!(fill = (unsigned int *)malloc(inputs * 129 * sizeof(unsigned int)))) return(-ENOMEM);
+	memcpy(fill, route->Start, inputs * 129 * sizeof(unsigned int));
+	for (i = 0; i < count; i++)
+	{
+		for (status = 0x80; status < 0x100; status++)
+		{
+			if (rule_wants(&rules[i], status)) route->List[fill[rules[i].Input * 129 + status - 0x80]++] = (unsigned short)i;
+		}
+	}
+	free(fill);
+	}
+
+	// Make each rule's note and velocity tables
+	for (i = 0; i < count; i++)
+	{
+		register MIDIROUTE_ACTION		*action;
+		register const MIDIROUTE_RULE	*rule;
+		register int						n;
+
+		action = &route->Actions[i];
+		rule = &rules[i];
+		action->Output = rule->Output;
+		action->Channel = rule->Channel;
+
+		for (n = 0; n < 128; n++)
+		{
+			register int	note;
+
+			note = n + rule->Transpose;
+			action->NoteMap[n] = (n < rule->LowNote || n > rule->HighNote || note < 0 || note > 127) ? 0xFF : (unsigned char)note;
+		}
+
+		// A velocity of 0 is a note-off, so it stays 0
+		action->VelMap[0] = 0;
+		for (n = 1; n < 128; n++)
+			action->VelMap[n] = (unsigned char)(rule->LowVel + (rule->HighVel - rule->LowVel) * pow((n - 1) / 126.0, rule->Curve) + 0.5);
+	}
+
+	return(0);
+}
+
+
+
+
+
+/********************* midi_route_free() *********************
+ * Frees the tables of a MIDIROUTE.
+ */
+
+void midi_route_free(MIDIROUTE *route)
+{
+	if (route->Actions) free(route->Actions);
+	if (route->List) free(route->List);
+	if (route->Start) free(route->Start);
+	memset(route, 0, sizeof(MIDIROUTE));
+}
+
+
+
+
+
+/********************* midi_route() *********************
+ * Routes one MIDI message.
+ *
+ * input =	Which input it came from.
+ * msg =		The message. This can also be a slice of a SysEx
+ *				(see midiparse.h), whether or not it starts with
+ *				the 0xF0.
+ * len =		How many bytes.
+ * out =		Where to put the messages to send. It must have
+ *				room for MIDIROUTE_MAXOUT() of them.
+ *
+ * RETURNS: How many messages were put in "out". For a
+ * message of more than 3 bytes, the caller sends its own
+ * bytes (unchanged) to each output in "out".
+ */
+
+unsigned int midi_route(const MIDIROUTE *route, unsigned int input, const unsigned char *msg, unsigned int len, MIDIROUTE_MSG *out)
+{
+	register const unsigned int	*start;
+	register unsigned int			i, status;
+	register MIDIROUTE_MSG			*ptr;
+
+	// A SysEx slice that doesn't start with the 0xF0 goes where the 0xF0 went
+	status = msg[0];
+	if (status < 0x80 || status == 0xF7) status = 0xF0;
+
+	start = &route->Start[input * 129 + status - 0x80];
+	ptr = out;
+
+	for (i = start[0]; i < start[1]; i++)
+	{
+		register const MIDIROUTE_ACTION	*action;
+
+		action = &route->Actions[route->List[i]];
+		ptr->Output = action->Output;
+
+		if (status < 0xF0)
+		{
+			register unsigned int	type;
+
+			type = status & 0xF0;
+			ptr->Msg[0] = (unsigned char)(action->Channel == 0xFF ? status : type | action->Channel);
+			if (len > 1)
+			{
+				// Note-off, note-on, and polyphonic pressure have a note number
+				if (type <= 0xA0 && (ptr->Msg[1] = action->NoteMap[msg[1]]) == 0xFF) continue;
+				else if (type > 0xA0) ptr->Msg[1] = msg[1];
+			}
+			if (len > 2) ptr->Msg[2] = (type == 0x90 ? action->VelMap[msg[2]] : msg[2]);
+		}
+		else if (len <= 3)
+			memcpy(&ptr->Msg[0], msg, len);
+
+		++ptr;
+	}
+
+	return((unsigned int)(ptr - out));
+}
+
+
+
+
+
+/********************* midi_route_event() *********************
+ * Routes one message that midi_parse() returned.
+ *
+ * input =	Which input it came from.
+ * event =	The message, or a slice of a SysEx.
+ * out =		Where to put the messages to send, as for
+ *				midi_route().
+ *
+ * RETURNS: How many messages were put in "out". For a
+ * SysEx slice, the caller sends the slice's own bytes to
+ * each output in "out".
+ *
+ * NOTE: Every slice of a SysEx goes where its 0xF0 went,
+ * including the empty slice that ends an aborted SysEx (whose
+ * SysEx points at the status that cut it off).
+ */
+
+unsigned int midi_route_event(const MIDIROUTE *route, unsigned int input, const MIDIEVENT *event, MIDIROUTE_MSG *out)
+{
+	static const unsigned char	SysExStatus = 0xF0;
+
+	if (event->Type == MIDI_TYPE_SYSEX) return(midi_route(route, input, &SysExStatus, 1, out));
+	return(midi_route(route, input, &event->Status, event->Length, out));
+}
@@ -0,0 +1,89 @@
+// midiroute.h
+// A rule table for routing MIDI messages from inputs to
+// outputs, filtering them by channel, message type, and note
+// range, and transforming them (transpose, velocity curve,
+// change of channel) on the way.
+//
+// The rules are written as text, ie:
+//   chan=1-4 type=note notes=36-59 transpose=12 vel=20-110 curve=0.7 tochan=10
+// and then compiled into lookup tables. For each input, and
+// each of the 128 status bytes, there's a list of which rules
+// want that status. And each rule has a 128 entry table that
+// maps a note number to its new number (or says to drop it),
+// and another for velocity. So routing a message is a few
+// array lookups, no matter how complicated the rules are.
+
+#ifndef MIDIROUTE_H
+#define MIDIROUTE_H
+
+#include "midiparse.h"
+
+// MIDIROUTE_RULE's Types. Bit n is set for a channel message whose
+// status is 0x80 + (n * 0x10)
+#define MIDIROUTE_NOTEOFF		0x0001
+#define MIDIROUTE_NOTEON		0x0002
+#define MIDIROUTE_POLYPRESS	0x0004
+#define MIDIROUTE_CONTROLLER	0x0008
+#define MIDIROUTE_PROGRAM		0x0010
+#define MIDIROUTE_CHANPRESS	0x0020
+#define MIDIROUTE_PITCHWHEEL	0x0040
+#define MIDIROUTE_SYSEX			0x0080
+#define MIDIROUTE_COMMON		0x0100	// System common (0xF1 to 0xF6)
+#define MIDIROUTE_REALTIME		0x0200	// System realtime (0xF8 to 0xFF)
+#define MIDIROUTE_CHANNEL		0x007F	// All channel messages
+#define MIDIROUTE_ALL			0x03FF
+
+// One rule, as parsed from text. Input and Output are whatever numbers
+// the caller uses for its ports
+typedef struct _MIDIROUTE_RULE
+{
+	float						Curve;		// Velocity curve exponent (1.0 = linear)
+	unsigned short			Input;
+	unsigned short			Output;
+	unsigned short			Channels;	// Bit n set = route MIDI channel n (0 to 15)
+	unsigned short			Types;		// MIDIROUTE_xxx
+	unsigned char			LowNote, HighNote;	// Route only these notes (before transposing)
+	unsigned char			LowVel, HighVel;		// Scale note-on velocities to this range
+	signed char				Transpose;	// Semitones to add to note numbers
+	unsigned char			Channel;		// Channel (0 to 15) to change to, or 0xFF to keep it
+} MIDIROUTE_RULE;
+
+// A compiled rule
+typedef struct _MIDIROUTE_ACTION
+{
+	unsigned char			NoteMap[128];	// New note number, or 0xFF to drop the message
+	unsigned char			VelMap[128];	// New note-on velocity
+	unsigned short			Output;
+	unsigned char			Channel;			// Channel to change to, or 0xFF to keep it
+	unsigned char			Pad;
+} MIDIROUTE_ACTION;
+
+// The compiled rule table
+typedef struct _MIDIROUTE
+{
+	MIDIROUTE_ACTION		*Actions;	// One per rule
+	unsigned short			*List;		// Action numbers, grouped by input and status
+	unsigned int			*Start;		// Where each input/status group starts in List (129 per input)
+	unsigned int			Inputs;		// How many inputs
+} MIDIROUTE;
+
+// One message that midi_route() says to send
+typedef struct _MIDIROUTE_MSG
+{
+	unsigned short			Output;
+	unsigned char			Msg[3];	// The transformed message (if it's 3 bytes or less)
+	unsigned char			Pad;
+} MIDIROUTE_MSG;
+
+// How many MIDIROUTE_MSGs midi_route() may return for one input and
+// status. Use it to size the array you pass
+#define MIDIROUTE_MAXOUT(route, input, status)	((route)->Start[(input) * 129 + (status) - 0x80 + 1] - (route)->Start[(input) * 129 + (status) - 0x80])
+
+void midi_route_rule_init(MIDIROUTE_RULE *, unsigned int, unsigned int);
+int midi_route_rule_parse(MIDIROUTE_RULE *, const char *);
+int midi_route_compile(MIDIROUTE *, const MIDIROUTE_RULE *, unsigned int, unsigned int);
+void midi_route_free(MIDIROUTE *);
+unsigned int midi_route(const MIDIROUTE *, unsigned int, const unsigned char *, unsigned int, MIDIROUTE_MSG *);
+unsigned int midi_route_event(const MIDIROUTE *, unsigned int, const MIDIEVENT *, MIDIROUTE_MSG *);
+
+#endif
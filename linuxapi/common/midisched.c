@@ -0,0 +1,410 @@
+// midisched.c
+// A real-time scheduler for timed MIDI output. See midisched.h.
+//
+// Compile it along with the program that uses it, mididev.c, devalloc.c, midienc.c,
+// and timing.c, and link with -lpthread. For example:
+// gcc -o chord chord.c ../../common/midisched.c ../../common/mididev.c ../../common/devalloc.c ../../common/midienc.c ../../common/timing.c -lasound -lpthread -lm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include "midisched.h"
+
+
+
+
+
+// The time the scheduler thread is about to sleep until. Our SIGUSR1
+// handler zeroes it. If the signal arrives while the thread is sleeping,
+// clock_nanosleep() returns early with EINTR. If it arrives just before
+// the thread calls clock_nanosleep(), then the thread "sleeps" until a
+// time long past, and returns at once. Either way, the wakeup isn't lost
+static __thread struct timespec	SleepUntil;
+
+// Set to 1 once we've installed our SIGUSR1 handler
+static unsigned char				HandlerInstalled = 0;
+
+
+
+
+
+/********************* wake_handler() *********************
+ * Called when midi_sched_add() (or midi_sched_stop()) sends
+ * SIGUSR1 to the scheduler thread to wake it early.
+ */
+
+static void wake_handler(int sig)
+{
+	SleepUntil.tv_sec = 0;
+	SleepUntil.tv_nsec = 0;
+}
+
+
+
+
+
+/********************* earlier() *********************
+ * Returns non-zero if event "a" should be sent before
+ * event "b".
+ */
+
+static inline int earlier(const MIDISCHED_EVENT *a, const MIDISCHED_EVENT *b)
+{
+	// Order wraps around after 4 billion events, so we compare the difference
+	return(a->Time < b->Time || (a->Time == b->Time && (int)(a->Order - b->Order) < 0));
+}
+
+
+
+
+
+/********************* heap_pop() *********************
+ * Removes the earliest event (Heap[0]) from the queue.
+ * Caller must hold the lock.
+ */
+
+static void heap_pop(MIDISCHED *sched)
+{
+	register MIDISCHED_EVENT	*heap;
+	register unsigned int		i, child, count;
+
+	heap = sched->Heap;
+	count = --sched->Count;
+	if (!count) return;
+
+	// Move the last event to the top, and sift it down to where it belongs
+	i = 0;
+	while ((child = i * 2 + 1) < count)
+	{
+		if (child + 1 < count && earlier(&heap[child + 1], &heap[child])) ++child;
+		if (!earlier(&heap[child], &heap[count])) break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = heap[count];
+}
+
+
+
+
+
+/********************* sched_thread() *********************
+ * The scheduler thread. Sleeps until the earliest event is
+ * due, then sends it (and any others due within the next
+ * tick) in one midi_dev_write().
+ */
+
+static void * sched_thread(void *arg)
+{
+	register MIDISCHED		*sched;
+	unsigned char				batch[MIDISCHED_BATCHSIZE];
+
+	sched = (MIDISCHED *)arg;
+
+	pthread_mutex_lock(&sched->Lock);
+
+	while (!sched->Stop)
+	{
+		register unsigned long long	now, due;
+		register const unsigned char	*direct;
+		register unsigned int			len;
+
+		// Nothing queued? Let midi_sched_drain() know, and sleep until someone
+		// queues something (which wakes us)
+		now = get_time_ns();
+		if (!sched->Count)
+		{
+			pthread_cond_broadcast(&sched->Empty);
+			due = now + 3600ULL * 1000000000ULL;
+		}
+		else
+			due = sched->Heap[0].Time;
+
+		if (due > now)
+		{
+			ns_to_timespec(due, &SleepUntil);
+			sched->Sleeping = due;
+			pthread_mutex_unlock(&sched->Lock);
+
+			// NOTE: We use an absolute time, so however long it took us to get here
+			// doesn't make us late
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &SleepUntil, 0);
+
+			pthread_mutex_lock(&sched->Lock);
+			sched->Sleeping = 0;
+			continue;
+		}
+
+		// Gather all the events due within the next tick into one batch, in the
+		// order they're due
+		due = sched->Heap[0].Time;
+		now += sched->Tick;
+		len = 0;
+		direct = 0;
+		while (sched->Count && sched->Heap[0].Time <= now)
+		{
+			register MIDISCHED_EVENT	*event;
+
+			event = &sched->Heap[0];
+			if (event->Length > MIDISCHED_BATCHSIZE - len)
+			{
+				// Doesn't fit in what's left of the batch? Leave it for the next write
+				if (len) break;
+
+				// Too big for a batch at all? Send it straight from the caller's buffer.
+				// It's a SysEx, which cancels running status
+				direct = event->Long;
+				len = event->Length;
+				midi_enc_reset(&sched->Encoder);
+			}
+			else
+			{
+				// Add it to the batch, leaving out its status byte if it's the same
+				// as the previous message's
+				len += midi_enc_message(&sched->Encoder, &batch[len], (event->Length > MIDISCHED_SHORTSIZE ? event->Long : &event->Data[0]), event->Length);
+			}
+			++sched->Events;
+			heap_pop(sched);
+			if (direct) break;
+		}
+
+		// Don't hold the lock while we write, since midi_dev_write() may block
+		// if the driver's buffer is full
+		sched->Busy = 1;
+		pthread_mutex_unlock(&sched->Lock);
+
+		time_hist_add(&sched->Late, get_time_ns() - due);
+		{
+		register int	err;
+
+		// If the write fails, the device may have missed our last status byte, so
+		// we make sure the next batch starts with one
+		if (len && (err = midi_dev_write(sched->Output, direct ? direct : &batch[0], len)) < 0)
+		{
+			if (!sched->Error) sched->Error = err;
+			midi_enc_reset(&sched->Encoder);
+		}
+		}
+		++sched->Writes;
+
+		pthread_mutex_lock(&sched->Lock);
+		sched->Busy = 0;
+	}
+
+	pthread_cond_broadcast(&sched->Empty);
+	pthread_mutex_unlock(&sched->Lock);
+
+	return(0);
+}
+
+
+
+
+
+/********************* midi_sched_start() *********************
+ * Initializes a MIDISCHED, and starts its thread.
+ *
+ * output =		The (blocking) MIDI output to send to.
+ * maxEvents =	How many events can be queued at once, or 0 for
+ *					MIDISCHED_MAXEVENTS.
+ * tick =		Events due within this many nanoseconds of each
+ *					other are sent in the same write. 0 for
+ *					MIDISCHED_TICK.
+ * priority =	The SCHED_FIFO priority (1 to 99) to run the thread
+ *					at, or 0 for normal priority. If we don't have
+ *					permission to use real-time priority, we use
+ *					normal priority, and leave sched->Realtime 0.
+ * encFlags =	MIDIENC_xxx flags for encoding each batch (ie,
+ *					MIDIENC_RUNNINGSTATUS), or 0 to send each message
+ *					as is.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+int midi_sched_start(MIDISCHED *sched, MIDIDEV *output, unsigned int maxEvents, unsigned long long tick, int priority, unsigned int encFlags)
+{
+	pthread_attr_t		attr;
+	register int		err;
+
+	memset(sched, 0, sizeof(MIDISCHED));
+	sched->Output = output;
+	sched->Size = (maxEvents ? maxEvents : MIDISCHED_MAXEVENTS);
+	sched->Tick = (tick ? tick : MIDISCHED_TICK);
+	time_hist_init(&sched->Late);
+	midi_enc_init(&sched->Encoder, encFlags, 0, 0);
+
+	if (!(sched->Heap = (MIDISCHED_EVENT *)malloc(sched->Size * sizeof(MIDISCHED_EVENT)))) return(-ENOMEM);
+
+	// Install our SIGUSR1 handler. We don't set SA_RESTART, so the signal
+	// interrupts clock_nanosleep()
+	if (!HandlerInstalled)
+	{
+		struct sigaction	action;
+
+		memset(&action, 0, sizeof(action));
+		action.sa_handler = wake_handler;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGUSR1, &action, 0);
+		HandlerInstalled = 1;
+	}
+
+	pthread_mutex_init(&sched->Lock, 0);
+	pthread_cond_init(&sched->Empty, 0);
+
+	// Try to start the thread with real-time priority, so that other
+	// programs don't delay our output
+	if (priority > 0)
+	{
+		struct sched_param	param;
+
+		pthread_attr_init(&attr);
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		param.sched_priority = priority;
+		pthread_attr_setschedparam(&attr, &param);
+		err = pthread_create(&sched->Thread, &attr, sched_thread, sched);
+		pthread_attr_destroy(&attr);
+		if (!err)
+		{
+			sched->Realtime = 1;
+			return(0);
+		}
+		if (err != EPERM) goto bad;
+	}
+
+	if ((err = pthread_create(&sched->Thread, 0, sched_thread, sched)))
+	{
+bad:	pthread_cond_destroy(&sched->Empty);
+		pthread_mutex_destroy(&sched->Lock);
+		free(sched->Heap);
+		sched->Heap = 0;
+		return(-err);
+	}
+
+	return(0);
+}
+
+
+
+
+
+/********************* midi_sched_add() *********************
+ * Queues a MIDI message to be sent at the specified time.
+ *
+ * time =	When to send it, in nanoseconds (monotonic clock,
+ *				as returned by get_time_ns()). A time that has
+ *				already passed means "as soon as possible".
+ * msg =		The message's bytes.
+ * len =		How many bytes.
+ *
+ * RETURNS: 0 if success, -EAGAIN if the queue is full, or
+ * -EINVAL if len is 0 or more than 65535.
+ *
+ * NOTE: A message longer than MIDISCHED_SHORTSIZE bytes isn't
+ * copied, so the caller must leave its buffer alone until
+ * the message is sent (ie, until midi_sched_drain()).
+ */
+
+int midi_sched_add(MIDISCHED *sched, unsigned long long time, const unsigned char *msg, unsigned int len)
+{
+	register MIDISCHED_EVENT	*heap;
+	register unsigned int		i;
+	MIDISCHED_EVENT				event;
+
+	if (!len || len > 0xFFFF) return(-EINVAL);
+
+	event.Time = time;
+	event.Length = (unsigned short)len;
+	if (len > MIDISCHED_SHORTSIZE)
+		event.Long = msg;
+	else
+	{
+		event.Long = 0;
+		memcpy(&event.Data[0], msg, len);
+	}
+
+	pthread_mutex_lock(&sched->Lock);
+
+	if (sched->Count >= sched->Size)
+	{
+		pthread_mutex_unlock(&sched->Lock);
+		return(-EAGAIN);
+	}
+
+	event.Order = sched->Order++;
+
+	// Add it at the bottom of the heap, and sift it up to where it belongs
+	heap = sched->Heap;
+	i = sched->Count++;
+	while (i)
+	{
+		register unsigned int	parent;
+
+		parent = (i - 1) / 2;
+		if (!earlier(&event, &heap[parent])) break;
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = event;
+
+	// If it's now the earliest event, and the thread is sleeping until
+	// some later time, wake it up so it can sleep until this one instead
+	if (!i && sched->Sleeping && time < sched->Sleeping)
+	{
+		sched->Sleeping = 0;
+		pthread_kill(sched->Thread, SIGUSR1);
+	}
+
+	pthread_mutex_unlock(&sched->Lock);
+
+	return(0);
+}
+
+
+
+
+
+/********************* midi_sched_drain() *********************
+ * Waits until every queued event has been sent, and the
+ * driver has sent all the bytes out the MIDI port.
+ */
+
+void midi_sched_drain(MIDISCHED *sched)
+{
+	pthread_mutex_lock(&sched->Lock);
+	while ((sched->Count || sched->Busy) && !sched->Stop) pthread_cond_wait(&sched->Empty, &sched->Lock);
+	pthread_mutex_unlock(&sched->Lock);
+
+	midi_dev_drain(sched->Output);
+}
+
+
+
+
+
+/********************* midi_sched_stop() *********************
+ * Ends the scheduler thread, and frees the MIDISCHED's
+ * resources. Any events still queued are thrown away.
+ */
+
+void midi_sched_stop(MIDISCHED *sched)
+{
+	if (sched->Heap)
+	{
+		pthread_mutex_lock(&sched->Lock);
+		sched->Stop = 1;
+		if (sched->Sleeping) pthread_kill(sched->Thread, SIGUSR1);
+		pthread_mutex_unlock(&sched->Lock);
+
+		pthread_join(sched->Thread, 0);
+
+		pthread_cond_destroy(&sched->Empty);
+		pthread_mutex_destroy(&sched->Lock);
+		free(sched->Heap);
+		sched->Heap = 0;
+	}
+}
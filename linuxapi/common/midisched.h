@@ -0,0 +1,81 @@
+// midisched.h
+// A scheduler for timed MIDI output. You queue up MIDI
+// messages, each with the (monotonic clock) time it should be
+// sent, and a real-time thread sends each one at its time.
+//
+// The queue is a binary heap ordered by time, so adding an
+// event, or taking the next one, is O(log n) no matter how
+// many are queued. The thread sleeps with clock_nanosleep()
+// until the earliest event is due. If you queue an event that
+// is earlier than what the thread is sleeping for, we wake it
+// with a signal (SIGUSR1), so it can go back to sleep for the
+// new time.
+//
+// When the thread wakes, it sends every event that's due
+// within the next "tick" in one midi_dev_write(). Messages
+// queued for the same time (ie, the notes of a chord) go to
+// the driver together, and are sent in the order queued. The
+// batch can be encoded with running status (see midienc.h).
+
+#ifndef MIDISCHED_H
+#define MIDISCHED_H
+
+#include <pthread.h>
+#include <alsa/asoundlib.h>
+#include "timing.h"
+#include "midienc.h"
+#include "mididev.h"
+
+// Messages up to this many bytes are copied into the queue. Longer
+// ones (ie, SysEx) are sent from the caller's buffer
+#define MIDISCHED_SHORTSIZE	10
+
+// Default for how close together events must be to go out in the
+// same write, in nanoseconds
+#define MIDISCHED_TICK			100000
+
+// Default for how many events can be queued
+#define MIDISCHED_MAXEVENTS	4096
+
+// How many bytes the thread sends per midi_dev_write(), at most
+#define MIDISCHED_BATCHSIZE	4096
+
+// One queued message. It's 32 bytes, so 2 fit in a cache line
+typedef struct _MIDISCHED_EVENT
+{
+	unsigned long long	Time;		// When to send it, in nanoseconds (monotonic clock)
+	const unsigned char	*Long;	// If Length > MIDISCHED_SHORTSIZE, points to the caller's bytes
+	unsigned int			Order;	// Breaks ties between events with the same Time, so they're sent in the order queued
+	unsigned short			Length;	// How many bytes
+	unsigned char			Data[MIDISCHED_SHORTSIZE];	// The bytes, if Length <= MIDISCHED_SHORTSIZE
+} MIDISCHED_EVENT;
+
+// A scheduler
+typedef struct _MIDISCHED
+{
+	MIDIDEV					*Output;		// The MIDI output
+	MIDISCHED_EVENT		*Heap;		// The queue. Heap[0] is the earliest event
+	unsigned int			Count;		// How many events are queued
+	unsigned int			Size;			// How many fit in Heap[]
+	unsigned int			Order;		// The next event's Order
+	unsigned long long	Tick;			// Events due this close to each other are sent together
+	unsigned long long	Sleeping;	// The time the thread is sleeping until (0 if awake)
+	pthread_mutex_t		Lock;			// Guards the above
+	pthread_cond_t			Empty;		// Signalled when the queue empties
+	pthread_t				Thread;
+	unsigned char			Busy;			// 1 while the thread is writing a batch
+	unsigned char			Realtime;	// 1 if the thread got SCHED_FIFO priority
+	unsigned char			Stop;			// Set to 1 to end the thread
+	int						Error;		// The first error from midi_dev_write(), if any
+	MIDIENC					Encoder;		// Applies running status to each batch
+	unsigned long			Writes;		// How many midi_dev_write() calls
+	unsigned long			Events;		// How many events sent
+	TIMEHIST					Late;			// How late each write was, compared to its first event's time
+} MIDISCHED;
+
+int midi_sched_start(MIDISCHED *, MIDIDEV *, unsigned int, unsigned long long, int, unsigned int);
+int midi_sched_add(MIDISCHED *, unsigned long long, const unsigned char *, unsigned int);
+void midi_sched_drain(MIDISCHED *);
+void midi_sched_stop(MIDISCHED *);
+
+#endif
@@ -0,0 +1,458 @@
+// midistat.c
+// Counters and rates for open rawmidi streams, in shared memory.
+// See midistat.h.
+//
+// Compile it along with the program that uses it, and timing.c. For example:
+// gcc -o smfrec smfrec.c ../../common/midistat.c ../../common/midiparse.c ../../common/midienc.c ../../common/mididev.c ../../common/devalloc.c ../../common/timing.c -lasound -lpthread -lrt -lm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "midistat.h"
+#include "timing.h"
+
+static const unsigned char MidiStatID[] = {'M', 'S', 'T', 'S'};
+
+
+
+
+
+/********************* shm_name() *********************
+ * Copies the name of the shared memory, with the leading
+ * slash shm_open() wants, to "buffer".
+ *
+ * RETURNS: "buffer".
+ */
+
+static char * shm_name(char *buffer, const char *name)
+{
+	sprintf(buffer, "%s%s", *name == '/' ? "" : "/", name);
+	return(buffer);
+}
+
+
+
+
+
+/********************* begin_update() *********************
+ * Sampler: Makes a port's sequence number odd, so a reader
+ * knows not to trust what it copies until we're done.
+ */
+
+static inline void begin_update(register MIDISTAT_PORT *port)
+{
+	__atomic_store_n(&port->Seq, port->Seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void end_update(register MIDISTAT_PORT *port)
+{
+	__atomic_store_n(&port->Seq, port->Seq + 1, __ATOMIC_RELEASE);
+}
+
+
+
+
+
+/********************* sample_port() *********************
+ * Sampler: Gets a port's status from the driver, and
+ * updates its numbers.
+ *
+ * elapsed =	Nanoseconds since the last sample.
+ */
+
+static void sample_port(MIDISTAT *stat, unsigned int i, unsigned long long now, unsigned long long elapsed)
+{
+	register MIDISTAT_PORT		*port;
+	register unsigned long long	bytes;
+	register unsigned long		xruns;
+	register unsigned int		fill;
+	unsigned long long			driverTime;
+
+	port = &stat->Header->Ports[i];
+	xruns = 0;
+	fill = port->Fill;
+	driverTime = port->DriverTime;
+
+	if (stat->Handles[i] && snd_rawmidi_status(stat->Handles[i], stat->Status) >= 0)
+	{
+		snd_htimestamp_t	ts;
+
+		xruns = (unsigned long)snd_rawmidi_status_get_xruns(stat->Status);
+
+		// For an input, "avail" is how many bytes are waiting to be read. For an
+		// output, it's how much room is left
+		fill = (unsigned int)snd_rawmidi_status_get_avail(stat->Status);
+		if (port->Flags & MIDISTAT_OUTPUT) fill = (fill < port->BufferSize ? port->BufferSize - fill : 0);
+
+		snd_rawmidi_status_get_tstamp(stat->Status, &ts);
+		driverTime = timespec_to_ns(&ts);
+	}
+
+	bytes = __atomic_load_n(&port->Bytes, __ATOMIC_RELAXED);
+
+	begin_update(port);
+	port->Fill = fill;
+	if (fill > port->MaxFill) port->MaxFill = fill;
+	port->Xruns += xruns;
+	port->DriverTime = driverTime;
+	if (elapsed)
+	{
+		port->ByteRate = (double)(bytes - stat->LastBytes[i]) * 1000000000.0 / elapsed;
+		port->XrunRate = (double)xruns * 1000000000.0 / elapsed;
+	}
+	port->SampleTime = now;
+	++port->Samples;
+	end_update(port);
+
+	stat->LastBytes[i] = bytes;
+}
+
+
+
+
+
+/********************* sampler_thread() *********************
+ * Samples every port, every Interval milliseconds.
+ */
+
+static void * sampler_thread(void *arg)
+{
+	register MIDISTAT				*stat;
+	register unsigned long long	interval;
+	unsigned long long				due, last;
+
+	stat = (MIDISTAT *)arg;
+	interval = stat->Header->Interval * 1000000ULL;
+	last = get_time_ns();
+	due = last + interval;
+
+	while (!stat->Stop)
+	{
+		struct timespec				ts;
+		register unsigned long long	now;
+		register unsigned int		i, count;
+
+		ns_to_timespec(due, &ts);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR && !stat->Stop);
+		due += interval;
+
+		pthread_mutex_lock(&stat->Lock);
+		now = get_time_ns();
+		count = stat->Header->PortCount;
+		for (i = 0; i < count; i++)
+		{
+			if (stat->Header->Ports[i].Flags & MIDISTAT_OPEN) sample_port(stat, i, now, now - last);
+		}
+		pthread_mutex_unlock(&stat->Lock);
+		last = now;
+	}
+
+	return(0);
+}
+
+
+
+
+
+/********************* midi_stat_open() *********************
+ * Creates the shared memory, and starts the sampler.
+ *
+ * name =		The shared memory's name (ie, "smfrec" for
+ *					/dev/shm/smfrec), or 0 to keep the numbers
+ *					private to this process.
+ * interval =	How often to sample the ports, in milliseconds,
+ *					or 0 for MIDISTAT_INTERVAL.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+int midi_stat_open(MIDISTAT *stat, const char *name, unsigned int interval)
+{
+	register MIDISTAT_HEADER	*header;
+	register int				err;
+
+	memset(stat, 0, sizeof(MIDISTAT));
+
+	if ((err = snd_rawmidi_status_malloc(&stat->Status)) < 0) return(err);
+
+	if (!name)
+	{
+		if ((header = (MIDISTAT_HEADER *)mmap(0, sizeof(MIDISTAT_HEADER), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+		{
+			err = -errno;
+			goto bad;
+		}
+	}
+	else
+	{
+		register int	fd;
+
+		if (!(stat->Name = (char *)malloc(strlen(name) + 2)))
+		{
+			err = -ENOMEM;
+			goto bad;
+		}
+		if ((fd = shm_open(shm_name(stat->Name, name), O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1)
+		{
+			err = -errno;
+			goto bad;
+		}
+		if (ftruncate(fd, sizeof(MIDISTAT_HEADER)) ||
+			(header = (MIDISTAT_HEADER *)mmap(0, sizeof(MIDISTAT_HEADER), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0)) == MAP_FAILED)
+		{
+			err = -errno;
+			close(fd);
+			shm_unlink(stat->Name);
+			goto bad;
+		}
+		close(fd);
+	}
+
+	memset(header, 0, sizeof(MIDISTAT_HEADER));
+	header->Version = MIDISTAT_VERSION;
+	header->Pid = (unsigned int)getpid();
+	header->Interval = (interval ? interval : MIDISTAT_INTERVAL);
+	header->Start = get_time_ns();
+	stat->Header = header;
+
+	// Fill in the ID last, so a reader knows the rest is there
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(&header->ID[0], &MidiStatID[0], 4);
+
+	pthread_mutex_init(&stat->Lock, 0);
+	if ((err = pthread_create(&stat->Thread, 0, sampler_thread, stat)))
+	{
+		err = -err;
+		midi_stat_close(stat);
+		return(err);
+	}
+	stat->Running = 1;
+
+	return(0);
+
+bad:
+	if (stat->Name) free(stat->Name);
+	stat->Name = 0;
+	snd_rawmidi_status_free(stat->Status);
+	stat->Status = 0;
+	return(err);
+}
+
+
+
+
+
+/********************* midi_stat_close() *********************
+ * Stops the sampler, and deletes the shared memory. (A reader
+ * that has it mapped can still see it, until it unmaps it.)
+ */
+
+void midi_stat_close(MIDISTAT *stat)
+{
+	if (stat->Running)
+	{
+		stat->Stop = 1;
+		pthread_join(stat->Thread, 0);
+		stat->Running = 0;
+	}
+
+	if (stat->Header)
+	{
+		pthread_mutex_destroy(&stat->Lock);
+		munmap(stat->Header, sizeof(MIDISTAT_HEADER));
+		stat->Header = 0;
+	}
+
+	if (stat->Name)
+	{
+		shm_unlink(stat->Name);
+		free(stat->Name);
+		stat->Name = 0;
+	}
+
+	if (stat->Status) snd_rawmidi_status_free(stat->Status);
+	stat->Status = 0;
+}
+
+
+
+
+
+/********************* midi_stat_add() *********************
+ * Starts keeping numbers for a port.
+ *
+ * name =		The port's name, for the reader.
+ * handle =		The port's ALSA handle, or 0 if it has none (ie,
+ *					a loopback). Then only the I/O counts are kept.
+ * output =		1 if it's an output, 0 if an input.
+ *
+ * RETURNS: The port, to pass to midi_stat_count(), or 0 if
+ * there's no room for another.
+ *
+ * NOTE: Don't call snd_rawmidi_status() for the handle after
+ * this. The sampler does that (see midistat.h).
+ */
+
+MIDISTAT_PORT * midi_stat_add(MIDISTAT *stat, const char *name, snd_rawmidi_t *handle, int output)
+{
+	register MIDISTAT_HEADER	*header;
+	register MIDISTAT_PORT		*port;
+	register unsigned int		i;
+	unsigned int					bufferSize;
+
+	if (!(header = stat->Header)) return(0);
+
+	bufferSize = 0;
+	if (handle)
+	{
+		snd_rawmidi_params_t	*params;
+
+		if (snd_rawmidi_params_malloc(&params) >= 0)
+		{
+			if (snd_rawmidi_params_current(handle, params) >= 0) bufferSize = (unsigned int)snd_rawmidi_params_get_buffer_size(params);
+			snd_rawmidi_params_free(params);
+		}
+	}
+
+	pthread_mutex_lock(&stat->Lock);
+
+	// Throw away any overflows from before we were watching. (We do this with
+	// the lock held, because the sampler uses the same Status)
+	if (handle) snd_rawmidi_status(handle, stat->Status);
+
+	// Reuse the slot of a port that was removed, if any
+	for (i = 0; i < header->PortCount && (header->Ports[i].Flags & MIDISTAT_OPEN); i++);
+	if (i >= MIDISTAT_MAXPORTS)
+	{
+		pthread_mutex_unlock(&stat->Lock);
+		return(0);
+	}
+
+	port = &header->Ports[i];
+	stat->Handles[i] = handle;
+
+	begin_update(port);
+	port->Flags = MIDISTAT_OPEN | (output ? MIDISTAT_OUTPUT : 0) | (handle ? MIDISTAT_DRIVER : 0);
+	port->BufferSize = bufferSize;
+	port->Fill = port->MaxFill = 0;
+	port->Xruns = port->Samples = port->SampleTime = port->DriverTime = 0;
+	port->ByteRate = port->XrunRate = 0;
+	strncpy(&port->Name[0], name, MIDISTAT_NAMESIZE - 1);
+	port->Name[MIDISTAT_NAMESIZE - 1] = 0;
+	end_update(port);
+
+	// Bytes belongs to the I/O thread, but it isn't using this port yet
+	__atomic_store_n(&port->Bytes, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&port->Transfers, 0, __ATOMIC_RELAXED);
+	stat->LastBytes[i] = 0;
+
+	if (i >= header->PortCount) __atomic_store_n(&header->PortCount, i + 1, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&stat->Lock);
+
+	return(port);
+}
+
+
+
+
+
+/********************* midi_stat_remove() *********************
+ * Stops keeping numbers for a port. Call this before closing
+ * its handle. We sample it one last time first, so its Xruns
+ * includes everything up to now.
+ *
+ * NOTE: The port's numbers stay in the shared memory (with
+ * MIDISTAT_OPEN cleared), until another port takes its slot.
+ */
+
+void midi_stat_remove(MIDISTAT *stat, MIDISTAT_PORT *port)
+{
+	register unsigned int	i;
+
+	if (!port || !stat->Header) return;
+
+	i = (unsigned int)(port - &stat->Header->Ports[0]);
+
+	pthread_mutex_lock(&stat->Lock);
+	sample_port(stat, i, get_time_ns(), 0);
+	begin_update(port);
+	port->Flags &= ~MIDISTAT_OPEN;
+	end_update(port);
+	stat->Handles[i] = 0;
+	pthread_mutex_unlock(&stat->Lock);
+}
+
+
+
+
+
+/********************* midi_stat_attach() *********************
+ * Reader: Maps the shared memory another process created with
+ * midi_stat_open().
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+int midi_stat_attach(const char *name, MIDISTAT_HEADER **header)
+{
+	register int	fd, err;
+	char				*shmName;
+
+	if (!(shmName = (char *)alloca(strlen(name) + 2))) return(-ENOMEM);
+
+	if ((fd = shm_open(shm_name(shmName, name), O_RDONLY, 0)) == -1) return(-errno);
+	*header = (MIDISTAT_HEADER *)mmap(0, sizeof(MIDISTAT_HEADER), PROT_READ, MAP_SHARED, fd, 0);
+	err = -errno;
+	close(fd);
+	if (*header == MAP_FAILED) return(err);
+
+	if (memcmp(&(*header)->ID[0], &MidiStatID[0], 4) || (*header)->Version != MIDISTAT_VERSION)
+	{
+		munmap(*header, sizeof(MIDISTAT_HEADER));
+		return(-EPROTO);
+	}
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	return(0);
+}
+
+void midi_stat_detach(MIDISTAT_HEADER *header)
+{
+	munmap(header, sizeof(MIDISTAT_HEADER));
+}
+
+
+
+
+
+/********************* midi_stat_read() *********************
+ * Reader: Copies a port's numbers, all from the same sample.
+ *
+ * RETURNS: 0 if success, or -ENOENT if the port isn't open.
+ */
+
+int midi_stat_read(const MIDISTAT_PORT *port, MIDISTAT_PORT *copy)
+{
+	register unsigned int	seq;
+
+	do
+	{
+		// Wait out an update in progress
+		while ((seq = __atomic_load_n(&port->Seq, __ATOMIC_ACQUIRE)) & 1) sched_yield();
+
+		memcpy(copy, port, sizeof(MIDISTAT_PORT));
+
+		// If the sampler changed it while we copied, do it again
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&port->Seq, __ATOMIC_RELAXED) != seq);
+
+	return((copy->Flags & MIDISTAT_OPEN) ? 0 : -ENOENT);
+}
@@ -0,0 +1,126 @@
+// midistat.h
+// Keeps counters and rates for each open rawmidi stream in shared
+// memory, so that another program (ie, ../../rawmidi/midistat,
+// or an exporter for a monitoring system) can watch them while
+// we run.
+//
+// There are two writers for each port, and they never wait for
+// each other:
+//
+// The I/O thread counts the bytes it reads or writes, with
+// midi_stat_count(). That's just an add to memory (no system
+// call, no lock).
+//
+// Our own "sampler" thread wakes up every so often, and calls
+// snd_rawmidi_status() for each port, to get how full the
+// driver's buffer is, and how many times it overflowed (an
+// input's bytes came in faster than they were read, so some were
+// lost). From those, and the I/O thread's counts, it figures the
+// rates. Because a reader must never see half of an update, it
+// writes them under a "sequence lock": it makes Seq odd, updates,
+// then makes Seq even again. A reader copies the port, and if
+// Seq was odd, or changed while it copied, it tries again. So
+// a reader needs no system call either, and never slows us down.
+//
+// NOTE: snd_rawmidi_status() resets the driver's overflow count
+// each time it's called. So once a port is added here, only the
+// sampler should call it. Get the overflow count from the
+// port's Xruns instead.
+
+#ifndef MIDISTAT_H
+#define MIDISTAT_H
+
+#include <pthread.h>
+#include <alsa/asoundlib.h>
+
+// How many ports the shared memory has room for
+#define MIDISTAT_MAXPORTS		128
+
+// How long a port name can be, including the nul
+#define MIDISTAT_NAMESIZE		32
+
+// Default for how often the sampler wakes up, in milliseconds
+#define MIDISTAT_INTERVAL		100
+
+// MIDISTAT_PORT Flags
+#define MIDISTAT_OPEN			0x01	// The slot is in use
+#define MIDISTAT_OUTPUT			0x02	// It's an output (else an input)
+#define MIDISTAT_DRIVER			0x04	// We get the driver's status (else only the I/O counts)
+
+// One port's numbers
+typedef struct _MIDISTAT_PORT
+{
+	// Kept by the I/O thread
+	unsigned long long	Bytes __attribute__((aligned(64)));	// How many bytes it read/wrote
+	unsigned long long	Transfers;		// How many reads/writes that moved bytes
+
+	// Kept by the sampler, under the sequence lock
+	unsigned int			Seq __attribute__((aligned(64)));	// Odd while being updated
+	unsigned int			Flags;			// MIDISTAT_xxx
+	unsigned int			BufferSize;		// Size of the driver's buffer, in bytes
+	unsigned int			Fill;				// Bytes in the driver's buffer at the last sample
+	unsigned int			MaxFill;			// The most bytes ever seen in the driver's buffer
+	unsigned int			Pad;
+	unsigned long long	Xruns;			// How many times the driver's buffer overflowed
+	unsigned long long	Samples;			// How many times we sampled it
+	unsigned long long	SampleTime;		// When we last sampled it (nanoseconds, monotonic clock)
+	unsigned long long	DriverTime;		// The driver's timestamp of its last status (0 if none)
+	double					ByteRate;		// Bytes per second, over the last interval
+	double					XrunRate;		// Overflows per second, over the last interval
+	char						Name[MIDISTAT_NAMESIZE];
+} MIDISTAT_PORT;
+
+// What's in the shared memory
+typedef struct _MIDISTAT_HEADER
+{
+	unsigned char			ID[4];			// {'M', 'S', 'T', 'S'}
+	unsigned int			Version;			// MIDISTAT_VERSION
+	unsigned int			Pid;				// The process that writes it
+	unsigned int			Interval;		// How often it's sampled, in milliseconds
+	unsigned int			PortCount;		// How many of Ports[] have ever been used
+	unsigned int			Pad;
+	unsigned long long	Start;			// When it was created (nanoseconds, monotonic clock)
+	MIDISTAT_PORT			Ports[MIDISTAT_MAXPORTS];
+} MIDISTAT_HEADER;
+
+#define MIDISTAT_VERSION		1
+
+// The writer's side
+typedef struct _MIDISTAT
+{
+	MIDISTAT_HEADER		*Header;			// The shared memory
+	char						*Name;			// Its name, or 0 if it's private
+	snd_rawmidi_t			*Handles[MIDISTAT_MAXPORTS];
+	snd_rawmidi_status_t	*Status;
+	unsigned long long	LastBytes[MIDISTAT_MAXPORTS];
+	pthread_t				Thread;
+	pthread_mutex_t		Lock;				// Keeps ports from being removed while sampled
+	volatile unsigned char	Stop;
+	unsigned char			Running;			// 1 if the sampler was started
+} MIDISTAT;
+
+/********************* midi_stat_count() *********************
+ * I/O thread: Counts the bytes read from, or written to, a
+ * port. "port" may be 0 (the port isn't monitored).
+ */
+
+static inline void midi_stat_count(MIDISTAT_PORT *port, unsigned int bytes)
+{
+	if (port && bytes)
+	{
+		// We're the only writer, so we needn't do an atomic add. But the store
+		// must be atomic, so a reader never sees half of it
+		__atomic_store_n(&port->Bytes, port->Bytes + bytes, __ATOMIC_RELAXED);
+		__atomic_store_n(&port->Transfers, port->Transfers + 1, __ATOMIC_RELAXED);
+	}
+}
+
+int midi_stat_open(MIDISTAT *, const char *, unsigned int);
+void midi_stat_close(MIDISTAT *);
+MIDISTAT_PORT * midi_stat_add(MIDISTAT *, const char *, snd_rawmidi_t *, int);
+void midi_stat_remove(MIDISTAT *, MIDISTAT_PORT *);
+int midi_stat_attach(const char *, MIDISTAT_HEADER **);
+void midi_stat_detach(MIDISTAT_HEADER *);
+int midi_stat_read(const MIDISTAT_PORT *, MIDISTAT_PORT *);
+
+#endif
@@ -0,0 +1,500 @@
+// midistore.c
+// A column-oriented, time-indexed store of parsed MIDI messages.
+// See midistore.h.
+//
+// Compile it along with the program that uses it, and midiparse.c. For example:
+// gcc -O2 -o midistorebench midistorebench.c ../../common/midistore.c ../../common/midiparse.c
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "midistore.h"
+
+
+
+
+
+static const unsigned char MidiStoreID[4] = {'M', 'S', 'T', 'R'};
+
+// What a SysEx returned by midi_store_query() points to, since
+// we keep only its 0xF0
+static const unsigned char SysExStart[1] = {0xF0};
+
+// How many more blocks we make room for each time the store fills
+#define MIDISTORE_GROWBY	64
+
+
+
+
+
+/********************** midi_store_init() *********************
+ * Initializes an empty MIDISTORE, to add messages to.
+ */
+
+void midi_store_init(MIDISTORE *store)
+{
+	memset(store, 0, sizeof(MIDISTORE));
+}
+
+
+
+
+
+/********************** midi_store_add() *********************
+ * Adds messages to the end of the store.
+ *
+ * events =		The messages, as midi_parse() returns them.
+ * count =		How many.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+int midi_store_add(MIDISTORE *store, const MIDIEVENT *events, unsigned int count)
+{
+	register MIDISTORE_BLOCK	*block;
+	register unsigned int		i;
+	unsigned long long			lastTime;
+
+	// Can't add to a store that's mapped (read-only) from a file
+	if (store->Map) return(-EROFS);
+
+	block = (store->BlockCount ? &store->Blocks[store->BlockCount - 1] : 0);
+	lastTime = (block ? block->MaxTime : 0);
+
+	for (i = 0; i < count; i++)
+	{
+		register const MIDIEVENT	*ev;
+		register unsigned int		n;
+		register unsigned char		status;
+
+		ev = &events[i];
+
+		// Of a SysEx, we keep only its start
+		if (ev->Type == MIDI_TYPE_SYSEX && !(ev->Flags & MIDI_SYSEX_START)) continue;
+
+		// Start another block?
+		if (!block || block->Count >= MIDISTORE_BLOCKEVENTS)
+		{
+			if (store->BlockCount >= store->BlockAlloc)
+			{
+				register MIDISTORE_BLOCK	*blocks;
+
+				if (!(blocks = (MIDISTORE_BLOCK *)realloc(store->Blocks, (size_t)(store->BlockAlloc + MIDISTORE_GROWBY) * sizeof(MIDISTORE_BLOCK))))
+					return(-ENOMEM);
+				store->Blocks = blocks;
+				store->BlockAlloc += MIDISTORE_GROWBY;
+			}
+
+			block = &store->Blocks[store->BlockCount++];
+			memset(block, 0, offsetof(MIDISTORE_BLOCK, Time));
+			block->MinTime = (ev->Time > lastTime ? ev->Time : lastTime);
+		}
+
+		// Keep the times in order, so a block's times can be binary searched
+		if (ev->Time > lastTime) lastTime = ev->Time;
+
+		status = (ev->Type == MIDI_TYPE_SYSEX ? 0xF0 : ev->Status);
+		n = block->Count++;
+		block->Time[n] = lastTime;
+		block->Status[n] = status;
+		block->Data1[n] = (ev->Type == MIDI_TYPE_SYSEX || ev->Length < 2 ? 0 : ev->Data1);
+		block->Data2[n] = (ev->Type == MIDI_TYPE_SYSEX || ev->Length < 3 ? 0 : ev->Data2);
+		block->StatusMap[status >> 5] |= 1U << (status & 31);
+		block->MaxTime = lastTime;
+		++store->Events;
+	}
+
+	return(0);
+}
+
+
+
+
+
+/********************** write_all() *********************
+ * Writes all of a buffer to a file, however many write()
+ * calls that takes.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+static int write_all(int handle, register const char *ptr, register unsigned long long left)
+{
+	while (left)
+	{
+		register ssize_t	written;
+
+		if ((written = write(handle, ptr, left > 0x40000000 ? 0x40000000 : left)) < 0)
+		{
+			if (errno == EINTR) continue;
+			return(-errno);
+		}
+		ptr += written;
+		left -= written;
+	}
+
+	return(0);
+}
+
+
+
+
+
+/********************** midi_store_save() *********************
+ * Saves the store to a file, which midi_store_load() can
+ * load.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+int midi_store_save(const MIDISTORE *store, const char *name)
+{
+	MIDISTORE_HEADER	header;
+	register int		handle, err;
+
+	memset(&header, 0, sizeof(MIDISTORE_HEADER));
+	memcpy(&header.ID[0], &MidiStoreID[0], 4);
+	header.Version = MIDISTORE_VERSION;
+	header.BlockSize = sizeof(MIDISTORE_BLOCK);
+	header.BlockCount = store->BlockCount;
+	header.Events = store->Events;
+	if (store->BlockCount)
+	{
+		header.FirstTime = store->Blocks[0].MinTime;
+		header.LastTime = store->Blocks[store->BlockCount - 1].MaxTime;
+	}
+
+	if ((handle = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) return(-errno);
+
+	// The header, then the blocks
+	if (!(err = write_all(handle, (const char *)&header, sizeof(MIDISTORE_HEADER))) && store->BlockCount)
+		err = write_all(handle, (const char *)store->Blocks, (unsigned long long)store->BlockCount * sizeof(MIDISTORE_BLOCK));
+
+	if (close(handle) && !err) err = -errno;
+	if (err) unlink(name);
+	return(err);
+}
+
+
+
+
+
+/********************** midi_store_load() *********************
+ * Loads a store that midi_store_save() saved. The file is
+ * memory-mapped, not read, so the columns of the blocks a
+ * search skips needn't be read from the disk. Messages can't
+ * be added to it.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+int midi_store_load(MIDISTORE *store, const char *name)
+{
+	struct stat						info;
+	register const MIDISTORE_HEADER	*header;
+	register int					handle, err;
+
+	midi_store_init(store);
+	if ((handle = open(name, O_RDONLY)) == -1) return(-errno);
+	if (fstat(handle, &info))
+	{
+		err = -errno;
+		goto bad;
+	}
+
+	err = -EINVAL;
+	if (info.st_size < (off_t)sizeof(MIDISTORE_HEADER)) goto bad;
+	store->MapSize = info.st_size;
+	if ((store->Map = mmap(0, store->MapSize, PROT_READ, MAP_SHARED, handle, 0)) == MAP_FAILED)
+	{
+		err = -errno;
+		store->Map = 0;
+		goto bad;
+	}
+
+	// Make sure it's really a store, and was saved with the same size blocks
+	header = (const MIDISTORE_HEADER *)store->Map;
+	if (memcmp(&header->ID[0], &MidiStoreID[0], 4) || header->Version != MIDISTORE_VERSION ||
+		header->BlockSize != sizeof(MIDISTORE_BLOCK) ||
+		sizeof(MIDISTORE_HEADER) + (unsigned long long)header->BlockCount * sizeof(MIDISTORE_BLOCK) > store->MapSize)
+	{
+		munmap(store->Map, store->MapSize);
+		store->Map = 0;
+bad:	close(handle);
+		return(err);
+	}
+
+	// The mapping stays after we close the file
+	close(handle);
+
+	store->Blocks = (MIDISTORE_BLOCK *)((char *)store->Map + sizeof(MIDISTORE_HEADER));
+	store->BlockCount = header->BlockCount;
+	store->Events = header->Events;
+
+	return(0);
+}
+
+
+
+
+
+/********************** midi_store_free() *********************
+ * Frees the blocks of a store, or unmaps its file.
+ */
+
+void midi_store_free(MIDISTORE *store)
+{
+	if (store->Map)
+		munmap(store->Map, store->MapSize);
+	else if (store->Blocks)
+		free(store->Blocks);
+	midi_store_init(store);
+}
+
+
+
+
+
+/********************** midi_store_query_init() *********************
+ * Sets up a search, starting at the first block.
+ *
+ * from, to =		The time range. Messages at or after "from",
+ *						and before "to".
+ * status, statusMask =	Find messages whose status byte, ANDed
+ *						with statusMask, is "status". Ie, 0xB2 and
+ *						0xFF for channel 3's controllers, or 0x90
+ *						and 0xF0 for note-ons on any channel.
+ * data1, data1Mask =	Also, their first data byte ANDed with
+ *						data1Mask must be "data1". Ie, 7 and 0x7F
+ *						for just the volume controller, or 0 and 0
+ *						for any.
+ */
+
+void midi_store_query_init(MIDISTORE_QUERY *query, unsigned long long from, unsigned long long to, unsigned char status, unsigned char statusMask, unsigned char data1, unsigned char data1Mask)
+{
+	register unsigned int	i;
+
+	memset(query, 0, sizeof(MIDISTORE_QUERY));
+	query->From = from;
+	query->To = to;
+	query->StatusMask = statusMask;
+	query->Status = status & statusMask;
+	query->Data1Mask = data1Mask;
+	query->Data1 = data1 & data1Mask;
+
+	// Which status bytes match. A block that has none of them is skipped
+	for (i = 0; i < 256; i++)
+	{
+		if ((i & statusMask) == query->Status) query->StatusMap[i >> 5] |= 1U << (i & 31);
+	}
+}
+
+
+
+
+
+/********************** midi_store_filter() *********************
+ * Finds the messages in part of a block that have the status
+ * and first data byte the query wants. (Not their times.
+ * midi_store_query() works out which part of the block has
+ * the times we want.)
+ *
+ * start, end =	Which of the block's messages to look at.
+ * matches =		Where to return the indexes of the ones that
+ *						match. Room for (end - start) of them.
+ *
+ * RETURNS: How many matched.
+ *
+ * NOTE: With SSE2, we compare 16 messages' status and data
+ * bytes at once, and get a 16-bit mask of which matched.
+ */
+
+unsigned int midi_store_filter(const MIDISTORE_BLOCK *block, const MIDISTORE_QUERY *query, unsigned int start, unsigned int end, unsigned short *matches)
+{
+	register unsigned short	*out;
+	register unsigned int	i;
+
+	out = matches;
+	i = start;
+
+#ifdef __SSE2__
+	{
+		__m128i		status, statusMask, data1, data1Mask;
+
+		status = _mm_set1_epi8((char)query->Status);
+		statusMask = _mm_set1_epi8((char)query->StatusMask);
+		data1 = _mm_set1_epi8((char)query->Data1);
+		data1Mask = _mm_set1_epi8((char)query->Data1Mask);
+
+		for (; i + 16 <= end; i += 16)
+		{
+			register unsigned int	bits;
+			__m128i					hits;
+
+			hits = _mm_and_si128(
+				_mm_cmpeq_epi8(_mm_and_si128(_mm_loadu_si128((const __m128i *)&block->Status[i]), statusMask), status),
+				_mm_cmpeq_epi8(_mm_and_si128(_mm_loadu_si128((const __m128i *)&block->Data1[i]), data1Mask), data1));
+
+			// One bit per message that matched. Usually none do
+			bits = (unsigned int)_mm_movemask_epi8(hits);
+			while (bits)
+			{
+				*out++ = (unsigned short)(i + __builtin_ctz(bits));
+				bits &= bits - 1;
+			}
+		}
+	}
+#endif
+
+	// The rest (or all of them, without SSE2)
+	for (; i < end; i++)
+	{
+		if ((block->Status[i] & query->StatusMask) == query->Status && (block->Data1[i] & query->Data1Mask) == query->Data1)
+			*out++ = (unsigned short)i;
+	}
+
+	return(out - matches);
+}
+
+
+
+
+
+/********************** find_time() *********************
+ * Returns the index of a block's first message at or after
+ * the specified time (or block->Count if none).
+ */
+
+static unsigned int find_time(register const MIDISTORE_BLOCK *block, unsigned long long time)
+{
+	register unsigned int	lo, hi;
+
+	lo = 0;
+	hi = block->Count;
+	while (lo < hi)
+	{
+		register unsigned int	mid;
+
+		mid = (lo + hi) >> 1;
+		if (block->Time[mid] < time)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return(lo);
+}
+
+
+
+
+
+/********************** midi_store_query() *********************
+ * Returns the next messages that match a search.
+ *
+ * query =		As midi_store_query_init() set it up. We update
+ *					it so the next call continues where this one
+ *					left off.
+ * events =		Where to return the messages. A SysEx is only
+ *					its 0xF0, so its SysEx points to a 0xF0
+ *					byte of our own. For other messages, SysEx is 0.
+ * max =			Room for how many.
+ *
+ * RETURNS: How many messages were returned. 0 when there are
+ * no more.
+ */
+
+unsigned int midi_store_query(const MIDISTORE *store, MIDISTORE_QUERY *query, MIDIEVENT *events, unsigned int max)
+{
+	unsigned short			matches[MIDISTORE_BLOCKEVENTS];
+	register unsigned int	count;
+
+	count = 0;
+	while (count < max && query->Block < store->BlockCount)
+	{
+		register const MIDISTORE_BLOCK	*block;
+		register unsigned int			start, end, found, i;
+
+		block = &store->Blocks[query->Block];
+
+		// The blocks are in time order, so once one starts after the
+		// range, we're done. The rest count as skipped
+		if (block->MinTime >= query->To)
+		{
+			query->BlocksSkipped += store->BlockCount - query->Block;
+			query->Block = store->BlockCount;
+			break;
+		}
+
+		// Skip the whole block if it ends before the range, or has none
+		// of the status bytes we want
+		if (block->MaxTime < query->From ||
+			!((block->StatusMap[0] & query->StatusMap[0]) | (block->StatusMap[1] & query->StatusMap[1]) |
+			(block->StatusMap[2] & query->StatusMap[2]) | (block->StatusMap[3] & query->StatusMap[3]) |
+			(block->StatusMap[4] & query->StatusMap[4]) | (block->StatusMap[5] & query->StatusMap[5]) |
+			(block->StatusMap[6] & query->StatusMap[6]) | (block->StatusMap[7] & query->StatusMap[7])))
+		{
+			++query->BlocksSkipped;
+			goto next;
+		}
+
+		// Which of its messages are in the range. Only a block that
+		// straddles the start or end of the range needs to be searched
+		start = (block->MinTime < query->From ? find_time(block, query->From) : 0);
+		end = (block->MaxTime >= query->To ? find_time(block, query->To) : block->Count);
+		if (query->Index)
+			start = query->Index;
+		else
+			++query->BlocksRead;
+
+		found = midi_store_filter(block, query, start, end, &matches[0]);
+
+		for (i = 0; i < found && count < max; i++, count++)
+		{
+			register MIDIEVENT		*ev;
+			register unsigned int	n;
+
+			n = matches[i];
+			ev = &events[count];
+			ev->Time = block->Time[n];
+			ev->SysEx = 0;
+			ev->Status = block->Status[n];
+			ev->Data1 = block->Data1[n];
+			ev->Data2 = block->Data2[n];
+			ev->Pad = ev->Flags = 0;
+			if (ev->Status >= 0xF8)
+				ev->Type = MIDI_TYPE_REALTIME;
+			else if (ev->Status == 0xF0)
+			{
+				ev->Type = MIDI_TYPE_SYSEX;
+				ev->Flags = MIDI_SYSEX_START;
+				ev->SysEx = &SysExStart[0];
+			}
+			else
+				ev->Type = (ev->Status >= 0xF0 ? MIDI_TYPE_COMMON : MIDI_TYPE_CHANNEL);
+			ev->Length = (ev->Status == 0xF0 ? 1 : 1 + MIDI_STATUS_DATA(ev->Status));
+		}
+
+		// No room for the rest of this block's matches? Continue from
+		// the first one next time
+		if (i < found)
+		{
+			query->Index = matches[i];
+			break;
+		}
+
+next:	query->Index = 0;
+		++query->Block;
+	}
+
+	return(count);
+}
@@ -0,0 +1,108 @@
+// midistore.h
+// A store of parsed MIDI messages, for searching long recordings
+// (ie, "every volume controller on channel 3 between 01:02:00 and
+// 01:05:00") without looking at every message in them.
+//
+// Messages are kept in fixed-size blocks of MIDISTORE_BLOCKEVENTS.
+// Within a block, each field has its own array (a "column"): all the
+// times, then all the status bytes, then all the first data bytes,
+// then all the second. A search for some status only has to read
+// the status column (4 KB per block), instead of every whole
+// message, and it can compare 16 status bytes in one SSE2
+// instruction.
+//
+// Each block also has the times of its first and last messages,
+// and a bitmap of which of the 256 status bytes appear in it. So a
+// search skips a whole block, without reading any of its columns,
+// if its times are outside the range, or it has none of the status
+// bytes we want.
+//
+// Messages must be added in time order (as they're recorded). A
+// message with an earlier time than the one before it is given that
+// one's time. Then within a block, the times are sorted, and we
+// find where the range starts and ends with a binary search.
+//
+// The store can be saved to a file (a MIDISTORE_HEADER, then the
+// blocks exactly as they are in memory), and loaded again by
+// memory-mapping that file, so a search only reads the parts of
+// the file that it needs.
+//
+// SysEx isn't kept, only an 0xF0 message (with 0 for its data
+// bytes) at the time each SysEx began.
+
+#ifndef MIDISTORE_H
+#define MIDISTORE_H
+
+#include "midiparse.h"
+
+// How many messages each block holds
+#define MIDISTORE_BLOCKEVENTS	4096
+
+// One block of messages. The header is padded to 64 bytes so the
+// columns start on a cache line
+typedef struct _MIDISTORE_BLOCK
+{
+	unsigned long long	MinTime;		// Time of the first message
+	unsigned long long	MaxTime;		// Time of the last message
+	unsigned int			Count;		// How many messages
+	unsigned int			StatusMap[8];	// Bit n is set if a message has status byte n
+	unsigned int			Reserved[3];
+	unsigned long long	Time[MIDISTORE_BLOCKEVENTS];
+	unsigned char			Status[MIDISTORE_BLOCKEVENTS];
+	unsigned char			Data1[MIDISTORE_BLOCKEVENTS];
+	unsigned char			Data2[MIDISTORE_BLOCKEVENTS];
+} MIDISTORE_BLOCK;
+
+// The header at the start of a saved store. The blocks follow it
+typedef struct _MIDISTORE_HEADER
+{
+	unsigned char			ID[4];		// {'M', 'S', 'T', 'R'}
+	unsigned int			Version;		// MIDISTORE_VERSION
+	unsigned int			BlockSize;	// sizeof(MIDISTORE_BLOCK)
+	unsigned int			BlockCount;	// How many blocks follow
+	unsigned long long	Events;		// How many messages in all
+	unsigned long long	FirstTime;	// Time of the first message
+	unsigned long long	LastTime;	// Time of the last message
+	unsigned int			Reserved[6];
+} MIDISTORE_HEADER;
+
+#define MIDISTORE_VERSION		1
+
+// A store, either being added to, or loaded from a file
+typedef struct _MIDISTORE
+{
+	MIDISTORE_BLOCK		*Blocks;
+	unsigned int			BlockCount;	// How many blocks are used (the last may be partly full)
+	unsigned int			BlockAlloc;	// How many blocks Blocks has room for. 0 if loaded from a file
+	unsigned long long	Events;		// How many messages in all
+	void						*Map;			// The mapped file, if loaded from one
+	unsigned long long	MapSize;
+} MIDISTORE;
+
+// A search. midi_store_query_init() fills it in, and midi_store_query()
+// updates it, so each call returns the next matches
+typedef struct _MIDISTORE_QUERY
+{
+	unsigned long long	From;			// Find messages at or after this time...
+	unsigned long long	To;			// ... and before this time
+	unsigned char			Status;		// ... whose (status & StatusMask) is Status
+	unsigned char			StatusMask;
+	unsigned char			Data1;		// ... and whose (first data byte & Data1Mask) is Data1
+	unsigned char			Data1Mask;
+	unsigned int			StatusMap[8];	// Which status bytes match
+	unsigned int			Block;		// Where to continue the search
+	unsigned int			Index;
+	unsigned long			BlocksRead;		// How many blocks we searched
+	unsigned long			BlocksSkipped;	// How many we skipped, by their times or StatusMap
+} MIDISTORE_QUERY;
+
+void midi_store_init(MIDISTORE *);
+int midi_store_add(MIDISTORE *, const MIDIEVENT *, unsigned int);
+int midi_store_save(const MIDISTORE *, const char *);
+int midi_store_load(MIDISTORE *, const char *);
+void midi_store_free(MIDISTORE *);
+void midi_store_query_init(MIDISTORE_QUERY *, unsigned long long, unsigned long long, unsigned char, unsigned char, unsigned char, unsigned char);
+unsigned int midi_store_query(const MIDISTORE *, MIDISTORE_QUERY *, MIDIEVENT *, unsigned int);
+unsigned int midi_store_filter(const MIDISTORE_BLOCK *, const MIDISTORE_QUERY *, unsigned int, unsigned int, unsigned short *);
+
+#endif
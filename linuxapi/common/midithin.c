@@ -0,0 +1,377 @@
+// midithin.c
+// Thins out controller values so a MIDI stream fits what the
+// output's cable can carry. See midithin.h.
+//
+// Compile it along with the program that uses it, midiout.c, mididev.c, devalloc.c, and timing.c. For example:
+// gcc -o midireplay midireplay.c ../../common/midithin.c ../../common/midiout.c ../../common/mididev.c ../../common/devalloc.c ../../common/midiparse.c ../../common/midilog.c ../../common/timing.c -lasound -lm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "midithin.h"
+
+
+
+
+
+/********************* midi_thin_init() *********************
+ * Initializes a MIDITHIN.
+ *
+ * output =			Where the messages go.
+ * bytesPerSec =	How many bytes a second the output's cable
+ *						carries, or 0 for MIDITHIN_DINRATE.
+ * burst =			How many bytes ahead of the cable we let the
+ *						driver get, or 0 for MIDITHIN_BURST.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+int midi_thin_init(MIDITHIN *thin, MIDIOUT *output, unsigned int bytesPerSec, unsigned int burst)
+{
+	memset(thin, 0, sizeof(MIDITHIN));
+	thin->Output = output;
+	thin->BytesPerNs = (bytesPerSec ? bytesPerSec : MIDITHIN_DINRATE) / 1000000000.0;
+	thin->Credit = thin->Burst = (burst ? burst : MIDITHIN_BURST);
+	thin->Last = get_time_ns();
+	time_hist_init(&thin->Latency);
+
+	if (!(thin->Queue = (MIDITHIN_ENTRY *)malloc(MIDITHIN_QUEUESIZE * sizeof(MIDITHIN_ENTRY))) ||
+		!(thin->SysEx = (unsigned char *)malloc(MIDITHIN_SYSEXSIZE)) ||
+		!(thin->Pending = (unsigned int *)calloc(MIDITHIN_KEYS, sizeof(unsigned int))))
+	{
+		midi_thin_free(thin);
+		return(-ENOMEM);
+	}
+
+	return(0);
+}
+
+
+
+
+
+/********************* midi_thin_free() *********************
+ * Frees a MIDITHIN's queue. Anything still queued is thrown
+ * away.
+ */
+
+void midi_thin_free(MIDITHIN *thin)
+{
+	if (thin->Queue) free(thin->Queue);
+	if (thin->SysEx) free(thin->SysEx);
+	if (thin->Pending) free(thin->Pending);
+	thin->Queue = 0;
+	thin->SysEx = 0;
+	thin->Pending = 0;
+	thin->Head = thin->Tail = 0;
+}
+
+
+
+
+
+/********************* get_key() *********************
+ * RETURNS: 1 + which pending value a message would replace,
+ * or 0 if it's not a message we can thin.
+ */
+
+static unsigned int get_key(register const unsigned char *msg, unsigned int len)
+{
+	register unsigned int	chan;
+
+	if (len != (msg[0] >= 0xD0 && msg[0] < 0xE0 ? 2 : 3)) return(0);
+	chan = msg[0] & 0x0F;
+
+	switch (msg[0] & 0xF0)
+	{
+		case 0xB0:
+		{
+			// Data entry, data increment/decrement, and the RPN/NRPN numbers
+			// only mean something in sequence. 120 and up are channel mode
+			// messages
+			if (msg[1] == 6 || msg[1] == 38 || (msg[1] >= 96 && msg[1] <= 101) || msg[1] >= 120) break;
+			return(1 + (chan << 7) + msg[1]);
+		}
+
+		case 0xE0:
+			return(1 + 16 * 128 + chan);
+
+		case 0xD0:
+			return(1 + 16 * 128 + 16 + chan);
+
+		case 0xA0:
+			return(1 + 16 * 128 + 32 + (chan << 7) + msg[1]);
+	}
+
+	return(0);
+}
+
+
+
+
+
+/********************* send_entry() *********************
+ * Gives the message at the head of the queue to the
+ * output.
+ *
+ * RETURNS: 0 if success, -ENOBUFS if the output's queue has
+ * no room for it, or another negative error number.
+ */
+
+static int send_entry(register MIDITHIN *thin, register const MIDITHIN_ENTRY *entry)
+{
+	register unsigned int	part;
+	register int			err;
+
+	if (!(entry->Flags & MIDITHIN_SYSEX)) return(midi_out_write(thin->Output, &entry->Msg[0], entry->Length));
+
+	// A SysEx's bytes may wrap around the end of SysEx[], so we write them in
+	// two parts. Make sure the output takes both, or neither
+	if (thin->Output->Count && entry->Length > thin->Output->Size - thin->Output->Count) return(-ENOBUFS);
+
+	if ((part = MIDITHIN_SYSEXSIZE - thin->SysExHead) > entry->Length) part = entry->Length;
+	if ((err = midi_out_write(thin->Output, thin->SysEx + thin->SysExHead, part)) < 0 ||
+		(part < entry->Length && (err = midi_out_write(thin->Output, thin->SysEx, entry->Length - part)) < 0))
+	{
+		return(err);
+	}
+
+	if ((thin->SysExHead += entry->Length) >= MIDITHIN_SYSEXSIZE) thin->SysExHead -= MIDITHIN_SYSEXSIZE;
+	thin->SysExCount -= entry->Length;
+
+	return(0);
+}
+
+
+
+
+
+/********************* pop_entry() *********************
+ * Sends the message at the head of the queue, and removes
+ * it.
+ *
+ * RETURNS: 0 if success, -ENOBUFS if the output's queue has
+ * no room for it, or another negative error number.
+ */
+
+static int pop_entry(register MIDITHIN *thin, unsigned long long now)
+{
+	register MIDITHIN_ENTRY	*entry;
+	register int				err;
+
+	entry = &thin->Queue[thin->Head & (MIDITHIN_QUEUESIZE - 1)];
+	if ((err = send_entry(thin, entry)) < 0) return(err);
+
+	thin->Credit -= entry->Length;
+	time_hist_add(&thin->Latency, now > entry->Time ? now - entry->Time : 0);
+	++thin->Sent;
+
+	// Now a newer value for this controller must be queued
+	if (entry->Key && thin->Pending[entry->Key - 1] == thin->Head + 1) thin->Pending[entry->Key - 1] = 0;
+	++thin->Head;
+
+	return(0);
+}
+
+
+
+
+
+/********************* midi_thin_service() *********************
+ * Sends as many queued messages as the cable has room for
+ * now. Call this when midi_thin_due() says.
+ *
+ * now =	The current (monotonic clock) time.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+int midi_thin_service(MIDITHIN *thin, unsigned long long now)
+{
+	register int	err;
+
+	// Earn credit for the time since we last looked. If the cable has been
+	// idle, we can't save up more than Burst
+	if (now > thin->Last)
+	{
+		if ((thin->Credit += (now - thin->Last) * thin->BytesPerNs) > thin->Burst) thin->Credit = thin->Burst;
+		thin->Last = now;
+	}
+
+	// We may go into debt for the last message (ie, a long SysEx). Then
+	// nothing more goes until we've paid it off
+	while (thin->Head != thin->Tail && thin->Credit > 0.0)
+	{
+		if ((err = pop_entry(thin, now)) < 0) return(err == -ENOBUFS ? 0 : err);
+	}
+
+	return(0);
+}
+
+
+
+
+
+/********************* midi_thin_write() *********************
+ * Sends a MIDI message, if the cable has room for it now.
+ * Otherwise queues it, or, if it's a controller value that
+ * is already waiting, replaces the waiting value.
+ *
+ * msg =	A whole message (or a slice of a SysEx).
+ * len =	How many bytes.
+ * now =	The current (monotonic clock) time.
+ *
+ * RETURNS: 0 if sent, queued, or replaced, -ENOBUFS if the
+ * queue has no room (the message is dropped), or another
+ * negative error number.
+ */
+
+int midi_thin_write(MIDITHIN *thin, const unsigned char *msg, unsigned int len, unsigned long long now)
+{
+	register MIDITHIN_ENTRY	*entry;
+	register unsigned int	key, pos;
+	register int			err;
+
+	if (!len) return(0);
+
+	// Realtime goes ahead of everything
+	if (msg[0] >= 0xF8)
+	{
+		if ((err = midi_out_write(thin->Output, msg, len)) >= 0) thin->Credit -= len;
+		return(err);
+	}
+
+	if ((err = midi_thin_service(thin, now)) < 0) return(err);
+
+	// If the cable has room, and nothing is waiting ahead of it, it goes now.
+	// (If the output's own queue is full, the device is slower than our
+	// model says, so it waits in our queue instead)
+	if (thin->Head == thin->Tail && thin->Credit > 0.0)
+	{
+		if ((err = midi_out_write(thin->Output, msg, len)) >= 0)
+		{
+			thin->Credit -= len;
+			time_hist_add(&thin->Latency, 0);
+			++thin->Sent;
+			return(0);
+		}
+		if (err != -ENOBUFS) return(err);
+	}
+
+	// Is an older value for this controller still waiting, with nothing on
+	// its channel queued after it? Then just replace it
+	if ((key = get_key(msg, len)) && (pos = thin->Pending[key - 1]))
+	{
+		--pos;
+		if ((int)(pos - thin->Barrier[msg[0] & 0x0F]) >= 0 && (int)(pos - thin->GlobalBarrier) >= 0)
+		{
+			memcpy(&thin->Queue[pos & (MIDITHIN_QUEUESIZE - 1)].Msg[0], msg, len);
+			++thin->Replaced;
+			return(0);
+		}
+	}
+
+	if (thin->Tail - thin->Head >= MIDITHIN_QUEUESIZE)
+	{
+		err = -ENOBUFS;
+		goto drop;
+	}
+
+	pos = thin->Tail;
+	entry = &thin->Queue[pos & (MIDITHIN_QUEUESIZE - 1)];
+	entry->Time = now;
+	entry->Key = (unsigned short)key;
+	entry->Length = (unsigned short)len;
+	entry->Flags = 0;
+
+	// A SysEx slice (or anything too big for Msg[]) goes in SysEx[]
+	if (len > sizeof(entry->Msg) || msg[0] < 0x80 || msg[0] == 0xF0 || msg[0] == 0xF7)
+	{
+		register unsigned int	tail, part;
+
+		if (len > MIDITHIN_SYSEXSIZE - thin->SysExCount)
+		{
+			err = -ENOBUFS;
+			goto drop;
+		}
+		if ((tail = thin->SysExHead + thin->SysExCount) >= MIDITHIN_SYSEXSIZE) tail -= MIDITHIN_SYSEXSIZE;
+		if ((part = MIDITHIN_SYSEXSIZE - tail) > len) part = len;
+		memcpy(thin->SysEx + tail, msg, part);
+		memcpy(thin->SysEx, msg + part, len - part);
+		thin->SysExCount += len;
+		entry->Flags = MIDITHIN_SYSEX;
+	}
+	else
+		memcpy(&entry->Msg[0], msg, len);
+
+	++thin->Tail;
+
+	// A controller value is now pending. Anything else on a channel keeps
+	// later values of that channel's controllers from going ahead of it, and
+	// anything else keeps all of them from doing so
+	if (key)
+		thin->Pending[key - 1] = pos + 1;
+	else if (msg[0] >= 0x80 && msg[0] < 0xF0)
+		thin->Barrier[msg[0] & 0x0F] = pos + 1;
+	else
+		thin->GlobalBarrier = pos + 1;
+
+	if (thin->Tail - thin->Head > thin->MaxQueued) thin->MaxQueued = thin->Tail - thin->Head;
+
+	return(0);
+
+drop:
+	if (err == -ENOBUFS) ++thin->Dropped;
+	return(err);
+}
+
+
+
+
+
+/********************* midi_thin_due() *********************
+ * RETURNS: The (monotonic clock) time when the cable will
+ * have room for the next queued message, or 0 if nothing is
+ * queued.
+ */
+
+unsigned long long midi_thin_due(MIDITHIN *thin)
+{
+	if (thin->Head == thin->Tail) return(0);
+
+	// If we have credit, but something is still queued, it's because the
+	// output's own queue is full. Try again in a millisecond
+	if (thin->Credit > 0.0) return(thin->Last + 1000000);
+
+	// How long until we've paid off what we owe, and have a little credit
+	return(thin->Last + (unsigned long long)(-thin->Credit / thin->BytesPerNs) + 1);
+}
+
+
+
+
+
+/********************* midi_thin_drain() *********************
+ * Gives everything queued to the output, without waiting
+ * for the cable to have room. (The output then sends it as
+ * fast as the device takes it.)
+ *
+ * RETURNS: 0 if success, -ENOBUFS if the output's queue
+ * didn't have room for it all, or another negative error
+ * number.
+ */
+
+int midi_thin_drain(MIDITHIN *thin)
+{
+	register unsigned long long	now;
+	register int					err;
+
+	now = get_time_ns();
+	while (thin->Head != thin->Tail)
+	{
+		if ((err = pop_entry(thin, now)) < 0) return(err);
+	}
+
+	return(0);
+}
@@ -0,0 +1,112 @@
+// midithin.h
+// Fits a stream of MIDI messages to what the output's cable can
+// carry, by thinning out controller values.
+//
+// A fast fader move (or pitch wheel, or aftertouch) on a USB
+// controller can send hundreds of values a second. A 31250 baud
+// MIDI cable carries only 3125 bytes a second, so when we pass such
+// a stream to a DIN output, the bytes pile up in the driver (and in
+// ../common/midiout.c's queue), and each message goes out later
+// than the one before it. But only the latest value of a
+// controller matters. So instead of queuing every value, we keep
+// one pending value per channel and controller (and per channel
+// for pitch bend and channel pressure, and per channel and note
+// for poly pressure), and when a newer value comes while the
+// older one is still waiting, we just replace it.
+//
+// We decide when a message can go out with a model of the cable,
+// a "token bucket": we earn BytesPerSec bytes of credit a second
+// (up to Burst bytes, which is how far ahead of the cable we let
+// the driver get), and each message we send spends its length.
+// While there's credit, messages go straight out. When there
+// isn't, they wait in our queue, in order.
+//
+// Notes, program changes, SysEx, and other such messages are
+// never thinned, or dropped (unless the queue itself is full).
+// They're also never reordered with controllers on the same
+// channel: a controller value can replace a pending one only if
+// no other message for that channel (and no SysEx or system
+// common message) was queued after it. Otherwise it's queued
+// again. So ie, the sustain pedal still goes down before the
+// note it was meant to hold. The data entry and RPN/NRPN
+// controllers (which only mean something in sequence), and the
+// channel mode messages (ie, All Notes Off), are never thinned.
+//
+// Realtime messages (ie, MIDI clock) are timing, and can go
+// anywhere in the stream, so they go out right away, ahead of
+// the queue.
+
+#ifndef MIDITHIN_H
+#define MIDITHIN_H
+
+#include "midiout.h"
+#include "timing.h"
+
+// How many messages we can queue. Must be a power of 2
+#define MIDITHIN_QUEUESIZE		1024
+
+// How many bytes of SysEx we can queue
+#define MIDITHIN_SYSEXSIZE		8192
+
+// The bytes a second that a MIDI cable carries (31250 baud, 10 bits a byte)
+#define MIDITHIN_DINRATE		3125
+
+// Default for how many bytes ahead of the cable we let the driver get
+#define MIDITHIN_BURST			32
+
+// How many different controller values we can keep pending. One
+// for each channel and controller, then for each channel's pitch
+// bend, each channel's pressure, and each channel and note's
+// poly pressure
+#define MIDITHIN_KEYS			(16 * 128 + 16 + 16 + 16 * 128)
+
+// MIDITHIN_ENTRY Flags
+#define MIDITHIN_SYSEX			0x01	// Its bytes are in SysEx[], not Msg[]
+
+// One queued message
+typedef struct _MIDITHIN_ENTRY
+{
+	unsigned long long	Time;			// When it was first queued
+	unsigned short			Key;			// 1 + its pending controller (0 if it's not a controller value)
+	unsigned short			Length;		// How many bytes
+	unsigned char			Flags;		// MIDITHIN_xxx
+	unsigned char			Msg[3];
+} MIDITHIN_ENTRY;
+
+typedef struct _MIDITHIN
+{
+	MIDIOUT					*Output;
+	MIDITHIN_ENTRY			*Queue;
+	unsigned char			*SysEx;			// SysEx bytes, in the order of their entries
+	unsigned int			*Pending;		// For each key, 1 + the queue position of its pending value, or 0
+	unsigned int			Head;				// Queue position of the next message to send
+	unsigned int			Tail;				// Queue position of the next message queued
+	unsigned int			Barrier[16];	// Per channel, the queue position just past its last message we can't thin
+	unsigned int			GlobalBarrier;	// The queue position just past the last SysEx or system common message
+	unsigned int			SysExHead;		// Where the oldest SysEx byte is
+	unsigned int			SysExCount;		// How many SysEx bytes are queued
+
+	// The model of the cable
+	double					BytesPerNs;
+	double					Burst;
+	double					Credit;			// Bytes we can send now. Negative if we're in debt
+	unsigned long long	Last;				// When we last figured Credit
+
+	// What happened
+	unsigned long			Sent;				// How many messages we sent
+	unsigned long			Replaced;		// How many controller values were replaced by newer ones
+	unsigned long			Dropped;			// How many messages we threw away, for lack of room
+	unsigned int			MaxQueued;		// The most messages ever queued at once
+	TIMEHIST					Latency;			// How long each message waited in the queue
+} MIDITHIN;
+
+#define midi_thin_count(thin)	((thin)->Tail - (thin)->Head)
+
+int midi_thin_init(MIDITHIN *, MIDIOUT *, unsigned int, unsigned int);
+void midi_thin_free(MIDITHIN *);
+int midi_thin_write(MIDITHIN *, const unsigned char *, unsigned int, unsigned long long);
+int midi_thin_service(MIDITHIN *, unsigned long long);
+unsigned long long midi_thin_due(MIDITHIN *);
+int midi_thin_drain(MIDITHIN *);
+
+#endif
@@ -0,0 +1,500 @@
+// pcmdev.c
+// An audio playback or capture device that is either an ALSA PCM
+// device, or a virtual card run off the system clock. See pcmdev.h.
+//
+// Compile it along with the program that uses it, devalloc.c, and timing.c. For example:
+// gcc -o midiclock midiclock.c ../../common/pcmdev.c ../../common/mididev.c ../../common/devalloc.c ../../common/midisched.c ../../common/midienc.c ../../common/midiparse.c ../../common/timing.c -lasound -lpthread -lm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "pcmdev.h"
+#include "devalloc.h"
+#include "timing.h"
+
+
+
+
+
+/********************* open_virtual() *********************
+ * Sets up a virtual card.
+ *
+ * options =	What follows "virtual:" in the device name, or
+ *					"" if nothing.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+static int open_virtual(PCMDEV *dev, const char *options, snd_pcm_format_t format)
+{
+	register int	width;
+	double			ppm;
+
+	if ((width = snd_pcm_format_physical_width(format)) <= 0) return(-EINVAL);
+	dev->FrameBytes = (width / 8) * dev->Channels;
+
+	ppm = 0.0;
+	while (*options)
+	{
+		register const char	*end;
+		register int			len;
+
+		if (!(end = strchr(options, ','))) end = options + strlen(options);
+		len = (int)(end - options);
+
+		if (len == 4 && !strncmp(options, "fast", 4))
+			dev->Fast = 1;
+		else if (!strncmp(options, "xrun=", 5))
+			dev->XrunPeriods = strtoul(options + 5, 0, 10);
+		else if (!strncmp(options, "ppm=", 4))
+			ppm = atof(options + 4);
+		else
+			return(-EINVAL);
+
+		options = (*end ? end + 1 : end);
+	}
+
+	// The buffer must be a whole number of periods, as with most cards
+	if (!dev->PeriodFrames || dev->PeriodFrames > dev->BufferFrames) return(-EINVAL);
+	dev->BufferFrames -= dev->BufferFrames % dev->PeriodFrames;
+
+	dev->NsPerFrame = 1000000000.0 / (dev->Rate * (1.0 + ppm / 1000000.0));
+	dev->Start = get_time_ns();
+	dev->NextXrun = dev->XrunPeriods * dev->PeriodFrames;
+
+	return(0);
+}
+
+
+
+
+
+/********************* virtual_prepare() *********************
+ * Stops the virtual card, and sets it back to frame 0, as
+ * after an xrun and snd_pcm_prepare().
+ */
+
+static void virtual_prepare(register PCMDEV *dev)
+{
+	// The fast card's clock carries on from where it stopped
+	if (dev->Fast) dev->Start += (unsigned long long)(dev->Played * dev->NsPerFrame);
+
+	dev->Played = dev->Applied = 0;
+	dev->Running = dev->Xrun = 0;
+	dev->NextXrun = dev->XrunPeriods * dev->PeriodFrames;
+}
+
+
+
+
+
+/********************* virtual_start() *********************
+ * Starts the virtual card running.
+ */
+
+static void virtual_start(register PCMDEV *dev)
+{
+	if (!dev->Fast) dev->Start = get_time_ns();
+	dev->Running = 1;
+}
+
+
+
+
+
+/********************* virtual_check() *********************
+ * Checks whether the virtual card has underrun/overrun
+ * (or whether it's time to inject an xrun), and if so,
+ * stops it.
+ */
+
+static void virtual_check(register PCMDEV *dev)
+{
+	if (dev->NextXrun && dev->Played >= dev->NextXrun)
+	{
+		dev->Played = dev->NextXrun;
+		++dev->Injected;
+		goto xrun;
+	}
+
+	// Playback underruns when the card has played everything written.
+	// Capture overruns when the card has captured a buffer more than read
+	if (dev->Capture ? dev->Played - dev->Applied > dev->BufferFrames : dev->Played > dev->Applied)
+	{
+xrun:	dev->Xrun = 1;
+		dev->Running = 0;
+	}
+}
+
+
+
+
+
+/********************* virtual_update() *********************
+ * Moves the virtual card's position to where its clock says
+ * it is now.
+ */
+
+static void virtual_update(register PCMDEV *dev)
+{
+	if (dev->Running && !dev->Fast)
+	{
+		dev->Played = (unsigned long long)((get_time_ns() - dev->Start) / dev->NsPerFrame);
+		virtual_check(dev);
+	}
+}
+
+
+
+
+
+/********************* virtual_wait() *********************
+ * Waits until the virtual card gets to the specified frame.
+ * (Or for the fast card, moves it there now.)
+ */
+
+static void virtual_wait(register PCMDEV *dev, unsigned long long frame)
+{
+	if (dev->Fast)
+	{
+		dev->Played = frame;
+		virtual_check(dev);
+	}
+	else
+	{
+		struct timespec	ts;
+
+		ns_to_timespec(dev->Start + (unsigned long long)(frame * dev->NsPerFrame) + 1, &ts);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0);
+		virtual_update(dev);
+	}
+}
+
+
+
+
+
+/********************* pcm_dev_open() *********************
+ * Opens an audio device, and sets its sample format, rate,
+ * buffer size, and period size.
+ *
+ * name =			The device name. See pcmdev.h.
+ * capture =		1 for capture, or 0 for playback.
+ * format =			The sample format (ie, SND_PCM_FORMAT_S16_LE).
+ * channels =		How many channels.
+ * rate =			The sample rate. An ALSA card may give us a
+ *						different one (see dev->Rate).
+ * bufferFrames =	The buffer size in frames, and...
+ * periodFrames =	...the period size. Again, dev->BufferFrames
+ *						and dev->PeriodFrames are what we got.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+int pcm_dev_open(PCMDEV *dev, const char *name, int capture, snd_pcm_format_t format, unsigned int channels, unsigned int rate, snd_pcm_uframes_t bufferFrames, snd_pcm_uframes_t periodFrames)
+{
+	snd_pcm_hw_params_t	*hw_params;
+	snd_pcm_sw_params_t	*sw_params;
+	register int			err;
+
+	memset(dev, 0, sizeof(PCMDEV));
+	dev->Capture = (capture ? 1 : 0);
+	dev->Rate = rate;
+	dev->Channels = channels;
+	dev->BufferFrames = bufferFrames;
+	dev->PeriodFrames = periodFrames;
+
+	if (!strncmp(name, "virtual", 7) && (!name[7] || name[7] == ':')) return(open_virtual(dev, name[7] ? &name[8] : "", format));
+
+	if (!strncmp(name, "free", 4) && (!name[4] || name[4] == ':'))
+		err = dev_alloc_pcm(&dev->Handle, 0, name[4] ? &name[5] : "", capture ? SND_PCM_STREAM_CAPTURE : SND_PCM_STREAM_PLAYBACK, 0);
+	else
+		err = snd_pcm_open(&dev->Handle, name, capture ? SND_PCM_STREAM_CAPTURE : SND_PCM_STREAM_PLAYBACK, 0);
+	if (err < 0)
+	{
+		dev->Handle = 0;
+		return(err);
+	}
+
+	if ((err = snd_pcm_hw_params_malloc(&hw_params)) < 0) goto bad;
+	if ((err = snd_pcm_hw_params_any(dev->Handle, hw_params)) < 0 ||
+		(err = snd_pcm_hw_params_set_format(dev->Handle, hw_params, format)) < 0 ||
+		(err = snd_pcm_hw_params_set_rate_near(dev->Handle, hw_params, &dev->Rate, 0)) < 0 ||
+		(err = snd_pcm_hw_params_set_channels(dev->Handle, hw_params, channels)) < 0 ||
+		(err = snd_pcm_hw_params_set_access(dev->Handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0 ||
+		(err = snd_pcm_hw_params_set_buffer_size_near(dev->Handle, hw_params, &dev->BufferFrames)) < 0 ||
+		(err = snd_pcm_hw_params_set_period_size_near(dev->Handle, hw_params, &dev->PeriodFrames, 0)) < 0 ||
+		(err = snd_pcm_hw_params(dev->Handle, hw_params)) < 0)
+	{
+		snd_pcm_hw_params_free(hw_params);
+		goto bad;
+	}
+	snd_pcm_hw_params_free(hw_params);
+	dev->FrameBytes = (snd_pcm_format_physical_width(format) / 8) * channels;
+
+	// Have the card timestamp its position every time it moves. By default,
+	// that's with the time of day, which can jump. We want the monotonic clock.
+	// And like the virtual card, don't start playback until the buffer is full
+	if ((err = snd_pcm_sw_params_malloc(&sw_params)) < 0) goto bad;
+	if ((err = snd_pcm_sw_params_current(dev->Handle, sw_params)) < 0 ||
+		(!capture && (err = snd_pcm_sw_params_set_start_threshold(dev->Handle, sw_params, dev->BufferFrames)) < 0) ||
+		(err = snd_pcm_sw_params_set_tstamp_mode(dev->Handle, sw_params, SND_PCM_TSTAMP_ENABLE)) < 0 ||
+#if SND_LIB_VERSION >= 0x01001c
+		(err = snd_pcm_sw_params_set_tstamp_type(dev->Handle, sw_params, SND_PCM_TSTAMP_TYPE_MONOTONIC)) < 0 ||
+#endif
+		(err = snd_pcm_sw_params(dev->Handle, sw_params)) < 0)
+	{
+		snd_pcm_sw_params_free(sw_params);
+bad:	snd_pcm_close(dev->Handle);
+		dev->Handle = 0;
+		return(err);
+	}
+	snd_pcm_sw_params_free(sw_params);
+
+	return(0);
+}
+
+
+
+
+
+/********************* pcm_dev_close() *********************
+ * Closes an audio device opened with pcm_dev_open().
+ */
+
+void pcm_dev_close(PCMDEV *dev)
+{
+	if (dev->Handle)
+	{
+		snd_pcm_close(dev->Handle);
+		dev->Handle = 0;
+	}
+}
+
+
+
+
+
+/********************* pcm_dev_writei() *********************
+ * Plays interleaved frames, waiting for room in the buffer
+ * as needed.
+ *
+ * RETURNS: How many frames written, or a negative error
+ * number (-EPIPE if an underrun, in which case call
+ * pcm_dev_recover()).
+ */
+
+snd_pcm_sframes_t pcm_dev_writei(PCMDEV *dev, const void *buffer, snd_pcm_uframes_t frames)
+{
+	register snd_pcm_uframes_t	done, avail;
+
+	if (dev->Handle) return(snd_pcm_writei(dev->Handle, buffer, frames));
+
+	// The virtual card ignores the data. We only keep track of how much of
+	// the buffer it fills
+	done = 0;
+	while (done < frames)
+	{
+		virtual_update(dev);
+		if (dev->Xrun) return(done ? (snd_pcm_sframes_t)done : -EPIPE);
+
+		if (!(avail = dev->BufferFrames - (snd_pcm_uframes_t)(dev->Applied - dev->Played)))
+		{
+			// Full. Wait until the card has played enough for the rest, or a
+			// period's worth, whichever is less
+			avail = frames - done;
+			if (avail > dev->PeriodFrames) avail = dev->PeriodFrames;
+			virtual_wait(dev, dev->Applied - dev->BufferFrames + avail);
+			continue;
+		}
+
+		if (avail > frames - done) avail = frames - done;
+		dev->Applied += avail;
+		done += avail;
+		if (!dev->Running && dev->Applied >= dev->BufferFrames) virtual_start(dev);
+	}
+
+	return((snd_pcm_sframes_t)done);
+}
+
+
+
+
+
+/********************* pcm_dev_readi() *********************
+ * Records interleaved frames, waiting for them to arrive
+ * as needed.
+ *
+ * RETURNS: How many frames read, or a negative error number
+ * (-EPIPE if an overrun, in which case call
+ * pcm_dev_recover()).
+ */
+
+snd_pcm_sframes_t pcm_dev_readi(PCMDEV *dev, void *buffer, snd_pcm_uframes_t frames)
+{
+	register snd_pcm_uframes_t	done, avail;
+
+	if (dev->Handle) return(snd_pcm_readi(dev->Handle, buffer, frames));
+
+	if (!dev->Running && !dev->Xrun) virtual_start(dev);
+
+	// The virtual card records silence
+	done = 0;
+	while (done < frames)
+	{
+		virtual_update(dev);
+		if (dev->Xrun) return(done ? (snd_pcm_sframes_t)done : -EPIPE);
+
+		if (!(avail = (snd_pcm_uframes_t)(dev->Played - dev->Applied)))
+		{
+			avail = frames - done;
+			if (avail > dev->PeriodFrames) avail = dev->PeriodFrames;
+			virtual_wait(dev, dev->Applied + avail);
+			continue;
+		}
+
+		if (avail > frames - done) avail = frames - done;
+		memset((char *)buffer + done * dev->FrameBytes, 0, avail * dev->FrameBytes);
+		dev->Applied += avail;
+		done += avail;
+	}
+
+	return((snd_pcm_sframes_t)done);
+}
+
+
+
+
+
+/********************* pcm_dev_recover() *********************
+ * Recovers from an underrun/overrun (-EPIPE), or a suspend
+ * (-ESTRPIPE), returned by pcm_dev_writei()/pcm_dev_readi().
+ *
+ * RETURNS: 0 if recovered, or a negative error number.
+ *
+ * NOTE: What was in the buffer is lost, and playback starts
+ * over once the buffer fills again.
+ */
+
+int pcm_dev_recover(PCMDEV *dev, int err)
+{
+	if (dev->Handle) return(snd_pcm_recover(dev->Handle, err, 1));
+
+	if (err != -EPIPE) return(err);
+	virtual_prepare(dev);
+	return(0);
+}
+
+
+
+
+
+/********************* pcm_dev_htimestamp() *********************
+ * Gets how many frames there's room for (playback), or are
+ * waiting to be read (capture), and when the card was at
+ * that position.
+ *
+ * avail =	Where to return how many frames.
+ * time =	Where to return the time, in nanoseconds (monotonic
+ *				clock, or the fast virtual card's clock). 0 if the
+ *				card isn't running.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+int pcm_dev_htimestamp(PCMDEV *dev, snd_pcm_uframes_t *avail, unsigned long long *time)
+{
+	if (dev->Handle)
+	{
+		snd_htimestamp_t	ts;
+		register int		err;
+
+		if ((err = snd_pcm_htimestamp(dev->Handle, avail, &ts)) < 0) return(err);
+		*time = timespec_to_ns(&ts);
+		return(0);
+	}
+
+	virtual_update(dev);
+	if (dev->Capture)
+		*avail = (snd_pcm_uframes_t)(dev->Played - dev->Applied);
+	else
+		*avail = dev->BufferFrames - (snd_pcm_uframes_t)(dev->Applied - dev->Played);
+	*time = (dev->Running ? dev->Start + (unsigned long long)(dev->Played * dev->NsPerFrame) : 0);
+	return(0);
+}
+
+
+
+
+
+/********************* pcm_dev_drain() *********************
+ * For playback, waits until everything written has been
+ * played, and stops the card. For capture, stops the card.
+ */
+
+void pcm_dev_drain(PCMDEV *dev)
+{
+	if (dev->Handle)
+		snd_pcm_drain(dev->Handle);
+	else
+	{
+		// Playback that never filled the buffer starts now
+		if (!dev->Capture && !dev->Running && !dev->Xrun && dev->Applied) virtual_start(dev);
+
+		// Don't inject an xrun while draining
+		dev->NextXrun = 0;
+		if (!dev->Capture && dev->Running) virtual_wait(dev, dev->Applied);
+
+		virtual_prepare(dev);
+	}
+}
+
+
+
+
+
+/********************* pcm_dev_drop() *********************
+ * Stops the card at once, throwing away whatever is in the
+ * buffer. It's then ready to be written (or read) again,
+ * from frame 0.
+ */
+
+void pcm_dev_drop(PCMDEV *dev)
+{
+	if (dev->Handle)
+	{
+		snd_pcm_drop(dev->Handle);
+		snd_pcm_prepare(dev->Handle);
+	}
+	else
+		virtual_prepare(dev);
+}
+
+
+
+
+
+/********************* pcm_dev_start() *********************
+ * Starts playback before the buffer is full (ie, for a
+ * sound that's shorter than the buffer). Otherwise, it
+ * starts only once the buffer fills.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ *
+ * NOTE: Does nothing if the card is already running, or
+ * nothing has been written yet.
+ */
+
+int pcm_dev_start(PCMDEV *dev)
+{
+	if (dev->Handle)
+	{
+		if (snd_pcm_state(dev->Handle) != SND_PCM_STATE_PREPARED || snd_pcm_avail(dev->Handle) >= (snd_pcm_sframes_t)dev->BufferFrames) return(0);
+		return(snd_pcm_start(dev->Handle));
+	}
+
+	if (!dev->Capture && !dev->Running && !dev->Xrun && dev->Applied) virtual_start(dev);
+	return(0);
+}
@@ -0,0 +1,88 @@
+// pcmdev.h
+// A thin layer over an audio (PCM) playback or capture device, so
+// that our audio engines, and the benchmarks that use them, can
+// run without a sound card.
+//
+// The device name says which kind of device it is:
+//
+// "hw:0,0"		(or any other ALSA PCM name) An ALSA device. We set
+//					it up for interleaved read/write access, with the
+//					card timestamping its position by the monotonic
+//					clock.
+//
+// "free"		Any free subdevice of any card's PCM devices. Or
+// "free:C"		any free subdevice of card C's, or "free:C,D" of
+//					card C's device D. See devalloc.h.
+//
+// "virtual"	A virtual card, whose clock is the system's monotonic
+//					clock. Playback starts once the buffer is full, and
+//					the card then "plays" Rate frames a second, so
+//					pcm_dev_writei() waits just as it would for a real
+//					card. Capture starts with the first pcm_dev_readi(),
+//					and returns silence at the same rate. If the caller
+//					falls behind, it gets an underrun/overrun (-EPIPE).
+//					Options can follow a colon, separated by commas, ie
+//					"virtual:fast,xrun=100":
+//
+//					fast		Don't wait. Whenever the caller would have to
+//								wait for the card, the card's clock jumps
+//								ahead instead. So an engine runs as fast as
+//								it can, and the times pcm_dev_htimestamp()
+//								returns are from this virtual clock (which
+//								starts at the time we're opened).
+//					xrun=n	Inject an underrun (or overrun) after every n
+//								periods.
+//					ppm=n		Make the card's crystal run n parts per million
+//								fast (or slow, if negative) compared to the
+//								system clock.
+//
+//					Everything the virtual card does depends only on
+//					what the caller does (and in real time, on the
+//					clock), so runs are repeatable.
+//
+// Only interleaved read/write access is supported. There's no
+// memory-mapped access, nor ALSA's async callback, so the programs
+// built on those (../pcm/alsawave2, and ../pcm/sampler's audio)
+// still open ALSA directly, and need a real card. (sampler's MIDI
+// input goes through mididev.h.)
+
+#ifndef PCMDEV_H
+#define PCMDEV_H
+
+#include <alsa/asoundlib.h>
+
+// A playback or capture device
+typedef struct _PCMDEV
+{
+	snd_pcm_t				*Handle;			// The ALSA device, or 0 if virtual
+	unsigned int			Rate;				// The sample rate we got
+	unsigned int			Channels;
+	unsigned int			FrameBytes;		// Bytes per frame
+	snd_pcm_uframes_t		BufferFrames;	// The buffer size we got
+	snd_pcm_uframes_t		PeriodFrames;	// The period size we got
+	unsigned char			Capture;			// 1 if capture, 0 if playback
+
+	// The virtual card
+	unsigned char			Fast;				// 1 if we don't wait for its clock
+	unsigned char			Running;			// 1 once it's started
+	unsigned char			Xrun;				// 1 if it has underrun/overrun
+	double					NsPerFrame;		// How long each frame lasts, by its crystal
+	unsigned long long	Start;			// The (monotonic) time it was at frame 0
+	unsigned long long	Played;			// How many frames it has played/captured since it started
+	unsigned long long	Applied;			// How many frames the caller has written/read since then
+	unsigned long long	NextXrun;		// When Played gets here, we inject an xrun (0 = never)
+	unsigned long			XrunPeriods;	// Inject an xrun after every this many periods (0 = never)
+	unsigned long			Injected;		// How many xruns we've injected
+} PCMDEV;
+
+int pcm_dev_open(PCMDEV *, const char *, int, snd_pcm_format_t, unsigned int, unsigned int, snd_pcm_uframes_t, snd_pcm_uframes_t);
+void pcm_dev_close(PCMDEV *);
+snd_pcm_sframes_t pcm_dev_writei(PCMDEV *, const void *, snd_pcm_uframes_t);
+snd_pcm_sframes_t pcm_dev_readi(PCMDEV *, void *, snd_pcm_uframes_t);
+int pcm_dev_recover(PCMDEV *, int);
+int pcm_dev_htimestamp(PCMDEV *, snd_pcm_uframes_t *, unsigned long long *);
+void pcm_dev_drain(PCMDEV *);
+void pcm_dev_drop(PCMDEV *);
+int pcm_dev_start(PCMDEV *);
+
+#endif
@@ -0,0 +1,364 @@
+// pcmmeter.c
+// Per-period peak, RMS, and clip metering of 16-bit audio. See
+// pcmmeter.h.
+//
+// Compile it along with the program that uses it, and link with -lm. For example:
+// gcc -o alsawave alsawave.c ../../common/pcmmeter.c ../../common/timing.c -lasound -lm
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sched.h>
+#include <errno.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "pcmmeter.h"
+
+
+
+
+
+// How many times 32 samples meter_sse2() does before it checks whether
+// any clipped
+#define PCMMETER_RUN		1024
+
+
+
+
+
+/********************** pcm_meter_init() *********************
+ * Initializes a PCMMETER.
+ *
+ * channels =	How many channels in each frame.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+int pcm_meter_init(PCMMETER *meter, unsigned int channels)
+{
+	memset(meter, 0, sizeof(PCMMETER));
+	if (!channels || channels > PCMMETER_MAXCHANNELS) return(-EINVAL);
+	meter->Channels = channels;
+	return(0);
+}
+
+
+
+
+
+/********************** meter_scalar() *********************
+ * Adds samples to the period's per-channel numbers, one at
+ * a time.
+ *
+ * samples =	The samples.
+ * count =		How many samples (not frames).
+ * channel =	Which channel the first sample is.
+ */
+
+static void meter_scalar(const short *samples, unsigned int count, unsigned int channels, register unsigned int channel,
+	unsigned int *peak, unsigned long long *sum, unsigned int *clips)
+{
+	register unsigned int	i;
+
+	for (i = 0; i < count; i++)
+	{
+		register int			s;
+		register unsigned int	a;
+
+		s = samples[i];
+		a = (unsigned int)(s < 0 ? -s : s);
+		if (a >= 32767)
+		{
+			a = 32767;
+			++clips[channel];
+		}
+		if (a > peak[channel]) peak[channel] = a;
+		sum[channel] += (unsigned long long)(s * s);
+		if (++channel >= channels) channel = 0;
+	}
+}
+
+
+
+
+
+#ifdef __SSE2__
+
+/********************** meter_sse2() *********************
+ * Adds samples to the period's per-channel numbers, 32 at a
+ * time. "channels" must be 1, 2, 4, or 8, so that each lane
+ * of a vector is always the same channel (lane % channels).
+ *
+ * RETURNS: How many samples it did (a multiple of 32). The
+ * caller does the rest with meter_scalar().
+ *
+ * NOTE: Clipping is rare, so we don't look for it sample by
+ * sample. We keep only each lane's highest and lowest sample,
+ * and if a run of samples reached full scale, we do that run
+ * over with meter_scalar(), which counts the clips.
+ */
+
+static unsigned int meter_sse2(const short *samples, unsigned int count, unsigned int channels,
+	unsigned int *peak, unsigned long long *sum, unsigned int *clips)
+{
+	register unsigned int	done;
+	__m128i						zero, full;
+
+	zero = _mm_setzero_si128();
+	full = _mm_set1_epi16(32767);
+
+	done = 0;
+	while (count - done >= 32)
+	{
+		__m128i						vmax, vmin, vpeak, sum0, sum1, sum2, sum3;
+		register unsigned int	run, i, start;
+
+		vmax = vmin = sum0 = sum1 = sum2 = sum3 = zero;
+		run = (count - done) >> 5;
+		if (run > PCMMETER_RUN) run = PCMMETER_RUN;
+		start = done;
+
+		for (i = 0; i < run; i++, done += 32)
+		{
+			__m128i	a, b, c, d, lo, hi;
+
+			a = _mm_loadu_si128((const __m128i *)&samples[done]);
+			b = _mm_loadu_si128((const __m128i *)&samples[done + 8]);
+			c = _mm_loadu_si128((const __m128i *)&samples[done + 16]);
+			d = _mm_loadu_si128((const __m128i *)&samples[done + 24]);
+			vmax = _mm_max_epi16(vmax, _mm_max_epi16(_mm_max_epi16(a, b), _mm_max_epi16(c, d)));
+			vmin = _mm_min_epi16(vmin, _mm_min_epi16(_mm_min_epi16(a, b), _mm_min_epi16(c, d)));
+
+			// Pair each of a's samples with the one 8 later in b (the same
+			// channel), so _mm_madd_epi16() gives a[n]^2 + b[n]^2 in 32-bit
+			// lane n. Likewise c and d, and add the two. Unless a sample was
+			// -32768 (full scale, so we'll do this run over anyway), that's
+			// under 2^32. Then add those into 64-bit totals
+			lo = _mm_unpacklo_epi16(a, b);
+			hi = _mm_unpackhi_epi16(a, b);
+			a = _mm_unpacklo_epi16(c, d);
+			b = _mm_unpackhi_epi16(c, d);
+			lo = _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(a, a));
+			hi = _mm_add_epi32(_mm_madd_epi16(hi, hi), _mm_madd_epi16(b, b));
+			sum0 = _mm_add_epi64(sum0, _mm_unpacklo_epi32(lo, zero));	// Lanes 0 and 1
+			sum1 = _mm_add_epi64(sum1, _mm_unpackhi_epi32(lo, zero));	// 2 and 3
+			sum2 = _mm_add_epi64(sum2, _mm_unpacklo_epi32(hi, zero));	// 4 and 5
+			sum3 = _mm_add_epi64(sum3, _mm_unpackhi_epi32(hi, zero));	// 6 and 7
+		}
+
+		// The absolute peak of each lane. (0 - -32768 saturates to 32767)
+		vpeak = _mm_max_epi16(vmax, _mm_subs_epi16(zero, vmin));
+
+		// Did any of the run clip? Then do it over, counting the clips
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(vpeak, full)))
+			meter_scalar(&samples[start], done - start, channels, 0, peak, sum, clips);
+
+		// Add up the lanes of each channel
+		else
+		{
+			unsigned short			lanePeak[8];
+			unsigned long long	laneSum[8];
+
+			_mm_storeu_si128((__m128i *)&lanePeak[0], vpeak);
+			_mm_storeu_si128((__m128i *)&laneSum[0], sum0);
+			_mm_storeu_si128((__m128i *)&laneSum[2], sum1);
+			_mm_storeu_si128((__m128i *)&laneSum[4], sum2);
+			_mm_storeu_si128((__m128i *)&laneSum[6], sum3);
+
+			for (i = 0; i < 8; i++)
+			{
+				register unsigned int	ch;
+
+				ch = i & (channels - 1);
+				if (lanePeak[i] > peak[ch]) peak[ch] = lanePeak[i];
+				sum[ch] += laneSum[i];
+			}
+		}
+	}
+
+	return(done);
+}
+
+#endif
+
+
+
+
+
+/********************** pcm_meter_s16() *********************
+ * Meters one period (or any number of frames) of 16-bit
+ * interleaved audio, and publishes the levels.
+ *
+ * samples =	The frames.
+ * frames =		How many frames.
+ *
+ * NOTE: Only one thread may call this for a given meter.
+ */
+
+void pcm_meter_s16(PCMMETER *meter, const short *samples, unsigned int frames)
+{
+	unsigned int				peak[PCMMETER_MAXCHANNELS], clips[PCMMETER_MAXCHANNELS];
+	unsigned long long		sum[PCMMETER_MAXCHANNELS];
+	register unsigned int	channels, count, done, ch;
+
+	channels = meter->Channels;
+	count = frames * channels;
+	memset(&peak[0], 0, sizeof(peak));
+	memset(&clips[0], 0, sizeof(clips));
+	memset(&sum[0], 0, sizeof(sum));
+
+	done = 0;
+#ifdef __SSE2__
+	if (!(8 % channels)) done = meter_sse2(samples, count, channels, &peak[0], &sum[0], &clips[0]);
+#endif
+	meter_scalar(samples + done, count - done, channels, done % channels, &peak[0], &sum[0], &clips[0]);
+
+	// Publish the totals under the sequence lock
+	__atomic_store_n(&meter->Seq, meter->Seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	for (ch = 0; ch < channels; ch++)
+	{
+		register PCMMETER_CHANNEL	*chan;
+
+		chan = &meter->Channel[ch];
+		__atomic_store_n(&chan->Peak, peak[ch], __ATOMIC_RELAXED);
+		__atomic_store_n(&chan->SumSquares, chan->SumSquares + sum[ch], __ATOMIC_RELAXED);
+		__atomic_store_n(&chan->Clips, chan->Clips + clips[ch], __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&meter->Frames, meter->Frames + frames, __ATOMIC_RELAXED);
+	__atomic_store_n(&meter->Periods, meter->Periods + 1, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&meter->Seq, meter->Seq + 1, __ATOMIC_RELEASE);
+
+	// Raise each channel's highest peak. A reader may take it (set it to
+	// 0) at the same time, in which case we just try again
+	for (ch = 0; ch < channels; ch++)
+	{
+		unsigned int	old;
+
+		old = __atomic_load_n(&meter->Channel[ch].MaxPeak, __ATOMIC_RELAXED);
+		while (peak[ch] > old && !__atomic_compare_exchange_n(&meter->Channel[ch].MaxPeak, &old, peak[ch], 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	}
+}
+
+
+
+
+
+/********************** copy_totals() *********************
+ * Reader: Copies the meter's totals, as of the end of some
+ * period.
+ */
+
+static void copy_totals(PCMMETER *meter, PCMMETER_READER *copy)
+{
+	register unsigned int	seq, ch;
+
+	do
+	{
+		// Wait out an update in progress
+		while ((seq = __atomic_load_n(&meter->Seq, __ATOMIC_ACQUIRE)) & 1) sched_yield();
+
+		copy->Frames = __atomic_load_n(&meter->Frames, __ATOMIC_RELAXED);
+		for (ch = 0; ch < meter->Channels; ch++)
+		{
+			copy->SumSquares[ch] = __atomic_load_n(&meter->Channel[ch].SumSquares, __ATOMIC_RELAXED);
+			copy->Clips[ch] = __atomic_load_n(&meter->Channel[ch].Clips, __ATOMIC_RELAXED);
+		}
+
+		// If the audio thread changed them while we copied, do it again
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&meter->Seq, __ATOMIC_RELAXED) != seq);
+}
+
+
+
+
+
+/********************** pcm_meter_reader_init() *********************
+ * Initializes a reader, so its first pcm_meter_read() gets
+ * the levels from now on.
+ */
+
+void pcm_meter_reader_init(PCMMETER *meter, PCMMETER_READER *reader)
+{
+	register unsigned int	ch;
+
+	copy_totals(meter, reader);
+	for (ch = 0; ch < meter->Channels; ch++) __atomic_store_n(&meter->Channel[ch].MaxPeak, 0, __ATOMIC_RELAXED);
+}
+
+
+
+
+
+/********************** to_db() *********************
+ * Converts a level (where 32768 is full scale) to dBFS.
+ */
+
+static double to_db(double level)
+{
+	return(level > 0 ? 20.0 * log10(level / 32768.0) : PCMMETER_FLOOR);
+}
+
+
+
+
+
+/********************** pcm_meter_read() *********************
+ * Reader: Gets each channel's levels since the last call.
+ *
+ * levels =		Where to return them. meter->Channels of them.
+ *
+ * RETURNS: How many frames they're over. (If 0, the levels
+ * are all silence.)
+ *
+ * NOTE: Only one reader may take the highest peaks. (If
+ * there are several readers, they share them.)
+ */
+
+unsigned long long pcm_meter_read(PCMMETER *meter, PCMMETER_READER *reader, PCMMETER_LEVELS *levels)
+{
+	PCMMETER_READER				now;
+	register unsigned long long	frames;
+	register unsigned int		ch;
+
+	copy_totals(meter, &now);
+	frames = now.Frames - reader->Frames;
+
+	for (ch = 0; ch < meter->Channels; ch++)
+	{
+		levels[ch].Peak = to_db(__atomic_exchange_n(&meter->Channel[ch].MaxPeak, 0, __ATOMIC_RELAXED));
+		levels[ch].Rms = (frames ? to_db(sqrt((double)(now.SumSquares[ch] - reader->SumSquares[ch]) / frames)) : PCMMETER_FLOOR);
+		levels[ch].Clips = (unsigned long)(now.Clips[ch] - reader->Clips[ch]);
+	}
+
+	*reader = now;
+	return(frames);
+}
+
+
+
+
+
+/********************** pcm_meter_print() *********************
+ * Reader: Prints each channel's peak and RMS levels (and
+ * clips, if any) since the last call, on one line.
+ */
+
+void pcm_meter_print(PCMMETER *meter, PCMMETER_READER *reader)
+{
+	PCMMETER_LEVELS			levels[PCMMETER_MAXCHANNELS];
+	register unsigned int	ch;
+
+	if (!pcm_meter_read(meter, reader, &levels[0])) return;
+
+	for (ch = 0; ch < meter->Channels; ch++)
+	{
+		printf("%s%u: %6.1f dB peak %6.1f dB RMS", ch ? " | " : "", ch + 1, levels[ch].Peak, levels[ch].Rms);
+		if (levels[ch].Clips) printf(" (%lu CLIPPED)", levels[ch].Clips);
+	}
+	printf("\n");
+}
@@ -0,0 +1,76 @@
+// pcmmeter.h
+// Level meters for 16-bit interleaved audio. The audio thread
+// (or callback) meters each period as it passes through, and any
+// other thread can read the levels at any time, without ever
+// making the audio thread wait.
+//
+// For each channel, we keep the peak (the highest absolute sample),
+// the sum of the squares of the samples (from which a reader gets
+// the RMS level over whatever time it likes), and how many samples
+// were clipped (at full scale). With SSE2, and 1, 2, 4, or 8
+// channels, we do 8 samples at once. Then every channel's samples
+// are always in the same lanes of the vector, so the lanes can be
+// added up per channel at the end of the period.
+//
+// The audio thread publishes the totals under a "sequence lock", as
+// midistat.h does: it makes Seq odd, updates, then makes Seq even
+// again. A reader copies the totals, and if Seq was
+// odd, or changed while it copied, it tries again. So a reader
+// always gets the totals of a whole number of periods. The highest
+// peak since the reader last looked is kept apart from the totals,
+// and the reader takes it (resets it to 0) with an atomic exchange.
+//
+// pcm_meter_s16() makes no system call, doesn't allocate, and never
+// waits, so it's safe even in a signal handler (ie, an ALSA async
+// callback).
+
+#ifndef PCMMETER_H
+#define PCMMETER_H
+
+// The most channels we meter
+#define PCMMETER_MAXCHANNELS	8
+
+// The level that pcm_meter_read() returns for silence, in dBFS
+#define PCMMETER_FLOOR			-120.0
+
+// One channel's numbers
+typedef struct _PCMMETER_CHANNEL
+{
+	unsigned int			Peak;			// The highest absolute sample in the last period (0 to 32767)
+	unsigned int			MaxPeak;		// The highest since a reader last took it. Not under the sequence lock
+	unsigned long long	SumSquares;	// The total of every sample squared (it wraps, after days)
+	unsigned long long	Clips;		// How many samples were at full scale (32767, or -32767 and below)
+} PCMMETER_CHANNEL;
+
+typedef struct _PCMMETER
+{
+	unsigned int			Seq __attribute__((aligned(64)));	// Odd while being updated
+	unsigned int			Channels;
+	unsigned long long	Frames;		// How many frames we've metered
+	unsigned long long	Periods;		// How many times pcm_meter_s16() was called
+	PCMMETER_CHANNEL		Channel[PCMMETER_MAXCHANNELS];
+} PCMMETER;
+
+// A reader's copy of the totals, as of its last pcm_meter_read()
+typedef struct _PCMMETER_READER
+{
+	unsigned long long	Frames;
+	unsigned long long	SumSquares[PCMMETER_MAXCHANNELS];
+	unsigned long long	Clips[PCMMETER_MAXCHANNELS];
+} PCMMETER_READER;
+
+// One channel's levels, since the reader's last pcm_meter_read()
+typedef struct _PCMMETER_LEVELS
+{
+	double					Peak;			// In dBFS (0 is full scale)
+	double					Rms;			// In dBFS
+	unsigned long			Clips;		// How many samples were clipped
+} PCMMETER_LEVELS;
+
+int pcm_meter_init(PCMMETER *, unsigned int);
+void pcm_meter_s16(PCMMETER *, const short *, unsigned int);
+void pcm_meter_reader_init(PCMMETER *, PCMMETER_READER *);
+unsigned long long pcm_meter_read(PCMMETER *, PCMMETER_READER *, PCMMETER_LEVELS *);
+void pcm_meter_print(PCMMETER *, PCMMETER_READER *);
+
+#endif
@@ -0,0 +1,220 @@
+// preroll.c
+// An always-on, overwrite-safe ring of captured audio. See
+// preroll.h.
+//
+// Compile it along with the program that uses it. For example:
+// gcc -o prerollrec prerollrec.c ../../common/preroll.c ../../common/pcmmeter.c ../../common/pcmdev.c ../../common/devalloc.c ../../common/timing.c -lasound -lpthread -lm
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include "preroll.h"
+
+
+
+
+
+// The size of a huge page. (2 MB on x86 and ARM64 with 4 KB pages)
+#define PREROLL_HUGEPAGE	(2 * 1024 * 1024ULL)
+
+// The oldest frame that's still safe to read, when the capture thread
+// has written "written" frames. It may be filling up to Margin frames
+// past that, which writes over the Margin frames after this one
+#define PREROLL_OLDEST(ring, written)	((written) + (ring)->Margin > (ring)->Frames ? (written) + (ring)->Margin - (ring)->Frames : 0)
+
+
+
+
+
+/********************** preroll_init() *********************
+ * Allocates a PREROLL's ring.
+ *
+ * frames =		How many frames it must hold. (The last of
+ *					them may be being written over, so this
+ *					should be the pre-roll we want, plus some
+ *					time for the disk to catch up.)
+ * frameBytes =	How many bytes in each frame.
+ * margin =		The most frames that the capture thread will
+ *					ask preroll_write_ptr() for. (Ie, the period
+ *					size.)
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ *
+ * NOTE: We round the size up to a whole number of pages, and
+ * use all of it. So ring->Frames may be more than "frames".
+ */
+
+int preroll_init(PREROLL *ring, unsigned int frames, unsigned int frameBytes, unsigned int margin)
+{
+	register unsigned long long	size;
+
+	memset(ring, 0, sizeof(PREROLL));
+	if (!frames || !frameBytes || !margin || margin > frames) return(-EINVAL);
+	size = (unsigned long long)(frames + margin) * frameBytes;
+
+#ifdef MAP_HUGETLB
+	// Try huge pages first. This fails if the pool doesn't have enough
+	ring->MapSize = (size + PREROLL_HUGEPAGE - 1) & ~(PREROLL_HUGEPAGE - 1);
+	if ((ring->Buffer = (unsigned char *)mmap(0, ring->MapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0)) != MAP_FAILED)
+		ring->Pages = PREROLL_PAGES_HUGE;
+	else
+#endif
+	{
+		register unsigned long long	pageSize;
+
+		pageSize = (unsigned long long)sysconf(_SC_PAGESIZE);
+		ring->MapSize = (size + pageSize - 1) & ~(pageSize - 1);
+		if ((ring->Buffer = (unsigned char *)mmap(0, ring->MapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+		{
+			ring->Buffer = 0;
+			return(-ENOMEM);
+		}
+
+#ifdef MADV_HUGEPAGE
+		// Ask for transparent huge pages instead. That only works for whole,
+		// aligned huge pages, so a small ring won't get any
+		if (!madvise(ring->Buffer, ring->MapSize, MADV_HUGEPAGE)) ring->Pages = PREROLL_PAGES_TRANSPARENT;
+#endif
+	}
+
+	// Touch every page now, so the capture thread never waits for the
+	// kernel to find one. And keep them in RAM if we're allowed
+	memset(ring->Buffer, 0, ring->MapSize);
+	if (!mlock(ring->Buffer, ring->MapSize)) ring->Locked = 1;
+
+	ring->Frames = (unsigned int)(ring->MapSize / frameBytes);
+	ring->FrameBytes = frameBytes;
+	ring->Margin = margin;
+	return(0);
+}
+
+
+
+
+
+/********************** preroll_free() *********************
+ * Frees a PREROLL's ring.
+ */
+
+void preroll_free(PREROLL *ring)
+{
+	if (ring->Buffer)
+	{
+		if (ring->Locked) munlock(ring->Buffer, ring->MapSize);
+		munmap(ring->Buffer, ring->MapSize);
+	}
+	ring->Buffer = 0;
+}
+
+
+
+
+
+/********************** preroll_write_ptr() *********************
+ * Capture thread: Returns where to put the next frames.
+ *
+ * frames =		Where to return how many frames fit there.
+ *					That's at most ring->Margin, and less if we're
+ *					near the end of the ring.
+ *
+ * Read the audio there, then call preroll_commit().
+ */
+
+void * preroll_write_ptr(PREROLL *ring, unsigned int *frames)
+{
+	register unsigned int	pos, count;
+
+	pos = (unsigned int)(ring->Written % ring->Frames);
+	count = ring->Frames - pos;
+	*frames = (count > ring->Margin ? ring->Margin : count);
+
+	// Make sure readers see the last commit before they see us write
+	// over the audio it made old
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return(ring->Buffer + (unsigned long long)pos * ring->FrameBytes);
+}
+
+void preroll_commit(PREROLL *ring, unsigned int frames)
+{
+	__atomic_store_n(&ring->Written, ring->Written + frames, __ATOMIC_RELEASE);
+}
+
+
+
+
+
+/********************** preroll_reader_init() *********************
+ * Starts a reader some way back in the ring.
+ *
+ * back =	How many frames back from the live audio to start.
+ *				If the ring doesn't have that many yet (or they
+ *				don't fit), the reader starts at the oldest it
+ *				has.
+ */
+
+void preroll_reader_init(PREROLL *ring, PREROLL_READER *reader, unsigned long long back)
+{
+	register unsigned long long	written, oldest;
+
+	written = __atomic_load_n(&ring->Written, __ATOMIC_ACQUIRE);
+	oldest = PREROLL_OLDEST(ring, written);
+	reader->Next = (written > back ? written - back : 0);
+	if (reader->Next < oldest) reader->Next = oldest;
+	reader->Lost = 0;
+}
+
+
+
+
+
+/********************** preroll_read() *********************
+ * Reader: Copies the next frames out of the ring.
+ *
+ * buffer =		Where to copy them.
+ * max =			Room for how many frames.
+ *
+ * RETURNS: How many frames were copied. 0 if the reader has
+ * caught up to the live audio.
+ *
+ * NOTE: If the capture thread wrote over frames that we
+ * hadn't read yet, we skip them, and add how many to
+ * reader->Lost.
+ */
+
+unsigned int preroll_read(PREROLL *ring, PREROLL_READER *reader, void *buffer, unsigned int max)
+{
+	for (;;)
+	{
+		register unsigned long long	written, oldest;
+		register unsigned int			count, pos, first;
+
+		written = __atomic_load_n(&ring->Written, __ATOMIC_ACQUIRE);
+		oldest = PREROLL_OLDEST(ring, written);
+		if (reader->Next < oldest)
+		{
+			reader->Lost += oldest - reader->Next;
+			reader->Next = oldest;
+		}
+
+		if (!(count = (written - reader->Next > max ? max : (unsigned int)(written - reader->Next)))) return(0);
+
+		// Copy them out (in 2 pieces if they wrap around the end of the ring)
+		pos = (unsigned int)(reader->Next % ring->Frames);
+		first = ring->Frames - pos;
+		if (first > count) first = count;
+		memcpy(buffer, ring->Buffer + (unsigned long long)pos * ring->FrameBytes, (size_t)first * ring->FrameBytes);
+		if (count > first) memcpy((unsigned char *)buffer + (size_t)first * ring->FrameBytes, ring->Buffer, (size_t)(count - first) * ring->FrameBytes);
+
+		// Make sure the capture thread didn't start writing over them while
+		// we copied. If it did, try again with what's still there
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		written = __atomic_load_n(&ring->Written, __ATOMIC_RELAXED);
+		if (reader->Next >= PREROLL_OLDEST(ring, written))
+		{
+			reader->Next += count;
+			return(count);
+		}
+	}
+}
@@ -0,0 +1,62 @@
+// preroll.h
+// An always-on ring of the last few seconds of captured audio, so
+// that when someone presses "record" a moment too late, we can still
+// save what came just before.
+//
+// The capture thread reads each period from the card straight into
+// the ring (no copying, and no allocating), and just keeps going
+// around it, writing over the oldest audio. It never waits for
+// anyone. When recording is triggered, a reader starts some seconds
+// back in the ring (the "pre-roll"), and copies from there on out to
+// the disk, catching up to the live audio and then keeping up with
+// it.
+//
+// The reader copies the audio out of the ring, then checks that the
+// capture thread hadn't already started writing over it (like a
+// seqlock). So if the disk is so slow that the capture thread laps
+// the reader, the reader knows, skips ahead to audio that's still
+// there, and counts how many frames it lost. It never saves audio
+// that was half written over.
+//
+// The ring is allocated (and every page of it touched, and locked
+// into RAM if we're allowed) once, at the start. We first ask for
+// huge pages (2 MB each, from the pool that
+// /proc/sys/vm/nr_hugepages sets up), so a ring of many MB needs
+// only a few TLB entries. If there are none, we ask the kernel to
+// use transparent huge pages for it, else it's ordinary pages.
+
+#ifndef PREROLL_H
+#define PREROLL_H
+
+// What kind of pages the ring got
+#define PREROLL_PAGES_NORMAL		0
+#define PREROLL_PAGES_TRANSPARENT	1	// We asked for transparent huge pages (the kernel may or may not have used them)
+#define PREROLL_PAGES_HUGE			2	// Huge pages, from the hugetlb pool
+
+typedef struct _PREROLL
+{
+	unsigned long long	Written __attribute__((aligned(64)));	// How many frames the capture thread has put in, ever
+	unsigned char			*Buffer __attribute__((aligned(64)));
+	unsigned long long	MapSize;		// How many bytes we mapped
+	unsigned int			Frames;		// How many frames the ring holds
+	unsigned int			FrameBytes;	// Bytes per frame
+	unsigned int			Margin;		// The most frames the capture thread fills before it commits them
+	unsigned char			Pages;		// PREROLL_PAGES_xxx
+	unsigned char			Locked;		// 1 if the ring is locked into RAM
+} PREROLL;
+
+// One reader's place in the ring. Only that reader's thread may use it
+typedef struct _PREROLL_READER
+{
+	unsigned long long	Next;			// The next frame to read
+	unsigned long long	Lost;			// How many frames were written over before we read them
+} PREROLL_READER;
+
+int preroll_init(PREROLL *, unsigned int, unsigned int, unsigned int);
+void preroll_free(PREROLL *);
+void * preroll_write_ptr(PREROLL *, unsigned int *);
+void preroll_commit(PREROLL *, unsigned int);
+void preroll_reader_init(PREROLL *, PREROLL_READER *, unsigned long long);
+unsigned int preroll_read(PREROLL *, PREROLL_READER *, void *, unsigned int);
+
+#endif
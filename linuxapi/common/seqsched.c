@@ -0,0 +1,244 @@
+// seqsched.c
+// Timed MIDI output through the ALSA sequencer's kernel queue. See
+// seqsched.h.
+//
+// Compile it along with the program that uses it, and timing.c. For example:
+// gcc -o midischedbench midischedbench.c ../../common/midisched.c ../../common/mididev.c ../../common/devalloc.c ../../common/seqsched.c ../../common/midienc.c ../../common/midiparse.c ../../common/timing.c -lasound -lpthread -lm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include "seqsched.h"
+
+
+
+
+
+/********************* seq_sched_open() *********************
+ * Initializes a SEQSCHED. Creates a sequencer client with a
+ * port connected to the specified MIDI output, and starts
+ * a queue.
+ *
+ * dest =		The sequencer address of the MIDI output, ie
+ *					"20:0", or a client name such as "USB MIDI:0".
+ *					("aconnect -o" lists them.)
+ * poolSize =	How many events the kernel should hold for us at
+ *					once, or 0 for SEQSCHED_POOLSIZE.
+ * batchSize =	How many bytes of events to batch up before
+ *					handing them to the kernel, or 0 for
+ *					SEQSCHED_BATCHSIZE.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+int seq_sched_open(SEQSCHED *sched, const char *dest, unsigned int poolSize, unsigned int batchSize)
+{
+	snd_seq_queue_status_t		*status;
+	const snd_seq_real_time_t	*realTime;
+	snd_seq_addr_t					addr;
+	unsigned long long			before, after;
+	register int					err;
+
+	memset(sched, 0, sizeof(SEQSCHED));
+	sched->Queue = sched->Port = -1;
+
+	if ((err = snd_seq_open(&sched->Handle, "default", SND_SEQ_OPEN_OUTPUT, SND_SEQ_NONBLOCK)) < 0) goto bad2;
+	snd_seq_set_client_name(sched->Handle, "seqsched");
+
+	if ((err = snd_seq_parse_address(sched->Handle, &addr, dest)) < 0) goto bad;
+
+	// Create our port, and connect it to the output. We send our events to
+	// whoever is subscribed to our port, so others can listen in too
+	if ((err = sched->Port = snd_seq_create_simple_port(sched->Handle, "seqsched", SND_SEQ_PORT_CAP_READ|SND_SEQ_PORT_CAP_SUBS_READ, SND_SEQ_PORT_TYPE_MIDI_GENERIC|SND_SEQ_PORT_TYPE_APPLICATION)) < 0) goto bad;
+	if ((err = snd_seq_connect_to(sched->Handle, sched->Port, addr.client, addr.port)) < 0) goto bad;
+
+	// The kernel's pool limits how far ahead we can queue. Our output buffer
+	// sets how many events we hand over per write()
+	if ((err = snd_seq_set_client_pool_output(sched->Handle, poolSize ? poolSize : SEQSCHED_POOLSIZE)) < 0 ||
+		(err = snd_seq_set_output_buffer_size(sched->Handle, batchSize ? batchSize : SEQSCHED_BATCHSIZE)) < 0)
+	{
+		goto bad;
+	}
+
+	// We need to turn MIDI bytes into sequencer events. SysEx we do ourselves,
+	// so the encoder only needs room for a short message
+	if ((err = snd_midi_event_new(16, &sched->Encoder)) < 0) goto bad;
+
+	if ((err = sched->Queue = snd_seq_alloc_named_queue(sched->Handle, "seqsched")) < 0) goto bad;
+	if ((err = snd_seq_start_queue(sched->Handle, sched->Queue, 0)) < 0 || (err = snd_seq_drain_output(sched->Handle)) < 0) goto bad;
+
+	// Find out what monotonic time the queue's time 0 is. We read the queue's
+	// time between two reads of the clock, and split the difference
+	if ((err = snd_seq_queue_status_malloc(&status)) < 0) goto bad;
+	before = get_time_ns();
+	err = snd_seq_get_queue_status(sched->Handle, sched->Queue, status);
+	after = get_time_ns();
+	if (err >= 0)
+	{
+		realTime = snd_seq_queue_status_get_real_time(status);
+		sched->Start = before + (after - before) / 2 - ((unsigned long long)realTime->tv_sec * 1000000000ULL + realTime->tv_nsec);
+	}
+	snd_seq_queue_status_free(status);
+	if (err >= 0) return(0);
+
+bad:
+	seq_sched_close(sched);
+bad2:
+	return(err);
+}
+
+
+
+
+
+/********************* seq_sched_add() *********************
+ * Adds a MIDI message to the batch of events for the
+ * kernel's queue, to be sent at the specified time. If
+ * the batch is full, hands it to the kernel first.
+ *
+ * time =	When to send it, in nanoseconds (monotonic clock,
+ *				as returned by get_time_ns()). A time that has
+ *				already passed means "as soon as possible".
+ * msg =		The message's bytes. It must be one complete
+ *				message.
+ * len =		How many bytes.
+ *
+ * RETURNS: 0 if success, -EAGAIN if the kernel's pool is
+ * full (wait for POLLOUT, then call seq_sched_flush(), and
+ * add the message again), or another negative error number.
+ *
+ * NOTE: A SysEx isn't copied until the batch is handed to the
+ * kernel, so the caller must leave its buffer alone until
+ * then. It must fit in the batch.
+ */
+
+int seq_sched_add(SEQSCHED *sched, unsigned long long time, const unsigned char *msg, unsigned int len)
+{
+	snd_seq_event_t		ev;
+	snd_seq_real_time_t	rt;
+	register int			err;
+
+	if (!len) return(-EINVAL);
+
+	snd_seq_ev_clear(&ev);
+	if (msg[0] == 0xF0)
+		snd_seq_ev_set_sysex(&ev, len, msg);
+	else
+	{
+		snd_midi_event_reset_encode(sched->Encoder);
+		if (snd_midi_event_encode(sched->Encoder, msg, len, &ev) < 0 || ev.type == SND_SEQ_EVENT_NONE) return(-EINVAL);
+	}
+
+	// Convert to the queue's time
+	time = (time > sched->Start ? time - sched->Start : 0);
+	rt.tv_sec = (unsigned int)(time / 1000000000ULL);
+	rt.tv_nsec = (unsigned int)(time % 1000000000ULL);
+
+	snd_seq_ev_set_source(&ev, sched->Port);
+	snd_seq_ev_set_subs(&ev);
+	snd_seq_ev_schedule_real(&ev, sched->Queue, 0, &rt);
+
+	// Batch it up. If the batch is full, hand it to the kernel and try again
+	if ((err = snd_seq_event_output_buffer(sched->Handle, &ev)) == -EAGAIN)
+	{
+		if ((err = seq_sched_flush(sched)) < 0) return(err);
+		err = snd_seq_event_output_buffer(sched->Handle, &ev);
+	}
+	if (err < 0) return(err);
+
+	++sched->Events;
+	return(0);
+}
+
+
+
+
+
+/********************* seq_sched_flush() *********************
+ * Hands the batch of events to the kernel's queue.
+ *
+ * RETURNS: 0 if success, -EAGAIN if the kernel's pool is
+ * full (some of the batch may have been taken), or another
+ * negative error number.
+ */
+
+int seq_sched_flush(SEQSCHED *sched)
+{
+	register int	err;
+
+	if (!snd_seq_event_output_pending(sched->Handle)) return(0);
+
+	++sched->Writes;
+	if ((err = snd_seq_drain_output(sched->Handle)) == -EAGAIN) ++sched->Full;
+	return(err < 0 ? err : 0);
+}
+
+
+
+
+
+/********************* seq_sched_poll_descriptors() *********************
+ * Fills in the pollfd's to wait on for room in the
+ * kernel's pool (POLLOUT).
+ *
+ * space =	How many pollfd's "pfds" has room for.
+ *
+ * RETURNS: How many pollfd's filled in.
+ */
+
+int seq_sched_poll_descriptors(SEQSCHED *sched, struct pollfd *pfds, unsigned int space)
+{
+	return(snd_seq_poll_descriptors(sched->Handle, pfds, space, POLLOUT));
+}
+
+
+
+
+
+/********************* seq_sched_drain() *********************
+ * Hands any batched events to the kernel, and waits until
+ * the queue has sent them all.
+ */
+
+void seq_sched_drain(SEQSCHED *sched)
+{
+	struct pollfd	*pfds;
+	register int	npfds;
+
+	npfds = snd_seq_poll_descriptors_count(sched->Handle, POLLOUT);
+	pfds = (struct pollfd *)alloca(npfds * sizeof(struct pollfd));
+	npfds = seq_sched_poll_descriptors(sched, pfds, npfds);
+
+	while (seq_sched_flush(sched) == -EAGAIN) poll(pfds, npfds, 100);
+
+	snd_seq_sync_output_queue(sched->Handle);
+}
+
+
+
+
+
+/********************* seq_sched_close() *********************
+ * Frees the queue, the port, and the client. Any events
+ * not yet sent are thrown away.
+ */
+
+void seq_sched_close(SEQSCHED *sched)
+{
+	if (sched->Handle)
+	{
+		snd_seq_drop_output(sched->Handle);
+		if (sched->Queue >= 0) snd_seq_free_queue(sched->Handle, sched->Queue);
+		if (sched->Port >= 0) snd_seq_delete_simple_port(sched->Handle, sched->Port);
+		snd_seq_close(sched->Handle);
+		sched->Handle = 0;
+	}
+
+	if (sched->Encoder)
+	{
+		snd_midi_event_free(sched->Encoder);
+		sched->Encoder = 0;
+	}
+}
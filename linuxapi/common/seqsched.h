@@ -0,0 +1,67 @@
+// seqsched.h
+// Timed MIDI output through the ALSA sequencer, instead of our
+// own scheduler thread (see midisched.h).
+//
+// The rawmidi API does no sequenced playback. Our MIDI scheduler
+// makes up for that with a real-time thread that wakes up at each
+// event's time and calls snd_rawmidi_write(). How accurate that is
+// depends on how quickly the OS wakes our thread, which may not be
+// very quickly when the system is busy (or when we can't get
+// real-time priority).
+//
+// The sequencer lets us hand each event to the kernel ahead of
+// time, stamped with when it should be sent. The kernel keeps them
+// in a queue, and its timer (an hrtimer, on most systems) sends
+// each one to the MIDI port at its time. So the timing-critical
+// wakeups happen in the kernel, not in our process, and we only
+// need to keep the queue fed.
+//
+// We feed it in batches. Each seq_sched_add() just puts the event
+// in ALSA's output buffer. seq_sched_flush() hands the whole buffer
+// to the kernel in one write.
+//
+// We open the sequencer in non-blocking mode, so when the kernel's
+// pool of events for our client is full, we return -EAGAIN rather
+// than wait for the queue to drain. Poll the sequencer's
+// descriptors for POLLOUT (see seq_sched_poll_descriptors()), then
+// flush and add more.
+//
+// Times are given in nanoseconds on the monotonic clock, the same
+// as for midi_sched_add(). We work out what queue time that is from
+// when the queue started.
+
+#ifndef SEQSCHED_H
+#define SEQSCHED_H
+
+#include <alsa/asoundlib.h>
+#include "timing.h"
+
+// Default for how many events the kernel holds for us at once
+#define SEQSCHED_POOLSIZE		1000
+
+// Default for how many bytes of events we batch up before handing
+// them to the kernel. An event is 28 bytes (plus the data for a
+// SysEx)
+#define SEQSCHED_BATCHSIZE		(256 * 28)
+
+// A sequencer scheduler
+typedef struct _SEQSCHED
+{
+	snd_seq_t				*Handle;		// Our sequencer client
+	snd_midi_event_t		*Encoder;	// Turns MIDI bytes into sequencer events
+	unsigned long long	Start;		// The monotonic time when the queue's time was 0
+	int						Queue;		// Our queue
+	int						Port;			// Our port, which is connected to the output
+	unsigned long			Events;		// How many events added
+	unsigned long			Writes;		// How many times we handed a batch to the kernel
+	unsigned long			Full;			// How many times the kernel's pool was full
+} SEQSCHED;
+
+int seq_sched_open(SEQSCHED *, const char *, unsigned int, unsigned int);
+int seq_sched_add(SEQSCHED *, unsigned long long, const unsigned char *, unsigned int);
+int seq_sched_flush(SEQSCHED *);
+int seq_sched_poll_descriptors(SEQSCHED *, struct pollfd *, unsigned int);
+void seq_sched_drain(SEQSCHED *);
+void seq_sched_close(SEQSCHED *);
+
+#endif
@@ -0,0 +1,568 @@
+// smf.c
+// Loads a Standard MIDI File into a time-sorted event array.
+// See smf.h.
+//
+// Compile it along with the program that uses it, for example:
+// gcc -o smfplay smfplay.c ../../common/smf.c ../../common/midisched.c ../../common/mididev.c ../../common/devalloc.c ../../common/midienc.c ../../common/timing.c -lasound -lpthread -lm
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "smf.h"
+
+
+
+
+
+// What a track's next event is
+#define SMF_NEXT_MIDI	0	// A channel message, in Msg[]
+#define SMF_NEXT_SYSEX	1	// An 0xF0 SysEx. Its bytes (after the 0xF0) are at Data
+#define SMF_NEXT_ESCAPE	2	// An 0xF7 "escape". Its bytes are at Data, to be sent as is
+#define SMF_NEXT_TEMPO	3	// A tempo change, in Tempo
+#define SMF_NEXT_END		4	// The end of the track
+
+// A track we're reading. We decode one event ahead, so the merge can
+// compare the tracks' next times
+typedef struct _SMF_TRACK
+{
+	const unsigned char	*Ptr;			// The next byte to decode
+	const unsigned char	*End;			// The end of the track's data
+	const unsigned char	*Data;		// SMF_NEXT_SYSEX/ESCAPE: The event's bytes
+	unsigned int			Tick;			// Time of the next event, in ticks
+	unsigned int			Length;		// How many bytes in the next event
+	unsigned int			Tempo;		// SMF_NEXT_TEMPO: Microseconds per quarter note
+	unsigned char			Next;			// SMF_NEXT_xxx
+	unsigned char			Status;		// The running status
+	unsigned char			Msg[3];		// SMF_NEXT_MIDI: The message
+} SMF_TRACK;
+
+// The state of our merge
+typedef struct _SMF_LOAD
+{
+	SMF						*Smf;
+	unsigned int			EventSize;		// How many SMF_EVENTs fit in Smf->Events
+	unsigned int			ExtraSize;		// How many bytes fit in Smf->Extra
+	unsigned int			TempoSize;		// How many SMF_TEMPOs fit in Smf->Tempos
+	unsigned int			Tempo;			// The current tempo (microseconds per quarter note)
+	unsigned int			TempoTick;		// When the current tempo started, in ticks
+	unsigned long long	TempoTime;		// ... and in nanoseconds
+	double					NsPerTick;		// For an SMPTE division, the length of a tick
+} SMF_LOAD;
+
+
+
+
+
+/********************* read_vlq() *********************
+ * Decodes a variable length quantity (up to 4 bytes, 7
+ * bits per byte, with the high bit set on all but the
+ * last byte).
+ *
+ * RETURNS: The value, or -1 if the track ends in the
+ * middle of it.
+ */
+
+static int read_vlq(SMF_TRACK *track)
+{
+	register const unsigned char	*ptr;
+	register unsigned int			value, i;
+
+	ptr = track->Ptr;
+	value = 0;
+	for (i = 0; i < 4 && ptr < track->End; i++)
+	{
+		value = (value << 7) | (*ptr & 0x7F);
+		if (!(*ptr++ & 0x80))
+		{
+			track->Ptr = ptr;
+			return((int)value);
+		}
+	}
+
+	return(-1);
+}
+
+
+
+
+
+/********************* read_event() *********************
+ * Decodes a track's next event (that we care about), and
+ * its time. Meta events other than tempo and end of
+ * track are skipped. A corrupt track is treated as if it
+ * ended.
+ */
+
+static void read_event(SMF_TRACK *track)
+{
+	register int	delta, len;
+
+	for (;;)
+	{
+		if (track->Ptr >= track->End || (delta = read_vlq(track)) < 0) goto end;
+		track->Tick += (unsigned int)delta;
+		if (track->Ptr >= track->End) goto end;
+
+		switch (*track->Ptr)
+		{
+			// ========================= Meta event ==========================
+			case 0xFF:
+			{
+				register unsigned char	type;
+
+				if (track->Ptr + 2 > track->End) goto end;
+				type = track->Ptr[1];
+				track->Ptr += 2;
+				if ((len = read_vlq(track)) < 0 || track->Ptr + len > track->End) goto end;
+
+				// End of track
+				if (type == 0x2F) goto end;
+
+				// NOTE: Strictly, a meta event cancels running status. But some files
+				// rely on it carrying over, and nothing is lost by allowing that
+
+				// Tempo, in microseconds per quarter note
+				if (type == 0x51 && len == 3)
+				{
+					track->Tempo = ((unsigned int)track->Ptr[0] << 16) | ((unsigned int)track->Ptr[1] << 8) | track->Ptr[2];
+					track->Ptr += 3;
+					if (!track->Tempo) continue;
+					track->Next = SMF_NEXT_TEMPO;
+					return;
+				}
+
+				// Anything else (ie, text) doesn't affect playback
+				track->Ptr += len;
+				continue;
+			}
+
+			// ========================= SysEx ==========================
+			case 0xF0:
+			case 0xF7:
+			{
+				track->Next = (*track->Ptr == 0xF0 ? SMF_NEXT_SYSEX : SMF_NEXT_ESCAPE);
+				++track->Ptr;
+				if ((len = read_vlq(track)) < 0 || track->Ptr + len > track->End) goto end;
+				track->Data = track->Ptr;
+				track->Length = (unsigned int)len;
+				track->Ptr += len;
+
+				// SysEx cancels running status
+				track->Status = 0;
+
+				// An empty one has nothing to send
+				if (!len) continue;
+				return;
+			}
+
+			// ========================= Channel message ==========================
+			default:
+			{
+				// A new status, or running status?
+				if (*track->Ptr & 0x80) track->Status = *track->Ptr++;
+				else if (!track->Status) goto end;
+
+				// Program change and channel pressure have 1 data byte. The others have 2
+				track->Length = ((track->Status & 0xE0) == 0xC0 ? 2 : 3);
+				if (track->Ptr + track->Length - 1 > track->End) goto end;
+				track->Msg[0] = track->Status;
+				track->Msg[1] = track->Ptr[0] & 0x7F;
+				track->Msg[2] = (track->Length > 2 ? track->Ptr[1] & 0x7F : 0);
+				track->Ptr += track->Length - 1;
+				track->Next = SMF_NEXT_MIDI;
+				return;
+			}
+		}
+	}
+
+end:
+	track->Next = SMF_NEXT_END;
+}
+
+
+
+
+
+/********************* tick_to_time() *********************
+ * Converts a time in ticks to nanoseconds, using the
+ * current tempo.
+ */
+
+static unsigned long long tick_to_time(SMF_LOAD *load, unsigned int tick)
+{
+	register unsigned long long	us;
+	register unsigned int		division;
+
+	if (load->NsPerTick != 0.0) return((unsigned long long)((double)tick * load->NsPerTick));
+
+	// Microseconds (times the division) since the last tempo change. We split the
+	// division so that the multiply by 1000 can't overflow
+	division = (unsigned int)load->Smf->Division;
+	us = (unsigned long long)(tick - load->TempoTick) * load->Tempo;
+	return(load->TempoTime + (us / division) * 1000ULL + (us % division) * 1000ULL / division);
+}
+
+
+
+
+
+/********************* add_event() *********************
+ * Appends a track's next event to the song's events.
+ *
+ * RETURNS: 0 if success, or -ENOMEM.
+ */
+
+static int add_event(SMF_LOAD *load, SMF_TRACK *track, unsigned int trackNum)
+{
+	register SMF				*smf;
+	register SMF_EVENT		*event;
+
+	smf = load->Smf;
+
+	if (smf->EventCount >= load->EventSize)
+	{
+		load->EventSize *= 2;
+		if (!(event = (SMF_EVENT *)realloc(smf->Events, load->EventSize * sizeof(SMF_EVENT)))) return(-ENOMEM);
+		smf->Events = event;
+	}
+
+	event = &smf->Events[smf->EventCount++];
+	event->Time = tick_to_time(load, track->Tick);
+	event->Tick = track->Tick;
+	event->Track = (unsigned char)trackNum;
+
+	if (track->Next == SMF_NEXT_MIDI)
+	{
+		event->Length = track->Length;
+		event->Offset = 0;
+		memcpy(&event->Msg[0], &track->Msg[0], 3);
+	}
+	else
+	{
+		register unsigned char	*ptr;
+		register unsigned int	len;
+
+		// A SysEx is stored in the file without its 0xF0, so we put it back. We copy
+		// it into our Extra buffer, so that we don't need the file after loading
+		len = track->Length + (track->Next == SMF_NEXT_SYSEX);
+		if (smf->ExtraSize + len > load->ExtraSize)
+		{
+			load->ExtraSize = (load->ExtraSize + len) * 2;
+			if (!(ptr = (unsigned char *)realloc(smf->Extra, load->ExtraSize))) return(-ENOMEM);
+			smf->Extra = ptr;
+		}
+
+		event->Offset = smf->ExtraSize;
+		event->Length = len;
+		ptr = smf->Extra + smf->ExtraSize;
+		if (track->Next == SMF_NEXT_SYSEX) *ptr++ = 0xF0;
+		memcpy(ptr, track->Data, track->Length);
+		smf->ExtraSize += len;
+
+		// Keep the first bytes in Msg[] too, so the caller can check the status the same
+		// way for all events (and so a short one is where SMF_EVENT_BYTES() looks)
+		event->Msg[1] = event->Msg[2] = 0;
+		memcpy(&event->Msg[0], smf->Extra + event->Offset, len < 3 ? len : 3);
+	}
+
+	return(0);
+}
+
+
+
+
+
+/********************* set_tempo() *********************
+ * Applies a tempo change, and adds it to the tempo map.
+ *
+ * RETURNS: 0 if success, or -ENOMEM.
+ */
+
+static int set_tempo(SMF_LOAD *load, SMF_TRACK *track)
+{
+	register SMF				*smf;
+	register SMF_TEMPO		*tempo;
+
+	smf = load->Smf;
+
+	// Tempo means nothing with an SMPTE division
+	if (load->NsPerTick != 0.0) return(0);
+
+	load->TempoTime = tick_to_time(load, track->Tick);
+	load->TempoTick = track->Tick;
+	load->Tempo = track->Tempo;
+
+	if (smf->TempoCount >= load->TempoSize)
+	{
+		load->TempoSize = (load->TempoSize + 8) * 2;
+		if (!(tempo = (SMF_TEMPO *)realloc(smf->Tempos, load->TempoSize * sizeof(SMF_TEMPO)))) return(-ENOMEM);
+		smf->Tempos = tempo;
+	}
+
+	tempo = &smf->Tempos[smf->TempoCount++];
+	tempo->Time = load->TempoTime;
+	tempo->Tick = load->TempoTick;
+	tempo->Tempo = load->Tempo;
+
+	return(0);
+}
+
+
+
+
+
+/********************* earlier() *********************
+ * Returns non-zero if track "a"'s next event should come
+ * before track "b"'s. At the same tick, the lower track
+ * number goes first. So in a format 1 file, a tempo change
+ * in the first track takes effect before any notes at the
+ * same time.
+ */
+
+static inline int earlier(const SMF_TRACK *tracks, unsigned short a, unsigned short b)
+{
+	return(tracks[a].Tick < tracks[b].Tick || (tracks[a].Tick == tracks[b].Tick && a < b));
+}
+
+
+
+
+
+/********************* sift_down() *********************
+ * Moves the track at heap[i] down the merge heap to where
+ * it belongs.
+ */
+
+static void sift_down(const SMF_TRACK *tracks, unsigned short *heap, unsigned int count, unsigned int i)
+{
+	register unsigned int	child;
+	register unsigned short	top;
+
+	top = heap[i];
+	while ((child = i * 2 + 1) < count)
+	{
+		if (child + 1 < count && earlier(tracks, heap[child + 1], heap[child])) ++child;
+		if (!earlier(tracks, heap[child], top)) break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = top;
+}
+
+
+
+
+
+/********************* smf_load() *********************
+ * Loads a MIDI file.
+ *
+ * smf =		The SMF to fill in.
+ * name =	The file's name.
+ *
+ * RETURNS: 0 if success, or a negative error number. -EINVAL
+ * means it's not a MIDI file (or is format 2, which we don't
+ * play).
+ *
+ * NOTE: Call smf_free() when done with the SMF (even if this
+ * fails).
+ */
+
+int smf_load(SMF *smf, const char *name)
+{
+	struct stat						info;
+	SMF_LOAD							load;
+	register const unsigned char	*file, *ptr, *end;
+	SMF_TRACK						*tracks;
+	unsigned short					*heap;
+	register unsigned int		count, i;
+	register int					err, handle;
+
+	memset(smf, 0, sizeof(SMF));
+
+	// Map the file into memory. We read it from start to end once, so tell the
+	// kernel to read ahead
+	if ((handle = open(name, O_RDONLY)) == -1) return(-errno);
+	if (fstat(handle, &info))
+	{
+		err = -errno;
+		close(handle);
+		return(err);
+	}
+	if (info.st_size < 14)
+	{
+		close(handle);
+		return(-EINVAL);
+	}
+	file = (const unsigned char *)mmap(0, info.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, handle, 0);
+	err = -errno;
+	close(handle);
+	if (file == MAP_FAILED) return(err);
+	madvise((void *)file, info.st_size, MADV_SEQUENTIAL);
+
+	tracks = 0;
+	err = -EINVAL;
+	end = file + info.st_size;
+
+	// The header chunk: "MThd", its length (6), format, number of tracks, and division
+	if (memcmp(file, "MThd", 4)) goto out;
+	count = ((unsigned int)file[4] << 24) | (file[5] << 16) | (file[6] << 8) | file[7];
+	if (count < 6 || count > info.st_size - 8) goto out;
+	smf->Format = ((unsigned short)file[8] << 8) | file[9];
+	smf->Tracks = ((unsigned short)file[10] << 8) | file[11];
+	smf->Division = (short)(((unsigned short)file[12] << 8) | file[13]);
+	if (smf->Format > 1 || !smf->Tracks || !smf->Division) goto out;
+
+	memset(&load, 0, sizeof(load));
+	load.Smf = smf;
+	load.Tempo = 500000;		// 120 BPM until the file says otherwise
+
+	// A negative division is the SMPTE frame rate (with 29 meaning 29.97), and the
+	// low byte is ticks per frame
+	if (smf->Division < 0)
+	{
+		register double	fps;
+
+		fps = (double)(-(smf->Division >> 8));
+		if (fps == 29.0) fps = 30000.0 / 1001.0;
+		if (!(smf->Division & 0xFF)) goto out;
+		load.NsPerTick = 1000000000.0 / (fps * (smf->Division & 0xFF));
+	}
+
+	err = -ENOMEM;
+	if (!(tracks = (SMF_TRACK *)calloc(smf->Tracks, sizeof(SMF_TRACK) + sizeof(unsigned short)))) goto out;
+	heap = (unsigned short *)(tracks + smf->Tracks);
+
+	// Find each track chunk ("MTrk"). We skip any other chunks
+	ptr = file + 8 + count;
+	count = 0;
+	while (count < smf->Tracks && ptr + 8 <= end)
+	{
+		register unsigned long	len;
+
+		len = ((unsigned long)ptr[4] << 24) | (ptr[5] << 16) | (ptr[6] << 8) | ptr[7];
+		ptr += 8;
+		if (len > (unsigned long)(end - ptr)) len = end - ptr;
+		if (!memcmp(ptr - 8, "MTrk", 4))
+		{
+			tracks[count].Ptr = ptr;
+			tracks[count].End = ptr + len;
+			++count;
+		}
+		ptr += len;
+	}
+	smf->Tracks = (unsigned short)count;
+
+	// Start with room for an event per 3 bytes of the file, which is about what
+	// dense note data needs
+	load.EventSize = (unsigned int)(info.st_size / 3) + 16;
+	if (!(smf->Events = (SMF_EVENT *)malloc(load.EventSize * sizeof(SMF_EVENT)))) goto out;
+
+	// Decode the first event of each track, and put the tracks in a heap ordered by
+	// the time of that event
+	for (i = 0; i < count; i++)
+	{
+		read_event(&tracks[i]);
+		heap[i] = (unsigned short)i;
+	}
+	for (i = count / 2; i-- > 0;) sift_down(tracks, heap, count, i);
+
+	// Repeatedly take the earliest event of all the tracks, then decode that track's
+	// next event, and put it back in the heap. A track that ends leaves the heap
+	while (count)
+	{
+		register SMF_TRACK	*track;
+
+		track = &tracks[heap[0]];
+		switch (track->Next)
+		{
+			case SMF_NEXT_END:
+			{
+				register unsigned long long	time;
+
+				if ((time = tick_to_time(&load, track->Tick)) > smf->Duration) smf->Duration = time;
+				heap[0] = heap[--count];
+				if (count) sift_down(tracks, heap, count, 0);
+				continue;
+			}
+
+			case SMF_NEXT_TEMPO:
+				if ((err = set_tempo(&load, track)) < 0) goto out;
+				break;
+
+			default:
+				if ((err = add_event(&load, track, heap[0])) < 0) goto out;
+		}
+
+		read_event(track);
+		sift_down(tracks, heap, count, 0);
+	}
+
+	// Give back the room we didn't use
+	if (smf->EventCount && smf->EventCount < load.EventSize)
+	{
+		register SMF_EVENT	*events;
+
+		if ((events = (SMF_EVENT *)realloc(smf->Events, smf->EventCount * sizeof(SMF_EVENT)))) smf->Events = events;
+	}
+
+	if (smf->EventCount && smf->Events[smf->EventCount - 1].Time > smf->Duration) smf->Duration = smf->Events[smf->EventCount - 1].Time;
+
+	err = 0;
+out:
+	if (tracks) free(tracks);
+	munmap((void *)file, info.st_size);
+	return(err);
+}
+
+
+
+
+
+/********************* smf_free() *********************
+ * Frees an SMF loaded by smf_load().
+ */
+
+void smf_free(SMF *smf)
+{
+	if (smf->Events) free(smf->Events);
+	if (smf->Tempos) free(smf->Tempos);
+	if (smf->Extra) free(smf->Extra);
+	memset(smf, 0, sizeof(SMF));
+}
+
+
+
+
+
+/********************* smf_seek() *********************
+ * Finds the first event at (or after) the specified time.
+ *
+ * time =	Nanoseconds from the start of the song.
+ *
+ * RETURNS: The index of the event in smf->Events, or
+ * smf->EventCount if there are no events that late.
+ */
+
+unsigned int smf_seek(const SMF *smf, unsigned long long time)
+{
+	register unsigned int	lo, hi;
+
+	lo = 0;
+	hi = smf->EventCount;
+	while (lo < hi)
+	{
+		register unsigned int	mid;
+
+		mid = lo + (hi - lo) / 2;
+		if (smf->Events[mid].Time < time)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return(lo);
+}
@@ -0,0 +1,58 @@
+// smf.h
+// Loads a Standard MIDI File (format 0 or 1) into one array
+// of events, sorted by time, ready to play.
+//
+// The file is memory-mapped, and each track's variable length
+// quantities are decoded once, as we merge the tracks. We keep
+// the tracks' next events in a heap, so merging n events from k
+// tracks takes O(n log k). Tempo changes are applied as we go,
+// so each event's time is already in nanoseconds from the start
+// of the song. Playing is then just sending each event at its
+// time, and seeking is a binary search of the array.
+
+#ifndef SMF_H
+#define SMF_H
+
+// One event of the song. It's 24 bytes. Messages of up to 3 bytes
+// are in Msg[]. Longer ones (SysEx, and 0xF7 "escapes") are in
+// the SMF's Extra buffer. Use SMF_EVENT_BYTES() to get the bytes
+typedef struct _SMF_EVENT
+{
+	unsigned long long	Time;		// When to send it, in nanoseconds from the start of the song
+	unsigned int			Tick;		// The same, in the file's ticks
+	unsigned int			Offset;	// If Length > 3, where its bytes are in Extra
+	unsigned int			Length;	// How many bytes
+	unsigned char			Track;	// Which track it came from (the low 8 bits of the number)
+	unsigned char			Msg[3];	// The bytes, if Length <= 3
+} SMF_EVENT;
+
+#define SMF_EVENT_BYTES(smf, event)	((event)->Length > 3 ? (smf)->Extra + (event)->Offset : &(event)->Msg[0])
+
+// One entry of the tempo map
+typedef struct _SMF_TEMPO
+{
+	unsigned long long	Time;		// When the tempo changes, in nanoseconds
+	unsigned int			Tick;		// The same, in ticks
+	unsigned int			Tempo;	// Microseconds per quarter note
+} SMF_TEMPO;
+
+// A loaded MIDI file
+typedef struct _SMF
+{
+	SMF_EVENT				*Events;		// All the events, sorted by time
+	unsigned int			EventCount;
+	SMF_TEMPO				*Tempos;		// All the tempo changes, sorted by time
+	unsigned int			TempoCount;
+	unsigned char			*Extra;		// The bytes of the long events
+	unsigned int			ExtraSize;
+	unsigned long long	Duration;	// Time of the end of the last track, in nanoseconds
+	unsigned short			Format;		// 0 or 1
+	unsigned short			Tracks;		// How many tracks
+	short						Division;	// The file's header: Ticks per quarter note, or SMPTE format if negative
+} SMF;
+
+int smf_load(SMF *, const char *);
+void smf_free(SMF *);
+unsigned int smf_seek(const SMF *, unsigned long long);
+
+#endif
@@ -0,0 +1,143 @@
+// timing.c
+// Nanosecond clock helpers, and a histogram for collecting
+// latency/jitter measurements. See timing.h.
+//
+// Compile it along with the program that uses it, for example:
+// gcc -o rawmidiinput rawmidiinput.c ../../common/midiparse.c ../../common/ump.c ../../common/mididev.c ../../common/devalloc.c ../../common/timing.c ../../common/midilog.c -lasound -lpthread -lm
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "timing.h"
+
+
+
+
+
+/********************** get_time_ns() *********************
+ * Returns the current time of the monotonic clock, in
+ * nanoseconds. Unlike the time of day, this never jumps,
+ * so it's what we want for measuring intervals. It's also
+ * the clock we ask ALSA to timestamp MIDI input with.
+ */
+
+unsigned long long get_time_ns(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(timespec_to_ns(&ts));
+}
+
+
+
+
+
+/********************** timespec_to_ns() *********************
+ * Converts a timespec to nanoseconds.
+ */
+
+unsigned long long timespec_to_ns(const struct timespec *ts)
+{
+	return((unsigned long long)ts->tv_sec * 1000000000ULL + ts->tv_nsec);
+}
+
+
+
+
+
+/********************** ns_to_timespec() *********************
+ * Converts nanoseconds to a timespec (for example, to pass
+ * to clock_nanosleep()).
+ */
+
+void ns_to_timespec(unsigned long long ns, struct timespec *ts)
+{
+	ts->tv_sec = (time_t)(ns / 1000000000ULL);
+	ts->tv_nsec = (long)(ns % 1000000000ULL);
+}
+
+
+
+
+
+/********************** time_hist_init() *********************
+ * Empties a TIMEHIST.
+ */
+
+void time_hist_init(TIMEHIST *hist)
+{
+	memset(hist, 0, sizeof(TIMEHIST));
+	hist->Min = ~0ULL;
+}
+
+
+
+
+
+/********************** time_hist_add() *********************
+ * Adds one value (in nanoseconds) to a TIMEHIST.
+ */
+
+void time_hist_add(TIMEHIST *hist, unsigned long long ns)
+{
+	register unsigned int	bucket;
+
+	// The bucket is the position of the highest set bit
+	bucket = (ns ? 63 - __builtin_clzll(ns) : 0);
+	if (bucket >= TIMEHIST_BUCKETS) bucket = TIMEHIST_BUCKETS - 1;
+	++hist->Buckets[bucket];
+
+	++hist->Count;
+	if (ns < hist->Min) hist->Min = ns;
+	if (ns > hist->Max) hist->Max = ns;
+	hist->Sum += (double)ns;
+	hist->SumSquares += (double)ns * (double)ns;
+}
+
+
+
+
+
+/********************** time_hist_print() *********************
+ * Prints a TIMEHIST's min, mean, standard deviation, and max,
+ * followed by a bar for each non-empty bucket. All times are
+ * printed in microseconds.
+ *
+ * title =	A heading to print.
+ */
+
+void time_hist_print(const TIMEHIST *hist, const char *title)
+{
+	register unsigned int	i;
+	unsigned long				most;
+	double						mean, var;
+
+	printf("%s: %lu values\n", title, hist->Count);
+	if (!hist->Count) return;
+
+	mean = hist->Sum / hist->Count;
+	var = hist->SumSquares / hist->Count - mean * mean;
+	printf("   min %.3f us, mean %.3f us, stddev %.3f us, max %.3f us\n", hist->Min / 1000.0, mean / 1000.0,
+		(var > 0 ? sqrt(var) : 0.0) / 1000.0, hist->Max / 1000.0);
+
+	most = 0;
+	for (i = 0; i < TIMEHIST_BUCKETS; i++)
+	{
+		if (hist->Buckets[i] > most) most = hist->Buckets[i];
+	}
+
+	for (i = 0; i < TIMEHIST_BUCKETS; i++)
+	{
+		if (hist->Buckets[i])
+		{
+			char			bar[51];
+			register int	len;
+
+			len = (int)((hist->Buckets[i] * 50 + most - 1) / most);
+			memset(&bar[0], '#', len);
+			bar[len] = 0;
+			printf("   %12.3f us+ %10lu %s\n", (i ? (double)(1ULL << i) : 0.0) / 1000.0, hist->Buckets[i], &bar[0]);
+		}
+	}
+}
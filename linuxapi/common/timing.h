@@ -0,0 +1,30 @@
+// timing.h
+// Nanosecond clock helpers, and a histogram for collecting
+// latency/jitter measurements.
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <time.h>
+
+// How many buckets in a TIMEHIST. Bucket n counts the values from
+// 2^n up to (but not including) 2^(n+1) nanoseconds. Bucket 0 also
+// counts values of 0. The last bucket counts everything bigger
+#define TIMEHIST_BUCKETS	40
+
+typedef struct _TIMEHIST
+{
+	unsigned long			Buckets[TIMEHIST_BUCKETS];
+	unsigned long			Count;	// How many values we've added
+	unsigned long long	Min, Max;
+	double					Sum, SumSquares;
+} TIMEHIST;
+
+unsigned long long get_time_ns(void);
+unsigned long long timespec_to_ns(const struct timespec *);
+void ns_to_timespec(unsigned long long, struct timespec *);
+void time_hist_init(TIMEHIST *);
+void time_hist_add(TIMEHIST *, unsigned long long);
+void time_hist_print(const TIMEHIST *, const char *);
+
+#endif
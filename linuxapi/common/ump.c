@@ -0,0 +1,522 @@
+// ump.c
+// Parses MIDI 2.0 Universal MIDI Packets, and translates them to
+// and from MIDI 1.0 bytes. See ump.h.
+//
+// Compile it along with the program that uses it, and midiparse.c. For example:
+// gcc -o rawmidiinput rawmidiinput.c ../../common/midiparse.c ../../common/ump.c ../../common/mididev.c ../../common/devalloc.c ../../common/timing.c ../../common/midilog.c -lasound -lpthread -lm
+
+#include <string.h>
+#include "ump.h"
+#include "midiparse.h"
+
+
+
+
+
+// How many words are in each message type's packets. The types that
+// MIDI 2.0 hasn't defined yet still have sizes, so we can skip them
+const unsigned char UmpWordTable[16] = {
+	1, 1, 1, 2,		// Utility, system, MIDI 1.0 channel voice, 7-bit SysEx
+	2, 4, 1, 1,		// MIDI 2.0 channel voice, 8-bit data, (reserved)
+	2, 2, 2, 3,		// (reserved)
+	3, 4, 4, 4,		// (reserved), flex data, (reserved), stream
+};
+
+
+
+
+
+/******************** ump_parse_init() *******************
+ * Initializes a UMPPARSER before its first use, or resets
+ * it (ie, after an input overrun).
+ */
+
+void ump_parse_init(UMPPARSER *parser)
+{
+	memset(parser, 0, sizeof(UMPPARSER));
+}
+
+
+
+
+
+/*********************** ump_parse() **********************
+ * Splits the words read from a UMP device into packets.
+ *
+ * parser =		The UMPPARSER. A packet that isn't complete
+ *					at the end of the buffer is remembered here,
+ *					and finished on the next call.
+ * buffer =		The bytes read (32-bit words, in the CPU's byte
+ *					order). It needn't be aligned, nor end on a word.
+ * len =			How many bytes are in the buffer.
+ * time =		When they arrived (in nanoseconds). This is
+ *					stored in every UMPEVENT we return.
+ * events =		Where to put the packets.
+ * maxEvents =	How many UMPEVENTs fit in events[].
+ * used =		Where to return how many bytes of buffer were
+ *					consumed. This is "len" unless events[] filled
+ *					up. In that case, call ump_parse() again, passing
+ *					the remainder of the buffer.
+ *
+ * RETURNS: The number of UMPEVENTs stored in events[].
+ */
+
+unsigned int ump_parse(UMPPARSER *parser, const unsigned char *buffer, unsigned int len, unsigned long long time, UMPEVENT *events, unsigned int maxEvents, unsigned int *used)
+{
+	register const unsigned char	*ptr, *end;
+	register UMPEVENT					*event;
+	register unsigned int			size;
+
+	ptr = buffer;
+	end = buffer + len;
+	event = events;
+
+	while (ptr < end && event < events + maxEvents)
+	{
+		// Most of the time, the whole packet is in the buffer. Its first
+		// word's type says how big it is
+		if (!parser->Have && end - ptr >= 4)
+		{
+			memcpy(&event->Words[0], ptr, 4);
+			size = UMP_WORDS(event->Words[0]) * 4;
+			if (end - ptr >= size)
+			{
+				memcpy(&event->Words[1], ptr + 4, size - 4);
+				ptr += size;
+				goto got;
+			}
+		}
+
+		// Otherwise, collect it a piece at a time. First its first word (so
+		// we know its size), then the rest
+		size = (parser->Have < 4 ? 4 : UMP_WORDS(parser->Words[0]) * 4) - parser->Have;
+		if (size > (unsigned int)(end - ptr)) size = (unsigned int)(end - ptr);
+		memcpy((unsigned char *)&parser->Words[0] + parser->Have, ptr, size);
+		ptr += size;
+		if ((parser->Have += size) < 4 || parser->Have < UMP_WORDS(parser->Words[0]) * 4) continue;
+
+		memcpy(&event->Words[0], &parser->Words[0], parser->Have);
+		parser->Have = 0;
+
+got:	event->Time = time;
+		event->Type = (unsigned char)UMP_TYPE(event->Words[0]);
+		event->Group = (unsigned char)UMP_GROUP(event->Words[0]);
+		event->Length = UmpWordTable[event->Type];
+		++event;
+	}
+
+	*used = (unsigned int)(ptr - buffer);
+	return((unsigned int)(event - events));
+}
+
+
+
+
+
+/********************* put_cc() *********************
+ * Makes a MIDI 1.0 controller message.
+ */
+
+static unsigned char * put_cc(register unsigned char *out, unsigned int chan, unsigned int num, unsigned int value)
+{
+	*out++ = (unsigned char)(0xB0 | chan);
+	*out++ = (unsigned char)num;
+	*out++ = (unsigned char)(value & 0x7F);
+	return(out);
+}
+
+
+
+
+
+/********************* ump_to_midi1() *********************
+ * Translates a packet to MIDI 1.0 bytes.
+ *
+ * packet =	The packet's words.
+ * out =		Where to put the bytes. UMP_MAXMIDI1 of them.
+ *
+ * RETURNS: How many bytes, or 0 if the packet has no MIDI
+ * 1.0 equivalent.
+ *
+ * NOTE: A 7-bit SysEx's packets each translate to a slice of
+ * the SysEx. The first slice starts with the 0xF0, and the
+ * last ends with the 0xF7.
+ *
+ * A MIDI 2.0 channel voice message's values are scaled down
+ * the way the MIDI 2.0 spec says: by keeping just their high
+ * bits. (Except a note-on's velocity never becomes 0, since
+ * that would mean note-off.) A program change with a bank
+ * becomes 2 bank select controllers and the program change,
+ * and an RPN or NRPN becomes its 4 controllers.
+ */
+
+unsigned int ump_to_midi1(register const unsigned int *packet, unsigned char *out)
+{
+	register unsigned char	*ptr;
+	register unsigned int	status, chan;
+
+	ptr = out;
+	status = (packet[0] >> 16) & 0xFF;
+	chan = status & 0x0F;
+
+	switch (UMP_TYPE(packet[0]))
+	{
+		case UMP_TYPE_SYSTEM:
+		{
+			if (status <= 0xF0 || status == 0xF7) break;
+			goto bytes;
+		}
+
+		case UMP_TYPE_MIDI1:
+		{
+			if (status < 0x80 || status >= 0xF0) break;
+bytes:	*ptr++ = (unsigned char)status;
+			if (MIDI_STATUS_DATA(status) > 0) *ptr++ = (unsigned char)((packet[0] >> 8) & 0x7F);
+			if (MIDI_STATUS_DATA(status) > 1) *ptr++ = (unsigned char)(packet[0] & 0x7F);
+			break;
+		}
+
+		case UMP_TYPE_SYSEX7:
+		{
+			register unsigned int	count, i;
+
+			// The data bytes are in the low 2 bytes of the first word, then
+			// the second word, high byte first
+			status = (packet[0] >> 20) & 0x0F;
+			if ((count = (packet[0] >> 16) & 0x0F) > 6) count = 6;
+			if (status == UMP_SYSEX_COMPLETE || status == UMP_SYSEX_START) *ptr++ = 0xF0;
+			for (i = 0; i < count; i++) *ptr++ = (unsigned char)((packet[(i + 2) >> 2] >> (8 * (3 - ((i + 2) & 3)))) & 0x7F);
+			if (status == UMP_SYSEX_COMPLETE || status == UMP_SYSEX_END) *ptr++ = 0xF7;
+			break;
+		}
+
+		case UMP_TYPE_MIDI2:
+		{
+			switch (status & 0xF0)
+			{
+				case 0x90:
+				{
+					// Note-on. Its velocity can't scale down to 0
+					*ptr++ = (unsigned char)status;
+					*ptr++ = (unsigned char)((packet[0] >> 8) & 0x7F);
+					*ptr++ = (unsigned char)((packet[1] >> 25) ? (packet[1] >> 25) : 1);
+					break;
+				}
+
+				case 0x80:
+				case 0xA0:
+				{
+					// Note-off's 16-bit velocity, or poly pressure's 32 bits
+					*ptr++ = (unsigned char)status;
+					*ptr++ = (unsigned char)((packet[0] >> 8) & 0x7F);
+					*ptr++ = (unsigned char)(packet[1] >> 25);
+					break;
+				}
+
+				case 0xB0:
+				{
+					ptr = put_cc(ptr, chan, (packet[0] >> 8) & 0x7F, packet[1] >> 25);
+					break;
+				}
+
+				case 0xC0:
+				{
+					// If the "bank valid" option is set, select the bank first
+					if (packet[0] & 0x01)
+					{
+						ptr = put_cc(ptr, chan, 0, (packet[1] >> 8) & 0x7F);
+						ptr = put_cc(ptr, chan, 32, packet[1] & 0x7F);
+					}
+					*ptr++ = (unsigned char)status;
+					*ptr++ = (unsigned char)((packet[1] >> 24) & 0x7F);
+					break;
+				}
+
+				case 0xD0:
+				{
+					*ptr++ = (unsigned char)status;
+					*ptr++ = (unsigned char)(packet[1] >> 25);
+					break;
+				}
+
+				case 0xE0:
+				{
+					*ptr++ = (unsigned char)status;
+					*ptr++ = (unsigned char)((packet[1] >> 18) & 0x7F);
+					*ptr++ = (unsigned char)(packet[1] >> 25);
+					break;
+				}
+
+				case 0x20:
+				case 0x30:
+				{
+					register unsigned int	value;
+
+					// An RPN (or NRPN), with a 32-bit value. MIDI 1.0 sends its bank
+					// and index, then a 14-bit value as data entry MSB and LSB
+					value = packet[1] >> 18;
+					ptr = put_cc(ptr, chan, (status & 0xF0) == 0x20 ? 101 : 99, (packet[0] >> 8) & 0x7F);
+					ptr = put_cc(ptr, chan, (status & 0xF0) == 0x20 ? 100 : 98, packet[0] & 0x7F);
+					ptr = put_cc(ptr, chan, 6, value >> 7);
+					ptr = put_cc(ptr, chan, 38, value);
+					break;
+				}
+
+				// The per-note controllers, relative RPNs, and per-note
+				// management have no MIDI 1.0 equivalent
+			}
+		}
+	}
+
+	return((unsigned int)(ptr - out));
+}
+
+
+
+
+
+/********************* ump_enc_init() *********************
+ * Initializes a UMPENC.
+ *
+ * group =	Which group (0 to 15) the packets are sent on.
+ */
+
+void ump_enc_init(UMPENC *enc, unsigned int group)
+{
+	memset(enc, 0, sizeof(UMPENC));
+	enc->Group = (unsigned char)(group & 0x0F);
+}
+
+
+
+
+
+/********************* put_sysex() *********************
+ * Makes a 7-bit SysEx packet of the SysEx bytes waiting in
+ * the UMPENC.
+ *
+ * status =	UMP_SYSEX_xxx.
+ *
+ * RETURNS: How many words (2).
+ */
+
+static unsigned int put_sysex(register UMPENC *enc, unsigned int status, register unsigned int *words)
+{
+	unsigned char	bytes[6];
+
+	memset(&bytes[0], 0, sizeof(bytes));
+	memcpy(&bytes[0], &enc->SysEx[0], enc->Count);
+
+	words[0] = (UMP_TYPE_SYSEX7 << 28) | ((unsigned int)enc->Group << 24) | (status << 20) | ((unsigned int)enc->Count << 16) | (bytes[0] << 8) | bytes[1];
+	words[1] = ((unsigned int)bytes[2] << 24) | (bytes[3] << 16) | (bytes[4] << 8) | bytes[5];
+	enc->Count = 0;
+	enc->Started = 1;
+	++enc->Packets;
+	return(2);
+}
+
+
+
+
+
+/********************* ump_from_midi1() *********************
+ * Translates MIDI 1.0 bytes to packets.
+ *
+ * msg =		Whole MIDI 1.0 messages, or SysEx slices (as
+ *				midi_parse() returns).
+ * len =		How many bytes.
+ * words =	Where to put the packets. UMP_MAXWORDS(len) words.
+ *
+ * RETURNS: How many words.
+ *
+ * NOTE: Channel voice messages become type 0x2 packets, and
+ * system messages type 0x1. So they go through a UMP device
+ * unchanged, and come back out of ump_to_midi1() the same.
+ * A SysEx's bytes are held until there are 6 of them, or its
+ * 0xF7 (or some other status) ends it. Realtime bytes can
+ * come between a SysEx's slices.
+ */
+
+unsigned int ump_from_midi1(register UMPENC *enc, const unsigned char *msg, unsigned int len, unsigned int *words)
+{
+	register unsigned int	i, n, status, data;
+
+	n = 0;
+	for (i = 0; i < len; i++)
+	{
+		status = msg[i];
+
+		// A SysEx data byte. We don't know which packet of the SysEx is the
+		// last until its end, so we keep a full packet until another byte
+		// comes
+		if (status < 0x80)
+		{
+			if (!enc->InSysEx) continue;
+			if (enc->Count >= 6) n += put_sysex(enc, enc->Started ? UMP_SYSEX_CONTINUE : UMP_SYSEX_START, &words[n]);
+			enc->SysEx[enc->Count++] = (unsigned char)status;
+			continue;
+		}
+
+		// Realtime goes anywhere
+		if (status >= 0xF8)
+		{
+			words[n++] = (UMP_TYPE_SYSTEM << 28) | ((unsigned int)enc->Group << 24) | (status << 16);
+			++enc->Packets;
+			continue;
+		}
+
+		// Any other status ends a SysEx
+		if (enc->InSysEx)
+		{
+			n += put_sysex(enc, enc->Started ? UMP_SYSEX_END : UMP_SYSEX_COMPLETE, &words[n]);
+			enc->InSysEx = 0;
+		}
+
+		if (status == 0xF0)
+		{
+			enc->InSysEx = 1;
+			enc->Started = enc->Count = 0;
+			continue;
+		}
+		if (status == 0xF7) continue;
+
+		// Channel or system common. If the message isn't all here, drop it
+		data = MIDI_STATUS_DATA(status);
+		if (i + data >= len) break;
+		words[n++] = ((status < 0xF0 ? UMP_TYPE_MIDI1 : UMP_TYPE_SYSTEM) << 28) | ((unsigned int)enc->Group << 24) | (status << 16) |
+			(data > 0 ? (unsigned int)msg[i + 1] << 8 : 0) | (data > 1 ? msg[i + 2] : 0);
+		i += data;
+		++enc->Packets;
+	}
+
+	return(n);
+}
+
+
+
+
+
+/********************* ump_upscale() *********************
+ * Scales a value up to more bits, the way the MIDI 2.0 spec
+ * says (its "min-center-max" scaling). 0 stays 0, the center
+ * value (ie, 64 of 0 to 127) stays the center, and the
+ * maximum becomes the new maximum. So a MIDI 1.0 value goes
+ * to MIDI 2.0 and back unchanged.
+ *
+ * value =		The value.
+ * srcBits =	How many bits it has (ie, 7).
+ * dstBits =	How many it should have (ie, 16 or 32).
+ */
+
+unsigned int ump_upscale(unsigned int value, unsigned int srcBits, unsigned int dstBits)
+{
+	register unsigned int	scaleBits, repeatBits, repeat, result;
+
+	scaleBits = dstBits - srcBits;
+	result = value << scaleBits;
+	if (value <= (1U << (srcBits - 1))) return(result);
+
+	// Above the center, fill the new low bits by repeating the value's
+	// bits below its top one
+	repeatBits = srcBits - 1;
+	repeat = value & ((1U << repeatBits) - 1);
+	if (scaleBits > repeatBits)
+		repeat <<= scaleBits - repeatBits;
+	else
+		repeat >>= repeatBits - scaleBits;
+	while (repeat)
+	{
+		result |= repeat;
+		repeat >>= repeatBits;
+	}
+
+	return(result);
+}
+
+
+
+
+
+/********************* ump_midi2_from_midi1() *********************
+ * Makes a MIDI 2.0 channel voice packet from a MIDI 1.0 one.
+ *
+ * msg =		The MIDI 1.0 message. A note, poly pressure,
+ *				controller, program change, channel pressure, or
+ *				pitch bend.
+ * len =		How many bytes.
+ * group =	Which group to send it on.
+ * orig =	The MIDI 2.0 packet that "msg" was translated from
+ *				(and then perhaps changed, ie, transposed), or 0
+ *				if none.
+ * words =	Where to put the packet. 2 words.
+ *
+ * RETURNS: How many words (2), or 0 if there's no such
+ * MIDI 2.0 message.
+ *
+ * NOTE: Where msg's value is what "orig"'s scales down to,
+ * we keep orig's value, with all of its bits. So a MIDI 2.0
+ * stream that only gets its channels and notes changed
+ * passes through at full resolution. Other values are
+ * scaled up with ump_upscale().
+ */
+
+unsigned int ump_midi2_from_midi1(const unsigned char *msg, unsigned int len, unsigned int group, const unsigned int *orig, unsigned int *words)
+{
+	register unsigned int	status, value, high;
+
+	status = msg[0];
+	if (status < 0x80 || status >= 0xF0 || len != 1U + MIDI_STATUS_DATA(status)) return(0);
+
+	// Only keep the original's value if it's the same kind of message
+	if (orig && (UMP_TYPE(orig[0]) != UMP_TYPE_MIDI2 || ((orig[0] >> 20) & 0x0F) != (status >> 4))) orig = 0;
+
+	words[0] = (UMP_TYPE_MIDI2 << 28) | ((group & 0x0F) << 24) | (status << 16);
+
+	switch (status & 0xF0)
+	{
+		case 0x80:
+		case 0x90:
+		{
+			// A 16-bit velocity, and the original's attribute (if any)
+			words[0] |= (unsigned int)msg[1] << 8;
+			high = (orig ? orig[1] >> 25 : 0);
+			if (orig && (high == msg[2] || (!high && msg[2] == 1 && (status & 0xF0) == 0x90)))
+			{
+				words[0] |= orig[0] & 0xFF;
+				words[1] = orig[1];
+			}
+			else
+				words[1] = ump_upscale(msg[2], 7, 16) << 16;
+			break;
+		}
+
+		case 0xA0:
+		case 0xB0:
+		{
+			words[0] |= (unsigned int)msg[1] << 8;
+			value = msg[2];
+			goto value32;
+		}
+
+		case 0xC0:
+		{
+			words[1] = (unsigned int)msg[1] << 24;
+			break;
+		}
+
+		case 0xD0:
+		{
+			value = msg[1];
+value32:	words[1] = (orig && (orig[1] >> 25) == value ? orig[1] : ump_upscale(value, 7, 32));
+			break;
+		}
+
+		case 0xE0:
+		{
+			value = msg[1] | ((unsigned int)msg[2] << 7);
+			words[1] = (orig && (orig[1] >> 18) == value ? orig[1] : ump_upscale(value, 14, 32));
+		}
+	}
+
+	return(2);
+}
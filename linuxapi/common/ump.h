@@ -0,0 +1,107 @@
+// ump.h
+// Reads and writes MIDI 2.0 "Universal MIDI Packets" (UMP), as
+// ALSA's UMP rawmidi devices (snd_ump_open(), ALSA 1.2.10 and up)
+// give and take them.
+//
+// A UMP stream isn't bytes, but 32-bit words (in the CPU's byte
+// order). Each packet is 1 to 4 words, and the top 4 bits of its
+// first word (the "message type") say how many. So there's no
+// running status, and no realtime bytes in the middle of other
+// messages. The parser just looks up the size, and copies that many
+// words. (It still has to remember a packet that a read cut in two.)
+//
+// The message types we translate to and from MIDI 1.0 bytes are:
+//
+// 0x1	System common and realtime. 1 word: 0x1G, then the
+//			status and up to 2 data bytes.
+// 0x2	MIDI 1.0 channel voice. 1 word: 0x2G, then the status
+//			and up to 2 data bytes.
+// 0x3	7-bit SysEx. 2 words: 0x3G, then a status nibble (whole
+//			SysEx, start, continue, or end), a count nibble, and up
+//			to 6 data bytes. The 0xF0 and 0xF7 aren't sent.
+// 0x4	MIDI 2.0 channel voice. 2 words: 0x4G, the status, then
+//			16-bit velocities and 32-bit controller values. A
+//			32-bit controller goes in one 8 byte packet, where
+//			MIDI 1.0 needs 2 controllers (6 bytes) for just 14 bits.
+//
+// ("G" is the group, 0 to 15. Each is like a separate MIDI 1.0
+// cable.)
+//
+// Types 0x1 to 0x3 translate to MIDI 1.0 bytes and back with nothing
+// lost. Type 0x4's values have to be scaled down to MIDI 1.0's 7 (or
+// 14) bits. Everything else (utility messages, 8-bit data, flex data,
+// and stream messages) has no MIDI 1.0 equivalent.
+
+#ifndef UMP_H
+#define UMP_H
+
+// The message types
+#define UMP_TYPE_UTILITY		0x0
+#define UMP_TYPE_SYSTEM			0x1
+#define UMP_TYPE_MIDI1			0x2
+#define UMP_TYPE_SYSEX7			0x3
+#define UMP_TYPE_MIDI2			0x4
+#define UMP_TYPE_DATA			0x5
+#define UMP_TYPE_FLEX			0xD
+#define UMP_TYPE_STREAM			0xF
+
+// How many words are in a packet, indexed by message type
+extern const unsigned char UmpWordTable[16];
+
+#define UMP_TYPE(word)			((word) >> 28)
+#define UMP_GROUP(word)			(((word) >> 24) & 0x0F)
+#define UMP_WORDS(word)			UmpWordTable[(word) >> 28]
+
+// Type 0x3's status nibble
+#define UMP_SYSEX_COMPLETE		0x0
+#define UMP_SYSEX_START			0x1
+#define UMP_SYSEX_CONTINUE		0x2
+#define UMP_SYSEX_END			0x3
+
+// The most MIDI 1.0 bytes ump_to_midi1() makes from one packet. (An
+// RPN is 4 controllers)
+#define UMP_MAXMIDI1				12
+
+// How many words ump_from_midi1() may make from "len" bytes. (A
+// realtime byte makes a word. 6 SysEx bytes make 2, and the SysEx's
+// end may make 2 more)
+#define UMP_MAXWORDS(len)		((len) + 4)
+
+// One parsed packet. It's 32 bytes, so 2 fit in a cache line
+typedef struct _UMPEVENT
+{
+	unsigned long long	Time;			// When it arrived, in nanoseconds (0 if unknown)
+	unsigned int			Words[4];	// The packet (Length words of it)
+	unsigned char			Type;			// UMP_TYPE_xxx
+	unsigned char			Group;
+	unsigned char			Length;		// How many words
+	unsigned char			Pad[5];
+} UMPEVENT;
+
+// The parser's state, which carries over from one call to the next
+typedef struct _UMPPARSER
+{
+	unsigned int			Words[4];	// A packet that the last buffer cut short
+	unsigned int			Have;			// How many bytes of it we have
+} UMPPARSER;
+
+// The state of a MIDI 1.0 to UMP translation
+typedef struct _UMPENC
+{
+	unsigned char			SysEx[6];	// SysEx bytes waiting to fill a packet
+	unsigned char			Count;		// How many
+	unsigned char			InSysEx;		// 1 if we've had an 0xF0 but not its 0xF7
+	unsigned char			Started;		// 1 if we've sent a packet of this SysEx
+	unsigned char			Group;		// The group to send on
+	unsigned long			Packets;		// How many packets we've made
+} UMPENC;
+
+void ump_parse_init(UMPPARSER *);
+unsigned int ump_parse(UMPPARSER *, const unsigned char *, unsigned int, unsigned long long, UMPEVENT *, unsigned int, unsigned int *);
+unsigned int ump_to_midi1(const unsigned int *, unsigned char *);
+void ump_enc_init(UMPENC *, unsigned int);
+unsigned int ump_from_midi1(UMPENC *, const unsigned char *, unsigned int, unsigned int *);
+unsigned int ump_midi2_from_midi1(const unsigned char *, unsigned int, unsigned int, const unsigned int *, unsigned int *);
+unsigned int ump_upscale(unsigned int, unsigned int, unsigned int);
+
+#endif
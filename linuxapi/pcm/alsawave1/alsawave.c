@@ -2,20 +2,36 @@
 // WAVE file using ALSA. This goes directly to the first
 // audio card (ie, its first set of audio out jacks). It
 // uses the snd_pcm_writei() mode of outputting waveform data,
-// blocking.
+// blocking, through our thin layer over it (../../common/pcmdev.h).
 //
 // Compile as so to create "alsawave":
-// gcc -o alsawave alsawave.c -lasound
+// gcc -o alsawave alsawave.c ../../common/pcmdev.c ../../common/devalloc.c ../../common/timing.c -lasound -lm
 //
 // Run it from a terminal, specifying the name of a WAVE file to play:
 // ./alsawave MyWaveFile.wav
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <unistd.h>
+//
+// To play through some other card, use -a and any name pcmdev.h
+// takes. "virtual" needs no sound card at all:
+// ./alsawave -a virtual MyWaveFile.wav
+//
+// As ../alsawave2 does, it prints how long each startup stage took
+// (loading the wave, opening the card and setting its parameters,
+// and the first write, which fills the card's buffer and starts it). To
+// benchmark open-to-first-frame, also specify how many times to
+// repeat the startup. Each repeat is timed "cold" (we close the card
+// and throw away ALSA's parsed config), and "warm" (we keep the
+// configured handle and just re-prime it):
+// ./alsawave MyWaveFile.wav 50
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 // Include the ALSA .H file that defines ALSA functions/data
-#include <alsa/asoundlib.h>
+#include <alsa/asoundlib.h>
+#include "../../common/pcmdev.h"
+#include "../../common/timing.h"
 
 
 
@@ -72,8 +88,8 @@ typedef struct _FORMAT {
 // 64 sample points have been played
 #define PERIODSIZE	(2*64)
 
-// Handle to ALSA (audio card's) playback port
-snd_pcm_t				*PlaybackHandle;
+// The audio card's playback port
+PCMDEV					Audio;
 
 // Handle to our callback thread
 snd_async_handler_t	*CallbackHandle;
@@ -93,10 +109,25 @@ unsigned char			WaveBits;
 // Number of channels in the wave file
 unsigned char			WaveChannels;
 
-// The name of the ALSA port we output to. In this case, we're
-// directly writing to hardware card 0,0 (ie, first set of audio
-// outputs on the first audio card)
-static const char		SoundCardPortName[] = "plughw:0,0";
+// How many frames we've written to the card
+snd_pcm_uframes_t		PlayPosition;
+
+// The startup stages that we time. The last one ends when our first
+// write has filled the card's buffer, which starts the card. That's
+// the moment the first frame is handed to the DAC
+enum {STAGE_LOAD, STAGE_OPEN, STAGE_START, STAGE_COUNT};
+
+static const char * const	StageNames[STAGE_COUNT] = {"waveLoad()", "pcm_dev_open()", "start_audio()"};
+
+// The (monotonic clock) time when main() started, and when each
+// startup stage finished. In nanoseconds
+static unsigned long long	StartTime;
+static unsigned long long	StageTimes[STAGE_COUNT];
+
+// The name of the ALSA port we output to. Unless the user picks
+// another with -a, we're directly writing to hardware card 0,0
+// (ie, first set of audio outputs on the first audio card)
+static const char		*SoundCardPortName = "plughw:0,0";
 
 // For WAVE file loading
 static const unsigned char Riff[4]	= { 'R', 'I', 'F', 'F' };
@@ -108,6 +139,32 @@ static const unsigned char Data[4] = { 'd', 'a', 't', 'a' };
 
 
 
+/********************** print_stages() *********************
+ * Prints how long each startup stage took, and the total
+ * time from the start of main() to the first frame.
+ *
+ * NOTE: The times must be in the global "StageTimes", and
+ * the start of main() in "StartTime".
+ */
+
+static void print_stages(void)
+{
+	register unsigned long long	prev;
+	register unsigned int		i;
+
+	prev = StartTime;
+	for (i = 0; i < STAGE_COUNT; i++)
+	{
+		printf("%-22s %8.3f ms\n", StageNames[i], (double)(StageTimes[i] - prev) / 1000000.0);
+		prev = StageTimes[i];
+	}
+	printf("%-22s %8.3f ms\n", "Time to first frame", (double)(prev - StartTime) / 1000000.0);
+}
+
+
+
+
+
 /********************** compareID() *********************
  * Compares the passed ID str (ie, a ptr to 4 Ascii
  * bytes) with the ID at the passed ptr. Returns TRUE if
@@ -233,41 +290,218 @@ bad:	close(inHandle);
 
 
 
-/********************** play_audio() **********************
- * Plays the loaded waveform.
+/*********************** write_audio() **********************
+ * Writes wave data to the card, from "PlayPosition" on,
+ * until "end". When the card's buffer is full, this waits
+ * for the card to play some of it.
  *
- * NOTE: ALSA sound card's handle must be in the global
- * "PlaybackHandle". A pointer to the wave data must be in
- * the global "WavePtr", and its size of "WaveSize".
- */
+ * RETURNS: 0 if success, or a negative error number.
+ *
+ * NOTE: The sound card must be in the global "Audio". A
+ * pointer to the wave data must be in the global "WavePtr",
+ * and its size of "WaveSize".
+ */
 
-static void play_audio(void)
+static int write_audio(snd_pcm_uframes_t end)
 {
-	register snd_pcm_uframes_t		count, frames;
+	register snd_pcm_sframes_t	frames;
+	register unsigned int		frameBytes;
 
-	// Output the wave data
-	count = 0;
-	do
+	frameBytes = ((unsigned int)WaveBits / 8) * WaveChannels;
+	while (PlayPosition < end)
 	{
-		frames = snd_pcm_writei(PlaybackHandle, WavePtr + count, WaveSize - count);
+		frames = pcm_dev_writei(&Audio, WavePtr + PlayPosition * frameBytes, end - PlayPosition);
 
 		// If an error, try to recover from it
-		if (frames < 0)
-			frames = snd_pcm_recover(PlaybackHandle, frames, 0);
-		if (frames < 0)
+		if (frames < 0 && (frames = pcm_dev_recover(&Audio, (int)frames)) < 0)
 		{
-			printf("Error playing wave: %s\n", snd_strerror(frames));
-			break;
+			printf("Error playing wave: %s\n", snd_strerror((int)frames));
+			return((int)frames);
 		}
 
-		// Update our pointer
-		count += frames;
+		// Update our position
+		PlayPosition += frames;
+	}
+
+	return(0);
+}
+
+
+
 
-	} while (count < WaveSize);
 
-	// Wait for playback to completely finish
-	if (count == WaveSize)
-		snd_pcm_drain(PlaybackHandle);
+/************************ start_audio() ***********************
+ * Writes the start of the wave to the (stopped) card. Once
+ * that fills the card's buffer, the card starts playing.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ *
+ * NOTE: The sound card must be in the global "Audio", as set
+ * up by open_audio(), or stopped by replay_audio().
+ */
+
+static int start_audio(void)
+{
+	register int	err;
+
+	// The card starts once its buffer is full. If the wave is shorter than
+	// that, we start the card ourselves
+	PlayPosition = 0;
+	if ((err = write_audio(WaveSize < Audio.BufferFrames ? WaveSize : Audio.BufferFrames)) < 0) return(err);
+	if ((err = pcm_dev_start(&Audio)) < 0)
+	{
+		printf("Start error: %s\n", snd_strerror(err));
+		return(err);
+	}
+
+	StageTimes[STAGE_START] = get_time_ns();
+
+	return(0);
+}
+
+
+
+
+
+/************************* open_audio() ***********************
+ * Opens the audio card, and sets its parameters to suit the
+ * wave. This is the "cold" part of our startup.
+ *
+ * RETURNS: 0 if success, or a negative error number (in which
+ * case the card is closed).
+ *
+ * NOTE: Sets the global "Audio".
+ */
+
+static int open_audio(void)
+{
+	snd_pcm_format_t	format;
+	register int		err;
+
+	switch (WaveBits)
+	{
+		case 8:
+			format = SND_PCM_FORMAT_U8;
+			break;
+
+		case 24:
+			format = SND_PCM_FORMAT_S24;
+			break;
+
+		case 32:
+			format = SND_PCM_FORMAT_S32;
+			break;
+
+		default:
+			format = SND_PCM_FORMAT_S16;
+	}
+
+	// Open audio card we wish to use for playback, and set its hardware parameters
+	// (sample rate, bit resolution, etc). Audio.BufferFrames is how big a buffer we
+	// got. NOTE: The first open after snd_config_update_free_global() also has ALSA
+	// (re)load and parse its config files
+	if ((err = pcm_dev_open(&Audio, SoundCardPortName, 0, format, WaveChannels, WaveRate, BUFFERSIZE, PERIODSIZE)) < 0)
+	{
+		printf("Can't open audio %s: %s\n", SoundCardPortName, snd_strerror(err));
+		return(err);
+	}
+	StageTimes[STAGE_OPEN] = get_time_ns();
+
+	return(0);
+}
+
+
+
+
+
+/************************ replay_audio() **********************
+ * Restarts playback from the beginning of the wave, reusing
+ * the already open and configured card. This is the "fast
+ * path" for playing a cue again. We skip reparsing ALSA's
+ * config, reopening the card, and setting its parameters.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+static int replay_audio(void)
+{
+	// Throw away whatever is still in the card's buffer. That leaves it
+	// stopped and ready for start_audio() to fill its buffer again
+	pcm_dev_drop(&Audio);
+	return(start_audio());
+}
+
+
+
+
+
+/********************* benchmark_audio() **********************
+ * Measures the open-to-first-frame time "count" times, both
+ * cold (the card is closed and ALSA's parsed config freed
+ * before reopening), and warm (replay_audio() on the already
+ * configured card). Prints the minimum, average, and maximum
+ * of each.
+ *
+ * RETURNS: 0 if success (in which case the card is still
+ * open), or a negative error number (in which case it's
+ * closed).
+ *
+ * NOTE: The sound card must be in the global "Audio", and
+ * must already be open.
+ */
+
+static int benchmark_audio(unsigned int count)
+{
+	unsigned long long	min[2], max[2], total[2], start, elapsed;
+	register unsigned int	i, warm;
+	register int			err;
+
+	for (warm = 0; warm < 2; warm++)
+	{
+		min[warm] = ~0ULL;
+		max[warm] = total[warm] = 0;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		for (warm = 0; warm < 2; warm++)
+		{
+			if (!warm)
+			{
+				// Cold path. Throw away everything, like a program that has just started
+				pcm_dev_close(&Audio);
+				snd_config_update_free_global();
+
+				start = get_time_ns();
+				if ((err = open_audio())) return(err);
+				if ((err = start_audio())) goto bad;
+			}
+			else
+			{
+				// Fast path. Keep the configured card, and ALSA's config, warm
+				start = get_time_ns();
+				if ((err = replay_audio()))
+				{
+bad:				pcm_dev_close(&Audio);
+					return(err);
+				}
+			}
+
+			elapsed = StageTimes[STAGE_START] - start;
+			total[warm] += elapsed;
+			if (elapsed < min[warm]) min[warm] = elapsed;
+			if (elapsed > max[warm]) max[warm] = elapsed;
+		}
+	}
+
+	for (warm = 0; warm < 2; warm++)
+	{
+		printf("%s open-to-first-frame (%u runs): min %.3f ms, avg %.3f ms, max %.3f ms\n",
+			warm ? "Warm" : "Cold", count, (double)min[warm] / 1000000.0,
+			(double)total[warm] / (count * 1000000.0), (double)max[warm] / 1000000.0);
+	}
+
+	return(0);
 }
 
 
@@ -291,58 +525,58 @@ static void free_wave_data(void)
 
 
 
-int main(int argc, char **argv)
-{
+int main(int argc, char **argv)
+{
+	StartTime = get_time_ns();
+
 	// No wave data loaded yet
 	WavePtr = 0;
 
+	// Did the user pick a card (ie, -a virtual)?
+	if (argc > 2 && !strcmp(argv[1], "-a"))
+	{
+		SoundCardPortName = argv[2];
+		argc -= 2;
+		argv += 2;
+	}
+
 	if (argc < 2)
 		printf("You must supply the name of a 16-bit mono WAVE file to play\n");
 
 	// Load the wave file
 	else if (!waveLoad(argv[1]))
 	{
-		register int		err;
+		StageTimes[STAGE_LOAD] = get_time_ns();
 
-		// Open audio card we wish to use for playback
-		if ((err = snd_pcm_open(&PlaybackHandle, &SoundCardPortName[0], SND_PCM_STREAM_PLAYBACK, 0)) < 0)
-			printf("Can't open audio %s: %s\n", &SoundCardPortName[0], snd_strerror(err));
-		else
+		// Open audio card we wish to use for playback, and set its parameters
+		if (!open_audio())
 		{
-			switch (WaveBits)
+			// Fill the card's buffer with the start of the wave, which starts playback
+			if (!start_audio())
 			{
-				case 8:
-					err = SND_PCM_FORMAT_U8;
-					break;
-			
-				case 16:
-					err = SND_PCM_FORMAT_S16;
-					break;
-			
-				case 24:
-					err = SND_PCM_FORMAT_S24;
-					break;
-			
-				case 32:
-					err = SND_PCM_FORMAT_S32;
-					break;
-			}
-		
-			// Set the audio card's hardware parameters (sample rate, bit resolution, etc)
-			if ((err = snd_pcm_set_params(PlaybackHandle, err, SND_PCM_ACCESS_RW_INTERLEAVED, WaveChannels, WaveRate, 1, 500000)) < 0)
-				printf("Can't set sound parameters: %s\n", snd_strerror(err));
+				print_stages();
 
-			// Play the waveform
-			else
-				play_audio();
+				// Did the user ask for a benchmark of the startup?
+				if (argc > 2)
+				{
+					if (benchmark_audio(atoi(argv[2]) > 0 ? (unsigned int)atoi(argv[2]) : 1)) goto out;
+
+					// Play the wave once more, from the start
+					if (replay_audio()) goto close;
+				}
+
+				// Play the rest of the waveform, and wait for playback to completely finish
+				if (!write_audio(WaveSize)) pcm_dev_drain(&Audio);
+			}
 
 			// Close sound card
-			snd_pcm_close(PlaybackHandle);
+close:	pcm_dev_close(&Audio);
 		}
 	}
+out:
 
 	// Free the WAVE data
 	free_wave_data();
 
 	return(0);
-}
+}
@@ -6,17 +6,44 @@
 // buffer).
 //
 // Compile as so to create "alsawave":
-// gcc -o alsawave alsawave.c -lasound
+// gcc -o alsawave alsawave.c ../../common/pcmmeter.c ../../common/timing.c -lasound -lm
 //
 // Run it from a terminal, specifying the name of a WAVE file to play:
 // ./alsawave MyWaveFile.wav
+//
+// It prints how long each startup stage took (loading the
+// wave, opening the card, setting its hardware and software
+// parameters, and priming/starting playback). To benchmark
+// open-to-first-frame, also specify how many times to repeat
+// the startup. Each repeat is timed twice: once "cold" (we
+// close the card and throw away ALSA's parsed config, like a
+// freshly started program), and once "warm" (we keep the
+// configured handle and just re-prime it):
+// ./alsawave MyWaveFile.wav 50
+//
+// With -m, we meter the audio as copy_wave_data() copies each period
+// to the card (see ../../common/pcmmeter.h), and once a second print
+// each channel's peak and RMS levels, and whether it clipped. The
+// meter looks at the samples while they're still in the cache from
+// the copy, so checking a file's levels doesn't need a second pass
+// over it:
+// ./alsawave -m MyWaveFile.wav
+//
+// NOTE: This opens the card with ALSA directly, not through
+// ../../common/pcmdev.h like ../prerollrec does, so it needs a real
+// sound card. pcmdev only does read/write access, and its virtual card
+// has neither memory-mapped access nor ALSA's async (SIGIO) callback.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <time.h>
 
 // Include the ALSA .H file that defines ALSA functions/data
 #include <alsa/asoundlib.h>
+#include "../../common/pcmmeter.h"
+#include "../../common/timing.h"
 
 
 
@@ -91,6 +118,28 @@ unsigned char			WaveChannels;
 // How many frames we've already copied (from WavePtr to the audio card's buffer)
 unsigned int			PlayPosition;
 
+// Set to 0 while we're stopping/restarting the card, so that our
+// callback leaves the card alone
+volatile unsigned char	Playing;
+
+// Set to 1 if user wants the levels metered
+unsigned char				Metering;
+
+// The levels of what we've copied to the card
+PCMMETER						Meter;
+
+// The startup stages that we time. The last one ends when the card
+// has been primed with data and triggered, which is the moment
+// the first frame is handed to the DAC
+enum {STAGE_LOAD, STAGE_OPEN, STAGE_HARDWARE, STAGE_SOFTWARE, STAGE_START, STAGE_COUNT};
+
+static const char * const	StageNames[STAGE_COUNT] = {"waveLoad()", "snd_pcm_open()", "set_audio_hardware()", "set_audio_software()", "start_audio()"};
+
+// The (monotonic clock) time when main() started, and when each
+// startup stage finished. In nanoseconds
+static unsigned long long	StartTime;
+static unsigned long long	StageTimes[STAGE_COUNT];
+
 // The name of the ALSA port we output to. In this case, we're
 // directly writing to hardware card 0,0 (ie, first set of audio
 // outputs on the first audio card)
@@ -106,6 +155,32 @@ static const unsigned char Data[4] = { 'd', 'a', 't', 'a' };
 
 
 
+/********************** print_stages() *********************
+ * Prints how long each startup stage took, and the total
+ * time from the start of main() to the first frame.
+ *
+ * NOTE: The times must be in the global "StageTimes", and
+ * the start of main() in "StartTime".
+ */
+
+static void print_stages(void)
+{
+	register unsigned long long	prev;
+	register unsigned int		i;
+
+	prev = StartTime;
+	for (i = 0; i < STAGE_COUNT; i++)
+	{
+		printf("%-22s %8.3f ms\n", StageNames[i], (double)(StageTimes[i] - prev) / 1000000.0);
+		prev = StageTimes[i];
+	}
+	printf("%-22s %8.3f ms\n", "Time to first frame", (double)(prev - StartTime) / 1000000.0);
+}
+
+
+
+
+
 /********************** compareID() *********************
  * Compares the passed ID str (ie, a ptr to 4 Ascii
  * bytes) with the ID at the passed ptr. Returns TRUE if
@@ -305,11 +380,15 @@ good:		return(0);
 static void copy_wave_data(const snd_pcm_channel_area_t *buffer, snd_pcm_uframes_t offset, snd_pcm_uframes_t numSamples)
 {
 	register short		*bufPtr;
+	short					*start;
+	snd_pcm_uframes_t	frames;
 
 	// Get the address of the audio card's interleaved buffer. Note: "offset" is in sample frames. Since we're
 	// doing 16-bit stereo, there are two 16-bit sample pointer per frame. That means 4 bytes per
 	// frame. So, to get the current byte offset within the sound card buffer, we multiply by 4
 	bufPtr = (short *)(((unsigned char *)buffer[0].addr) + (offset * 4));
+	start = bufPtr;
+	frames = numSamples;
 
 	// Copy as many sample points as we have wave data yet to be played, until we fill as many sample
 	// frames as ALSA told us to fill. Also update "PlayPosition" global
@@ -341,6 +420,9 @@ static void copy_wave_data(const snd_pcm_channel_area_t *buffer, snd_pcm_uframes
 		*(bufPtr)++ = 0;
 		--numSamples;
 	}
+
+	// Meter what we just copied, while it's still in the cache
+	if (Metering) pcm_meter_s16(&Meter, start, (unsigned int)frames);
 }
 
 
@@ -363,6 +445,9 @@ static void audio_callback(snd_async_handler_t *ahandler)
 	register unsigned char			first;
 	snd_pcm_uframes_t					size;
 
+	// Is main() stopping or restarting the card? Then leave it alone
+	if (!Playing) return;
+
 restart:
 	first = 0;
 	while (1)
@@ -547,6 +632,11 @@ out:				return(err);
 		goto out;
 	}
 
+	// Let our callback keep the card fed from now on
+	Playing = 1;
+
+	StageTimes[STAGE_START] = get_time_ns();
+
 	return(0);
 }
 
@@ -787,11 +877,171 @@ bad2:	snd_pcm_sw_params_free(sw_params);
 
 
 
+/************************* open_audio() ***********************
+ * Opens the audio card, and sets its hardware and software
+ * parameters. This is the "cold" part of our startup.
+ *
+ * RETURNS: 0 if success, or non-zero if error (in which case
+ * the card is closed).
+ *
+ * NOTE: Sets the global "PlaybackHandle".
+ */
+
+static int open_audio(void)
+{
+	register int		err;
+
+	// Open audio card we wish to use for playback. NOTE: The first open after
+	// snd_config_update_free_global() also has ALSA (re)load and parse its config files
+	if ((err = snd_pcm_open(&PlaybackHandle, &SoundCardPortName[0], SND_PCM_STREAM_PLAYBACK, 0)) < 0)
+	{
+		printf("Can't open audio %s: %s\n", &SoundCardPortName[0], snd_strerror(err));
+		return(err);
+	}
+	StageTimes[STAGE_OPEN] = get_time_ns();
+
+	// Set the audio card's hardware parameters (sample rate, bit resolution, etc).
+	// NOTE: set_audio_hardware() closes the card if it fails
+	if ((err = set_audio_hardware())) return(err);
+	StageTimes[STAGE_HARDWARE] = get_time_ns();
+
+	// Set the audio card's software parameters (how we wish to fill its sound buffer, etc)
+	if ((err = set_audio_software()))
+	{
+		snd_pcm_close(PlaybackHandle);
+		return(err);
+	}
+	StageTimes[STAGE_SOFTWARE] = get_time_ns();
+
+	return(0);
+}
+
+
+
+
+
+/************************ replay_audio() **********************
+ * Restarts playback from the beginning of the wave, reusing
+ * the already open and configured card. This is the "fast
+ * path" for playing a cue again. We skip reparsing ALSA's
+ * config, reopening the card, and renegotiating its hardware
+ * and software parameters. We only have to stop the card,
+ * and then re-prime and trigger it.
+ *
+ * RETURNS: 0 if success, or non-zero if error.
+ *
+ * NOTE: ALSA sound card's handle must be in the global
+ * "PlaybackHandle", as set up by open_audio().
+ */
+
+static int replay_audio(void)
+{
+	// Keep our callback out of the way while we stop the card. Then throw
+	// away whatever is still in the card's buffer
+	Playing = 0;
+	snd_pcm_drop(PlaybackHandle);
+
+	// start_audio() prepares the card again, fills the start of its buffer,
+	// and triggers it
+	return(start_audio());
+}
+
+
+
+
+
+/********************* benchmark_audio() **********************
+ * Measures the open-to-first-frame time "count" times, both
+ * cold (the card is closed and ALSA's parsed config freed
+ * before reopening), and warm (replay_audio() on the already
+ * configured card). Prints the minimum, average, and maximum
+ * of each.
+ *
+ * RETURNS: 0 if success (in which case the card is still
+ * open), or non-zero if error (in which case it's closed).
+ *
+ * NOTE: ALSA sound card's handle must be in the global
+ * "PlaybackHandle", and must already be open.
+ */
+
+static int benchmark_audio(unsigned int count)
+{
+	unsigned long long	min[2], max[2], total[2], start, elapsed;
+	register unsigned int	i, warm;
+	register int			err;
+
+	for (warm = 0; warm < 2; warm++)
+	{
+		min[warm] = ~0ULL;
+		max[warm] = total[warm] = 0;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		for (warm = 0; warm < 2; warm++)
+		{
+			if (!warm)
+			{
+				// Cold path. Throw away everything, like a program that has just started
+				Playing = 0;
+				snd_pcm_close(PlaybackHandle);
+				snd_config_update_free_global();
+
+				start = get_time_ns();
+				if ((err = open_audio())) return(err);
+				if ((err = start_audio())) goto bad;
+			}
+			else
+			{
+				// Fast path. Keep the configured card, and ALSA's config, warm
+				start = get_time_ns();
+				if ((err = replay_audio()))
+				{
+bad:				snd_pcm_close(PlaybackHandle);
+					return(err);
+				}
+			}
+
+			elapsed = StageTimes[STAGE_START] - start;
+			total[warm] += elapsed;
+			if (elapsed < min[warm]) min[warm] = elapsed;
+			if (elapsed > max[warm]) max[warm] = elapsed;
+		}
+	}
+
+	for (warm = 0; warm < 2; warm++)
+	{
+		printf("%s open-to-first-frame (%u runs): min %.3f ms, avg %.3f ms, max %.3f ms\n",
+			warm ? "Warm" : "Cold", count, (double)min[warm] / 1000000.0,
+			(double)total[warm] / (count * 1000000.0), (double)max[warm] / 1000000.0);
+	}
+
+	return(0);
+}
+
+
+
+
+
 int main(int argc, char **argv)
 {
+	PCMMETER_READER		reader;
+	unsigned long long	next;
+
+	StartTime = get_time_ns();
+
 	// No wave data loaded yet
 	WavePtr = 0;
 
+	// Did the user ask for the levels to be metered?
+	if (argc > 1 && !strcmp(argv[1], "-m"))
+	{
+		Metering = 1;
+		--argc;
+		++argv;
+	}
+	pcm_meter_init(&Meter, 2);
+
 	if (argc < 2)
 	{
 		printf("You must supply the name of a 16-bit mono WAVE file to play\n");
@@ -800,36 +1050,51 @@ int main(int argc, char **argv)
 	// Load the wave file
 	else if (!waveLoad(argv[1]))
 	{
-		register int		err;
+		StageTimes[STAGE_LOAD] = get_time_ns();
 
-		// Open audio card we wish to use for playback
-		if ((err = snd_pcm_open(&PlaybackHandle, &SoundCardPortName[0], SND_PCM_STREAM_PLAYBACK, 0)) < 0)
-			printf("Can't open audio %s: %s\n", &SoundCardPortName[0], snd_strerror(err));
-		else
+		// Open the audio card and set its hardware and software parameters
+		if (!open_audio())
 		{
-			// Set the audio card's hardware parameters (sample rate, bit resolution, etc)
-			if (!set_audio_hardware() &&
+			// Initially fill in the sound card's hardware buffer with some data before we
+			// start playback (so that we don't hear random audio garbage upon startup),
+			// and then start the audio playback. ALSA will call our callback whenever it
+			// needs us to copy more wave data to the sound card's buffer
+			if (!start_audio())
+			{
+				print_stages();
 
-				// Set the audio card's software parameters (how we wish to fill its sound buffer, etc)
-				!set_audio_software() &&
+				// Did the user ask for a benchmark of the startup?
+				if (argc > 2)
+				{
+					if (benchmark_audio(atoi(argv[2]) > 0 ? (unsigned int)atoi(argv[2]) : 1)) goto out;
+
+					// Play the wave once more, from the start
+					replay_audio();
+				}
 
-				// Initially fill in the sound card's hardware buffer with some data before we
-				// start playback (so that we don't hear random audio garbage upon startup),
-				// and then start the audio playback. ALSA will call our callback whenever it
-				// needs us to copy more wave data to the sound card's buffer
-				!start_audio())
-			{
 				// ALSA calls our callback on a separate thread, so our main thread has nothing
 				// to do until playback is over. We'll just loop around waiting for our callback
 				// to indicate that the wave file has been played to the end. That happens when
-				// PlayPosition = the wave's total size
-				while (PlayPosition < WaveSize) sleep(1000);
+				// PlayPosition = the wave's total size. If we're metering, we print the levels
+				// once a second while we wait
+				pcm_meter_reader_init(&Meter, &reader);
+				next = get_time_ns() + 1000000000ULL;
+				while (PlayPosition < WaveSize)
+				{
+					sleep(1);
+					if (Metering && get_time_ns() >= next)
+					{
+						pcm_meter_print(&Meter, &reader);
+						next += 1000000000ULL;
+					}
+				}
 			}
 
 			// Close sound card
 			snd_pcm_close(PlaybackHandle);
 		}
 	}
+out:
 
 	// Free the WAVE data
 	free_wave_data();
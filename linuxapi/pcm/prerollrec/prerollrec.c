@@ -0,0 +1,516 @@
+// Records audio from an audio input (the capture devices that
+// ../listpcm lists) to 16-bit WAVE files, including the few seconds
+// BEFORE you told it to start. So when something interesting starts
+// and you hit "record" a moment too late, you still get the start.
+//
+// We capture all the time, into a ring that holds the last few
+// seconds (the "pre-roll"). Press ENTER to start recording a take,
+// and ENTER again to stop it. Each take's file starts with the
+// pre-roll, and then carries on with the live audio. Capture never
+// stops, so you can record as many takes as you like, and each has
+// its own pre-roll. Press CTRL-C to quit:
+// ./prerollrec -p 15 take hw:1,0
+// makes take-001.wav, take-002.wav, etc, each starting with up to 15
+// seconds before you pressed ENTER.
+//
+// The work is split between two threads, so that writing to the
+// disk can never delay reading the card:
+//
+// The capture thread (at real-time priority if we're allowed)
+// reads each period from the card straight into the ring (see
+// ../../common/preroll.h), and goes around it forever, writing over
+// the oldest audio. It never waits for the writer, and never
+// allocates memory. The ring is allocated (in huge pages, if the
+// system has some set aside), touched, and locked into RAM before
+// we start.
+//
+// While a take is being recorded, the writer thread copies the
+// audio out of the ring, and writes it to the file. It starts out
+// the pre-roll behind the live audio, and catches up within a
+// moment. If the disk is so slow that the capture thread gets all
+// the way around the ring and writes over audio that the writer
+// hasn't saved yet, the writer skips ahead (so the take has a gap),
+// and we tell you how much was lost. It never saves audio that was
+// half written over. Every few seconds (and at the end of the take)
+// we fill in the lengths in the WAVE header, so the file is usable
+// even if we're killed.
+//
+// Options:
+// -p seconds	How much pre-roll (default 10).
+// -r rate		The sample rate (default 48000).
+// -c channels	How many channels (default 2).
+// -m				Meter the levels. Once a second, we print each
+//					channel's peak and RMS levels, and whether it
+//					clipped.
+//
+// The capture thread meters each period as it's read (see
+// ../../common/pcmmeter.h), while it's still in the cache. That
+// never waits on anything, and costs well under a microsecond per
+// period, so it's safe to leave on all the time.
+//
+// The device can be any ALSA PCM name (default is "default"), or
+// "free" for any free capture subdevice, or "virtual" to try it
+// without a sound card (see ../../common/pcmdev.h).
+//
+// To give the ring huge pages, set some aside first (as root). Ie,
+// 10 huge pages (20 MB) make room for 100 seconds of 48 KHz stereo:
+// echo 10 > /proc/sys/vm/nr_hugepages
+//
+// Compile as:
+// gcc -o prerollrec prerollrec.c ../../common/preroll.c ../../common/pcmmeter.c ../../common/pcmdev.c ../../common/devalloc.c ../../common/timing.c -lasound -lpthread -lm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <alsa/asoundlib.h>
+#include "../../common/preroll.h"
+#include "../../common/pcmdev.h"
+#include "../../common/pcmmeter.h"
+#include "../../common/timing.h"
+
+
+
+// The period and buffer sizes we ask the card for, in frames
+#define PERIODFRAMES		512
+#define BUFFERFRAMES		4096
+
+// How much more than the pre-roll the ring holds, in seconds. That's
+// how far the writer can fall behind the live audio before it loses
+// any. (It's that far behind for a moment, at the start of a take,
+// while it saves the pre-roll)
+#define SLACKSECONDS		2
+
+// How many frames the writer copies out of the ring at a time
+#define CHUNKFRAMES		8192
+
+// The size of our WAVE file's header
+#define WAVEHEADERSIZE	44
+
+// Set to 1 if user wants to stop
+int StopFlag = 0;
+
+// Set to 1 to tell the writer thread to finish up
+volatile unsigned char CaptureDone = 0;
+
+// Set to 1 while user wants a take recorded
+volatile unsigned char Recording = 0;
+
+PCMDEV Dev;
+PREROLL Ring;
+PCMMETER Meter;
+
+// Our options
+unsigned int PrerollSeconds = 10;
+unsigned int Rate = 48000;
+unsigned int Channels = 2;
+unsigned char Metering = 0;
+const char *BaseName;
+
+// Kept by the capture thread
+unsigned long Overruns;
+
+// Kept by the writer thread
+FILE *File;
+PREROLL_READER Reader;
+unsigned char *Chunk;
+unsigned long long DataBytes;
+unsigned int Take;
+
+
+
+
+
+/********************* sighandler() *********************
+ * Called when user presses CTRL-C.
+ */
+
+static void sighandler(int signum)
+{
+	StopFlag = 1;
+}
+
+
+
+
+
+/********************* capture_thread() *********************
+ * Reads the card's audio into the ring, until we're told to
+ * stop.
+ */
+
+static void * capture_thread(void *arg)
+{
+	while (!StopFlag)
+	{
+		register snd_pcm_sframes_t	count;
+		register void					*ptr;
+		unsigned int					frames;
+
+		// Read straight into the ring
+		ptr = preroll_write_ptr(&Ring, &frames);
+		if ((count = pcm_dev_readi(&Dev, ptr, frames)) < 0)
+		{
+			register int	err;
+
+			if (count == -EAGAIN || count == -EINTR) continue;
+
+			// An overrun means we weren't scheduled in time, and the card
+			// lost some audio. The ring (and any take) just carries on
+			++Overruns;
+			if ((err = pcm_dev_recover(&Dev, (int)count)) < 0)
+			{
+				printf("Can't recover from %s: %s\n", snd_strerror((int)count), snd_strerror(err));
+				StopFlag = 1;
+			}
+			continue;
+		}
+
+		// Meter it while it's still in the cache
+		if (Metering) pcm_meter_s16(&Meter, ptr, (unsigned int)count);
+
+		preroll_commit(&Ring, (unsigned int)count);
+	}
+
+	CaptureDone = 1;
+	return(0);
+}
+
+
+
+
+
+/********************* put_le32() *********************
+ * Stores a 32-bit number in little endian (Intel) order.
+ */
+
+static void put_le32(unsigned char *ptr, unsigned int val)
+{
+	ptr[0] = (unsigned char)val;
+	ptr[1] = (unsigned char)(val >> 8);
+	ptr[2] = (unsigned char)(val >> 16);
+	ptr[3] = (unsigned char)(val >> 24);
+}
+
+
+
+
+
+/********************* write_header() *********************
+ * Writes the WAVE header, with the lengths as they are now,
+ * at the start of the file. Then goes back to the end.
+ */
+
+static void write_header(void)
+{
+	unsigned char	header[WAVEHEADERSIZE] = {'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E',
+								'f', 'm', 't', ' ', 16, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 16, 0,
+								'd', 'a', 't', 'a', 0, 0, 0, 0};
+	register unsigned int	dataBytes;
+
+	// A WAVE file can't hold more than 4 GB
+	dataBytes = (DataBytes > 0xFFFFFFFFULL - WAVEHEADERSIZE ? 0xFFFFFFFFU - WAVEHEADERSIZE : (unsigned int)DataBytes);
+
+	put_le32(&header[4], dataBytes + WAVEHEADERSIZE - 8);
+	header[22] = (unsigned char)Dev.Channels;
+	put_le32(&header[24], Dev.Rate);
+	put_le32(&header[28], Dev.Rate * Dev.FrameBytes);
+	header[32] = (unsigned char)Dev.FrameBytes;
+	put_le32(&header[40], dataBytes);
+
+	fflush(File);
+	fseek(File, 0, SEEK_SET);
+	fwrite(&header[0], 1, WAVEHEADERSIZE, File);
+	fflush(File);
+	fseek(File, 0, SEEK_END);
+}
+
+
+
+
+
+/********************* start_take() *********************
+ * Creates the next take's file, and starts the reader the
+ * pre-roll behind the live audio.
+ */
+
+static void start_take(void)
+{
+	char	name[PATH_MAX];
+
+	snprintf(&name[0], sizeof(name), "%s-%03u.wav", BaseName, ++Take);
+	if (!(File = fopen(&name[0], "wb")))
+	{
+		printf("Can't create %s: %s\n", &name[0], strerror(errno));
+		Recording = 0;
+		return;
+	}
+	setvbuf(File, 0, _IOFBF, 1024 * 1024);
+
+	DataBytes = 0;
+	write_header();
+	preroll_reader_init(&Ring, &Reader, (unsigned long long)PrerollSeconds * Dev.Rate);
+	printf("Recording %s, starting %.1f seconds back. Press ENTER to stop\n", &name[0],
+		(double)(__atomic_load_n(&Ring.Written, __ATOMIC_ACQUIRE) - Reader.Next) / Dev.Rate);
+}
+
+
+
+
+
+/********************* end_take() *********************
+ * Fills in the WAVE header, and closes the take's file.
+ */
+
+static void end_take(void)
+{
+	write_header();
+	fclose(File);
+	File = 0;
+
+	printf("Take %u: %.1f seconds", Take, (double)(DataBytes / Dev.FrameBytes) / Dev.Rate);
+	if (Reader.Lost) printf(". %llu frames were lost because the disk fell behind!", Reader.Lost);
+	printf("\n");
+}
+
+
+
+
+
+/********************* writer_thread() *********************
+ * While a take is being recorded, copies the audio out of
+ * the ring, and writes it to the file.
+ */
+
+static void * writer_thread(void *arg)
+{
+	struct timespec			interval;
+	register unsigned int	idle;
+
+	interval.tv_sec = 0;
+	interval.tv_nsec = 10000000;
+	idle = 0;
+
+	for (;;)
+	{
+		register unsigned char	done, recording;
+
+		// Check these before we empty the ring, so a take gets all the
+		// audio up to when it was stopped
+		done = CaptureDone;
+		recording = Recording;
+
+		if (recording && !File) start_take();
+
+		if (File)
+		{
+			register unsigned int	count;
+
+			while ((count = preroll_read(&Ring, &Reader, Chunk, CHUNKFRAMES)))
+			{
+				if (fwrite(Chunk, Dev.FrameBytes, count, File) != count)
+				{
+					printf("Can't write take %u: %s\n", Take, strerror(errno));
+					Recording = recording = 0;
+					break;
+				}
+				DataBytes += (unsigned long long)count * Dev.FrameBytes;
+			}
+
+			if (!recording || done)
+				end_take();
+
+			// Every 5 seconds, make sure the file is complete up to this point
+			else if (++idle >= 500)
+			{
+				write_header();
+				idle = 0;
+			}
+		}
+
+		if (done) break;
+
+		nanosleep(&interval, 0);
+	}
+
+	return(0);
+}
+
+
+
+
+
+/****************** start_thread() *********************
+ * Starts a thread, at SCHED_FIFO priority if "priority"
+ * is non-zero and we're allowed.
+ *
+ * RETURNS: 0 if success, or an error number.
+ */
+
+static int start_thread(pthread_t *thread, void * (*func)(void *), void *arg, int priority)
+{
+	register int		err;
+
+	if (priority)
+	{
+		pthread_attr_t			attr;
+		struct sched_param	param;
+
+		pthread_attr_init(&attr);
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		param.sched_priority = priority;
+		pthread_attr_setschedparam(&attr, &param);
+		err = pthread_create(thread, &attr, func, arg);
+		pthread_attr_destroy(&attr);
+		if (err != EPERM) return(err);
+		printf("Can't get real-time priority for the capture thread. Run as root for that\n");
+	}
+
+	return(pthread_create(thread, 0, func, arg));
+}
+
+
+
+
+
+int main(int argc, char **argv)
+{
+	static const char * const	PageNames[3] = {"normal pages", "transparent huge pages", "huge pages"};
+	register int			err;
+	pthread_t				capture, writer;
+	const char				*devName;
+	unsigned long			overruns;
+	unsigned long long	lost, next;
+	PCMMETER_READER		levels;
+
+	// Get the options
+	while (argc > 2 && argv[1][0] == '-')
+	{
+		if (argv[1][1] == 'm')
+		{
+			Metering = 1;
+			--argc;
+			++argv;
+			continue;
+		}
+		if (argv[1][1] == 'p')
+			PrerollSeconds = (unsigned int)atoi(argv[2]);
+		else if (argv[1][1] == 'r')
+			Rate = (unsigned int)atoi(argv[2]);
+		else if (argv[1][1] == 'c')
+			Channels = (unsigned int)atoi(argv[2]);
+		else
+			break;
+		argc -= 2;
+		argv += 2;
+	}
+
+	if (argc < 2 || argv[1][0] == '-' || !Rate || !Channels || Channels > 32 || PrerollSeconds > 600)
+	{
+		printf("Usage: prerollrec [-p seconds] [-r rate] [-c channels] [-m] basename [device]\n");
+		return 1;
+	}
+	BaseName = argv[1];
+	devName = (argc > 2 ? argv[2] : "default");
+
+	if ((err = pcm_dev_open(&Dev, devName, 1, SND_PCM_FORMAT_S16_LE, Channels, Rate, BUFFERFRAMES, PERIODFRAMES)) < 0)
+	{
+		printf("Can't open audio input %s: %s\n", devName, snd_strerror(err));
+		return 1;
+	}
+
+	// Allocate everything now, so nothing is allocated while we capture
+	if ((err = preroll_init(&Ring, (PrerollSeconds + SLACKSECONDS) * Dev.Rate, Dev.FrameBytes, (unsigned int)Dev.PeriodFrames)) < 0 ||
+		!(Chunk = (unsigned char *)malloc((size_t)CHUNKFRAMES * Dev.FrameBytes)))
+	{
+		printf("Can't allocate the pre-roll ring!\n");
+		goto out;
+	}
+	if (Metering && pcm_meter_init(&Meter, Dev.Channels) < 0)
+	{
+		printf("Can't meter more than %u channels!\n", PCMMETER_MAXCHANNELS);
+		goto out;
+	}
+
+	printf("%u Hz, %u channels. The ring holds %.1f seconds (%llu KB of %s%s)\n", Dev.Rate, Dev.Channels,
+		(double)Ring.Frames / Dev.Rate, Ring.MapSize / 1024, PageNames[Ring.Pages], Ring.Locked ? ", locked" : "");
+
+	// Trap when user presses CTRL-C
+	signal(SIGINT, sighandler);
+
+	if ((err = start_thread(&capture, capture_thread, 0, 50)))
+	{
+		printf("Can't start the capture thread: %s\n", strerror(err));
+		goto out;
+	}
+	if ((err = start_thread(&writer, writer_thread, 0, 0)))
+	{
+		printf("Can't start the writer thread: %s\n", strerror(err));
+		StopFlag = 1;
+		pthread_join(capture, 0);
+		goto out;
+	}
+
+	printf("Capturing from %s. Press ENTER to record a take (with %u seconds of pre-roll), CTRL-C to quit.\n", devName, PrerollSeconds);
+
+	// Wait for ENTER. Once a second, check whether anything was lost, and
+	// print the levels if we're metering
+	overruns = 0;
+	lost = 0;
+	pcm_meter_reader_init(&Meter, &levels);
+	next = get_time_ns() + 1000000000ULL;
+	while (!StopFlag)
+	{
+		struct pollfd	pfd;
+
+		pfd.fd = 0;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 1000) > 0)
+		{
+			char	line[256];
+
+			if (!fgets(&line[0], sizeof(line), stdin)) break;
+			Recording ^= 1;
+		}
+
+		if (Overruns != overruns)
+		{
+			printf("Warning: The card's buffer overflowed %lu times. Some audio was lost!\n", Overruns - overruns);
+			overruns = Overruns;
+		}
+
+		if (File && Reader.Lost != lost)
+		{
+			printf("Warning: The writer fell behind, and %llu frames were lost! (Is the disk slow?)\n", Reader.Lost - lost);
+			lost = Reader.Lost;
+		}
+		if (!File) lost = 0;
+
+		if (Metering && get_time_ns() >= next)
+		{
+			pcm_meter_print(&Meter, &levels);
+			next = get_time_ns() + 1000000000ULL;
+		}
+	}
+
+	StopFlag = 1;
+	pthread_join(capture, 0);
+	pthread_join(writer, 0);
+
+	printf("\nCaptured %llu frames. %lu overruns\n", Ring.Written, Overruns);
+
+out:
+	pcm_dev_close(&Dev);
+	preroll_free(&Ring);
+	if (Chunk) free(Chunk);
+
+	return 0;
+}
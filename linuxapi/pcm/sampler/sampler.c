@@ -0,0 +1,1211 @@
+// A simple MIDI sampler. It plays 16-bit 44KHz WAVE files
+// (loaded into RAM before we start) when notes arrive at a
+// MIDI input, using the memory-mapped mode of outputting to
+// the first audio card, as in ../alsawave2:
+// ./sampler piano.wav
+//
+// Each WAVE file can be assigned to one note (ie, 36 for a
+// kick drum), in which case it plays at its own pitch. A file
+// with no note assigned plays on all the other notes, at a
+// pitch relative to middle C (note 60):
+// ./sampler piano.wav kick.wav=36 snare.wav=38
+//
+// A separate thread reads the MIDI input (non-blocking, sleeping
+// in poll()), and puts each note-on and note-off, along with its
+// arrival time, in a lock-free ring buffer (../../common/midiring.h).
+// It never waits for the audio.
+//
+// Our audio_callback() takes the notes out of the ring, and
+// starts and stops voices. Rather than starting each note at the
+// beginning of the period it's mixing (which would make a note's
+// timing depend on when it happened to arrive relative to the
+// period), we start it at the same offset into the period as it
+// arrived into the previous period. Every note is then delayed
+// by the same amount, so the rhythm you play is the rhythm you
+// hear.
+//
+// There's a fixed number of voices (MAXVOICES), allocated up
+// front. If they're all playing when another note starts, we
+// "steal" the one that's fading out the most, or else the one
+// that has played the longest. The velocity of the note-on scales
+// the volume.
+//
+// When you quit (CTRL-C), we print a histogram of the latency
+// from each note-on's arrival at the MIDI input (timestamped by
+// the driver, if it supports SND_RAWMIDI_READ_TSTAMP) until its
+// first sample gets to the audio card's DAC.
+//
+// Options:
+// -m card,dev	The MIDI input. Default is the first one we find.
+// -a card,dev	The audio output. Default is 0,0.
+// -1				One-shot. Ignore note-offs, so each sample plays to
+//					its end (ie, for drums).
+//
+// The MIDI input can be any name that ../../common/mididev.h takes
+// (ie, -m free:1).
+//
+// NOTE: Like ../alsawave2, this opens the card with ALSA directly,
+// not through ../../common/pcmdev.h, so it needs a real sound card.
+// pcmdev only does read/write access, and its virtual card has
+// neither memory-mapped access nor ALSA's async (SIGIO) callback.
+//
+// Compile as:
+// gcc -o sampler sampler.c ../../common/midiparse.c ../../common/mididev.c ../../common/devalloc.c ../../common/timing.c -lasound -lpthread -lm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <math.h>
+
+// Include the ALSA .H file that defines ALSA functions/data
+#include <alsa/asoundlib.h>
+#include "../../common/midiparse.h"
+#include "../../common/midiring.h"
+#include "../../common/mididev.h"
+#include "../../common/timing.h"
+
+
+
+
+
+#pragma pack (1)
+/////////////////////// WAVE File Stuff /////////////////////
+// An IFF file header looks like this
+typedef struct _FILE_head
+{
+	unsigned char	ID[4];	// could be {'R', 'I', 'F', 'F'} or {'F', 'O', 'R', 'M'}
+	unsigned int	Length;	// Length of subsequent file (including remainder of header). This is in
+									// Intel reverse byte order if RIFF, Motorola format if FORM.
+	unsigned char	Type[4];	// {'W', 'A', 'V', 'E'} or {'A', 'I', 'F', 'F'}
+} FILE_head;
+
+
+// An IFF chunk header looks like this
+typedef struct _CHUNK_head
+{
+	unsigned char ID[4];	// 4 ascii chars that is the chunk ID
+	unsigned int	Length;	// Length of subsequent data within this chunk. This is in Intel reverse byte
+							// order if RIFF, Motorola format if FORM. Note: this doesn't include any
+							// extra byte needed to pad the chunk out to an even size.
+} CHUNK_head;
+
+// WAVE fmt chunk
+typedef struct _FORMAT {
+	short				wFormatTag;
+	unsigned short	wChannels;
+	unsigned int	dwSamplesPerSec;
+	unsigned int	dwAvgBytesPerSec;
+	unsigned short	wBlockAlign;
+	unsigned short	wBitsPerSample;
+  // Note: there may be additional fields here, depending upon wFormatTag
+} FORMAT;
+#pragma pack()
+
+
+
+
+
+// Sample rate of the card (and of the WAVE files)
+#define RATE				44100
+
+// Size of the audio card hardware buffer, in frames. Note-to-sound
+// latency is mostly how long it takes to play this buffer, so it's
+// much smaller than what ../alsawave2 uses. If you hear underruns,
+// increase this and PERIODSIZE
+#define BUFFERSIZE		256
+
+// How many frames the card plays before it calls our callback to
+// fill some more of its buffer
+#define PERIODSIZE		64
+
+// The biggest period we can handle (if the card won't do PERIODSIZE)
+#define MAXPERIOD			1024
+
+// How many notes can play at once
+#define MAXVOICES			32
+
+// How many frames a voice takes to fade out after its note-off (about
+// 10 msecs). Stopping the sound instantly would make a click
+#define RELEASEFRAMES	441
+
+// How many notes the ring holds
+#define RINGSIZE			1024
+
+// The biggest number of WAVE files we can load
+#define MAXSAMPLES		128
+
+// A loaded WAVE file
+typedef struct _SAMPLE
+{
+	short						*Data;		// The 16-bit sample points, interleaved if stereo
+	unsigned int			Frames;		// How many frames in Data
+	unsigned char			Channels;	// 1 or 2
+} SAMPLE;
+
+// One playing note
+typedef struct _VOICE
+{
+	const SAMPLE			*Sample;		// The WAVE it plays, or 0 if the voice is free
+	unsigned long long	Position;	// Where we are in the WAVE, in frames * 65536
+	unsigned int			Step;			// How much Position moves per output frame
+	unsigned int			Started;		// Which note-on started it (to find the oldest)
+	int						Gain;			// Volume, from 0 to 32768
+	unsigned short			Fade;			// Once releasing, how many frames until it's silent
+	unsigned char			Note;
+	unsigned char			Channel;
+	unsigned char			Releasing;	// 1 after its note-off
+} VOICE;
+
+// A note-on or note-off, passed from the MIDI thread to the audio
+typedef struct _NOTEEVENT
+{
+	unsigned long long	Time;			// When it arrived, in nanoseconds
+	unsigned char			Status;
+	unsigned char			Note;
+	unsigned char			Velocity;
+	unsigned char			Pad[5];
+} NOTEEVENT;
+
+// Set to 1 if user wants to stop
+int StopFlag = 0;
+
+// Handle to ALSA (audio card's) playback port
+snd_pcm_t				*PlaybackHandle;
+
+// Handle to our callback thread
+snd_async_handler_t	*CallbackHandle;
+
+// Set to 0 while we're stopping the card, so that our callback
+// leaves the card alone
+volatile unsigned char	Playing;
+
+// The actual buffer and period size the card uses
+snd_pcm_uframes_t		BufferFrames, PeriodFrames;
+
+// How long a period lasts, in nanoseconds
+unsigned long long	PeriodTime;
+
+// The loaded WAVE files
+SAMPLE					Samples[MAXSAMPLES];
+unsigned int			SampleCount;
+
+// Which WAVE each note plays (0 if none), and how fast
+const SAMPLE			*NoteSample[128];
+unsigned int			NoteStep[128];
+
+// Volume for each velocity
+int						VelocityGain[128];
+
+VOICE						Voices[MAXVOICES];
+unsigned int			NoteCount;
+
+// Our options
+char						MidiName[64];
+char						AudioName[64] = "hw:0,0";
+unsigned char			OneShot = 0;
+
+// Notes from the MIDI thread to audio_callback()
+MIDIRING					Ring;
+
+// Counts of what audio_callback() has done, which we print when done
+unsigned long			Stolen, Xruns, Lost;
+TIMEHIST					Latency;
+
+// For WAVE file loading
+static const unsigned char Riff[4]	= { 'R', 'I', 'F', 'F' };
+static const unsigned char Wave[4] = { 'W', 'A', 'V', 'E' };
+static const unsigned char Fmt[4] = { 'f', 'm', 't', ' ' };
+static const unsigned char Data[4] = { 'd', 'a', 't', 'a' };
+
+
+
+
+
+/****************** sighandler() *********************
+ * Called by the operating system when the user presses
+ * CTRL-C to stop.
+ */
+
+void sighandler(int dummy)
+{
+	// Let main() know that user wants to break out of the loop
+	StopFlag = 1;
+}
+
+
+
+
+
+/****************** find_midi_in() *********************
+ * Finds the first MIDI input in the system, and copies
+ * its name (for snd_rawmidi_open) to the specified
+ * buffer. If no MIDI input is found, zeroes out the
+ * buffer.
+ */
+
+void find_midi_in(char *cardName)
+{
+	register int			err;
+	int						cardNum;
+	snd_rawmidi_info_t	*rawMidiInfo;
+
+	// Assume no input found
+	cardName[0] = 0;
+
+	// Start with first card
+	cardNum = -1;
+
+	// To get some info about the subdevices of a MIDI device, we need a
+	// snd_rawmidi_info_t, so let's allocate one on the stack
+	snd_rawmidi_info_alloca(&rawMidiInfo);
+	memset(rawMidiInfo, 0, snd_rawmidi_info_sizeof());
+
+	do
+	{
+		// Get next sound card's card number. When "cardNum" == -1, then ALSA
+		// fetches the first card
+		if ((err = snd_card_next(&cardNum)) < 0) break;
+
+		// Another card? ALSA sets "cardNum" to -1 if no more
+		if (cardNum != -1)
+		{
+			snd_ctl_t			*midiHandle;
+
+			// Open this card. We specify only the card number -- not any device nor sub-device too
+			sprintf(cardName, "hw:%i", cardNum);
+			if ((err = snd_ctl_open(&midiHandle, cardName, 0)) >= 0)
+			{
+				int				devNum;
+
+				// Start with the first device on this card, and look for a MIDI input
+				devNum = -1;
+				for (;;)
+				{
+					// Get the number of the next MIDI device on this card
+					if ((err = snd_ctl_rawmidi_next_device(midiHandle, &devNum)) < 0 || devNum < 0) break;
+
+					// Get info on the MIDI in portion of this device's first subdevice
+					snd_rawmidi_info_set_device(rawMidiInfo, devNum);
+					snd_rawmidi_info_set_stream(rawMidiInfo, SND_RAWMIDI_STREAM_INPUT);
+					snd_rawmidi_info_set_subdevice(rawMidiInfo, 0);
+					if ((err = snd_ctl_rawmidi_info(midiHandle, rawMidiInfo)) >= 0 && snd_rawmidi_info_get_subdevices_count(rawMidiInfo))
+					{
+						// We found a MIDI Input device. Format its name in the caller's buffer
+						sprintf(cardName, "hw:%i,%i", cardNum, devNum);
+
+						// All done
+						cardNum = -1;
+
+						break;
+					}
+				}
+
+				// Close the card after we're done enumerating its subdevices
+				snd_ctl_close(midiHandle);
+			}
+		}
+
+		// Another card?
+	} while (cardNum != -1);
+
+	// ALSA allocates some mem to load its config file when we call some of the
+	// above functions. Now that we're done getting the info, let's tell ALSA
+	// to unload the info and free up that mem
+	snd_config_update_free_global();
+}
+
+
+
+
+
+/********************** compareID() *********************
+ * Compares the passed ID str (ie, a ptr to 4 Ascii
+ * bytes) with the ID at the passed ptr. Returns TRUE if
+ * a match, FALSE if not.
+ */
+
+static unsigned char compareID(const unsigned char * id, unsigned char * ptr)
+{
+	register unsigned char i = 4;
+
+	while (i--)
+	{
+		if ( *(id)++ != *(ptr)++ ) return(0);
+	}
+	return(1);
+}
+
+
+
+
+
+/********************** waveLoad() *********************
+ * Loads a WAVE file.
+ *
+ * fn =			Filename to load.
+ * sample =		Where to put the wave data, and its size.
+ *
+ * RETURNS: 0 if success, non-zero if not.
+ */
+
+static unsigned char waveLoad(const char *fn, SAMPLE *sample)
+{
+	const char				*message;
+	FILE_head				head;
+	register int			inHandle;
+
+	sample->Channels = 0;
+
+	if ((inHandle = open(fn, O_RDONLY)) == -1)
+		message = "didn't open";
+
+	// Read in IFF File header
+	else
+	{
+		if (read(inHandle, &head, sizeof(FILE_head)) == sizeof(FILE_head))
+		{
+			// Is it a RIFF and WAVE?
+			if (!compareID(&Riff[0], &head.ID[0]) || !compareID(&Wave[0], &head.Type[0]))
+			{
+				message = "is not a WAVE file";
+				goto bad;
+			}
+
+			// Read in next chunk header
+			while (read(inHandle, &head, sizeof(CHUNK_head)) == sizeof(CHUNK_head))
+			{
+				// ============================ Is it a fmt chunk? ===============================
+				if (compareID(&Fmt[0], &head.ID[0]))
+				{
+					FORMAT	format;
+
+					// Read in the remainder of chunk
+					if (head.Length < sizeof(FORMAT) || read(inHandle, &format.wFormatTag, sizeof(FORMAT)) != sizeof(FORMAT)) break;
+					head.Length -= sizeof(FORMAT);
+					if (head.Length & 1) ++head.Length;
+					lseek(inHandle, head.Length, SEEK_CUR);
+
+					// Can't handle compressed WAVE files
+					if (format.wFormatTag != 1)
+					{
+						message = "compressed WAVE not supported";
+						goto bad;
+					}
+
+					// Only 16-bit allowed
+					if (format.wBitsPerSample != 16)
+					{
+						message = "must be a 16-bit WAVE!";
+						goto bad;
+					}
+
+					// Only 44100 sample rate allowed
+					if (format.dwSamplesPerSec != RATE)
+					{
+						message = "rate must be 44.1 KHz";
+						goto bad;
+					}
+
+					if (!format.wChannels || format.wChannels > 2)
+					{
+						message = "must be mono or stereo";
+						goto bad;
+					}
+
+					sample->Channels = (unsigned char)format.wChannels;
+				}
+
+				// ============================ Is it a data chunk? ===============================
+				else if (compareID(&Data[0], &head.ID[0]))
+				{
+					if (!sample->Channels) break;
+
+					// Size of wave data is head.Length. Allocate a buffer and read in the wave data
+					if (!(sample->Data = (short *)malloc(head.Length)))
+					{
+						message = "won't fit in RAM";
+						goto bad;
+					}
+
+					if (read(inHandle, sample->Data, head.Length) != head.Length)
+					{
+						free(sample->Data);
+						break;
+					}
+
+					// size must be in terms of sample frames
+					sample->Frames = head.Length / (2 * sample->Channels);
+
+					close(inHandle);
+					return(0);
+				}
+
+				// ============================ Skip this chunk ===============================
+				else
+				{
+					if (head.Length & 1) ++head.Length;  // If odd, round it up to account for pad byte
+					lseek(inHandle, head.Length, SEEK_CUR);
+				}
+			}
+		}
+
+		message = "is a bad WAVE file";
+bad:	close(inHandle);
+	}
+
+	printf("%s %s\n", fn, message);
+	return(1);
+}
+
+
+
+
+
+/********************** audioRecovery() **********************
+ * Called whenever we encounter an error in filling the sound
+ * card's buffer with more audio data.
+ *
+ * NOTE: ALSA sound card's handle must be in the global
+ * "PlaybackHandle".
+ */
+
+static int audioRecovery(register int err)
+{
+	// Under-run?
+	if (err == -EPIPE)
+	{
+		// NOTE: If you see these during playback, you'll have to increase
+		// BUFFERSIZE/PERIODSIZE
+		++Xruns;
+		if ((err = snd_pcm_prepare(PlaybackHandle)) >= 0)
+good:		return(0);
+		printf("Can't recovery from underrun, prepare failed: %s\n", snd_strerror(err));
+	}
+
+	// Audio suspended?
+	else if (err == -ESTRPIPE)
+	{
+		printf("audio suspended\n");
+
+		// Wait until the suspend flag is released
+		while ((err = snd_pcm_resume(PlaybackHandle)) == -EAGAIN) sleep(1);
+		if (err >= 0) goto good;
+		if ((err = snd_pcm_prepare(PlaybackHandle)) >= 0) goto good;
+		printf("Can't recovery from suspend, prepare failed: %s\n", snd_strerror(err));
+	}
+
+	return(err);
+}
+
+
+
+
+
+/********************** note_on() **********************
+ * Starts a voice playing the WAVE for a note.
+ */
+
+static void note_on(register const NOTEEVENT *event)
+{
+	register VOICE				*voice, *steal;
+	register const SAMPLE	*sample;
+
+	if (!(sample = NoteSample[event->Note])) return;
+
+	// Look for a free voice. While we're at it, pick the one to steal if
+	// there isn't. The one that's fading out the most is the least missed.
+	// Otherwise, the oldest
+	steal = &Voices[0];
+	for (voice = &Voices[0]; voice < &Voices[MAXVOICES]; voice++)
+	{
+		if (!voice->Sample) goto got;
+		if (voice->Releasing > steal->Releasing ||
+			(voice->Releasing == steal->Releasing && (voice->Releasing ? voice->Fade < steal->Fade : voice->Started < steal->Started)))
+		{
+			steal = voice;
+		}
+	}
+	voice = steal;
+	++Stolen;
+
+got:
+	voice->Sample = sample;
+	voice->Position = 0;
+	voice->Step = NoteStep[event->Note];
+	voice->Started = ++NoteCount;
+	voice->Gain = VelocityGain[event->Velocity];
+	voice->Fade = RELEASEFRAMES;
+	voice->Note = event->Note;
+	voice->Channel = event->Status & 0x0F;
+	voice->Releasing = 0;
+}
+
+
+
+
+
+/********************** note_off() **********************
+ * Starts fading out the voices playing a note.
+ */
+
+static void note_off(register const NOTEEVENT *event)
+{
+	register VOICE		*voice;
+
+	for (voice = &Voices[0]; voice < &Voices[MAXVOICES]; voice++)
+	{
+		if (voice->Sample && !voice->Releasing && voice->Note == event->Note && voice->Channel == (event->Status & 0x0F))
+			voice->Releasing = 1;
+	}
+}
+
+
+
+
+
+/********************** mix_voices() **********************
+ * Adds the playing voices to the mix, for the specified
+ * range of frames.
+ *
+ * mix =	Interleaved stereo, 32-bit.
+ */
+
+static void mix_voices(int *mix, unsigned int from, unsigned int to)
+{
+	register VOICE		*voice;
+
+	for (voice = &Voices[0]; voice < &Voices[MAXVOICES]; voice++)
+	{
+		register const SAMPLE	*sample;
+		register int				*ptr;
+		register unsigned int	i;
+
+		if (!(sample = voice->Sample)) continue;
+
+		ptr = mix + from * 2;
+		for (i = from; i < to; i++)
+		{
+			register const short		*data;
+			register unsigned int	index, frac;
+			register int				left, right, gain;
+
+			// Stop at the end of the WAVE (we need the frame after this one to
+			// interpolate)
+			index = (unsigned int)(voice->Position >> 16);
+			if (index + 1 >= sample->Frames)
+			{
+stop:			voice->Sample = 0;
+				break;
+			}
+
+			// When the WAVE is pitched up or down, we land between its sample
+			// points. Draw a straight line between the two we're between
+			frac = (unsigned int)(voice->Position & 0xFFFF) >> 1;
+			data = sample->Data + index * sample->Channels;
+			left = data[0] + (((data[sample->Channels] - data[0]) * (int)frac) >> 15);
+			if (sample->Channels == 1)
+				right = left;
+			else
+				right = data[1] + (((data[3] - data[1]) * (int)frac) >> 15);
+			voice->Position += voice->Step;
+
+			gain = voice->Gain;
+			if (voice->Releasing)
+			{
+				if (!voice->Fade) goto stop;
+				gain = (gain * voice->Fade--) / RELEASEFRAMES;
+			}
+
+			*ptr++ += (left * gain) >> 15;
+			*ptr++ += (right * gain) >> 15;
+		}
+	}
+}
+
+
+
+
+
+/********************** render_period() **********************
+ * Mixes one period of audio, starting and stopping voices
+ * at the time of each note in the ring.
+ *
+ * block =		Where to put the interleaved stereo 16-bit frames.
+ * frames =		How many frames.
+ * endTime =	The time the period represents the end of. Notes
+ *					that arrived during the period before that get
+ *					started at the same offset in this one.
+ * queued =		How many frames are in the card's buffer ahead of
+ *					this period (to figure out when a note is heard).
+ * now =			When we read "queued".
+ */
+
+static void render_period(short *block, unsigned int frames, unsigned long long endTime, unsigned int queued, unsigned long long now)
+{
+	int								mix[MAXPERIOD * 2];
+	register const NOTEEVENT	*event;
+	register unsigned int		pos, i;
+	register unsigned long long	startTime;
+
+	memset(&mix[0], 0, frames * 2 * sizeof(int));
+	startTime = endTime - PeriodTime;
+	pos = 0;
+
+	while ((event = (const NOTEEVENT *)midi_ring_read_ptr(&Ring)) && event->Time < endTime)
+	{
+		register unsigned int	offset;
+
+		// Where in the period it happened. If we were late getting to
+		// it (ie, an underrun), then play it as soon as we can
+		offset = (event->Time > startTime ? (unsigned int)((event->Time - startTime) * RATE / 1000000000ULL) : 0);
+		if (offset < pos) offset = pos;
+		if (offset >= frames) offset = frames - 1;
+
+		// Mix the voices up to that frame, then start/stop them
+		mix_voices(&mix[0], pos, offset);
+		pos = offset;
+
+		if ((event->Status & 0xF0) == 0x90 && event->Velocity)
+		{
+			note_on(event);
+
+			// It will be heard when the card plays this frame
+			if (NoteSample[event->Note])
+				time_hist_add(&Latency, now + (queued + offset) * 1000000000ULL / RATE - event->Time);
+		}
+		else if (!OneShot)
+			note_off(event);
+
+		midi_ring_release(&Ring);
+	}
+
+	mix_voices(&mix[0], pos, frames);
+
+	// Clip the mix to 16 bits
+	for (i = 0; i < frames * 2; i++)
+		block[i] = (short)(mix[i] > 32767 ? 32767 : (mix[i] < -32768 ? -32768 : mix[i]));
+}
+
+
+
+
+
+/********************** write_period() **********************
+ * Copies one period of audio to the current position of
+ * the sound card's buffer.
+ *
+ * RETURNS: 0 if success, 1 if the card needs to be started
+ * again (after recovering from an error), or a negative
+ * error number.
+ */
+
+static int write_period(const short *block)
+{
+	register int			err, ret;
+	snd_pcm_uframes_t		size, offset, frames;
+
+	ret = 0;
+	size = PeriodFrames;
+	do
+	{
+		const snd_pcm_channel_area_t	*buffer;
+
+		// Get the pointer to the audio hardware's buffer where we need to copy,
+		// and how many frames. NOTE: If the buffer wraps, then "frames" may be
+		// less than "size"
+		frames = size;
+		if ((err = snd_pcm_mmap_begin(PlaybackHandle, &buffer, &offset, &frames)) < 0)
+		{
+			if ((err = audioRecovery(err)) < 0)
+			{
+				printf("MMAP begin error: %s\n", snd_strerror(err));
+				return(err);
+			}
+			return(1);
+		}
+
+		// 16-bit stereo is 4 bytes per frame
+		memcpy(((unsigned char *)buffer[0].addr) + (offset * 4), block, frames * 4);
+
+		// Commit the data
+		if ((err = snd_pcm_mmap_commit(PlaybackHandle, offset, frames)) < 0 || (snd_pcm_uframes_t)err != frames)
+		{
+			if ((err = audioRecovery(err >= 0 ? -EPIPE : err)) < 0)
+			{
+				printf("MMAP commit error: %s\n", snd_strerror(err));
+				return(err);
+			}
+			ret = 1;
+		}
+
+		block += frames * 2;
+		size -= frames;
+	} while (size > 0 && frames);
+
+	return(ret);
+}
+
+
+
+
+
+/********************** audio_callback() **********************
+ * Called by ALSA whenever the sound card's buffer needs to be
+ * filled with more audio data.
+ */
+
+static void audio_callback(snd_async_handler_t *ahandler)
+{
+	short								block[MAXPERIOD * 2];
+	register int					err;
+	register unsigned long long	now;
+
+	// Is main() stopping the card? Then leave it alone
+	if (!Playing) return;
+
+	now = get_time_ns();
+
+	for (;;)
+	{
+		// Check state, and if there's an error, try to recover
+		switch (snd_pcm_state(PlaybackHandle))
+		{
+			case SND_PCM_STATE_XRUN:
+			{
+				if ((err = audioRecovery(-EPIPE)))
+				{
+					printf("XRUN recovery failed: %s\n", snd_strerror(err));
+					return;
+				}
+				break;
+			}
+
+			case SND_PCM_STATE_SUSPENDED:
+			{
+				if ((err = audioRecovery(-ESTRPIPE)))
+				{
+					printf("SUSPEND recovery failed: %s\n", snd_strerror(err));
+					return;
+				}
+			}
+		}
+
+		// Get how many frames the sound card needs us to copy to the sound
+		// card's buffer
+		if ((err = snd_pcm_avail_update(PlaybackHandle)) < 0)
+		{
+			if ((err = audioRecovery(err)))
+			{
+				printf("Avail update failed: %s\n", snd_strerror(err));
+				return;
+			}
+			continue;
+		}
+
+		if ((snd_pcm_uframes_t)err < PeriodFrames)
+		{
+			// After recovering from an underrun, the card needs to be started again
+			if (snd_pcm_state(PlaybackHandle) == SND_PCM_STATE_PREPARED && (err = snd_pcm_start(PlaybackHandle)) < 0)
+				printf("Start error: %s\n", snd_strerror(err));
+			break;
+		}
+
+		// Normally we're called right after the card has played a period, so
+		// the period we mix now represents the one that just ended. If we've
+		// fallen behind, and there's room for several periods, the earlier
+		// ones represent earlier times
+		render_period(&block[0], PeriodFrames, now - ((unsigned long long)err / PeriodFrames - 1) * PeriodTime,
+			BufferFrames - err, now);
+		if (write_period(&block[0]) < 0) return;
+	}
+}
+
+
+
+
+
+/********************** start_audio() **********************
+ * Initially fills the sound card's buffer with silence,
+ * then starts playback.
+ *
+ * NOTE: ALSA sound card's handle must be in the global
+ * "PlaybackHandle".
+ */
+
+static int start_audio(void)
+{
+	short				block[MAXPERIOD * 2];
+	register int	err;
+
+	snd_pcm_prepare(PlaybackHandle);
+
+	// Fill the whole buffer, so we have it all to absorb any delay in
+	// our callback
+	memset(&block[0], 0, sizeof(block));
+	while (snd_pcm_avail_update(PlaybackHandle) >= (snd_pcm_sframes_t)PeriodFrames)
+	{
+		if ((err = write_period(&block[0])) < 0) return(err);
+	}
+
+	// Start the playback (unless filling the buffer already did)
+	if (snd_pcm_state(PlaybackHandle) == SND_PCM_STATE_PREPARED && (err = snd_pcm_start(PlaybackHandle)) < 0)
+	{
+		printf("Start error: %s\n", snd_strerror(err));
+		return(err);
+	}
+
+	// Let our callback keep the card fed from now on
+	Playing = 1;
+
+	return(0);
+}
+
+
+
+
+
+/********************* open_audio() *******************
+ * Opens the audio card, and sets its hardware and software
+ * parameters for low latency, memory-mapped playback.
+ *
+ * RETURNS: 0 if success, or non-zero if error (in which
+ * case the card is closed).
+ *
+ * NOTE: Sets the global "PlaybackHandle".
+ */
+
+static int open_audio(void)
+{
+	register int			err;
+	snd_pcm_hw_params_t	*hw_params;
+	snd_pcm_sw_params_t	*sw_params;
+
+	if ((err = snd_pcm_open(&PlaybackHandle, &AudioName[0], SND_PCM_STREAM_PLAYBACK, 0)) < 0)
+	{
+		printf("Can't open audio %s: %s\n", &AudioName[0], snd_strerror(err));
+		return(err);
+	}
+
+	// 16-bit, 44.1KHz, stereo, interleaved, memory-mapped. See ../alsawave2
+	// for what each of these does
+	if ((err = snd_pcm_hw_params_malloc(&hw_params)) < 0)
+	{
+		printf("Can't get sound hardware struct %s\n", snd_strerror(err));
+		goto bad1;
+	}
+	BufferFrames = BUFFERSIZE;
+	PeriodFrames = PERIODSIZE;
+	if ((err = snd_pcm_hw_params_any(PlaybackHandle, hw_params)) < 0 ||
+		(err = snd_pcm_hw_params_set_format(PlaybackHandle, hw_params, SND_PCM_FORMAT_S16_LE)) < 0 ||
+		(err = snd_pcm_hw_params_set_rate(PlaybackHandle, hw_params, RATE, 0)) < 0 ||
+		(err = snd_pcm_hw_params_set_channels(PlaybackHandle, hw_params, 2)) < 0 ||
+		(err = snd_pcm_hw_params_set_access(PlaybackHandle, hw_params, SND_PCM_ACCESS_MMAP_INTERLEAVED)) < 0 ||
+		(err = snd_pcm_hw_params_set_buffer_size_near(PlaybackHandle, hw_params, &BufferFrames)) < 0 ||
+		(err = snd_pcm_hw_params_set_period_size_near(PlaybackHandle, hw_params, &PeriodFrames, 0)) < 0 ||
+		(err = snd_pcm_hw_params(PlaybackHandle, hw_params)) < 0)
+	{
+		printf("Can't set hardware params: %s\n", snd_strerror(err));
+		snd_pcm_hw_params_free(hw_params);
+		goto bad1;
+	}
+	snd_pcm_hw_params_free(hw_params);
+
+	if (PeriodFrames > MAXPERIOD)
+	{
+		printf("The card's period is too big (%lu frames)\n", PeriodFrames);
+		err = -EINVAL;
+		goto bad1;
+	}
+	PeriodTime = PeriodFrames * 1000000000ULL / RATE;
+
+	// Call our callback whenever another period can be copied. We start the
+	// card ourselves, once we've filled its buffer
+	if ((err = snd_pcm_sw_params_malloc(&sw_params)) < 0)
+	{
+		printf("Can't get sound software struct: %s\n", snd_strerror(err));
+		goto bad1;
+	}
+	if ((err = snd_pcm_sw_params_current(PlaybackHandle, sw_params)) < 0 ||
+		(err = snd_pcm_sw_params_set_avail_min(PlaybackHandle, sw_params, PeriodFrames)) < 0 ||
+		(err = snd_pcm_sw_params_set_start_threshold(PlaybackHandle, sw_params, BufferFrames)) < 0 ||
+		(err = snd_pcm_sw_params(PlaybackHandle, sw_params)) < 0)
+	{
+		printf("Can't set software params: %s\n", snd_strerror(err));
+		snd_pcm_sw_params_free(sw_params);
+		goto bad1;
+	}
+	snd_pcm_sw_params_free(sw_params);
+
+	if ((err = snd_async_add_pcm_handler(&CallbackHandle, PlaybackHandle, audio_callback, 0)) < 0)
+	{
+		printf("Can't register sound callback: %s\n", snd_strerror(err));
+bad1:	snd_pcm_close(PlaybackHandle);
+		return(err);
+	}
+
+	printf("Audio buffer is %lu frames (%.1f msecs), period is %lu frames\n", BufferFrames, BufferFrames * 1000.0 / RATE, PeriodFrames);
+	return(0);
+}
+
+
+
+
+
+/****************** midi_thread() *********************
+ * Reads the MIDI input, and puts the note-ons and note-offs
+ * in the ring for audio_callback().
+ */
+
+static void * midi_thread(void *arg)
+{
+	register MIDIDEV			*midiIn;
+	MIDIPARSER					parser;
+	MIDIEVENT					events[256];
+	unsigned char				buffer[1024];
+	struct pollfd				*pfds;
+	register int				npfds;
+
+	midiIn = (MIDIDEV *)arg;
+
+	npfds = midi_dev_poll_descriptors_count(midiIn);
+	pfds = (struct pollfd *)alloca(npfds * sizeof(struct pollfd));
+	midi_dev_poll_descriptors(midiIn, pfds, npfds);
+
+	midi_parse_init(&parser);
+
+	while (!StopFlag)
+	{
+		register int			len;
+		unsigned long long		now;
+
+		// Wake up at least every 100 msecs to check whether we should stop
+		if (poll(pfds, npfds, 100) <= 0) continue;
+		now = get_time_ns();
+
+		for (;;)
+		{
+			register const unsigned char	*ptr;
+			unsigned int					used, count, i;
+
+			// If the driver timestamps the bytes, this gets their time
+			if ((len = midi_dev_read(midiIn, &buffer[0], sizeof(buffer), &now)) <= 0) break;
+
+			ptr = &buffer[0];
+			while (len)
+			{
+				count = midi_parse(&parser, ptr, len, now, &events[0], sizeof(events) / sizeof(MIDIEVENT), &used);
+				ptr += used;
+				len -= used;
+
+				// We only want the note-ons and note-offs
+				for (i = 0; i < count; i++)
+				{
+					register NOTEEVENT	*note;
+
+					if (events[i].Type != MIDI_TYPE_CHANNEL || (events[i].Status & 0xF0) > 0x90) continue;
+
+					if (!(note = (NOTEEVENT *)midi_ring_write_ptr(&Ring)))
+						++Lost;
+					else
+					{
+						note->Time = events[i].Time;
+						note->Status = events[i].Status;
+						note->Note = events[i].Data1;
+						note->Velocity = events[i].Data2;
+						midi_ring_commit(&Ring);
+					}
+				}
+			}
+		}
+	}
+
+	return(0);
+}
+
+
+
+
+
+/****************** load_samples() *********************
+ * Loads the WAVE files named on the command line, and
+ * figures out which one each note plays, and how fast.
+ *
+ * RETURNS: 0 if success, non-zero if not.
+ */
+
+static int load_samples(int argc, char **argv)
+{
+	const SAMPLE			*fallback;
+	register unsigned int	note;
+
+	fallback = 0;
+	while (argc-- > 0)
+	{
+		register char	*assign;
+		register int	n;
+
+		if (SampleCount >= MAXSAMPLES)
+		{
+			printf("Too many WAVE files. We allow %u\n", MAXSAMPLES);
+			return(1);
+		}
+
+		// A WAVE for only one note?
+		n = -1;
+		if ((assign = strrchr(*argv, '=')))
+		{
+			*assign++ = 0;
+			if ((n = atoi(assign)) < 0 || n > 127)
+			{
+				printf("%s: note must be 0 to 127\n", *argv);
+				return(1);
+			}
+		}
+
+		if (waveLoad(*argv, &Samples[SampleCount])) return(1);
+
+		if (n >= 0)
+		{
+			NoteSample[n] = &Samples[SampleCount];
+			NoteStep[n] = 0x10000;
+		}
+		else
+			fallback = &Samples[SampleCount];
+
+		++SampleCount;
+		++argv;
+	}
+
+	// The notes without their own WAVE play the other one, at a pitch
+	// relative to middle C
+	for (note = 0; note < 128; note++)
+	{
+		if (!NoteSample[note] && fallback)
+		{
+			NoteSample[note] = fallback;
+			NoteStep[note] = (unsigned int)(65536.0 * pow(2.0, ((int)note - 60) / 12.0) + 0.5);
+		}
+	}
+
+	// Loudness goes more like the square of the velocity
+	for (note = 0; note < 128; note++) VelocityGain[note] = (int)(note * note * 32768 / (127 * 127));
+
+	return(0);
+}
+
+
+
+
+
+int main(int argc, char **argv)
+{
+	register int		err;
+	MIDIDEV				midiIn;
+	pthread_t			thread;
+
+	// Get the options
+	while (argc > 1 && argv[1][0] == '-')
+	{
+		if (argv[1][1] == '1')
+			OneShot = 1;
+		else if ((argv[1][1] == 'm' || argv[1][1] == 'a') && argc > 2)
+		{
+			snprintf(argv[1][1] == 'm' ? &MidiName[0] : &AudioName[0], sizeof(MidiName), strchr(argv[2], ':') ? "%s" : "hw:%s", argv[2]);
+			--argc;
+			++argv;
+		}
+		else
+			break;
+		--argc;
+		++argv;
+	}
+
+	if (argc < 2 || argv[1][0] == '-')
+	{
+		printf("Usage: sampler [-m midiport] [-a audioport] [-1] file.wav[=note] ...\n");
+		return 1;
+	}
+
+	if (load_samples(argc - 1, &argv[1])) goto out;
+
+	// Did user supply a MIDI Input? If not, we need to find one
+	if (!MidiName[0])
+	{
+		find_midi_in(&MidiName[0]);
+		if (!MidiName[0])
+		{
+			printf("Can't find a MIDI Input!\n");
+			goto out;
+		}
+	}
+
+	if (midi_ring_init(&Ring, sizeof(NOTEEVENT), RINGSIZE) < 0)
+	{
+		printf("Out of memory!\n");
+		goto out;
+	}
+
+	// Ask the driver to timestamp the bytes as they arrive
+	if ((err = midi_dev_open(&midiIn, &MidiName[0], MIDIDEV_INPUT|MIDIDEV_NONBLOCK|MIDIDEV_TSTAMP)) < 0)
+	{
+		printf("Can't open MIDI Input %s: %s\n", &MidiName[0], snd_strerror(err));
+		goto out;
+	}
+
+	time_hist_init(&Latency);
+
+	if (!open_audio())
+	{
+		if (!start_audio())
+		{
+			// Trap when user presses CTRL-C
+			signal(SIGINT, sighandler);
+
+			// ALSA calls audio_callback() from a SIGIO handler. Make sure it's
+			// not on the MIDI thread, by starting that thread with SIGIO blocked
+			{
+			sigset_t		set;
+
+			sigemptyset(&set);
+			sigaddset(&set, SIGIO);
+			pthread_sigmask(SIG_BLOCK, &set, 0);
+			err = pthread_create(&thread, 0, midi_thread, &midiIn);
+			pthread_sigmask(SIG_UNBLOCK, &set, 0);
+			}
+
+			if (err)
+				printf("Can't start MIDI thread: %s\n", strerror(err));
+			else
+			{
+				printf("Playing %u WAVE files from %s (timestamped %s).\nPress CTRL-C to stop.\n",
+					SampleCount, &MidiName[0], midiIn.Timestamps ? "by the driver" : "on wakeup");
+
+				// ALSA calls our callback on this thread (in a signal handler), so
+				// we have nothing to do but wait
+				while (!StopFlag) sleep(1);
+
+				pthread_join(thread, 0);
+			}
+
+			Playing = 0;
+			snd_pcm_drop(PlaybackHandle);
+		}
+
+		// Close sound card
+		snd_pcm_close(PlaybackHandle);
+
+		printf("\n%u notes, %lu voices stolen, %lu underruns, %lu notes lost\n", NoteCount, Stolen, Xruns, Lost);
+		if (Latency.Count) time_hist_print(&Latency, "Note-to-sound latency");
+	}
+
+	midi_dev_close(&midiIn);
+	midi_ring_free(&Ring);
+out:
+	while (SampleCount) free(Samples[--SampleCount].Data);
+
+	return 0;
+}
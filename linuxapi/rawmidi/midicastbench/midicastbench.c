@@ -0,0 +1,237 @@
+// Checks, and measures, our broadcast ring (../../common/midicast.h),
+// which rawmidiinput and smfrec use to hand each MIDI message from
+// their input thread to several reader threads. No MIDI hardware is
+// needed.
+//
+// A writer thread writes numbered records as fast as it can, and
+// several reader threads each read them at their own pace. Each
+// reader checks that its records are whole (not half overwritten),
+// and in order, and counts any it missed.
+//
+// First, the writer writes exactly as many records as the ring holds,
+// so it can't lap anyone. Every reader, even a slow one, must get
+// every record. Then the writer writes many times that, so the slow
+// reader (and on a single CPU, the others too) gets lapped. Each must
+// notice every lap, and every record must be either read or counted
+// as skipped.
+//
+// Compile as:
+// gcc -O2 -o midicastbench midicastbench.c -lpthread
+//
+// Run it, optionally specifying how many million records to write
+// in the second test (default 10):
+// ./midicastbench 20
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include "../../common/midicast.h"
+
+
+
+
+
+// One record. With its sequence number, it fills a 64 byte slot
+typedef struct _RECORD
+{
+	unsigned long long	Number;
+	unsigned char			Data[48];	// Every byte is the low byte of Number
+} RECORD;
+
+// How many readers we run. The last one is slow
+#define NUMREADERS		3
+
+// What each reader found
+typedef struct _READER
+{
+	MIDICAST_READER		Cast;
+	pthread_t				Thread;
+	unsigned long long	Next;			// The number of the record we expect next
+	unsigned long			Missed;		// How many records were missing, by their numbers
+	unsigned long			Bad;			// How many were torn, or out of order
+	unsigned char			Slow;			// 1 to nap every so often
+} READER;
+
+static MIDICAST		Cast;
+static READER			Readers[NUMREADERS];
+
+// How many records the writer writes, and set to 1 when it's done
+static unsigned long	Count;
+static int				WriteDone;
+
+
+
+
+
+/********************** get_time_ns() *********************
+ * Returns the current time of the monotonic clock, in
+ * nanoseconds.
+ */
+
+static unsigned long long get_time_ns(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+
+
+
+
+/********************** reader_thread() *********************
+ * Reads records until the writer is done, and checks them.
+ */
+
+static void * reader_thread(void *arg)
+{
+	register READER			*reader;
+	RECORD						record;
+	struct timespec			nap;
+	register unsigned int	i, n;
+	register int				done;
+
+	reader = (READER *)arg;
+	nap.tv_sec = 0;
+	nap.tv_nsec = 1000000;
+	n = 0;
+
+	do
+	{
+		done = __atomic_load_n(&WriteDone, __ATOMIC_ACQUIRE);
+
+		while (midi_cast_read(&Cast, &reader->Cast, &record))
+		{
+			for (i = 0; i < sizeof(record.Data); i++)
+			{
+				if (record.Data[i] != (unsigned char)record.Number) break;
+			}
+			if (i < sizeof(record.Data) || record.Number < reader->Next)
+				++reader->Bad;
+			else
+				reader->Missed += record.Number - reader->Next;
+			reader->Next = record.Number + 1;
+
+			// The slow reader naps every 64 records, like a display that
+			// scrolls slowly
+			if (reader->Slow && !(++n & 63)) nanosleep(&nap, 0);
+		}
+
+		sched_yield();
+	} while (!done || midi_cast_lag(&Cast, &reader->Cast));
+
+	// Any missing at the end?
+	reader->Missed += Count - reader->Next;
+
+	return(0);
+}
+
+
+
+
+
+/********************** run() *********************
+ * Writes "count" records through a ring of "size" records,
+ * with NUMREADERS readers, and prints what each got.
+ *
+ * RETURNS: The number of readers whose numbers don't add
+ * up (or 1 if we couldn't run at all).
+ */
+
+static unsigned int run(const char *name, unsigned int size, unsigned long count, int mustGetAll)
+{
+	unsigned long long		start, elapsed;
+	register unsigned long	i;
+	register unsigned int	r, failed;
+
+	if (midi_cast_init(&Cast, sizeof(RECORD), size))
+	{
+		printf("Can't allocate the ring\n");
+		return(1);
+	}
+
+	Count = count;
+	WriteDone = 0;
+	memset(&Readers[0], 0, sizeof(Readers));
+	Readers[NUMREADERS - 1].Slow = 1;
+
+	// Each reader gets its place before the first record is written
+	for (r = 0; r < NUMREADERS; r++) midi_cast_reader_init(&Cast, &Readers[r].Cast);
+	for (r = 0; r < NUMREADERS; r++)
+	{
+		if (pthread_create(&Readers[r].Thread, 0, reader_thread, &Readers[r]))
+		{
+			printf("Can't start a reader\n");
+			exit(1);
+		}
+	}
+
+	// Write them as fast as we can. We never wait for the readers
+	start = get_time_ns();
+	for (i = 0; i < count; i++)
+	{
+		register RECORD	*record;
+
+		record = (RECORD *)midi_cast_write_ptr(&Cast);
+		record->Number = i;
+		memset(&record->Data[0], (unsigned char)i, sizeof(record->Data));
+		midi_cast_commit(&Cast);
+	}
+	elapsed = get_time_ns() - start;
+	__atomic_store_n(&WriteDone, 1, __ATOMIC_RELEASE);
+
+	printf("%s: wrote %lu records through a ring of %u, %.2f ns each\n", name, count, size, (double)elapsed / count);
+
+	failed = 0;
+	for (r = 0; r < NUMREADERS; r++)
+	{
+		register READER	*reader;
+
+		reader = &Readers[r];
+		pthread_join(reader->Thread, 0);
+		printf("  %s reader: read %lu, skipped %lu (lapped %lu times), %lu torn or out of order\n",
+			reader->Slow ? "Slow" : "Fast", reader->Cast.Read, reader->Cast.Skipped, reader->Cast.Laps, reader->Bad);
+
+		// Every record must be read, or counted as skipped. And what it says it
+		// skipped must be what was missing from the numbers it read
+		if (reader->Bad || reader->Cast.Read + reader->Cast.Skipped != count || reader->Missed != reader->Cast.Skipped ||
+			(mustGetAll && reader->Cast.Read != count))
+		{
+			printf("  ... that doesn't add up!\n");
+			++failed;
+		}
+	}
+
+	// The slow reader should have been lapped, unless the ring held everything
+	if (!mustGetAll && !Readers[NUMREADERS - 1].Cast.Laps) printf("  (The slow reader was never lapped. Try more records)\n");
+
+	midi_cast_free(&Cast);
+
+	return(failed);
+}
+
+
+
+
+
+int main(int argc, char **argv)
+{
+	register unsigned int	failed;
+	unsigned long				millions;
+
+	millions = (argc > 1 && atoi(argv[1]) > 0 ? (unsigned long)atoi(argv[1]) : 10);
+
+	// The ring holds everything, so every reader must get every record
+	failed = run("Fan-out", 65536, 65536, 1);
+
+	// The writer laps the slow reader
+	failed += run("Laps", 1024, millions * 1000000UL, 0);
+
+	if (failed) printf("%u readers got the wrong records!\n", failed);
+
+	return 0;
+}
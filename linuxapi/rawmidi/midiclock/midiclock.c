@@ -0,0 +1,651 @@
+// Sends, or follows, MIDI timing clock (0xF8, 24 per quarter
+// note).
+//
+// To be the clock master, sending start (0xFA), then clock, out
+// the MIDI output that is specified on the command line (ie, 1,0)
+// until you press CTRL-C (when we send stop, 0xFC):
+// ./midiclock master [-t bpm] [-a audioport] 1,0
+//
+// A clock that is run off the system timer drifts against the
+// sound card's own crystal, so over a few minutes, a drum machine
+// following it slowly gets out of step with the audio. Instead, we
+// play (silent) audio, and derive each tick from how many frames
+// the card has played. After each write, snd_pcm_htimestamp() tells
+// us the frame position the card was at, and the (monotonic clock)
+// time when it was there. Those timestamps are noisy (the card's
+// position moves a USB packet at a time, and so on), so we feed
+// them to a delay locked loop, like the slave's below, which keeps
+// a straight line of frame position against time, and nudges it
+// (and its slope) a little toward each timestamp. From that line,
+// we figure out the time that each tick's frame will be played, and
+// have our MIDI scheduler (../../common/midisched.c) send the tick
+// then. So the clock stays locked to the audio. Every 5 seconds, we print how fast
+// the card's crystal runs compared to the system clock (in parts
+// per million), and how far a clock run off the system timer would
+// have drifted from the audio by now.
+//
+// "-a" can also name a virtual card (see ../../common/pcmdev.h), ie
+// "-a virtual:ppm=50" to see how we follow a card whose crystal is
+// 50 ppm fast, without a sound card.
+//
+// To follow a clock coming in the MIDI input that is specified on
+// the command line:
+// ./midiclock slave [-t bpm] [-b bandwidth] 1,0
+//
+// Clock bytes never arrive perfectly evenly (the sender's timer,
+// the cable, USB, and our own wakeups all add jitter). So rather
+// than measuring the time between two ticks, we use a "delay
+// locked loop" (a PLL for time), which predicts when the next tick
+// is due, and nudges its prediction (and its idea of the tick
+// period) by a fraction of how far off it was. "-b" is the loop's
+// bandwidth, in Hz (default 1.0). Lower values give a steadier
+// tempo, but take longer to follow a tempo change. Every second,
+// we print the tempo, how much the ticks' arrival jittered around
+// the prediction, and how far the sender's clock is from the
+// nominal tempo (-t, default 120) in parts per million.
+//
+// Compile as:
+// gcc -o midiclock midiclock.c ../../common/pcmdev.c ../../common/mididev.c ../../common/devalloc.c ../../common/midisched.c ../../common/midienc.c ../../common/midiparse.c ../../common/timing.c -lasound -lpthread -lm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <math.h>
+#include <alsa/asoundlib.h>
+#include "../../common/midisched.h"
+#include "../../common/mididev.h"
+#include "../../common/pcmdev.h"
+#include "../../common/midiparse.h"
+#include "../../common/timing.h"
+
+
+
+// MIDI clock is 24 ticks per quarter note
+#define PPQN				24
+
+// Audio settings for the master. We only need to know where the card
+// is, so the buffer doesn't need to be small
+#define RATE				44100
+#define BUFFERSIZE		4096
+#define PERIODSIZE		512
+
+// The bandwidth (in Hz) of the master's loop that follows the audio
+// timestamps. It starts wide, so it locks on quickly, then narrows
+// after AUDIOSETTLE nanoseconds, to smooth out the timestamps' jitter
+#define AUDIOBANDWIDTH_START	1.0
+#define AUDIOBANDWIDTH			0.1
+#define AUDIOSETTLE				5000000000ULL
+
+// How many bytes we read at a time, and how many MIDIEVENTs we parse
+#define INPUTBUFSIZE		1024
+#define MAXEVENTS			256
+
+// Set to 1 if user wants to stop
+int StopFlag = 0;
+
+// Our options
+double			Tempo = 120.0;
+double			Bandwidth = 1.0;
+char				AudioName[64] = "hw:0,0";
+
+// The master's audio card
+PCMDEV			Audio;
+
+// The slave's delay locked loop
+typedef struct _DLL
+{
+	double					Period;	// Filtered time between ticks, in nanoseconds
+	double					Next;		// When we predict the next tick
+	double					B, C;		// The loop's coefficients
+	unsigned long long	Last;		// When the previous tick arrived
+	unsigned long			Ticks;	// How many ticks since it (re)started
+} DLL;
+
+
+
+
+
+/****************** sighandler() *********************
+ * Called by the operating system when the user presses
+ * CTRL-C to stop.
+ */
+
+void sighandler(int dummy)
+{
+	// Let main() know that user wants to break out of the loop
+	StopFlag = 1;
+}
+
+
+
+
+
+/****************** find_midi_port() *********************
+ * Finds the first MIDI input (or output) in the system, and
+ * copies its name (for snd_rawmidi_open) to the specified
+ * buffer. If none is found, zeroes out the buffer.
+ *
+ * type =	SND_RAWMIDI_STREAM_OUTPUT to find an output, or
+ *				SND_RAWMIDI_STREAM_INPUT for an input.
+ */
+
+void find_midi_port(char *cardName, int type)
+{
+	register int			err;
+	int						cardNum;
+	snd_rawmidi_info_t	*rawMidiInfo;
+
+	// Assume none found
+	cardName[0] = 0;
+
+	// Start with first card
+	cardNum = -1;
+
+	// To get some info about the subdevices of a MIDI device, we need a
+	// snd_rawmidi_info_t, so let's allocate one on the stack
+	snd_rawmidi_info_alloca(&rawMidiInfo);
+	memset(rawMidiInfo, 0, snd_rawmidi_info_sizeof());
+
+	do
+	{
+		// Get next sound card's card number. When "cardNum" == -1, then ALSA
+		// fetches the first card
+		if ((err = snd_card_next(&cardNum)) < 0) break;
+
+		// Another card? ALSA sets "cardNum" to -1 if no more
+		if (cardNum != -1)
+		{
+			snd_ctl_t			*midiHandle;
+
+			// Open this card. We specify only the card number -- not any device nor sub-device too
+			sprintf(cardName, "hw:%i", cardNum);
+			if ((err = snd_ctl_open(&midiHandle, cardName, 0)) >= 0)
+			{
+				int				devNum;
+
+				// Start with the first device on this card, and look for a MIDI port
+				devNum = -1;
+				for (;;)
+				{
+					// Get the number of the next MIDI device on this card
+					if ((err = snd_ctl_rawmidi_next_device(midiHandle, &devNum)) < 0 || devNum < 0) break;
+
+					// Get info on the wanted portion of this device's first subdevice
+					snd_rawmidi_info_set_device(rawMidiInfo, devNum);
+					snd_rawmidi_info_set_stream(rawMidiInfo, type);
+					snd_rawmidi_info_set_subdevice(rawMidiInfo, 0);
+					if ((err = snd_ctl_rawmidi_info(midiHandle, rawMidiInfo)) >= 0 && snd_rawmidi_info_get_subdevices_count(rawMidiInfo))
+					{
+						// We found one. Format its name in the caller's buffer
+						sprintf(cardName, "hw:%i,%i", cardNum, devNum);
+
+						// All done
+						cardNum = -1;
+
+						break;
+					}
+				}
+
+				// Close the card after we're done enumerating its subdevices
+				snd_ctl_close(midiHandle);
+			}
+		}
+
+		// Another card?
+	} while (cardNum != -1);
+
+	// ALSA allocates some mem to load its config file when we call some of the
+	// above functions. Now that we're done getting the info, let's tell ALSA
+	// to unload the info and free up that mem
+	snd_config_update_free_global();
+}
+
+
+
+
+
+/********************* open_audio() *******************
+ * Opens the audio card for 16-bit stereo playback, and
+ * asks it to timestamp its position with the monotonic
+ * clock (the same clock our MIDI scheduler uses).
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ *
+ * NOTE: Sets the global "Audio".
+ */
+
+static int open_audio(void)
+{
+	register int	err;
+
+	if ((err = pcm_dev_open(&Audio, &AudioName[0], 0, SND_PCM_FORMAT_S16_LE, 2, RATE, BUFFERSIZE, PERIODSIZE)) < 0)
+		printf("Can't open audio %s: %s\n", &AudioName[0], snd_strerror(err));
+	return(err);
+}
+
+
+
+
+
+/****************** master() *********************
+ * Sends MIDI clock, locked to the audio card's playback
+ * position, until the user presses CTRL-C.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+static int master(MIDIDEV *midiOut)
+{
+	static const unsigned char	start = 0xFA, clock = 0xF8, stop = 0xFC;
+	MIDISCHED							sched;
+	TIMEHIST								jitter;
+	short									*silence;
+	register int						err;
+	double								framesPerTick, nsPerFrame, fitTime, tickFrame;
+	unsigned long long				written, firstFrame, firstTime, fitFrame, nextReport, tick;
+	unsigned long						xruns;
+
+	if ((err = open_audio()) < 0) return(err);
+
+	if (!(silence = (short *)calloc(Audio.PeriodFrames, 4)))
+	{
+		err = -ENOMEM;
+		goto out2;
+	}
+
+	if ((err = midi_sched_start(&sched, midiOut, 0, 0, 50, 0)) < 0)
+	{
+		printf("Can't start the MIDI scheduler: %s\n", snd_strerror(err));
+		goto out;
+	}
+	time_hist_init(&jitter);
+
+	// How many audio frames between ticks
+	framesPerTick = Audio.Rate * 60.0 / (Tempo * PPQN);
+	printf("Sending MIDI clock at %.2f BPM (a tick every %.2f frames at %u Hz).\nPress CTRL-C to stop.\n", Tempo, framesPerTick, Audio.Rate);
+
+	written = firstFrame = firstTime = fitFrame = nextReport = tick = 0;
+	nsPerFrame = tickFrame = fitTime = 0.0;
+	xruns = 0;
+
+	while (!StopFlag)
+	{
+		snd_pcm_uframes_t				avail;
+		unsigned long long			now;
+		register unsigned long long	time, played, frames;
+		register double				error, frame, predicted;
+
+		// Play another period of silence. When the buffer is full, this waits
+		// for the card to play a period, so the card paces us
+		if ((err = (int)pcm_dev_writei(&Audio, silence, Audio.PeriodFrames)) < 0)
+		{
+			if (err == -EINTR) continue;
+			if ((err = pcm_dev_recover(&Audio, err)) < 0)
+			{
+				printf("Can't recover audio: %s\n", snd_strerror(err));
+				break;
+			}
+
+			// An underrun throws away what was in the buffer, so our count of
+			// frames no longer matches the card's. Start over
+			++xruns;
+			written = firstFrame = firstTime = 0;
+			continue;
+		}
+		written += err;
+
+		// Where was the card, and when? The card isn't running until the
+		// buffer first fills, so there's no timestamp until then
+		if (pcm_dev_htimestamp(&Audio, &avail, &now) < 0 || !now || avail > Audio.BufferFrames) continue;
+		time = now;
+		played = written - (Audio.BufferFrames - avail);
+
+		if (!firstTime)
+		{
+			// The next tick plays with the audio we write next. (If we're
+			// starting over after an underrun, the ticks carry on from there)
+			firstTime = time;
+			firstFrame = played;
+			tickFrame = (double)written - tick * framesPerTick;
+			nsPerFrame = 1000000000.0 / Audio.Rate;
+			fitTime = (double)time;
+			fitFrame = played;
+			nextReport = time + 5000000000ULL;
+			continue;
+		}
+
+		// Where the loop's line says the card should be now, and how far this
+		// timestamp is from it. We measure that before we move the line, so it's
+		// the timestamp's real jitter
+		frames = played - fitFrame;
+		predicted = fitTime + frames * nsPerFrame;
+		error = (double)time - predicted;
+		time_hist_add(&jitter, (unsigned long long)fabs(error));
+
+		// Then move the line part of the way toward the timestamp, and adjust how
+		// long a frame lasts a little. So one noisy timestamp moves neither much.
+		// These are the slave's loop's coefficients, but per frame, since the card
+		// may have played a different number of frames since the last timestamp
+		if (frames)
+		{
+			register double	w;
+
+			w = 2.0 * M_PI * (time - firstTime < AUDIOSETTLE ? AUDIOBANDWIDTH_START : AUDIOBANDWIDTH) * frames / Audio.Rate;
+			fitTime = predicted + sqrt(2.0) * w * error;
+			fitFrame = played;
+			nsPerFrame += w * w * error / frames;
+		}
+
+		// Schedule each tick that falls within the audio we've written so far.
+		// Its time is when the card will play its frame
+		while ((frame = tickFrame + tick * framesPerTick) < written)
+		{
+			time = (unsigned long long)(fitTime + (frame - fitFrame) * nsPerFrame);
+			if (!tick) midi_sched_add(&sched, time, &start, 1);
+			midi_sched_add(&sched, time, &clock, 1);
+			++tick;
+		}
+
+		if (now >= nextReport)
+		{
+			register double	seconds;
+
+			seconds = (now - firstTime) / 1000000000.0;
+			printf("%8.1f secs: %lu ticks. Audio clock is %+.1f ppm from the system clock. A system timer clock would be %+.3f msecs off by now\n",
+				seconds, (unsigned long)tick, (1000000000.0 / (nsPerFrame * Audio.Rate) - 1.0) * 1000000.0,
+				(seconds - (played - firstFrame) / (double)Audio.Rate) * 1000.0);
+			nextReport += 5000000000ULL;
+		}
+	}
+
+	// Stop the slaves
+	midi_sched_add(&sched, get_time_ns(), &stop, 1);
+	midi_sched_drain(&sched);
+	midi_sched_stop(&sched);
+
+	printf("\nSent %lu ticks. %lu audio underruns\n", (unsigned long)tick, xruns);
+	time_hist_print(&jitter, "Audio timestamp jitter");
+	time_hist_print(&sched.Late, "Clock send lateness");
+	err = 0;
+
+out:
+	free(silence);
+out2:
+	pcm_dev_drop(&Audio);
+	pcm_dev_close(&Audio);
+	return(err);
+}
+
+
+
+
+
+/****************** dll_tick() *********************
+ * Feeds the arrival time of a clock tick to the delay
+ * locked loop.
+ *
+ * error =	Where to return how far the tick was from where
+ *				the loop predicted it, in nanoseconds.
+ *
+ * RETURNS: 1 if the loop is locked, and "error" is set, or 0
+ * if it's still starting up.
+ */
+
+static int dll_tick(register DLL *dll, unsigned long long time, double *error)
+{
+	register double	e;
+
+	// The first two ticks give us a rough period to start with
+	if (!dll->Ticks++)
+	{
+		dll->Last = time;
+		return(0);
+	}
+
+	if (dll->Ticks == 2)
+	{
+		register double	w;
+
+		dll->Period = (double)(time - dll->Last);
+		dll->Next = time + dll->Period;
+		dll->Last = time;
+
+		// The loop's bandwidth, as a fraction of the tick rate. This gives a
+		// critically damped loop
+		w = 2.0 * M_PI * Bandwidth * dll->Period / 1000000000.0;
+		dll->B = sqrt(2.0) * w;
+		dll->C = w * w;
+		return(0);
+	}
+
+	// A missing tick (or an extra one) would throw the loop way off, so
+	// start over
+	e = (double)time - dll->Next;
+	if (fabs(e) > dll->Period / 2.0)
+	{
+		dll->Ticks = 1;
+		dll->Last = time;
+		return(0);
+	}
+
+	// Move the prediction part of the way toward where the tick really was,
+	// and adjust the period a little
+	dll->Next += dll->B * e + dll->Period;
+	dll->Period += dll->C * e;
+	dll->Last = time;
+	*error = e;
+
+	return(1);
+}
+
+
+
+
+
+/****************** slave() *********************
+ * Follows the MIDI clock arriving at an input, until the
+ * user presses CTRL-C.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+static int slave(MIDIDEV *midiIn)
+{
+	DLL						dll;
+	TIMEHIST					jitter;
+	MIDIPARSER				parser;
+	MIDIEVENT				events[MAXEVENTS];
+	unsigned char			buffer[INPUTBUFSIZE];
+	struct pollfd			*pfds;
+	register int			npfds;
+	unsigned long long	nextReport;
+	unsigned long			total;
+	double					nominal, worst;
+
+	npfds = midi_dev_poll_descriptors_count(midiIn);
+	pfds = (struct pollfd *)alloca(npfds * sizeof(struct pollfd));
+	npfds = midi_dev_poll_descriptors(midiIn, pfds, npfds);
+
+	midi_parse_init(&parser);
+	time_hist_init(&jitter);
+	memset(&dll, 0, sizeof(dll));
+	nominal = 60000000000.0 / (Tempo * PPQN);
+	nextReport = get_time_ns() + 1000000000ULL;
+	total = 0;
+	worst = 0.0;
+
+	printf("Waiting for MIDI clock (timestamped %s)...\nPress CTRL-C to stop.\n", midiIn->Timestamps ? "by the driver" : "on wakeup");
+
+	while (!StopFlag)
+	{
+		register int			len;
+		unsigned long long		now;
+
+		// Wake up at least every 100 msecs to check whether we should stop
+		if (poll(pfds, npfds, 100) > 0)
+		{
+			now = get_time_ns();
+
+			for (;;)
+			{
+				register const unsigned char	*ptr;
+				unsigned int					used, count, i;
+
+				// If the driver timestamps the input, this sets "now" to when these
+				// bytes arrived
+				len = midi_dev_read(midiIn, &buffer[0], sizeof(buffer), &now);
+
+				if (len <= 0) break;
+
+				ptr = &buffer[0];
+				while (len)
+				{
+					count = midi_parse(&parser, ptr, len, now, &events[0], MAXEVENTS, &used);
+					ptr += used;
+					len -= used;
+
+					for (i = 0; i < count; i++)
+					{
+						double	error;
+
+						if (events[i].Type != MIDI_TYPE_REALTIME) continue;
+
+						switch (events[i].Status)
+						{
+							case 0xF8:
+							{
+								++total;
+								if (dll_tick(&dll, events[i].Time, &error))
+								{
+									time_hist_add(&jitter, (unsigned long long)fabs(error));
+									if (fabs(error) > worst) worst = fabs(error);
+								}
+								break;
+							}
+
+							// Start, or continue. The tempo may be different now
+							case 0xFA:
+							case 0xFB:
+								printf("%s\n", events[i].Status == 0xFA ? "Start" : "Continue");
+								dll.Ticks = 0;
+								break;
+
+							case 0xFC:
+								printf("Stop\n");
+								dll.Ticks = 0;
+						}
+					}
+				}
+			}
+		}
+
+		// Once a second, print what we know
+		if ((now = get_time_ns()) >= nextReport)
+		{
+			if (dll.Ticks > PPQN)
+			{
+				printf("Tempo %.3f BPM, jitter up to %.1f usecs, %+.1f ppm from %.2f BPM\n",
+					60000000000.0 / (dll.Period * PPQN), worst / 1000.0, (nominal / dll.Period - 1.0) * 1000000.0, Tempo);
+			}
+			worst = 0.0;
+			nextReport = now + 1000000000ULL;
+		}
+	}
+
+	printf("\nReceived %lu ticks\n", total);
+	if (jitter.Count) time_hist_print(&jitter, "Clock jitter (arrival minus prediction)");
+
+	return(0);
+}
+
+
+
+
+
+int main(int argc, char **argv)
+{
+	register int		err;
+	MIDIDEV				midi;
+	char					cardName[64];
+	unsigned char		isMaster;
+
+	if (argc < 2 || (strcmp(argv[1], "master") && strcmp(argv[1], "slave")))
+	{
+usage:
+		printf("Usage: midiclock master [-t bpm] [-a audioport] [midiport]\n       midiclock slave [-t bpm] [-b bandwidth] [midiport]\n");
+		return 1;
+	}
+	isMaster = (argv[1][0] == 'm');
+	--argc;
+	++argv;
+
+	// Get the options
+	while (argc > 2 && argv[1][0] == '-')
+	{
+		switch (argv[1][1])
+		{
+			case 't':
+				if ((Tempo = atof(argv[2])) <= 0.0) goto usage;
+				break;
+
+			case 'b':
+				if ((Bandwidth = atof(argv[2])) <= 0.0) goto usage;
+				break;
+
+			case 'a':
+				snprintf(&AudioName[0], sizeof(AudioName), strchr(argv[2], ':') || !strcmp(argv[2], "virtual") ? "%s" : "hw:%s", argv[2]);
+				break;
+
+			default:
+				goto usage;
+		}
+		argc -= 2;
+		argv += 2;
+	}
+
+	// Did user supply a MIDI port? If not, we need to find one
+	if (argc < 2)
+	{
+		find_midi_port(&cardName[0], isMaster ? SND_RAWMIDI_STREAM_OUTPUT : SND_RAWMIDI_STREAM_INPUT);
+		if (!cardName[0])
+		{
+			printf("Can't find a MIDI %s!\n", isMaster ? "output" : "input");
+			return 1;
+		}
+	}
+
+	// Use the one he supplied
+	else
+		sprintf(&cardName[0], strchr(argv[1], ':') ? "%s" : "hw:%s", argv[1]);
+
+	// Trap when user presses CTRL-C
+	signal(SIGINT, sighandler);
+
+	if (isMaster)
+	{
+		// The scheduler's thread does the waiting, so a blocking output is fine
+		if ((err = midi_dev_open(&midi, &cardName[0], MIDIDEV_OUTPUT)) < 0)
+		{
+			printf("Can't open MIDI output %s: %s\n", &cardName[0], snd_strerror(err));
+			return 1;
+		}
+		master(&midi);
+	}
+	else
+	{
+		// We open the input in non-blocking mode so that we can drain all
+		// available bytes without waiting for more. And we ask the driver to
+		// timestamp the bytes as they arrive
+		if ((err = midi_dev_open(&midi, &cardName[0], MIDIDEV_INPUT|MIDIDEV_NONBLOCK|MIDIDEV_TSTAMP)) < 0)
+		{
+			printf("Can't open MIDI input %s: %s\n", &cardName[0], snd_strerror(err));
+			return 1;
+		}
+		slave(&midi);
+	}
+
+	midi_dev_close(&midi);
+
+	return 0;
+}
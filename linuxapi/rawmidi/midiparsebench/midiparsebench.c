@@ -0,0 +1,400 @@
+// Measures how fast our MIDI parser (../../common/midiparse.c)
+// gets through several kinds of synthetic MIDI streams, in
+// parsed events per second. No MIDI hardware is needed.
+//
+// The streams are fed to the parser in INPUTBUFSIZE chunks,
+// just like rawmidiinput feeds it what it reads from the driver.
+//
+// Before timing anything, we check that a short stream with a
+// SysEx in it parses the same however it's split between two
+// reads (including right after the 0xF0), and that a SysEx cut
+// off by a note at the start of the next read still ends.
+//
+// Compile as:
+// gcc -O2 -o midiparsebench midiparsebench.c ../../common/midiparse.c
+//
+// Run it, optionally specifying how many seconds to spend
+// on each stream (default is 1):
+// ./midiparsebench 2
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../../common/midiparse.h"
+
+
+
+
+
+// How many bytes of each synthetic stream we generate
+#define STREAMSIZE		(4 * 1024 * 1024)
+
+// How many bytes we pass to midi_parse() per call
+#define INPUTBUFSIZE		8192
+
+// How many MIDIEVENTs we let midi_parse() return per call
+#define MAXEVENTS			1024
+
+// Our synthetic stream
+static unsigned char	*Stream;
+
+// How many messages the parser should find in the stream (a
+// SysEx counts as one message, however many slices it's cut into)
+static unsigned long	ExpectedEvents;
+
+// How many messages the parser did find
+static unsigned long	Messages;
+
+
+
+
+
+/********************** get_time_ns() *********************
+ * Returns the current time of the monotonic clock, in
+ * nanoseconds.
+ */
+
+static unsigned long long get_time_ns(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+
+
+
+
+/********************** make_stream() *********************
+ * Fills "Stream" with one of our synthetic MIDI streams,
+ * and sets "ExpectedEvents".
+ *
+ * type =	0 for note on/offs with running status,
+ *				1 for a controller sweep with a MIDI clock (0xF8)
+ *				  interleaved into the middle of the messages,
+ *				2 for 256-byte SysEx dumps with active sensing
+ *				  (0xFE) landing inside them,
+ *				3 for a mix of everything, including system
+ *				  common messages.
+ */
+
+static void make_stream(unsigned int type)
+{
+	register unsigned char	*ptr, *end;
+	register unsigned int	i;
+
+	ptr = Stream;
+	end = Stream + STREAMSIZE - 300;
+	ExpectedEvents = i = 0;
+
+	while (ptr < end)
+	{
+		switch (type)
+		{
+			case 0:
+			{
+				// Every 64th message, a new (note on) status. Otherwise running status
+				if (!(i & 63)) *ptr++ = 0x90 | (i & 0x0F);
+				*ptr++ = (unsigned char)(36 + (i % 48));
+				*ptr++ = (unsigned char)((i & 1) ? 0 : 100);
+				++ExpectedEvents;
+				break;
+			}
+
+			case 1:
+			{
+				// A controller, with a clock between its controller number and value
+				*ptr++ = 0xB0 | (i & 0x0F);
+				*ptr++ = 7;
+				if (!(i & 3))
+				{
+					*ptr++ = 0xF8;
+					++ExpectedEvents;
+				}
+				*ptr++ = (unsigned char)(i & 0x7F);
+				++ExpectedEvents;
+				break;
+			}
+
+			case 2:
+			{
+				register unsigned int	j;
+
+				*ptr++ = 0xF0;
+				for (j = 0; j < 254; j++)
+				{
+					*ptr++ = (unsigned char)(j & 0x7F);
+					if (j == 100) *ptr++ = 0xFE;
+				}
+				*ptr++ = 0xF7;
+
+				// The SysEx, and the realtime event inside it
+				ExpectedEvents += 2;
+				break;
+			}
+
+			default:
+			{
+				switch (i % 6)
+				{
+					case 0:
+						*ptr++ = 0x90;
+						*ptr++ = 60;
+						*ptr++ = 100;
+						break;
+					case 1:
+						*ptr++ = 0xC3;
+						*ptr++ = (unsigned char)(i & 0x7F);
+						break;
+					case 2:
+						*ptr++ = 0xE0;
+						*ptr++ = 0x00;
+						*ptr++ = 0xF8;
+						++ExpectedEvents;
+						*ptr++ = 0x40;
+						break;
+					case 3:
+						*ptr++ = 0xF1;
+						*ptr++ = (unsigned char)(i & 0x7F);
+						break;
+					case 4:
+						*ptr++ = 0xF0;
+						*ptr++ = 0x7E;
+						*ptr++ = 0x7F;
+						*ptr++ = 0x06;
+						*ptr++ = 0x01;
+						*ptr++ = 0xF7;
+						break;
+					default:
+						*ptr++ = 0xF2;
+						*ptr++ = 0x10;
+						*ptr++ = 0x20;
+				}
+				++ExpectedEvents;
+			}
+		}
+
+		++i;
+	}
+
+	// Pad the rest with active sensing
+	while (ptr < Stream + STREAMSIZE)
+	{
+		*ptr++ = 0xFE;
+		++ExpectedEvents;
+	}
+}
+
+
+
+
+
+/********************** check_splits() *********************
+ * Parses a short stream (a note, a SysEx, and a controller)
+ * in two pieces, split at every possible place, and checks
+ * that the SysEx slices put back together are the original
+ * SysEx, with only the first slice flagged as the start.
+ *
+ * RETURNS: The number of splits that failed.
+ */
+
+static unsigned int check_splits(void)
+{
+	static const unsigned char	Test[] = {0x90, 0x3C, 0x64, 0xF0, 0x43, 0x10, 0x4C, 0x00, 0x00, 0x7E, 0x00, 0xF7, 0xB0, 0x07, 0x64};
+	MIDIPARSER						parser;
+	MIDIEVENT						events[16];
+	unsigned char					sysex[sizeof(Test)];
+	register unsigned int		split, i, failed;
+	unsigned int					used, count, sysexLen, messages, starts;
+
+	failed = 0;
+	for (split = 1; split < sizeof(Test); split++)
+	{
+		const unsigned char	*piece;
+		unsigned int			len, ok;
+
+		midi_parse_init(&parser);
+		sysexLen = messages = starts = 0;
+		ok = 1;
+
+		// The first piece, then the rest
+		piece = &Test[0];
+		len = split;
+		while (len)
+		{
+			count = midi_parse(&parser, piece, len, 0, &events[0], 16, &used);
+			for (i = 0; i < count; i++)
+			{
+				if (events[i].Type != MIDI_TYPE_SYSEX)
+				{
+					++messages;
+					continue;
+				}
+
+				// Only the first slice is the start, and it must begin with the 0xF0
+				if (events[i].Flags & MIDI_SYSEX_START)
+				{
+					++starts;
+					if (sysexLen || events[i].SysEx[0] != 0xF0) ok = 0;
+				}
+				else if (!sysexLen)
+					ok = 0;
+				memcpy(&sysex[sysexLen], events[i].SysEx, events[i].Length);
+				sysexLen += events[i].Length;
+				if (events[i].Flags & MIDI_SYSEX_END) ++messages;
+			}
+
+			// Then the second piece
+			piece += used;
+			len -= used;
+			if (!len && piece == &Test[split]) len = sizeof(Test) - split;
+		}
+
+		if (!ok || starts != 1 || messages != 3 || sysexLen != 9 || memcmp(&sysex[0], &Test[3], 9))
+		{
+			printf("Split after byte %u: parsed %u messages, %u SysEx bytes, %u starts!\n", split, messages, sysexLen, starts);
+			++failed;
+		}
+	}
+
+	return(failed);
+}
+
+
+
+
+
+/********************** check_aborted() *********************
+ * Parses a SysEx that's cut off (without its 0xF7) by a note
+ * that starts the next read, and checks that we get the
+ * SysEx's start, then an empty slice that ends it (flagged
+ * as aborted), then the note.
+ *
+ * RETURNS: 0 if it parsed right, or 1 if not.
+ */
+
+static unsigned int check_aborted(void)
+{
+	static const unsigned char	First[] = {0xF0, 0x43, 0x10};
+	static const unsigned char	Second[] = {0x90, 0x3C, 0x64};
+	MIDIPARSER						parser;
+	MIDIEVENT						events[4];
+	unsigned int					used;
+
+	midi_parse_init(&parser);
+	if (midi_parse(&parser, &First[0], sizeof(First), 0, &events[0], 4, &used) != 1 ||
+		events[0].Type != MIDI_TYPE_SYSEX || events[0].Flags != MIDI_SYSEX_START || events[0].Length != 3 ||
+		midi_parse(&parser, &Second[0], sizeof(Second), 0, &events[0], 4, &used) != 2 ||
+		events[0].Type != MIDI_TYPE_SYSEX || events[0].Flags != (MIDI_SYSEX_END | MIDI_SYSEX_ABORTED) || events[0].Length ||
+		events[1].Type != MIDI_TYPE_CHANNEL || events[1].Status != 0x90 || events[1].Data1 != 0x3C)
+	{
+		return(1);
+	}
+
+	return(0);
+}
+
+
+
+
+
+/********************** parse_stream() *********************
+ * Runs the whole of "Stream" through the parser, in
+ * INPUTBUFSIZE chunks.
+ *
+ * RETURNS: How many events the parser returned. Also
+ * sets "Messages".
+ */
+
+static unsigned long parse_stream(void)
+{
+	MIDIPARSER					parser;
+	MIDIEVENT					events[MAXEVENTS];
+	register unsigned long	total;
+	register unsigned int	pos;
+	unsigned int				used, count;
+
+	midi_parse_init(&parser);
+	total = Messages = 0;
+	pos = 0;
+	while (pos < STREAMSIZE)
+	{
+		register unsigned int	len;
+
+		len = STREAMSIZE - pos;
+		if (len > INPUTBUFSIZE) len = INPUTBUFSIZE;
+
+		// Keep calling midi_parse() until it has used the whole chunk
+		do
+		{
+			register unsigned int	i;
+
+			count = midi_parse(&parser, Stream + pos, len, 0, &events[0], MAXEVENTS, &used);
+			total += count;
+
+			// Count whole messages. Every SysEx slice but the last is only part of one
+			for (i = 0; i < count; i++)
+			{
+				if (events[i].Type != MIDI_TYPE_SYSEX || (events[i].Flags & MIDI_SYSEX_END)) ++Messages;
+			}
+			pos += used;
+			len -= used;
+		} while (len);
+	}
+
+	return(total);
+}
+
+
+
+
+
+int main(int argc, char **argv)
+{
+	static const char * const	Names[4] = {"Notes, running status", "Controllers + clock", "SysEx + active sense", "Mixed"};
+	unsigned long long			seconds;
+	register unsigned int		type;
+
+	seconds = (argc > 1 && atoi(argv[1]) > 0 ? atoi(argv[1]) : 1);
+
+	if (!(Stream = (unsigned char *)malloc(STREAMSIZE)))
+	{
+		printf("Can't allocate the test stream\n");
+		return 1;
+	}
+
+	printf("MIDIEVENT is %u bytes\n", (unsigned int)sizeof(MIDIEVENT));
+
+	if (check_splits()) printf("The parser got split SysEx wrong!\n");
+	if (check_aborted()) printf("The parser got an aborted SysEx wrong!\n");
+
+	for (type = 0; type < 4; type++)
+	{
+		unsigned long long		start, elapsed, events, bytes;
+
+		make_stream(type);
+
+		// Check that the parser finds what we put in there
+		parse_stream();
+		if (Messages != ExpectedEvents)
+			printf("%s: parsed %lu messages, expected %lu!\n", Names[type], Messages, ExpectedEvents);
+
+		// Now time it. Parse the stream repeatedly until the time is up
+		events = bytes = 0;
+		start = get_time_ns();
+		do
+		{
+			events += parse_stream();
+			bytes += STREAMSIZE;
+		} while ((elapsed = get_time_ns() - start) < seconds * 1000000000ULL);
+
+		printf("%-24s %8.2f M events/sec  %8.2f MB/sec  (%.2f ns/event)\n", Names[type],
+			(double)events * 1000.0 / elapsed, (double)bytes * 1000.0 / elapsed, (double)elapsed / events);
+	}
+
+	free(Stream);
+
+	return 0;
+}
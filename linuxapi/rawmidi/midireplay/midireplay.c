@@ -0,0 +1,558 @@
+// Plays back part of a MIDI log captured by "rawmidiinput -l",
+// through the raw MIDI Output that is specified on the command
+// line (ie, 0,0 to play through the first card's first MIDI
+// output). If no output is specified, then it plays through the
+// first MIDI output it finds.
+//
+// The bytes are sent with the same timing as they were captured.
+// You can pick the part of the log to play with the -s (start)
+// and -e (end) options. These are in seconds of real (wall clock)
+// time from the start of the log (ie, the first record of the first
+// segment that hasn't been deleted). For example, to play the 3
+// minutes starting 1 hour, 2 minutes in:
+// ./midireplay -s 3720 -e 3900 /var/log/midi/rig1 1,0
+//
+// A log may hold several runs of rawmidiinput (perhaps with reboots
+// between them), each timed by that boot's monotonic clock. We time
+// each segment's records by the real time of its run (see
+// ../../common/midilog.h). We don't wait out the time between runs.
+// Instead, when we reach another run (or a record's time goes
+// backwards), we play its first record right away, and time the
+// rest from that.
+//
+// A busy stretch of the log may have more bytes than the MIDI cable
+// can carry in real time. We don't let that hold up our timing.
+// The output is non-blocking, and whatever the driver has no room
+// for waits in our own queue (../../common/midiout.c) until it does,
+// while we carry on sleeping until the next record is due. When
+// done, we print how often (and how long) the driver was full, and
+// how fast the device took the bytes.
+//
+// If the log came from a fast (ie, USB) controller, and you play it
+// through a DIN output, a fader move may have more controller values
+// than the cable can carry. Then use -b to tell us how many bytes a
+// second the cable carries (3125 for a standard MIDI cable). We
+// parse the log into messages, and while the cable is busy, keep
+// only the latest value of each controller (../../common/midithin.c),
+// so the output never falls further and further behind. Notes and
+// SysEx are never thinned. When done, we print how many values were
+// thinned out, and how much latency the waiting added.
+//
+// Options:
+// -s secs		Where to start.
+// -e secs		Where to end.
+// -b bytes		Thin controllers to fit this many bytes a second.
+//
+// Compile as:
+// gcc -o midireplay midireplay.c ../../common/midithin.c ../../common/midiout.c ../../common/mididev.c ../../common/devalloc.c ../../common/midiparse.c ../../common/midilog.c ../../common/timing.c -lasound -lm
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <signal.h>
+#include <time.h>
+#include <alsa/asoundlib.h>
+#include "../../common/midilog.h"
+#include "../../common/midiout.h"
+#include "../../common/midithin.h"
+#include "../../common/midiparse.h"
+#include "../../common/timing.h"
+
+
+
+// How many MIDIEVENTs we parse at a time
+#define MAXEVENTS			256
+
+// Set to 1 if user wants to abort
+int StopFlag = 0;
+
+// Counts of what we played
+unsigned long RecordCount, ByteCount;
+
+// The (real) time of the first record we play, and the time we played it. We
+// time all later records relative to these. PlayStart is 0 until we play one
+unsigned long long LogStart, PlayStart;
+
+// The real time of the last record we played, so we know if the time went backwards
+unsigned long long LastTime;
+
+// The base of the run whose segment we played last
+unsigned long long MonoBase, RealBase;
+
+// Set to 1 once we've sent a status byte. Until then, we skip data
+// bytes, since we likely started playing in the middle of a message
+unsigned char SeenStatus = 0;
+
+// If we're thinning controllers to fit the cable, its bytes a second (else 0)
+unsigned int ThinRate = 0;
+MIDITHIN Thin;
+MIDIPARSER Parser;
+
+
+
+
+
+
+/****************** sighandler() *********************
+ * Called by the operating system when the user presses
+ * CTRL-C to abort this app.
+ */
+
+void sighandler(int dummy)
+{
+	// Let main() know that user wants to break out of the loop
+	StopFlag = 1;
+}
+
+
+
+
+
+/****************** find_midi_out() *********************
+ * Finds the first MIDI output in the system, and copies
+ * its name (for snd_rawmidi_open) to the specified
+ * buffer. If no MIDI output is found, zeroes out the
+ * buffer.
+ */
+
+void find_midi_out(char *cardName)
+{
+	register int			err;
+	int						cardNum;
+	snd_rawmidi_info_t	*rawMidiInfo;
+
+	// Assume no output found
+	cardName[0] = 0;
+
+	// Start with first card
+	cardNum = -1;
+
+	// To get some info about the subdevices of a MIDI device, we need a
+	// snd_rawmidi_info_t, so let's allocate one on the stack
+	snd_rawmidi_info_alloca(&rawMidiInfo);
+	memset(rawMidiInfo, 0, snd_rawmidi_info_sizeof());
+
+	do
+	{
+		// Get next sound card's card number. When "cardNum" == -1, then ALSA
+		// fetches the first card
+		if ((err = snd_card_next(&cardNum)) < 0) break;
+
+		// Another card? ALSA sets "cardNum" to -1 if no more
+		if (cardNum != -1)
+		{
+			snd_ctl_t			*midiHandle;
+
+			// Open this card. We specify only the card number -- not any device nor sub-device too
+			sprintf(cardName, "hw:%i", cardNum);
+			if ((err = snd_ctl_open(&midiHandle, cardName, 0)) >= 0)
+			{
+				int				devNum;
+
+				// Start with the first device on this card, and look for a MIDI output
+				devNum = -1;
+				for (;;)
+				{
+					// Get the number of the next MIDI device on this card
+					if ((err = snd_ctl_rawmidi_next_device(midiHandle, &devNum)) < 0 || devNum < 0) break;
+
+					// Get info on the MIDI out portion of this device's first subdevice
+					snd_rawmidi_info_set_device(rawMidiInfo, devNum);
+					snd_rawmidi_info_set_stream(rawMidiInfo, SND_RAWMIDI_STREAM_OUTPUT);
+					snd_rawmidi_info_set_subdevice(rawMidiInfo, 0);
+					if ((err = snd_ctl_rawmidi_info(midiHandle, rawMidiInfo)) >= 0 && snd_rawmidi_info_get_subdevices_count(rawMidiInfo))
+					{
+						// We found a MIDI Output device. Format its name in the caller's buffer
+						sprintf(cardName, "hw:%i,%i", cardNum, devNum);
+
+						// All done
+						cardNum = -1;
+
+						break;
+					}
+				}
+
+				// Close the card after we're done enumerating its subdevices
+				snd_ctl_close(midiHandle);
+			}
+		}
+
+		// Another card?
+	} while (cardNum != -1);
+
+	// ALSA allocates some mem to load its config file when we call some of the
+	// above functions. Now that we're done getting the info, let's tell ALSA
+	// to unload the info and free up that mem
+	snd_config_update_free_global();
+}
+
+
+
+
+
+/****************** wait_until() *********************
+ * Sleeps until the specified time, meanwhile passing any
+ * queued bytes to the driver as it has room (and, if we're
+ * thinning, any queued messages as the cable has room).
+ *
+ * due =	The (monotonic clock) time to wake up.
+ *
+ * RETURNS: 0 if it's time, 1 if the user aborted, or a
+ * negative error number.
+ */
+
+static int wait_until(MIDIOUT *out, unsigned long long due)
+{
+	struct pollfd			*pfds;
+	register int			npfds, err;
+
+	npfds = midi_dev_poll_descriptors_count(out->Output);
+	pfds = (struct pollfd *)alloca(npfds * sizeof(struct pollfd));
+
+	for (;;)
+	{
+		register unsigned long long	now, wake, next;
+		struct timespec					timeout;
+
+		now = get_time_ns();
+		if (ThinRate && (err = midi_thin_service(&Thin, now)) < 0) return(err);
+		if (now >= due) return(0);
+		if (StopFlag) return(1);
+
+		// Wake up early if the cable will have room for a queued message
+		wake = due;
+		if (ThinRate && (next = midi_thin_due(&Thin)) && next < wake) wake = (next > now ? next : now);
+
+		// We ask for POLLOUT only if we have bytes queued. Otherwise this
+		// just sleeps. ppoll() takes a timeout in nanoseconds, where poll()
+		// would round it to milliseconds
+		npfds = midi_out_poll_descriptors(out, pfds, npfds);
+		ns_to_timespec(wake - now, &timeout);
+		if (ppoll(pfds, npfds, &timeout, 0) > 0 && (err = midi_out_flush(out)) < 0) return(err);
+	}
+}
+
+
+
+
+
+/****************** thin_record() *********************
+ * Parses a record's bytes into messages, and gives them to
+ * the thinning stage.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+static int thin_record(const unsigned char *data, unsigned int len)
+{
+	MIDIEVENT					events[MAXEVENTS];
+	register unsigned long long	now;
+
+	now = get_time_ns();
+	while (len)
+	{
+		register MIDIEVENT	*event;
+		unsigned int			used, count;
+
+		count = midi_parse(&Parser, data, len, now, &events[0], MAXEVENTS, &used);
+		data += used;
+		len -= used;
+
+		for (event = &events[0]; count--; event++)
+		{
+			register int	err;
+
+			// If the queue is full, the message is dropped (and counted)
+			if ((err = midi_thin_write(&Thin, event->Type == MIDI_TYPE_SYSEX ? event->SysEx : &event->Status, event->Length, now)) < 0 && err != -ENOBUFS)
+				return(err);
+		}
+	}
+
+	return(0);
+}
+
+
+
+
+
+/****************** play_segment() *********************
+ * Plays the records of one log segment whose times are
+ * within the range we want.
+ *
+ * out =				The MIDI output.
+ * header =				The segment, as mapped by midi_log_map().
+ * startTime =			Real time of the first record to play.
+ * endTime =			Real time after which we stop playing.
+ *
+ * RETURNS: 0 to continue to the next segment, 1 if we're
+ * done (past the end time, or aborted), or a negative error
+ * number.
+ */
+
+static int play_segment(MIDIOUT *out, const MIDILOG_HEADER *header, unsigned long long startTime, unsigned long long endTime)
+{
+	register unsigned long long	offset, time;
+	register int					err;
+
+	// Skip segments that are entirely before the start time
+	if (!header->Records || MIDILOG_REALTIME(header, header->LastTime) < startTime) return(0);
+	if (MIDILOG_REALTIME(header, header->FirstTime) > endTime) return(1);
+
+	// Jump to the first record at (or after) the start time, using the segment's index.
+	// The index has the records' own (monotonic) times
+	offset = MIDILOG_HEADERSIZE;
+	if (startTime > MIDILOG_REALTIME(header, header->FirstTime)) offset = midi_log_seek(header, startTime - header->RealBase + header->MonoBase);
+
+	// A segment from another run has times from another boot's clock, so we start
+	// the timing over at its first record
+	if (header->MonoBase != MonoBase || header->RealBase != RealBase)
+	{
+		MonoBase = header->MonoBase;
+		RealBase = header->RealBase;
+		PlayStart = 0;
+	}
+
+	// The log may still be being written, so we check how much is used as we go
+	while (offset < __atomic_load_n(&header->Used, __ATOMIC_ACQUIRE))
+	{
+		register const MIDILOG_RECORD	*record;
+		register const unsigned char	*data;
+		register unsigned int			len;
+
+		if (StopFlag) return(1);
+
+		record = (const MIDILOG_RECORD *)((const unsigned char *)header + offset);
+		time = MIDILOG_REALTIME(header, record->Time);
+		if (time > endTime) return(1);
+		offset += MIDILOG_RECORDSIZE(record->Length);
+
+		data = (const unsigned char *)(record + 1);
+		len = record->Length;
+
+		// Is this the first record (of the run)? Or did the time go backwards (ie,
+		// an old log with no bases, across a reboot)? Then we play it now, and
+		// everything after it relative to it
+		if (!PlayStart || time < LastTime)
+		{
+			LogStart = time;
+			PlayStart = get_time_ns();
+		}
+
+		// Otherwise, sleep until it's time to play this record. We wait until an
+		// absolute time, so our timing errors don't accumulate from one record to
+		// the next
+		else if ((err = wait_until(out, PlayStart + (time - LogStart))))
+			return(err);
+		LastTime = time;
+
+		// Skip any data bytes before the first status
+		if (!SeenStatus)
+		{
+			while (len && *data < 0x80)
+			{
+				++data;
+				--len;
+			}
+			if (!len) continue;
+			SeenStatus = 1;
+		}
+
+		if (ThinRate)
+		{
+			if ((err = thin_record(data, len)) < 0) return(err);
+		}
+
+		// If our queue is full, the record is dropped. It may have been part of a
+		// message, so skip data bytes again until the next status
+		else if ((err = midi_out_write(out, data, len)) < 0)
+		{
+			if (err != -ENOBUFS) return(err);
+			SeenStatus = 0;
+			continue;
+		}
+
+		++RecordCount;
+		ByteCount += len;
+	}
+
+	return(0);
+}
+
+
+
+
+
+int main(int argc, char **argv)
+{
+	register int			err;
+	MIDIDEV					midiOut;
+	MIDIOUT					output;
+	unsigned int			*seqs;
+	unsigned long long	startTime, endTime;
+	register int			count, i;
+	double					startSecs, endSecs;
+	char						cardName[64];
+
+	// Get the options
+	startSecs = 0.0;
+	endSecs = -1.0;
+	while (argc > 2 && argv[1][0] == '-')
+	{
+		if (argv[1][1] == 's')
+			startSecs = atof(argv[2]);
+		else if (argv[1][1] == 'e')
+			endSecs = atof(argv[2]);
+		else if (argv[1][1] == 'b')
+			ThinRate = (unsigned int)atoi(argv[2]);
+		else
+			break;
+		argc -= 2;
+		argv += 2;
+	}
+
+	if (argc < 2 || argv[1][0] == '-')
+	{
+		printf("Usage: midireplay [-s startsecs] [-e endsecs] [-b bytespersec] logname [card,device]\n");
+		return 1;
+	}
+
+	// Find the segments of the log
+	if ((count = midi_log_list(argv[1], &seqs)) <= 0)
+	{
+		printf("Can't find log %s\n", argv[1]);
+		return 1;
+	}
+
+	// The times are relative to the first record in the log, in real time
+	// (since the log may have several runs, each with its own clock)
+	startTime = 0;
+	for (i = 0; i < count && !startTime; i++)
+	{
+		MIDILOG		log;
+
+		if (midi_log_map(&log, argv[1], seqs[i]) < 0) continue;
+		if (log.Header->Records) startTime = MIDILOG_REALTIME(log.Header, log.Header->FirstTime);
+		midi_log_unmap(&log);
+	}
+	if (!startTime)
+	{
+		printf("Log %s has nothing to play\n", argv[1]);
+		goto out;
+	}
+	endTime = (endSecs < 0.0 ? ~0ULL : startTime + (unsigned long long)(endSecs * 1000000000.0));
+	startTime += (unsigned long long)(startSecs * 1000000000.0);
+
+	// Did user supply a MIDI Output? If not, we need to find one
+	if (argc < 3)
+	{
+		find_midi_out(&cardName[0]);
+		if (!cardName[0])
+		{
+			printf("Can't find a MIDI Output to play through!\n");
+			goto out;
+		}
+	}
+
+	// Use the one he supplied
+	else
+		sprintf(&cardName[0], strchr(argv[2], ':') ? "%s" : "hw:%s", argv[2]);
+
+	// Open output MIDI device, in non-blocking mode
+	if ((err = midi_dev_open(&midiOut, &cardName[0], MIDIDEV_OUTPUT|MIDIDEV_NONBLOCK)) < 0)
+	{
+		printf("Can't open MIDI Output %s: %s\n", &cardName[0], snd_strerror(err));
+		goto out;
+	}
+	if ((err = midi_out_init(&output, &midiOut, 0)) < 0)
+	{
+		printf("Can't set up MIDI Output %s: %s\n", &cardName[0], snd_strerror(err));
+		goto out2;
+	}
+	if (ThinRate)
+	{
+		if ((err = midi_thin_init(&Thin, &output, ThinRate, 0)) < 0)
+		{
+			printf("Out of memory!\n");
+			goto out3;
+		}
+		midi_parse_init(&Parser);
+	}
+
+	// Trap when user presses CTRL-C
+	signal(SIGINT, sighandler);
+
+	printf("Playing %s on %s...\nPress CTRL-C to abort.\n", argv[1], &cardName[0]);
+
+	// Play each segment in turn
+	for (i = 0; i < count; i++)
+	{
+		MIDILOG		log;
+
+		// A segment may have been deleted (by the log rotating) since we listed them
+		if (midi_log_map(&log, argv[1], seqs[i]) < 0) continue;
+
+		err = play_segment(&output, log.Header, startTime, endTime);
+		midi_log_unmap(&log);
+
+		if (err < 0)
+		{
+			printf("Can't write MIDI output: %s\n", snd_strerror(err));
+			break;
+		}
+		if (err) break;
+	}
+
+	// Let the thinned messages go out as the cable has room
+	while (ThinRate && midi_thin_count(&Thin) && !wait_until(&output, midi_thin_due(&Thin)));
+
+	// If we stopped in the middle, some notes may still be on. Send an
+	// All Notes Off controller on every MIDI channel
+	if (StopFlag)
+	{
+		unsigned char	buffer[3];
+
+		buffer[1] = 123;
+		buffer[2] = 0;
+		for (i = 0; i < 16; i++)
+		{
+			buffer[0] = 0xB0 | i;
+			if (ThinRate)
+				midi_thin_write(&Thin, &buffer[0], 3, get_time_ns());
+			else
+				midi_out_write(&output, &buffer[0], 3);
+		}
+	}
+
+	// If we were aborted, whatever is still thinned goes without waiting
+	if (ThinRate) midi_thin_drain(&Thin);
+
+	// Wait for the driver to send everything (but not forever, if the device
+	// has stopped taking bytes), then close the MIDI Output
+	if (midi_out_drain(&output, 5000) == -ETIMEDOUT) printf("Gave up waiting for the MIDI Output to take %u bytes\n", output.Count);
+
+	printf("Played %lu records (%lu bytes)\n", RecordCount, ByteCount);
+	if (output.Dropped) printf("%lu records dropped because the MIDI Output couldn't keep up\n", output.Dropped);
+	if (output.Stalls)
+	{
+		printf("The driver's buffer was full %lu times (we queued up to %u bytes)", output.Stalls, output.MaxCount);
+		if (output.NsPerByte) printf(". The device took %.0f bytes a second", 1000000000.0 / output.NsPerByte);
+		printf("\n");
+		time_hist_print(&output.Drain, "How long the driver stayed full");
+	}
+
+	if (ThinRate)
+	{
+		printf("Thinned out %lu controller values, and dropped %lu messages (at most %u were waiting for the cable)\n",
+			Thin.Replaced, Thin.Dropped, Thin.MaxQueued);
+		time_hist_print(&Thin.Latency, "Latency added by waiting for the cable");
+		midi_thin_free(&Thin);
+	}
+out3:
+	midi_out_free(&output);
+out2:
+	midi_dev_close(&midiOut);
+out:
+	free(seqs);
+	return 0;
+}
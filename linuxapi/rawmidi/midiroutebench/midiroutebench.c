@@ -0,0 +1,241 @@
+// Measures how fast our MIDI routing tables (../../common/midiroute.c)
+// route parsed messages, in messages per second, with a few typical
+// rules (a keyboard split with a transpose, a velocity curve, and
+// everything to a "thru" output). No MIDI hardware is needed.
+//
+// Before timing anything, we check that every slice of a SysEx goes
+// to the same outputs as its 0xF0. That includes a SysEx cut off
+// (without its 0xF7) by a note that starts the next read, whose last
+// slice is empty, and points at the note's status. If that slice
+// were routed like the note, ../midirouter would never let go of
+// the outputs that got the SysEx.
+//
+// Compile as:
+// gcc -O2 -o midiroutebench midiroutebench.c ../../common/midiroute.c ../../common/midiparse.c -lm
+//
+// Run it, optionally specifying how many seconds to spend
+// routing (default is 1):
+// ./midiroutebench 2
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../../common/midiroute.h"
+
+
+
+
+
+// How many messages in our synthetic stream
+#define STREAMEVENTS		(1024 * 1024)
+
+// The rules we route with. All from input 0
+static const struct
+{
+	unsigned short			Output;
+	const char *			Text;
+} Rules[] = {{0, ""},
+	{1, "chan=1 type=note notes=0-59 transpose=12 tochan=10"},
+	{1, "chan=1 type=cc,pitch"},
+	{2, "type=note vel=1-100 curve=1.5"},
+	{3, "type=sysex,realtime"},
+};
+
+#define NUMRULES		(sizeof(Rules) / sizeof(Rules[0]))
+
+// The most outputs a message may go to
+#define MAXOUT			NUMRULES
+
+static MIDIROUTE		Route;
+
+// Our synthetic stream, already parsed
+static MIDIEVENT		*Events;
+
+
+
+
+
+/********************** get_time_ns() *********************
+ * Returns the current time of the monotonic clock, in
+ * nanoseconds.
+ */
+
+static unsigned long long get_time_ns(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+
+
+
+
+/********************** route_outputs() *********************
+ * Routes one parsed message.
+ *
+ * RETURNS: A bitmask of the outputs it goes to.
+ */
+
+static unsigned int route_outputs(const MIDIEVENT *event)
+{
+	MIDIROUTE_MSG				outs[MAXOUT];
+	register unsigned int	n, mask;
+
+	mask = 0;
+	n = midi_route_event(&Route, 0, event, &outs[0]);
+	while (n--) mask |= 1U << outs[n].Output;
+	return(mask);
+}
+
+
+
+
+
+/********************** check_sysex() *********************
+ * Parses a SysEx cut off by a note at the start of the
+ * next read, and checks that each of its slices goes to
+ * the outputs that its start went to, and the note goes
+ * where a note should.
+ *
+ * RETURNS: 0 if it routed right, or 1 if not.
+ */
+
+static unsigned int check_sysex(void)
+{
+	static const unsigned char	First[] = {0xF0, 0x43, 0x10};
+	static const unsigned char	Second[] = {0x90, 0x3C, 0x64};
+	MIDIPARSER						parser;
+	MIDIEVENT						start, events[4];
+	unsigned int					used, count;
+
+	midi_parse_init(&parser);
+	if (midi_parse(&parser, &First[0], sizeof(First), 0, &start, 1, &used) != 1 ||
+		(count = midi_parse(&parser, &Second[0], sizeof(Second), 0, &events[0], 4, &used)) != 2 ||
+		!(events[0].Flags & MIDI_SYSEX_END))
+	{
+		printf("The parser didn't end the SysEx!\n");
+		return(1);
+	}
+
+	// The SysEx goes to the thru output, and the SysEx output. The note (on
+	// channel 1, but above the split) to the thru and velocity curve outputs
+	if (route_outputs(&start) != 0x09 || route_outputs(&events[0]) != 0x09 || route_outputs(&events[1]) != 0x05)
+	{
+		printf("SysEx start went to %02X, its end to %02X, and the note to %02X!\n", route_outputs(&start), route_outputs(&events[0]), route_outputs(&events[1]));
+		return(1);
+	}
+
+	return(0);
+}
+
+
+
+
+
+/********************** make_events() *********************
+ * Fills "Events" with a parsed stream of notes (on both
+ * sides of the split), controllers, pitch bends, and clock.
+ */
+
+static void make_events(void)
+{
+	unsigned char				bytes[3];
+	MIDIPARSER					parser;
+	register unsigned int	i, len;
+	unsigned int				used;
+
+	midi_parse_init(&parser);
+	for (i = 0; i < STREAMEVENTS; i++)
+	{
+		switch (i & 7)
+		{
+			case 0:
+			case 1:
+			case 2:
+			case 3:
+				bytes[0] = (unsigned char)((i & 4) ? 0x80 : 0x90) | ((i >> 3) & 1);
+				bytes[1] = (unsigned char)(36 + ((i >> 4) % 48));
+				bytes[2] = (unsigned char)(i & 0x7F);
+				len = 3;
+				break;
+			case 4:
+			case 5:
+				bytes[0] = 0xB0;
+				bytes[1] = 7;
+				bytes[2] = (unsigned char)(i & 0x7F);
+				len = 3;
+				break;
+			case 6:
+				bytes[0] = 0xE0;
+				bytes[1] = 0;
+				bytes[2] = (unsigned char)(i & 0x7F);
+				len = 3;
+				break;
+			default:
+				bytes[0] = 0xF8;
+				len = 1;
+		}
+
+		midi_parse(&parser, &bytes[0], len, 0, &Events[i], 1, &used);
+	}
+}
+
+
+
+
+
+int main(int argc, char **argv)
+{
+	MIDIROUTE_RULE				rules[NUMRULES];
+	MIDIROUTE_MSG				outs[MAXOUT];
+	unsigned long long		seconds, start, elapsed, routed, sent;
+	register unsigned int	i;
+	register int				err;
+
+	seconds = (argc > 1 && atoi(argv[1]) > 0 ? atoi(argv[1]) : 1);
+
+	for (i = 0; i < NUMRULES; i++)
+	{
+		midi_route_rule_init(&rules[i], 0, Rules[i].Output);
+		if ((err = midi_route_rule_parse(&rules[i], Rules[i].Text)) < 0)
+		{
+			printf("Bad rule: %s\n", Rules[i].Text);
+			return 1;
+		}
+	}
+	if ((err = midi_route_compile(&Route, &rules[0], NUMRULES, 1)) < 0)
+	{
+		printf("Can't compile the rules: %s\n", strerror(-err));
+		goto out;
+	}
+
+	if (check_sysex()) printf("The router sent a SysEx's slices to different outputs!\n");
+
+	if (!(Events = (MIDIEVENT *)malloc(STREAMEVENTS * sizeof(MIDIEVENT))))
+	{
+		printf("Can't allocate the test stream\n");
+		goto out;
+	}
+	make_events();
+
+	// Route the stream repeatedly until the time is up
+	routed = sent = 0;
+	start = get_time_ns();
+	do
+	{
+		for (i = 0; i < STREAMEVENTS; i++) sent += midi_route_event(&Route, 0, &Events[i], &outs[0]);
+		routed += STREAMEVENTS;
+	} while ((elapsed = get_time_ns() - start) < seconds * 1000000000ULL);
+
+	printf("Routed %8.2f M messages/sec (%.2f ns/message), %.2f outputs each\n",
+		(double)routed * 1000.0 / elapsed, (double)elapsed / routed, (double)sent / routed);
+
+	free(Events);
+out:
+	midi_route_free(&Route);
+
+	return 0;
+}
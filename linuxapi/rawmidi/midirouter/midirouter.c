@@ -0,0 +1,1113 @@
+// Routes MIDI messages from any number of MIDI inputs to any
+// number of MIDI outputs (ie, a "MIDI thru" box, or a patch bay),
+// filtering and changing them on the way, according to rules in
+// a text file:
+// ./midirouter myrules.txt
+//
+// Each line of the file is a rule. It names an input and an output
+// (ie, 1,0 for the second card's first MIDI port), followed by
+// any of the filters and transforms in ../../common/midiroute.c.
+// A # starts a comment. For example:
+//
+// # Keyboard's lower notes go up an octave, on channel 10
+// 1,0   2,0   chan=1 type=note notes=0-59 transpose=12 tochan=10
+// # Its controllers and pitch wheel, with no changes
+// 1,0   2,0   chan=1 type=cc,pitch
+// # Softer velocities from the drum pads
+// 3,0   2,0   vel=1-100 curve=1.5
+// # Clock from the drum machine to everyone
+// 3,0   1,0   type=realtime
+//
+// If you don't supply a file, we route everything from the first
+// MIDI input we find to the first MIDI output we find.
+//
+// A port can also be any other name that ../../common/mididev.h
+// takes, ie free:1 for any subdevice of card 1's MIDI ports that
+// no one else is using.
+//
+// All the ports are opened non-blocking, and serviced by one
+// thread, sleeping in epoll_wait() until any of them has input
+// (or until an output that was full has room again). epoll only
+// tells us about the ports that are ready, so this works just as
+// well with dozens of ports. Each input's bytes are parsed into
+// messages, and each message is routed with lookup tables made
+// from the rules. Then everything for each output goes to the
+// driver in one snd_rawmidi_write().
+//
+// When done (press CTRL-C), we print how many messages went
+// through each port, and a histogram of the latency from when
+// each message arrived at its input (as timestamped by the driver,
+// if it supports SND_RAWMIDI_READ_TSTAMP, or else when epoll woke
+// us) to when its output driver accepted it, and how many times
+// each input's driver buffer overflowed.
+//
+// While we run, a second thread (../../common/midistat.c) samples
+// each port's driver status (how full its buffer is, and whether it
+// overflowed), and keeps that, with the byte rates, in shared memory
+// if you use -m. Then ../midistat can show them live.
+//
+// A port named "ump:" and then a card and device (ie, ump:1,0) is
+// a MIDI 2.0 endpoint, which sends and receives 32-bit Universal MIDI
+// Packets (see ../../common/ump.h) instead of bytes. An input's packets
+// are translated to MIDI 1.0 for the rules, and a UMP output's messages
+// are translated back (with nothing lost, except that a MIDI 2.0
+// message's 16 and 32-bit values are scaled down to MIDI 1.0's). But a
+// MIDI 2.0 note or controller that goes from a UMP input to a UMP
+// output keeps its full resolution, unless a rule changes its value.
+// All of a UMP input's groups are routed alike, and a UMP output sends
+// on group 1 (0).
+//
+// Options:
+// -r				Send with running status.
+// -p priority	SCHED_FIFO priority to run at (1 to 99), or 0 for
+//					normal priority. Default 50.
+// -m name		Keep each port's numbers in shared memory /dev/shm/name.
+//
+// Compile as:
+// gcc -o midirouter midirouter.c ../../common/midiroute.c ../../common/midiparse.c ../../common/ump.c ../../common/midienc.c ../../common/mididev.c ../../common/devalloc.c ../../common/midistat.c ../../common/timing.c -lasound -lpthread -lrt -lm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <alsa/asoundlib.h>
+#include "../../common/midiroute.h"
+#include "../../common/midiparse.h"
+#include "../../common/midienc.h"
+#include "../../common/mididev.h"
+#include "../../common/ump.h"
+#include "../../common/midistat.h"
+#include "../../common/timing.h"
+
+
+
+// How many inputs, and how many outputs, we can open
+#define MAXPORTS			64
+
+// How many rules we can have
+#define MAXRULES			1024
+
+// How many bytes we read from an input at a time
+#define INPUTBUFSIZE		1024
+
+// How many MIDIEVENTs we parse at a time
+#define MAXEVENTS			256
+
+// How many bytes we collect for each output, per snd_rawmidi_write()
+#define OUTBUFSIZE		4096
+
+// How many bytes of messages we hold for an output, while another
+// input's SysEx is going out it
+#define HELDSIZE			1024
+
+// How many messages per output we remember the arrival time of
+#define MAXPENDING		256
+
+// Set in an epoll event's data for an output port
+#define OUTPUTFLAG		0x10000
+
+typedef struct _INPORT
+{
+	MIDIDEV					Dev;				// The port (for a UMP endpoint, the rawmidi device underneath)
+	MIDISTAT_PORT			*Stat;			// Its numbers
+	void						*Ump;				// Its snd_ump_t, if it's a UMP endpoint
+	MIDIPARSER				Parser;
+	UMPPARSER				UmpParser;
+	unsigned long			Messages;		// How many messages it received
+	unsigned char			Open;				// 1 if the port is open
+	char						Name[32];
+} INPORT;
+
+typedef struct _OUTPORT
+{
+	MIDIDEV					Dev;				// The port (for a UMP endpoint, the rawmidi device underneath)
+	MIDISTAT_PORT			*Stat;			// Its numbers
+	void						*Ump;				// Its snd_ump_t, if it's a UMP endpoint
+	unsigned char			Open;				// 1 if the port is open
+	MIDIENC					Encoder;			// Collects the bytes (or UMP words) to write
+	UMPENC					UmpEnc;			// Translates MIDI 1.0 to UMP, for a UMP endpoint
+	unsigned long long	Times[MAXPENDING];	// When the messages in Encoder's buffer arrived
+	unsigned int			TimeCount;
+	unsigned int			HeldLen;			// How many bytes in Held[]
+	unsigned short			SysExInput;		// 1 + the input whose SysEx is going out this port, or 0
+	unsigned char			Blocked;			// 1 if the driver's buffer is full, and we're waiting for room
+	unsigned char			Dirty;			// 1 if it's in the DirtyList
+	unsigned long			Messages;		// How many messages we sent it
+	unsigned long			Dropped;			// How many messages we threw away
+	unsigned char			Buffer[OUTBUFSIZE];
+	unsigned char			Held[HELDSIZE];
+	char						Name[32];
+} OUTPORT;
+
+// Set to 1 if user wants to stop
+int StopFlag = 0;
+
+// Our options
+unsigned int	EncFlags = 0;
+int				Priority = 50;
+
+INPORT			InPorts[MAXPORTS];
+OUTPORT			*OutPorts[MAXPORTS];
+unsigned int	InCount, OutCount;
+
+MIDIROUTE_RULE	Rules[MAXRULES];
+unsigned int	RuleCount;
+MIDIROUTE		Route;
+
+// The outputs that have bytes to write
+unsigned int	DirtyList[MAXPORTS];
+unsigned int	DirtyCount;
+
+int				EpollFd;
+
+TIMEHIST			Latency;
+
+MIDISTAT			Stat;
+
+
+
+
+
+/****************** sighandler() *********************
+ * Called by the operating system when the user presses
+ * CTRL-C to stop.
+ */
+
+void sighandler(int dummy)
+{
+	// Let main() know that user wants to break out of the loop
+	StopFlag = 1;
+}
+
+
+
+
+
+/****************** find_midi_port() *********************
+ * Finds the first MIDI input (or output) in the system, and
+ * copies its name (for snd_rawmidi_open) to the specified
+ * buffer. If none is found, zeroes out the buffer.
+ *
+ * type =	SND_RAWMIDI_STREAM_OUTPUT to find an output, or
+ *				SND_RAWMIDI_STREAM_INPUT for an input.
+ */
+
+void find_midi_port(char *cardName, int type)
+{
+	register int			err;
+	int						cardNum;
+	snd_rawmidi_info_t	*rawMidiInfo;
+
+	// Assume none found
+	cardName[0] = 0;
+
+	// Start with first card
+	cardNum = -1;
+
+	// To get some info about the subdevices of a MIDI device, we need a
+	// snd_rawmidi_info_t, so let's allocate one on the stack
+	snd_rawmidi_info_alloca(&rawMidiInfo);
+	memset(rawMidiInfo, 0, snd_rawmidi_info_sizeof());
+
+	do
+	{
+		// Get next sound card's card number. When "cardNum" == -1, then ALSA
+		// fetches the first card
+		if ((err = snd_card_next(&cardNum)) < 0) break;
+
+		// Another card? ALSA sets "cardNum" to -1 if no more
+		if (cardNum != -1)
+		{
+			snd_ctl_t			*midiHandle;
+
+			// Open this card. We specify only the card number -- not any device nor sub-device too
+			sprintf(cardName, "hw:%i", cardNum);
+			if ((err = snd_ctl_open(&midiHandle, cardName, 0)) >= 0)
+			{
+				int				devNum;
+
+				// Start with the first device on this card, and look for a MIDI port
+				devNum = -1;
+				for (;;)
+				{
+					// Get the number of the next MIDI device on this card
+					if ((err = snd_ctl_rawmidi_next_device(midiHandle, &devNum)) < 0 || devNum < 0) break;
+
+					// Get info on the wanted portion of this device's first subdevice
+					snd_rawmidi_info_set_device(rawMidiInfo, devNum);
+					snd_rawmidi_info_set_stream(rawMidiInfo, type);
+					snd_rawmidi_info_set_subdevice(rawMidiInfo, 0);
+					if ((err = snd_ctl_rawmidi_info(midiHandle, rawMidiInfo)) >= 0 && snd_rawmidi_info_get_subdevices_count(rawMidiInfo))
+					{
+						// We found one. Format its name in the caller's buffer
+						sprintf(cardName, "hw:%i,%i", cardNum, devNum);
+
+						// All done
+						cardNum = -1;
+
+						break;
+					}
+				}
+
+				// Close the card after we're done enumerating its subdevices
+				snd_ctl_close(midiHandle);
+			}
+		}
+
+		// Another card?
+	} while (cardNum != -1);
+
+	// ALSA allocates some mem to load its config file when we call some of the
+	// above functions. Now that we're done getting the info, let's tell ALSA
+	// to unload the info and free up that mem
+	snd_config_update_free_global();
+}
+
+
+
+
+
+/****************** get_port() *********************
+ * Returns the number of the input (or output) with the
+ * specified name, adding it to our list if it isn't there.
+ * A name such as "1,0" (or "ump:1,0") gets "hw:" put in
+ * front of it (after the "ump:").
+ *
+ * RETURNS: The port number, or -1 if there are too many.
+ */
+
+static int get_port(const char *name, int type)
+{
+	char						fullName[32];
+	register unsigned int	i, prefix;
+
+	prefix = (!strncmp(name, "ump:", 4) ? 4 : 0);
+	snprintf(&fullName[0], sizeof(fullName), "%.*s%s%s", prefix, name, strchr(name + prefix, ':') ? "" : "hw:", name + prefix);
+
+	if (type == SND_RAWMIDI_STREAM_INPUT)
+	{
+		for (i = 0; i < InCount; i++)
+		{
+			if (!strcmp(InPorts[i].Name, &fullName[0])) return((int)i);
+		}
+		if (InCount >= MAXPORTS) return(-1);
+		strcpy(InPorts[InCount].Name, &fullName[0]);
+		return((int)InCount++);
+	}
+
+	for (i = 0; i < OutCount; i++)
+	{
+		if (!strcmp(OutPorts[i]->Name, &fullName[0])) return((int)i);
+	}
+	if (OutCount >= MAXPORTS || !(OutPorts[OutCount] = (OUTPORT *)calloc(1, sizeof(OUTPORT)))) return(-1);
+	strcpy(OutPorts[OutCount]->Name, &fullName[0]);
+	return((int)OutCount++);
+}
+
+
+
+
+
+/****************** load_rules() *********************
+ * Loads the rules from the specified file.
+ *
+ * RETURNS: 0 if success, or -1 if an error (which we've
+ * printed).
+ */
+
+static int load_rules(const char *fn)
+{
+	FILE						*file;
+	char						line[512];
+	register unsigned int	lineNum;
+	register int			err;
+
+	if (!(file = fopen(fn, "r")))
+	{
+		printf("Can't open %s: %s\n", fn, strerror(errno));
+		return(-1);
+	}
+
+	err = lineNum = 0;
+	while (fgets(&line[0], sizeof(line), file))
+	{
+		char	inName[32], outName[32];
+		int	in, out, pos;
+
+		++lineNum;
+
+		// Skip blank lines and comments
+		if (sscanf(&line[0], " %31[^ \t\r\n#] %31[^ \t\r\n#]%n", &inName[0], &outName[0], &pos) < 2)
+		{
+			pos = 0;
+			sscanf(&line[0], " %n", &pos);
+			if (!line[pos] || line[pos] == '#') continue;
+			pos = -1;
+		}
+
+		else if (RuleCount >= MAXRULES)
+		{
+			printf("Too many rules in %s. We allow %u\n", fn, MAXRULES);
+			err = -1;
+			break;
+		}
+
+		else if ((in = get_port(&inName[0], SND_RAWMIDI_STREAM_INPUT)) < 0 || (out = get_port(&outName[0], SND_RAWMIDI_STREAM_OUTPUT)) < 0)
+		{
+			printf("Too many ports in %s. We allow %u inputs and %u outputs\n", fn, MAXPORTS, MAXPORTS);
+			err = -1;
+			break;
+		}
+
+		else
+			midi_route_rule_init(&Rules[RuleCount], (unsigned int)in, (unsigned int)out);
+
+		if (pos < 0 || midi_route_rule_parse(&Rules[RuleCount], &line[pos]) < 0)
+		{
+			printf("Error in %s line %u: %s", fn, lineNum, &line[0]);
+			err = -1;
+			break;
+		}
+		++RuleCount;
+	}
+
+	fclose(file);
+	return(err);
+}
+
+
+
+
+
+/****************** open_port() *********************
+ * Opens a MIDI input or output, non-blocking. A name that
+ * starts with "ump:" is a UMP endpoint. Any other name is
+ * one that midi_dev_open() takes (ie, "hw:1,0", or "free:1"
+ * for any free subdevice of card 1).
+ *
+ * flags =	MIDIDEV_INPUT (with MIDIDEV_TSTAMP if we want
+ *				the driver to timestamp the bytes), or
+ *				MIDIDEV_OUTPUT.
+ * ump =		Where to return the snd_ump_t (0 if not UMP).
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+static int open_port(const char *name, unsigned int flags, MIDIDEV *dev, void **ump)
+{
+	*ump = 0;
+
+	if (!strncmp(name, "ump:", 4))
+	{
+#if SND_LIB_VERSION >= 0x01020a
+		snd_ump_t		*umpHandle;
+		register int	err;
+
+		// A UMP endpoint is a rawmidi device underneath, so we read, write,
+		// and poll that like any other port
+		if ((err = snd_ump_open((flags & MIDIDEV_OUTPUT) ? 0 : &umpHandle, (flags & MIDIDEV_OUTPUT) ? &umpHandle : 0, name + 4, SND_RAWMIDI_NONBLOCK)) < 0) return(err);
+		*ump = umpHandle;
+		midi_dev_attach(dev, snd_ump_rawmidi(umpHandle), flags);
+		return(0);
+#else
+		// UMP came with ALSA 1.2.10
+		return(-ENOTSUP);
+#endif
+	}
+
+	return(midi_dev_open(dev, name, flags | MIDIDEV_NONBLOCK));
+}
+
+
+
+
+
+/****************** close_port() *********************
+ * Closes a port opened with open_port().
+ */
+
+static void close_port(MIDIDEV *dev, void *ump)
+{
+#if SND_LIB_VERSION >= 0x01020a
+	if (ump)
+	{
+		snd_ump_close((snd_ump_t *)ump);
+		return;
+	}
+#endif
+	midi_dev_close(dev);
+}
+
+
+
+
+
+/****************** set_epoll() *********************
+ * Adds the descriptors of an open port to our epoll set,
+ * or changes the events we wait for on them.
+ *
+ * op =		EPOLL_CTL_ADD, EPOLL_CTL_MOD, or EPOLL_CTL_DEL.
+ * id =		The port number (| OUTPUTFLAG for an output).
+ * events =	EPOLLIN for an input. For an output, EPOLLOUT while
+ *				we're waiting for room, or else 0 (in which case
+ *				epoll still tells us about errors).
+ */
+
+static void set_epoll(int op, MIDIDEV *dev, unsigned int id, unsigned int events)
+{
+	struct pollfd		*pfds;
+	register int		npfds;
+
+	npfds = midi_dev_poll_descriptors_count(dev);
+	pfds = (struct pollfd *)alloca(npfds * sizeof(struct pollfd));
+	midi_dev_poll_descriptors(dev, pfds, npfds);
+
+	while (npfds--)
+	{
+		struct epoll_event	ev;
+
+		ev.events = events;
+		ev.data.u32 = id;
+		epoll_ctl(EpollFd, op, pfds[npfds].fd, &ev);
+	}
+}
+
+
+
+
+
+/****************** close_output() *********************
+ * Closes an output that had an error (ie, it was
+ * unplugged).
+ */
+
+static void close_output(register OUTPORT *out, unsigned int id, int err)
+{
+	printf("Closing MIDI output %s: %s\n", out->Name, snd_strerror(err));
+	set_epoll(EPOLL_CTL_DEL, &out->Dev, id | OUTPUTFLAG, 0);
+	midi_stat_remove(&Stat, out->Stat);
+	close_port(&out->Dev, out->Ump);
+	out->Open = 0;
+	out->Encoder.Used = 0;
+}
+
+
+
+
+
+/****************** flush_output() *********************
+ * Passes as many of an output's bytes to the driver as it
+ * has room for. If it doesn't take them all, we ask epoll
+ * to tell us when it has room for more.
+ */
+
+static void flush_output(register OUTPORT *out, unsigned int id)
+{
+	register int			err;
+	register unsigned int	used;
+
+	if (!out->Open || !(used = out->Encoder.Used)) return;
+
+	if ((err = midi_dev_write(&out->Dev, out->Encoder.Buffer, used)) == -EAGAIN) err = 0;
+	if (err < 0)
+	{
+		close_output(out, id, err);
+		return;
+	}
+	midi_stat_count(out->Stat, err);
+
+	// The driver took it all. Now we know how long each message took to
+	// get through us
+	if ((unsigned int)err >= used)
+	{
+		register unsigned long long	now;
+		register unsigned int			i;
+
+		now = get_time_ns();
+		for (i = 0; i < out->TimeCount; i++) time_hist_add(&Latency, now - out->Times[i]);
+		out->TimeCount = out->Encoder.Used = 0;
+		if (out->Blocked)
+		{
+			out->Blocked = 0;
+			set_epoll(EPOLL_CTL_MOD, &out->Dev, id | OUTPUTFLAG, 0);
+		}
+	}
+
+	// The driver's buffer is full. Keep the rest for when it has room
+	else
+	{
+		memmove(out->Encoder.Buffer, out->Encoder.Buffer + err, used - err);
+		out->Encoder.Used = used - err;
+		if (!out->Blocked)
+		{
+			out->Blocked = 1;
+			set_epoll(EPOLL_CTL_MOD, &out->Dev, id | OUTPUTFLAG, EPOLLOUT);
+		}
+	}
+}
+
+
+
+
+
+/****************** put_output() *********************
+ * Adds a message's bytes to an output's buffer. For a UMP
+ * output, we translate them to UMP words.
+ *
+ * orig =	The MIDI 2.0 packet the message came from, or 0.
+ *				A UMP output sends that packet's values, if the
+ *				message still has them.
+ *
+ * RETURNS: 0 if success, or -1 if it didn't fit.
+ */
+
+static int put_output(register OUTPORT *out, unsigned int id, const unsigned char *msg, unsigned int len, unsigned long long time, const unsigned int *orig)
+{
+	if (!out->Open) goto drop;
+
+	if (out->Ump)
+	{
+		unsigned int				words[UMP_MAXWORDS(INPUTBUFSIZE)];
+		register unsigned int	n;
+
+		// Make sure it fits before we translate, so a SysEx's packets don't get
+		// out of step
+		if (len > INPUTBUFSIZE || UMP_MAXWORDS(len) * 4 > out->Encoder.Size - out->Encoder.Used) goto drop;
+		if (!orig || !(n = ump_midi2_from_midi1(msg, len, out->UmpEnc.Group, orig, &words[0])))
+			n = ump_from_midi1(&out->UmpEnc, msg, len, &words[0]);
+		memcpy(out->Encoder.Buffer + out->Encoder.Used, &words[0], n * 4);
+		out->Encoder.Used += n * 4;
+	}
+
+	else if (midi_enc_put(&out->Encoder, msg, len) < 0)
+	{
+drop:	++out->Dropped;
+		return(-1);
+	}
+
+	if (time && out->TimeCount < MAXPENDING) out->Times[out->TimeCount++] = time;
+
+	if (!out->Dirty)
+	{
+		out->Dirty = 1;
+		DirtyList[DirtyCount++] = id;
+	}
+
+	return(0);
+}
+
+
+
+
+
+/****************** end_sysex() *********************
+ * Called when a SysEx has finished going out a port. Sends
+ * the messages that we held back while it was going.
+ */
+
+static void end_sysex(register OUTPORT *out, unsigned int id)
+{
+	register unsigned int	i, len;
+
+	out->SysExInput = 0;
+
+	for (i = 0; i < out->HeldLen; i += len)
+	{
+		len = 1 + MIDI_STATUS_DATA(out->Held[i]);
+		put_output(out, id, &out->Held[i], len, 0, 0);
+	}
+
+	out->HeldLen = 0;
+}
+
+
+
+
+
+/****************** send_message() *********************
+ * Sends a message (of 3 bytes or less) out an output.
+ *
+ * input =		Which input it came from.
+ * orig =		The MIDI 2.0 packet it came from, or 0.
+ */
+
+static void send_message(unsigned int id, const unsigned char *msg, unsigned int len, unsigned long long time, unsigned int input, const unsigned int *orig)
+{
+	register OUTPORT	*out;
+
+	out = OutPorts[id];
+
+	// If another input's SysEx is going out this port, we can't interrupt it.
+	// (Except with a realtime message, which is allowed anywhere). So we hold
+	// on to the message until the SysEx is done
+	if (out->SysExInput && out->SysExInput != input + 1 && msg[0] < 0xF8)
+	{
+		if (out->HeldLen + len > HELDSIZE)
+			++out->Dropped;
+		else
+		{
+			memcpy(&out->Held[out->HeldLen], msg, len);
+			out->HeldLen += len;
+		}
+	}
+
+	else if (!put_output(out, id, msg, len, time, orig))
+		++out->Messages;
+}
+
+
+
+
+
+/****************** send_sysex() *********************
+ * Sends a slice of a SysEx out an output.
+ *
+ * input =		Which input it came from.
+ */
+
+static void send_sysex(unsigned int id, register const MIDIEVENT *event, unsigned int input)
+{
+	register OUTPORT	*out;
+
+	out = OutPorts[id];
+
+	// Only one SysEx at a time can go out a port. If this input's SysEx
+	// didn't get this port, it doesn't get any of its slices
+	if (event->Flags & MIDI_SYSEX_START)
+	{
+		if (out->SysExInput && out->SysExInput != input + 1)
+		{
+			++out->Dropped;
+			return;
+		}
+		out->SysExInput = (unsigned short)(input + 1);
+	}
+	else if (out->SysExInput != input + 1)
+		return;
+
+	// If the output doesn't have room for the whole slice, the SysEx is
+	// ruined, so we end it here. NOTE: The slice that ends an aborted SysEx
+	// may be empty (see midiparse.h). Then there's nothing to put, but
+	// we still send the 0xF7 and let the port go
+	if (event->Length && put_output(out, id, event->SysEx, event->Length, event->Time, 0) < 0)
+		end_sysex(out, id);
+
+	else if (event->Flags & MIDI_SYSEX_END)
+	{
+		static const unsigned char	eox = 0xF7;
+
+		// If it was cut short by some other status, end it properly
+		if (event->Flags & MIDI_SYSEX_ABORTED) put_output(out, id, &eox, 1, 0, 0);
+		++out->Messages;
+		end_sysex(out, id);
+	}
+}
+
+
+
+
+
+/****************** route_events() *********************
+ * Routes messages that arrived at an input.
+ *
+ * outs =	An array big enough for midi_route() to return a
+ *				message for every rule.
+ * orig =	The MIDI 2.0 packet the (one) message was
+ *				translated from, or 0.
+ */
+
+static void route_events(unsigned int input, register const MIDIEVENT *event, unsigned int count, MIDIROUTE_MSG *outs, const unsigned int *orig)
+{
+	InPorts[input].Messages += count;
+
+	for (; count--; event++)
+	{
+		register unsigned int	i, n;
+
+		n = midi_route_event(&Route, input, event, outs);
+
+		for (i = 0; i < n; i++)
+		{
+			if (event->Type == MIDI_TYPE_SYSEX)
+				send_sysex(outs[i].Output, event, input);
+			else
+				send_message(outs[i].Output, &outs[i].Msg[0], event->Length, event->Time, input, orig);
+		}
+	}
+}
+
+
+
+
+
+/****************** route_ump() *********************
+ * Routes the packets read from a UMP input.
+ *
+ * outs =	An array big enough for midi_route() to return a
+ *				message for every rule.
+ *
+ * NOTE: Each packet is translated to MIDI 1.0 bytes, and
+ * those are parsed (so the parser puts a SysEx's slices
+ * together as usual), and routed. A MIDI 2.0 note or
+ * controller's packet goes along with its message, so a UMP
+ * output can send its full resolution.
+ */
+
+static void route_ump(unsigned int input, register const unsigned char *ptr, register unsigned int len, unsigned long long now, MIDIROUTE_MSG *outs)
+{
+	register INPORT	*in;
+	UMPEVENT				packets[MAXEVENTS];
+	MIDIEVENT			events[UMP_MAXMIDI1];
+	unsigned char		bytes[UMP_MAXMIDI1];
+	unsigned int		used, count;
+
+	in = &InPorts[input];
+
+	while (len)
+	{
+		register const UMPEVENT	*packet;
+
+		count = ump_parse(&in->UmpParser, ptr, len, now, &packets[0], MAXEVENTS, &used);
+		ptr += used;
+		len -= used;
+
+		for (packet = &packets[0]; count--; packet++)
+		{
+			register unsigned int	n;
+
+			if ((n = ump_to_midi1(&packet->Words[0], &bytes[0])))
+			{
+				n = midi_parse(&in->Parser, &bytes[0], n, packet->Time, &events[0], UMP_MAXMIDI1, &used);
+				route_events(input, &events[0], n, outs, packet->Type == UMP_TYPE_MIDI2 && n == 1 ? &packet->Words[0] : 0);
+			}
+		}
+	}
+}
+
+
+
+
+
+/****************** read_input() *********************
+ * Reads everything that has arrived at an input, and
+ * routes it.
+ *
+ * outs =	An array big enough for midi_route() to return a
+ *				message for every rule.
+ */
+
+static void read_input(unsigned int input, unsigned long long now, MIDIROUTE_MSG *outs)
+{
+	register INPORT	*in;
+	unsigned char		buffer[INPUTBUFSIZE];
+	MIDIEVENT			events[MAXEVENTS];
+	register int		len;
+
+	in = &InPorts[input];
+
+	for (;;)
+	{
+		register const unsigned char	*ptr;
+		unsigned int					used, count;
+
+		// If the driver timestamps the bytes, this gets their time
+		if ((len = midi_dev_read(&in->Dev, &buffer[0], sizeof(buffer), &now)) <= 0) break;
+		midi_stat_count(in->Stat, len);
+
+		if (in->Ump)
+		{
+			route_ump(input, &buffer[0], (unsigned int)len, now, outs);
+			continue;
+		}
+
+		ptr = &buffer[0];
+		while (len)
+		{
+			count = midi_parse(&in->Parser, ptr, len, now, &events[0], MAXEVENTS, &used);
+			ptr += used;
+			len -= used;
+			route_events(input, &events[0], count, outs, 0);
+		}
+	}
+
+	// The input was unplugged, or some other error. Any SysEx it was in
+	// the middle of sending isn't going to finish, so end it
+	if (len < 0 && len != -EAGAIN)
+	{
+		register unsigned int	i;
+
+		printf("Closing MIDI input %s: %s\n", in->Name, snd_strerror(len));
+		set_epoll(EPOLL_CTL_DEL, &in->Dev, input, 0);
+		midi_stat_remove(&Stat, in->Stat);
+		close_port(&in->Dev, in->Ump);
+		in->Open = 0;
+
+		for (i = 0; i < OutCount; i++)
+		{
+			if (OutPorts[i]->SysExInput == input + 1)
+			{
+				static const unsigned char	eox = 0xF7;
+
+				put_output(OutPorts[i], i, &eox, 1, 0, 0);
+				end_sysex(OutPorts[i], i);
+			}
+		}
+	}
+}
+
+
+
+
+
+/****************** open_ports() *********************
+ * Opens all the inputs and outputs named in the rules, and
+ * adds them to our epoll set.
+ *
+ * RETURNS: 0 if success, or -1 if any can't be opened.
+ */
+
+static int open_ports(void)
+{
+	register unsigned int	i;
+	register int			err;
+
+	for (i = 0; i < InCount; i++)
+	{
+		register INPORT	*in;
+
+		in = &InPorts[i];
+		// Ask the driver to timestamp the bytes as they arrive, so our latency
+		// includes how long it took epoll to wake us
+		if ((err = open_port(in->Name, MIDIDEV_INPUT|MIDIDEV_TSTAMP, &in->Dev, &in->Ump)) < 0)
+		{
+			printf("Can't open MIDI input %s: %s\n", in->Name, snd_strerror(err));
+			return(-1);
+		}
+		in->Open = 1;
+
+		midi_parse_init(&in->Parser);
+		ump_parse_init(&in->UmpParser);
+		in->Stat = midi_stat_add(&Stat, in->Name, in->Dev.Handle, 0);
+		set_epoll(EPOLL_CTL_ADD, &in->Dev, i, EPOLLIN);
+		printf("Input %s (timestamped %s)\n", in->Name, in->Dev.Timestamps ? "by the driver" : "on wakeup");
+	}
+
+	for (i = 0; i < OutCount; i++)
+	{
+		register OUTPORT	*out;
+
+		out = OutPorts[i];
+		if ((err = open_port(out->Name, MIDIDEV_OUTPUT, &out->Dev, &out->Ump)) < 0)
+		{
+			printf("Can't open MIDI output %s: %s\n", out->Name, snd_strerror(err));
+			return(-1);
+		}
+		out->Open = 1;
+
+		midi_enc_init(&out->Encoder, EncFlags, &out->Buffer[0], OUTBUFSIZE);
+		ump_enc_init(&out->UmpEnc, 0);
+		out->Stat = midi_stat_add(&Stat, out->Name, out->Dev.Handle, 1);
+		set_epoll(EPOLL_CTL_ADD, &out->Dev, i | OUTPUTFLAG, 0);
+		printf("Output %s\n", out->Name);
+	}
+
+	return(0);
+}
+
+
+
+
+
+int main(int argc, char **argv)
+{
+	MIDIROUTE_MSG			*outs;
+	register unsigned int	i;
+	const char				*statName;
+	int						err;
+
+	outs = 0;
+	statName = 0;
+
+	// Get the options
+	while (argc > 1 && argv[1][0] == '-')
+	{
+		if (argv[1][1] == 'r')
+			EncFlags = MIDIENC_RUNNINGSTATUS;
+		else if (argv[1][1] == 'p' && argc > 2)
+		{
+			Priority = atoi(argv[2]);
+			--argc;
+			++argv;
+		}
+		else if (argv[1][1] == 'm' && argc > 2)
+		{
+			statName = argv[2];
+			--argc;
+			++argv;
+		}
+		else
+		{
+			printf("Usage: midirouter [-r] [-p priority] [-m name] [rulefile]\n");
+			return 1;
+		}
+		--argc;
+		++argv;
+	}
+
+	// Did user supply a rule file? If not, route the first input to the first output
+	if (argc > 1)
+	{
+		if (load_rules(argv[1]) < 0) return 1;
+		if (!RuleCount)
+		{
+			printf("%s has no rules!\n", argv[1]);
+			return 1;
+		}
+	}
+	else
+	{
+		char	inName[64], outName[64];
+
+		find_midi_port(&inName[0], SND_RAWMIDI_STREAM_INPUT);
+		find_midi_port(&outName[0], SND_RAWMIDI_STREAM_OUTPUT);
+		if (!inName[0] || !outName[0])
+		{
+			printf("Can't find a MIDI input and output!\n");
+			return 1;
+		}
+		midi_route_rule_init(&Rules[0], get_port(&inName[0], SND_RAWMIDI_STREAM_INPUT), get_port(&outName[0], SND_RAWMIDI_STREAM_OUTPUT));
+		RuleCount = 1;
+	}
+
+	if (midi_route_compile(&Route, &Rules[0], RuleCount, InCount) < 0 ||
+		!(outs = (MIDIROUTE_MSG *)malloc(RuleCount * sizeof(MIDIROUTE_MSG))))
+	{
+		printf("Out of memory!\n");
+		goto out;
+	}
+
+	if ((EpollFd = epoll_create1(0)) < 0)
+	{
+		printf("Can't create an epoll descriptor: %s\n", strerror(errno));
+		goto out;
+	}
+
+	if ((err = midi_stat_open(&Stat, statName, 100)) < 0)
+	{
+		printf("Can't create the status memory %s: %s\n", statName ? statName : "", snd_strerror(err));
+		goto close;
+	}
+
+	if (open_ports() < 0) goto close;
+
+	// Run at real-time priority, so we get the CPU as soon as a message arrives
+	if (Priority)
+	{
+		struct sched_param	param;
+
+		param.sched_priority = Priority;
+		if (sched_setscheduler(0, SCHED_FIFO, &param) < 0)
+			printf("Can't get real-time priority: %s. Run as root for that\n", strerror(errno));
+	}
+
+	time_hist_init(&Latency);
+
+	// Trap when user presses CTRL-C
+	signal(SIGINT, sighandler);
+
+	printf("Routing %u inputs to %u outputs with %u rules...\nPress CTRL-C to stop.\n", InCount, OutCount, RuleCount);
+
+	while (!StopFlag)
+	{
+		struct epoll_event			events[MAXPORTS];
+		register unsigned long long	now;
+		register int					count;
+
+		// Wait for any input to have something, or any full output to have room
+		if ((count = epoll_wait(EpollFd, &events[0], MAXPORTS, -1)) <= 0) continue;
+		now = get_time_ns();
+
+		for (i = 0; i < (unsigned int)count; i++)
+		{
+			register unsigned int	id;
+
+			id = events[i].data.u32;
+			if (!(id & OUTPUTFLAG))
+			{
+				if (InPorts[id].Open) read_input(id, now, outs);
+			}
+			else
+			{
+				id &= ~OUTPUTFLAG;
+				if (OutPorts[id]->Open)
+				{
+					if (events[i].events & (EPOLLERR | EPOLLHUP))
+						close_output(OutPorts[id], id, -ENODEV);
+					else
+						flush_output(OutPorts[id], id);
+				}
+			}
+		}
+
+		// Now give each output everything that was routed to it
+		for (i = 0; i < DirtyCount; i++)
+		{
+			OutPorts[DirtyList[i]]->Dirty = 0;
+			flush_output(OutPorts[DirtyList[i]], DirtyList[i]);
+		}
+		DirtyCount = 0;
+	}
+
+	printf("\n");
+	for (i = 0; i < InCount; i++)
+	{
+		MIDISTAT_PORT	sample;
+
+		// Get the last of the driver's overruns. (If the input was closed, we
+		// got them then)
+		sample.Xruns = 0;
+		if (InPorts[i].Stat)
+		{
+			midi_stat_remove(&Stat, InPorts[i].Stat);
+			midi_stat_read(InPorts[i].Stat, &sample);
+		}
+		printf("Input %-12s received %lu messages, %llu driver overruns\n", InPorts[i].Name, InPorts[i].Messages, sample.Xruns);
+	}
+	for (i = 0; i < OutCount; i++) printf("Output %-12s sent %lu messages, dropped %lu\n", OutPorts[i]->Name, OutPorts[i]->Messages, OutPorts[i]->Dropped);
+	if (Latency.Count)
+	{
+		time_hist_print(&Latency, "Input to output latency");
+		printf("Worst latency was %.3f msec\n", Latency.Max / 1000000.0);
+	}
+
+close:
+	// Stop the sampler before we close the ports it samples
+	midi_stat_close(&Stat);
+
+	for (i = 0; i < InCount; i++)
+	{
+		if (InPorts[i].Open) close_port(&InPorts[i].Dev, InPorts[i].Ump);
+	}
+	for (i = 0; i < OutCount; i++)
+	{
+		if (OutPorts[i]->Open)
+		{
+			// Let what's left go out, now that we can wait
+			midi_dev_nonblock(&OutPorts[i]->Dev, 0);
+			if (OutPorts[i]->Encoder.Used) midi_dev_write(&OutPorts[i]->Dev, OutPorts[i]->Encoder.Buffer, OutPorts[i]->Encoder.Used);
+			midi_dev_drain(&OutPorts[i]->Dev);
+			close_port(&OutPorts[i]->Dev, OutPorts[i]->Ump);
+		}
+	}
+	close(EpollFd);
+out:
+	if (outs) free(outs);
+	midi_route_free(&Route);
+	for (i = 0; i < OutCount; i++) free(OutPorts[i]);
+
+	return 0;
+}
@@ -0,0 +1,553 @@
+// Measures how accurately our MIDI scheduler (../../common/midisched.c)
+// sends MIDI messages at their scheduled times.
+//
+// Connect a MIDI cable from a MIDI output back into a MIDI input,
+// and specify both on the command line (output first):
+// ./midischedbench 1,0 1,0
+//
+// We schedule a series of note-on messages at regular intervals,
+// and timestamp each one as it arrives back at the input (using
+// the driver's timestamps if it supports SND_RAWMIDI_READ_TSTAMP).
+// When done, we print histograms of the latency (arrival time
+// minus scheduled time), and the jitter (how much the latency
+// varies from the lowest latency). With a 31250 baud cable, the
+// latency includes about 960 microseconds to send each 3-byte
+// message, plus whatever the MIDI interface adds.
+//
+// If you specify only a MIDI output, we print only how late the
+// scheduler thread was in writing each batch to the output.
+//
+// To run without a MIDI interface (or cable), use an in-memory
+// loopback (see ../../common/mididev.h) for both:
+// ./midischedbench loop:0 loop:0
+// Then the latency is only that of the scheduler and the OS.
+//
+// With "-s", we instead hand the messages ahead of time to the ALSA
+// sequencer's kernel queue (../../common/seqsched.c), and it sends
+// them at their times. Give the sequencer address of the same MIDI
+// output ("aconnect -o" lists them) instead of the rawmidi name,
+// and then the MIDI input (if any):
+// ./midischedbench -s 20:0 1,0
+//
+// To compare the two under heavy system load, use "-l" to run some
+// busy processes while we send, and "-p 0" so our scheduler thread
+// doesn't get real-time priority either. We also print how much CPU
+// time we used. For the sequencer, that leaves out the kernel's
+// timer work, which isn't charged to any process.
+//
+// Options:
+// -n count		How many messages to send (default 1000, max 16000).
+// -i usecs		Time between messages (default 5000). Don't make
+//					this less than the time it takes to send "-c"
+//					messages over the cable.
+// -c count		Schedule this many messages at each time (ie, a
+//					chord). Default 1.
+// -p priority	SCHED_FIFO priority of the scheduler thread (1 to 99),
+//					or 0 for normal priority. Default 50.
+// -r				Send with running status. With "-c", this shortens
+//					each chord by 1 byte per note after the first.
+// -s addr		Send through the sequencer's queue, to this sequencer
+//					address.
+// -l count		Run this many busy processes while we send. Default 0.
+//
+// Compile as:
+// gcc -o midischedbench midischedbench.c ../../common/midisched.c ../../common/mididev.c ../../common/devalloc.c ../../common/seqsched.c ../../common/midienc.c ../../common/midiparse.c ../../common/timing.c -lasound -lpthread -lm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <alsa/asoundlib.h>
+#include "../../common/midisched.h"
+#include "../../common/seqsched.h"
+#include "../../common/midiparse.h"
+#include "../../common/timing.h"
+
+
+
+// How many bytes we read at a time
+#define INPUTBUFSIZE		4096
+
+// How many MIDIEVENTs we parse at a time
+#define MAXEVENTS			256
+
+// Each message is a note-on. Its note number and velocity together
+// identify which message it is, so we can have this many
+#define MAXMESSAGES		(127 * 128)
+
+// Set to 1 if user wants to abort
+int StopFlag = 0;
+
+// Our options
+unsigned int	Count = 1000;
+unsigned int	Interval = 5000;
+unsigned int	Chord = 1;
+int				Priority = 50;
+unsigned int	EncFlags = 0;
+unsigned int	Load = 0;
+const char		*SeqDest = 0;
+
+// The time we scheduled each message for, and when it arrived (0 if
+// it hasn't)
+unsigned long long	*Scheduled, *Arrived;
+
+// With "-s", the next message to give the sequencer, and the first
+// error it returned
+unsigned int		Next = 0;
+int					SeqError = 0;
+
+// The busy processes we run with "-l"
+pid_t					*LoadPids;
+
+
+
+
+
+
+/****************** sighandler() *********************
+ * Called by the operating system when the user presses
+ * CTRL-C to abort this app.
+ */
+
+void sighandler(int dummy)
+{
+	// Let main() know that user wants to break out of the loop
+	StopFlag = 1;
+}
+
+
+
+
+
+/****************** make_message() *********************
+ * Makes the note-on for message number "i". Its note
+ * number and velocity together identify it.
+ */
+
+static void make_message(unsigned int i, unsigned char *buffer)
+{
+	buffer[0] = 0x90;
+	buffer[1] = (unsigned char)(i & 0x7F);
+	buffer[2] = (unsigned char)((i >> 7) + 1);
+}
+
+
+
+
+
+/****************** feed_seq() *********************
+ * Gives the sequencer as many of the remaining messages
+ * as its queue has room for.
+ *
+ * RETURNS: 0 if success (even if the queue is full), or
+ * a negative error number.
+ */
+
+static int feed_seq(SEQSCHED *seq)
+{
+	unsigned char	buffer[3];
+	register int	err;
+
+	while (Next < Count)
+	{
+		make_message(Next, &buffer[0]);
+		if ((err = seq_sched_add(seq, Scheduled[Next], &buffer[0], 3)) < 0) goto out;
+		++Next;
+	}
+
+	err = seq_sched_flush(seq);
+out:
+	// A full queue just means we wait for room
+	if (err == -EAGAIN) err = 0;
+	if (err < 0 && !SeqError) SeqError = err;
+	return(err);
+}
+
+
+
+
+
+/****************** start_load() *********************
+ * Starts Load processes that do nothing but use the CPU,
+ * at normal priority.
+ */
+
+static void start_load(void)
+{
+	register unsigned int	i;
+
+	if (!Load || !(LoadPids = (pid_t *)calloc(Load, sizeof(pid_t)))) return;
+
+	for (i = 0; i < Load; i++)
+	{
+		if (!(LoadPids[i] = fork()))
+		{
+			volatile unsigned long	spin;
+
+			signal(SIGINT, SIG_DFL);
+			for (spin = 0; ; spin++);
+		}
+	}
+
+	printf("Running %u busy processes\n", Load);
+}
+
+
+
+
+
+/****************** stop_load() *********************
+ * Ends the processes start_load() started.
+ */
+
+static void stop_load(void)
+{
+	register unsigned int	i;
+
+	if (LoadPids)
+	{
+		for (i = 0; i < Load; i++)
+		{
+			if (LoadPids[i] > 0)
+			{
+				kill(LoadPids[i], SIGKILL);
+				waitpid(LoadPids[i], 0, 0);
+			}
+		}
+		free(LoadPids);
+		LoadPids = 0;
+	}
+}
+
+
+
+
+
+/****************** cpu_time() *********************
+ * RETURNS: How much CPU time (user and system) our process
+ * has used, in nanoseconds. This includes all our threads,
+ * but not our busy processes.
+ */
+
+static unsigned long long cpu_time(void)
+{
+	struct rusage	usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return((unsigned long long)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ULL + (unsigned long long)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ULL);
+}
+
+
+
+
+
+/****************** receive() *********************
+ * Reads the messages that arrive back at the MIDI input,
+ * and records the arrival time of each.
+ *
+ * midiIn =			The (non-blocking) MIDI input.
+ * endTime =		When the last message is scheduled.
+ * seq =				The sequencer to keep feeding the rest of the
+ *						messages, or 0 if they're all queued.
+ *
+ * RETURNS: How many messages arrived.
+ */
+
+static unsigned int receive(MIDIDEV *midiIn, unsigned long long endTime, SEQSCHED *seq)
+{
+	MIDIPARSER				parser;
+	MIDIEVENT				events[MAXEVENTS];
+	unsigned char			buffer[INPUTBUFSIZE];
+	struct pollfd			*pfds;
+	register unsigned int	received;
+	register int			npfds, nseq;
+
+	// We also wait for room in the sequencer's queue, while there are
+	// messages left to give it
+	npfds = midi_dev_poll_descriptors_count(midiIn);
+	nseq = (seq ? snd_seq_poll_descriptors_count(seq->Handle, POLLOUT) : 0);
+	pfds = (struct pollfd *)alloca((npfds + nseq) * sizeof(struct pollfd));
+	npfds = midi_dev_poll_descriptors(midiIn, pfds, npfds);
+	if (seq) nseq = seq_sched_poll_descriptors(seq, &pfds[npfds], nseq);
+
+	midi_parse_init(&parser);
+	received = 0;
+
+	// Stop when everything has arrived, or a second after the last message was
+	// due (in case some were lost)
+	while (!StopFlag && received < Count && get_time_ns() < endTime + 1000000000ULL)
+	{
+		register int		len;
+		unsigned long long	now;
+
+		if (seq && Next < Count && feed_seq(seq) < 0) seq = 0;
+		if (poll(pfds, npfds + (seq && Next < Count ? nseq : 0), 100) <= 0) continue;
+		now = get_time_ns();
+
+		for (;;)
+		{
+			unsigned int		used, count, i;
+			register const unsigned char	*ptr;
+
+			// If the driver timestamps the input, each read returns only bytes with
+			// the same timestamp, and sets "now" to it
+			len = midi_dev_read(midiIn, &buffer[0], sizeof(buffer), &now);
+
+			if (len <= 0) break;
+
+			ptr = &buffer[0];
+			while (len)
+			{
+				count = midi_parse(&parser, ptr, len, now, &events[0], MAXEVENTS, &used);
+				ptr += used;
+				len -= used;
+
+				for (i = 0; i < count; i++)
+				{
+					register unsigned int	id;
+
+					// Our note-ons. Anything else (ie, active sensing from the interface) we ignore
+					if ((events[i].Status & 0xF0) != 0x90 || !events[i].Data2) continue;
+					id = events[i].Data1 | ((events[i].Data2 - 1) << 7);
+					if (id < Count && !Arrived[id])
+					{
+						Arrived[id] = events[i].Time;
+						++received;
+					}
+				}
+			}
+		}
+	}
+
+	return(received);
+}
+
+
+
+
+
+int main(int argc, char **argv)
+{
+	register int			err;
+	register unsigned int	i;
+	MIDIDEV					midiOut, midiIn, *output, *input;
+	MIDISCHED				sched;
+	SEQSCHED					seq;
+	unsigned long long	start, cpu;
+	char						cardName[64];
+
+	// Get the options
+	while (argc > 2 && argv[1][0] == '-')
+	{
+		if (argv[1][1] == 'r')
+		{
+			EncFlags = MIDIENC_RUNNINGSTATUS;
+			--argc;
+			++argv;
+			continue;
+		}
+
+		switch (argv[1][1])
+		{
+			case 'n':
+				Count = (unsigned int)atoi(argv[2]);
+				break;
+			case 'i':
+				Interval = (unsigned int)atoi(argv[2]);
+				break;
+			case 'c':
+				Chord = (unsigned int)atoi(argv[2]);
+				break;
+			case 'p':
+				Priority = atoi(argv[2]);
+				break;
+			case 's':
+				SeqDest = argv[2];
+				break;
+			case 'l':
+				Load = (unsigned int)atoi(argv[2]);
+				break;
+			default:
+				goto usage;
+		}
+		argc -= 2;
+		argv += 2;
+	}
+
+	// With "-s", the sequencer address takes the place of the MIDI output
+	if ((!SeqDest && argc < 2) || (argc > 1 && argv[1][0] == '-') || !Count || Count > MAXMESSAGES || !Chord)
+	{
+usage:
+		printf("Usage: midischedbench [-n count] [-i usecs] [-c chord] [-p priority] [-r] [-l load] outcard,device [incard,device]\n");
+		printf("       midischedbench [-n count] [-i usecs] [-c chord] [-l load] -s client:port [incard,device]\n");
+		return 1;
+	}
+	if (SeqDest)
+	{
+		// So argv[2] is the input, as without "-s"
+		--argv;
+		++argc;
+	}
+
+	if (!(Scheduled = (unsigned long long *)calloc(Count * 2, sizeof(unsigned long long))))
+	{
+		printf("Out of memory!\n");
+		return 1;
+	}
+	Arrived = Scheduled + Count;
+
+	// Open the MIDI output (unless the sequencer does it)
+	output = 0;
+	if (!SeqDest)
+	{
+		sprintf(&cardName[0], strchr(argv[1], ':') ? "%s" : "hw:%s", argv[1]);
+		if ((err = midi_dev_open(&midiOut, &cardName[0], MIDIDEV_OUTPUT)) < 0)
+		{
+			printf("Can't open MIDI Output %s: %s\n", &cardName[0], snd_strerror(err));
+			free(Scheduled);
+			return 1;
+		}
+		output = &midiOut;
+	}
+
+	// Open the MIDI input, if he wants to measure the loopback. Ask the driver
+	// to timestamp the input bytes as they arrive (with the monotonic clock), if
+	// it can. Otherwise, we timestamp each batch ourselves when poll() wakes us
+	input = 0;
+	if (argc > 2)
+	{
+		sprintf(&cardName[0], strchr(argv[2], ':') ? "%s" : "hw:%s", argv[2]);
+		if ((err = midi_dev_open(&midiIn, &cardName[0], MIDIDEV_INPUT|MIDIDEV_NONBLOCK|MIDIDEV_TSTAMP)) < 0)
+		{
+			printf("Can't open MIDI Input %s: %s\n", &cardName[0], snd_strerror(err));
+			goto out2;
+		}
+		input = &midiIn;
+		printf("Timestamping %s\n", midiIn.Timestamps ? "by the driver" : "each batch");
+
+		// Throw away anything that arrived before we start
+		midi_dev_drop(input);
+	}
+
+	if (SeqDest)
+	{
+		if ((err = seq_sched_open(&seq, SeqDest, 0, 0)) < 0)
+		{
+			printf("Can't open the sequencer to %s: %s\n", SeqDest, snd_strerror(err));
+			goto out;
+		}
+		printf("Sending through the sequencer's queue\n");
+	}
+	else
+	{
+		if ((err = midi_sched_start(&sched, output, Count, 0, Priority, EncFlags)) < 0)
+		{
+			printf("Can't start the MIDI scheduler: %s\n", strerror(-err));
+			goto out;
+		}
+		printf("Scheduler thread is %s\n", sched.Realtime ? "real-time" : "normal priority (run as root for real-time)");
+	}
+
+	// Trap when user presses CTRL-C
+	signal(SIGINT, sighandler);
+
+	start_load();
+	cpu = cpu_time();
+
+	// Queue all the messages up front, starting a little in the future. The
+	// sequencer's queue may not hold them all, so it gets what fits, and the
+	// rest as there's room
+	start = get_time_ns() + 50000000ULL;
+	for (i = 0; i < Count; i++)
+	{
+		Scheduled[i] = start + (unsigned long long)(i / Chord) * Interval * 1000ULL;
+		if (!SeqDest)
+		{
+			unsigned char	buffer[3];
+
+			make_message(i, &buffer[0]);
+			midi_sched_add(&sched, Scheduled[i], &buffer[0], 3);
+		}
+	}
+	if (SeqDest) feed_seq(&seq);
+
+	printf("Sending %u messages, %u every %u usecs...\n", Count, Chord, Interval);
+
+	// Collect the loopback arrivals while the scheduler sends
+	if (input)
+	{
+		TIMEHIST			latency, jitter;
+		unsigned long long	least;
+		register unsigned int	received;
+
+		received = receive(input, Scheduled[Count - 1], SeqDest ? &seq : 0);
+
+		time_hist_init(&latency);
+		time_hist_init(&jitter);
+		least = ~0ULL;
+		for (i = 0; i < Count; i++)
+		{
+			if (Arrived[i])
+			{
+				time_hist_add(&latency, Arrived[i] - Scheduled[i]);
+				if (Arrived[i] - Scheduled[i] < least) least = Arrived[i] - Scheduled[i];
+			}
+		}
+		for (i = 0; i < Count; i++)
+		{
+			if (Arrived[i]) time_hist_add(&jitter, Arrived[i] - Scheduled[i] - least);
+		}
+
+		printf("%u of %u messages arrived\n", received, Count);
+		time_hist_print(&latency, "Latency (arrival minus scheduled time)");
+		time_hist_print(&jitter, "Jitter (latency minus the lowest latency)");
+	}
+
+	if (SeqDest)
+	{
+		// Without an input, we just keep the queue fed
+		if (!input)
+		{
+			struct pollfd		*pfds;
+			register int		npfds;
+
+			npfds = snd_seq_poll_descriptors_count(seq.Handle, POLLOUT);
+			pfds = (struct pollfd *)alloca(npfds * sizeof(struct pollfd));
+			npfds = seq_sched_poll_descriptors(&seq, pfds, npfds);
+			while (!StopFlag && Next < Count && feed_seq(&seq) >= 0)
+			{
+				if (Next < Count) poll(pfds, npfds, 100);
+			}
+		}
+
+		if (!StopFlag) seq_sched_drain(&seq);
+		cpu = cpu_time() - cpu;
+		seq_sched_close(&seq);
+
+		if (SeqError) printf("Error queuing MIDI events: %s\n", snd_strerror(SeqError));
+		printf("%lu messages queued in %lu writes (the queue was full %lu times)\n", seq.Events, seq.Writes, seq.Full);
+	}
+	else
+	{
+		midi_sched_drain(&sched);
+		cpu = cpu_time() - cpu;
+		midi_sched_stop(&sched);
+
+		if (sched.Error) printf("Error writing MIDI Output: %s\n", snd_strerror(sched.Error));
+		printf("%lu messages sent in %lu writes (%lu bytes, %lu status bytes saved)\n", sched.Events, sched.Writes, sched.Encoder.Bytes, sched.Encoder.Saved);
+		time_hist_print(&sched.Late, "Send lateness (write time minus scheduled time)");
+	}
+
+	stop_load();
+	printf("CPU time used: %llu usecs\n", cpu / 1000ULL);
+
+out:
+	if (input) midi_dev_close(input);
+out2:
+	if (output) midi_dev_close(output);
+	free(Scheduled);
+
+	return 0;
+}
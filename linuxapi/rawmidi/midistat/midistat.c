@@ -0,0 +1,137 @@
+// Shows the MIDI port numbers that another program (ie, smfrec or
+// midirouter, run with -m name) keeps in shared memory. Once a
+// second, it prints a line for each of that program's ports:
+// ./midistat myrouter
+//
+// For each port, we show how many bytes per second are going
+// through it, how full the driver's buffer is now (and the most
+// it has been), and how many times it overflowed (so some input
+// bytes were lost). We read the numbers straight out of the shared
+// memory (see ../../common/midistat.h), so watching never slows
+// the other program down.
+//
+// Options:
+// -n count		Print this many times, then quit. (-n 1 is handy
+//					for a script.)
+// -i msecs		How often to print. Default 1000.
+//
+// Compile as:
+// gcc -o midistat midistat.c ../../common/midistat.c ../../common/timing.c -lasound -lpthread -lrt -lm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <alsa/asoundlib.h>
+#include "../../common/midistat.h"
+#include "../../common/timing.h"
+
+
+
+// Set to 1 if user wants to stop
+int StopFlag = 0;
+
+
+
+
+
+/****************** sighandler() *********************
+ * Called by the operating system when the user presses
+ * CTRL-C to stop.
+ */
+
+void sighandler(int dummy)
+{
+	StopFlag = 1;
+}
+
+
+
+
+
+/****************** print_ports() *********************
+ * Prints one line for each open port.
+ */
+
+static void print_ports(const MIDISTAT_HEADER *header)
+{
+	register unsigned int	i, count;
+	unsigned long long		now;
+
+	now = get_time_ns();
+	count = __atomic_load_n(&header->PortCount, __ATOMIC_ACQUIRE);
+
+	for (i = 0; i < count; i++)
+	{
+		MIDISTAT_PORT	port;
+
+		if (midi_stat_read(&header->Ports[i], &port) < 0) continue;
+
+		printf("%-6s %-16s %9.0f B/s %10llu bytes", (port.Flags & MIDISTAT_OUTPUT) ? "Output" : "Input", &port.Name[0], port.ByteRate, port.Bytes);
+		if (port.Flags & MIDISTAT_DRIVER)
+			printf("   buffer %5u/%-5u (max %5u)   %llu overruns (%.1f/s)", port.Fill, port.BufferSize, port.MaxFill, port.Xruns, port.XrunRate);
+
+		// If the sampler hasn't updated it for a while, the program may be stuck
+		if (port.SampleTime && now - port.SampleTime > header->Interval * 5000000ULL)
+			printf("   (stale %.1f s)", (now - port.SampleTime) / 1000000000.0);
+		printf("\n");
+	}
+}
+
+
+
+
+
+int main(int argc, char **argv)
+{
+	MIDISTAT_HEADER	*header;
+	register int		err;
+	int					count, interval;
+
+	count = 0;
+	interval = 1000;
+
+	// Get the options
+	while (argc > 2 && argv[1][0] == '-')
+	{
+		if (argv[1][1] == 'n')
+			count = atoi(argv[2]);
+		else if (argv[1][1] == 'i' && atoi(argv[2]) > 0)
+			interval = atoi(argv[2]);
+		else
+			break;
+		argc -= 2;
+		argv += 2;
+	}
+
+	if (argc < 2 || argv[1][0] == '-')
+	{
+		printf("Usage: midistat [-n count] [-i msecs] name\n");
+		return 1;
+	}
+
+	if ((err = midi_stat_attach(argv[1], &header)) < 0)
+	{
+		printf("Can't open the status memory %s: %s\n", argv[1], strerror(-err));
+		return 1;
+	}
+
+	printf("Ports of process %u, sampled every %u msecs\n", header->Pid, header->Interval);
+
+	// Trap when user presses CTRL-C
+	signal(SIGINT, sighandler);
+
+	while (!StopFlag)
+	{
+		print_ports(header);
+		if (count && !--count) break;
+		usleep(interval * 1000);
+		printf("\n");
+	}
+
+	midi_stat_detach(header);
+
+	return 0;
+}
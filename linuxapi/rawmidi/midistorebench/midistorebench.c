@@ -0,0 +1,333 @@
+// Measures how fast our MIDI message store (../../common/midistore.c)
+// answers searches of a long recording, compared to scanning a plain
+// list of all the messages (an array of MIDIEVENTs). No MIDI hardware
+// is needed.
+//
+// We make up a session of 10 million messages (about 3.5 hours of a
+// busy 16 channel performance: notes, controllers, pitch bend, MIDI
+// clock, and the odd SysEx and song position), add it to a store,
+// save the store to a file, and load it back. Then we time some
+// searches, each over the plain list, the store in memory, and the
+// store loaded from the file, and check that they all find the same
+// messages.
+//
+// Compile as:
+// gcc -O2 -o midistorebench midistorebench.c ../../common/midistore.c ../../common/midiparse.c
+//
+// To see what the SSE2 filter (midi_store_filter()) buys, compile
+// again with -U__SSE2__, and compare the note-on search, which has
+// to look at every message.
+//
+// Run it, optionally specifying how many million messages to make
+// up (default 10), and the name of the file to save the store to
+// (default /tmp/midistorebench.mstr, which we delete when done):
+// ./midistorebench 10 /tmp/session.mstr
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "../../common/midistore.h"
+
+
+
+
+
+// How many messages we ask midi_store_query() for per call
+#define MAXEVENTS			1024
+
+// The time between messages (on average), in nanoseconds. 10 million
+// messages make about 3.5 hours
+#define MSGINTERVAL		1250000ULL
+
+#define SECS(h, m, s)	((((h) * 60ULL + (m)) * 60ULL + (s)) * 1000000000ULL)
+
+// Our made-up session
+static MIDIEVENT		*Session;
+static unsigned long	SessionCount;
+
+// One search
+typedef struct _SEARCH
+{
+	const char				*Name;
+	unsigned long long	From, To;
+	unsigned char			Status, StatusMask, Data1, Data1Mask;
+} SEARCH;
+
+static const SEARCH Searches[] = {
+	{"CC7 on ch 3, 01:02:00-01:05:00",	SECS(1, 2, 0), SECS(1, 5, 0),	0xB2, 0xFF, 7, 0x7F},
+	{"Note-ons, any ch, whole session",	0, ~0ULL,							0x90, 0xF0, 0, 0},
+	{"Song position, whole session",		0, ~0ULL,							0xF2, 0xFF, 0, 0},
+	{"SysEx, whole session",				0, ~0ULL,							0xF0, 0xFF, 0, 0},
+	{"Ch 10 notes, first 10 minutes",	0, SECS(0, 10, 0),				0x99, 0xFF, 0, 0},
+};
+
+#define NUMSEARCHES	(sizeof(Searches) / sizeof(SEARCH))
+
+
+
+
+
+/********************** get_time_ns() *********************
+ * Returns the current time of the monotonic clock, in
+ * nanoseconds.
+ */
+
+static unsigned long long get_time_ns(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+
+
+
+
+/********************** make_session() *********************
+ * Fills "Session" with made-up messages, in time order.
+ */
+
+static void make_session(void)
+{
+	register unsigned long		i;
+	register unsigned int		seed;
+	unsigned long long			time;
+
+	seed = 12345;
+	time = 0;
+	for (i = 0; i < SessionCount; i++)
+	{
+		register MIDIEVENT		*ev;
+		register unsigned int	r;
+
+		// A simple random number generator, so every run makes the same session
+		seed = seed * 1103515245 + 12345;
+		r = seed >> 8;
+
+		ev = &Session[i];
+		memset(ev, 0, sizeof(MIDIEVENT));
+		time += (r % (2 * MSGINTERVAL / 1000)) * 1000;
+		ev->Time = time;
+		ev->Type = MIDI_TYPE_CHANNEL;
+		ev->Length = 3;
+		ev->Data1 = (unsigned char)((r >> 4) & 0x7F);
+		ev->Data2 = (unsigned char)((r >> 11) & 0x7F);
+
+		switch ((r >> 18) & 15)
+		{
+			case 0:
+			case 1:
+			case 2:
+			case 3:
+			case 4:
+				ev->Status = 0x90 | (r & 0x0F);
+				break;
+			case 5:
+			case 6:
+			case 7:
+				ev->Status = 0x80 | (r & 0x0F);
+				break;
+			case 8:
+			case 9:
+			case 10:
+				// Controllers. Mostly the mod wheel, volume and expression
+				ev->Status = 0xB0 | (r & 0x0F);
+				ev->Data1 = "\x01\x07\x0B\x40"[(r >> 22) & 3];
+				break;
+			case 11:
+				ev->Status = 0xE0 | (r & 0x0F);
+				break;
+			case 12:
+				ev->Status = 0xC0 | (r & 0x0F);
+				ev->Length = 2;
+				ev->Data2 = 0;
+				break;
+			default:
+				// MIDI clock, and very rarely a SysEx or a song position
+				ev->Type = MIDI_TYPE_REALTIME;
+				ev->Status = 0xF8;
+				ev->Length = 1;
+				ev->Data1 = ev->Data2 = 0;
+				if (!(r % 65536))
+				{
+					ev->Type = MIDI_TYPE_COMMON;
+					ev->Status = 0xF2;
+					ev->Length = 3;
+				}
+				else if (!(r % 8191))
+				{
+					ev->Type = MIDI_TYPE_SYSEX;
+					ev->Flags = MIDI_SYSEX_START | MIDI_SYSEX_END;
+					ev->Status = 0xF0;
+					ev->Length = 1;
+				}
+		}
+	}
+}
+
+
+
+
+
+/********************** scan_session() *********************
+ * Searches "Session" the slow way, looking at every message.
+ *
+ * RETURNS: How many messages matched. Also returns (in
+ * "sum") the total of their times, to check the other
+ * searches against.
+ */
+
+static unsigned long scan_session(register const SEARCH *search, unsigned long long *sum)
+{
+	register unsigned long	i, found;
+	register unsigned char	status, data1;
+
+	status = search->Status & search->StatusMask;
+	data1 = search->Data1 & search->Data1Mask;
+	found = 0;
+	*sum = 0;
+	for (i = 0; i < SessionCount; i++)
+	{
+		register const MIDIEVENT	*ev;
+
+		ev = &Session[i];
+		if (ev->Time >= search->From && ev->Time < search->To && (ev->Status & search->StatusMask) == status &&
+			(ev->Data1 & search->Data1Mask) == data1 && (ev->Type != MIDI_TYPE_SYSEX || (ev->Flags & MIDI_SYSEX_START)))
+		{
+			++found;
+			*sum += ev->Time;
+		}
+	}
+
+	return(found);
+}
+
+
+
+
+
+/********************** search_store() *********************
+ * Searches a MIDISTORE.
+ *
+ * RETURNS: How many messages matched, and their total time,
+ * like scan_session(). Also returns the query, so we can
+ * print how many blocks it skipped. If a SysEx doesn't point
+ * to its 0xF0, returns ~0 so that the caller complains.
+ */
+
+static unsigned long search_store(const MIDISTORE *store, register const SEARCH *search, unsigned long long *sum, MIDISTORE_QUERY *query)
+{
+	MIDIEVENT					events[MAXEVENTS];
+	register unsigned long	found;
+	register unsigned int	count, i;
+
+	midi_store_query_init(query, search->From, search->To, search->Status, search->StatusMask, search->Data1, search->Data1Mask);
+	found = 0;
+	*sum = 0;
+	while ((count = midi_store_query(store, query, &events[0], MAXEVENTS)))
+	{
+		found += count;
+		for (i = 0; i < count; i++)
+		{
+			if (events[i].Type == MIDI_TYPE_SYSEX && (!events[i].SysEx || events[i].SysEx[0] != 0xF0)) return(~0UL);
+			*sum += events[i].Time;
+		}
+	}
+
+	return(found);
+}
+
+
+
+
+
+int main(int argc, char **argv)
+{
+	MIDISTORE					store, loaded;
+	MIDISTORE_QUERY			query;
+	const char					*name;
+	unsigned long long		start, elapsed, sum, storeSum;
+	register unsigned long	i;
+	register int				err;
+
+	SessionCount = (argc > 1 && atoi(argv[1]) > 0 ? (unsigned long)atoi(argv[1]) : 10) * 1000000UL;
+	name = (argc > 2 ? argv[2] : "/tmp/midistorebench.mstr");
+
+	if (!(Session = (MIDIEVENT *)malloc(SessionCount * sizeof(MIDIEVENT))))
+	{
+		printf("Can't allocate the session\n");
+		return 1;
+	}
+	make_session();
+	printf("Session: %lu messages, %.1f minutes. A MIDIEVENT is %u bytes, a block of %u messages is %u bytes\n",
+		SessionCount, (double)Session[SessionCount - 1].Time / 60e9, (unsigned int)sizeof(MIDIEVENT),
+		MIDISTORE_BLOCKEVENTS, (unsigned int)sizeof(MIDISTORE_BLOCK));
+
+	// Add it to a store, in the sized batches that midi_parse() would return
+	midi_store_init(&store);
+	start = get_time_ns();
+	for (i = 0; i < SessionCount; i += MAXEVENTS)
+	{
+		if ((err = midi_store_add(&store, &Session[i], SessionCount - i < MAXEVENTS ? SessionCount - i : MAXEVENTS)) < 0)
+		{
+			printf("Can't add to the store: %s\n", strerror(-err));
+			goto out;
+		}
+	}
+	elapsed = get_time_ns() - start;
+	printf("Added to the store in %.1f ms (%.2f ns/message), %u blocks\n", elapsed / 1e6, (double)elapsed / SessionCount, store.BlockCount);
+
+	start = get_time_ns();
+	if ((err = midi_store_save(&store, name)) < 0)
+	{
+		printf("Can't save %s: %s\n", name, strerror(-err));
+		goto out;
+	}
+	elapsed = get_time_ns() - start;
+	printf("Saved to %s in %.1f ms\n", name, elapsed / 1e6);
+
+	if ((err = midi_store_load(&loaded, name)) < 0)
+	{
+		printf("Can't load %s: %s\n", name, strerror(-err));
+		goto out;
+	}
+
+	printf("\n%-34s %9s %11s %11s %11s  %s\n", "Search", "Found", "List scan", "Store", "Loaded", "Blocks searched/skipped");
+	for (i = 0; i < NUMSEARCHES; i++)
+	{
+		unsigned long long	listTime, storeTime, loadedTime;
+		unsigned long			found;
+
+		start = get_time_ns();
+		found = scan_session(&Searches[i], &sum);
+		listTime = get_time_ns() - start;
+
+		start = get_time_ns();
+		if (search_store(&store, &Searches[i], &storeSum, &query) != found || storeSum != sum)
+			printf("%s: the store found different messages!\n", Searches[i].Name);
+		storeTime = get_time_ns() - start;
+
+		start = get_time_ns();
+		if (search_store(&loaded, &Searches[i], &storeSum, &query) != found || storeSum != sum)
+			printf("%s: the loaded store found different messages!\n", Searches[i].Name);
+		loadedTime = get_time_ns() - start;
+
+		printf("%-34s %9lu %8.2f ms %8.2f ms %8.2f ms  %lu/%lu\n", Searches[i].Name, found,
+			listTime / 1e6, storeTime / 1e6, loadedTime / 1e6, query.BlocksRead, query.BlocksSkipped);
+
+		// Every block is either searched or skipped
+		if (query.BlocksRead + query.BlocksSkipped != loaded.BlockCount)
+			printf("%s: searched and skipped %lu blocks, of %u!\n", Searches[i].Name, query.BlocksRead + query.BlocksSkipped, loaded.BlockCount);
+	}
+
+	midi_store_free(&loaded);
+	if (argc <= 2) unlink(name);
+out:
+	midi_store_free(&store);
+	free(Session);
+
+	return 0;
+}
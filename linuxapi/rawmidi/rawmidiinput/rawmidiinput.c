@@ -2,28 +2,189 @@
 // Input that is specified on the command line (ie, 0,0 to receive
 // from the first card's first MIDI input). If no input is
 // specified, then it receives through the first MIDI input it
-// finds.
+// finds. A name with a colon is used as is, so it can be any name
+// ../../common/mididev.h takes (ie, free:1 for any subdevice of
+// card 1's inputs that no one else is using).
 //
 // This uses the ALSA rawmidi API to demonstrate how to input
 // MIDI events via that API (as opposed to the sequencer API).
 // With the raw API, we read the unadorned MIDI bytes -- no
 // timestamps, (perhaps) no resolved running status, etc.
 //
+// Rather than reading (and printing) one byte per call, we open
+// the input in non-blocking mode and sleep in poll() until the
+// driver has some bytes for us. Then we grab everything it has
+// in as few snd_rawmidi_read() calls as possible, and process the
+// whole batch at once. This also means that CTRL-C interrupts
+// our wait immediately, instead of after the next MIDI byte.
+//
+// The bytes are turned into messages by our MIDI parser (in
+// ../../common), which resolves running status, and copes with
+// realtime bytes arriving in the middle of other messages.
+//
+// If you specify the -t option, each message is also printed
+// with its arrival time, and when you quit, we print histograms
+// of the time between messages, and how much that time varies
+// from one message to the next (ie, jitter). Where the driver
+// supports it, we ask it to timestamp the bytes as they arrive
+// (SND_RAWMIDI_READ_TSTAMP). Otherwise, we read the clock as soon
+// as poll() wakes us, and use that time for the whole batch:
+// ./rawmidiinput -t 1,0
+//
+// For round-the-clock monitoring, printing hex is a waste. The
+// -l option instead appends the timestamped bytes to a binary
+// log (see ../../common/midilog.h), which is a series of
+// memory-mapped segment files named <base>.NNNNNN.mlog. Each
+// batch costs a memcpy(). An optional second number is how many
+// segments to keep (older ones are deleted), so the log never
+// outgrows the disk. Use midireplay to play back part of a log:
+// ./rawmidiinput -l /var/log/midi/rig1 100 1,0
+//
+// The -u option opens a MIDI 2.0 endpoint (with ALSA 1.2.10 and up),
+// which sends 32-bit Universal MIDI Packets instead of bytes. Then we
+// print each packet's words. A packet's first word says how many words
+// it has, so there's no running status to resolve (see
+// ../../common/ump.h):
+// ./rawmidiinput -u 1,0
+//
+// Printing must never hold up reading the input, else the driver's
+// buffer overflows and we lose bytes. So the main thread only reads
+// and parses (and counts the messages, and times them if -t). It puts
+// each message in a ring that it broadcasts from (see
+// ../../common/midicast.h), and the display has its own thread, which
+// takes the messages out at its own pace. If the display falls behind
+// (ie, a terminal that scrolls slowly), it skips ahead, and we tell
+// you how many messages it missed. The reading never waits for it.
+//
+// The log, on the other hand, must have every byte, just as it
+// arrived. So the main thread writes each run of bytes to the log
+// itself, before it parses them. That's only a memcpy(). The -s
+// option shows the messages even while logging:
+// ./rawmidiinput -s -l /var/log/midi/rig1 1,0
+//
 // Compile as:
-// gcc -o rawmidiinput rawmidiinput.c -lasound
+// gcc -o rawmidiinput rawmidiinput.c ../../common/midiparse.c ../../common/ump.c ../../common/mididev.c ../../common/devalloc.c ../../common/timing.c ../../common/midilog.c -lasound -lpthread -lm
 
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <string.h>
 #include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 #include <alsa/asoundlib.h>
+#include "../../common/midiparse.h"
+#include "../../common/midicast.h"
+#include "../../common/mididev.h"
+#include "../../common/ump.h"
+#include "../../common/timing.h"
+#include "../../common/midilog.h"
 
 
 
 // Set to 1 if user wants to abort
 int StopFlag = 0;
 
+// How many bytes we read from the driver at a time. A SysEx dump or
+// a dense controller stream can deliver a lot of bytes between wakeups
+#define INPUTBUFSIZE	8192
+
+// How big we ask the driver to make its own input buffer
+#define DRIVERBUFSIZE	16384
+
+// How many MIDIEVENTs we parse at a time
+#define MAXEVENTS		1024
+
+// Counts of what our reader has done, which we print when done
+unsigned long PollCount, ReadCount, ByteCount, MessageCount;
+
+// Our MIDI parser. Its state carries over from one batch to the next
+MIDIPARSER Parser;
+
+// Set to 1 if the input is a UMP endpoint (-u), and its parser
+unsigned char UmpMode = 0;
+UMPPARSER UmpParser;
+
+// The reader publishes each message in a broadcast ring, for the
+// consumer threads. A record is 64 bytes with the ring's sequence
+// number, so each is one cache line. A longer SysEx slice takes
+// several records
+#define CASTBYTES		44
+#define CASTSIZE		4096
+typedef struct _CASTRECORD
+{
+	unsigned long long	Time;			// When it arrived, in nanoseconds
+	unsigned short			Length;		// How many bytes
+	unsigned char			Type;			// MIDI_TYPE_xxx, or RECORD_UMP
+	unsigned char			Flags;		// MIDI_SYSEX_xxx
+	unsigned char			Bytes[CASTBYTES];
+} CASTRECORD;
+#define RECORD_UMP		0x80			// A UMP packet's words
+MIDICAST Cast;
+
+// The display thread's place in the ring
+MIDICAST_READER DisplayReader;
+
+// How often (in nanoseconds) the display checks for new messages
+#define POLLINTERVAL		1000000
+
+// Set to 1 when the reader is done, so the display finishes up
+int ReadDone = 0;
+
+// An eventfd that the reader's poll() also watches, so that we can
+// wake it up to stop, from any thread
+int WakeFd = -1;
+
+// How we're timestamping the input
+#define TSTAMP_NONE		0	// Not timestamping
+#define TSTAMP_BATCH		1	// We read the clock when poll() wakes us
+#define TSTAMP_DRIVER	2	// The driver timestamps the bytes as they arrive
+unsigned char TimestampMode = TSTAMP_NONE;
+
+// Set to 1 if the user wants timestamps printed (-t)
+unsigned char ShowTimes = 0;
+
+// The log we write the input to, if -l
+MIDILOG Log;
+unsigned char Logging = 0;
+
+// Set to 1 if we print the messages (ie, not -l, unless -s too)
+unsigned char Showing = 0;
+
+// With TSTAMP_DRIVER, each snd_rawmidi_tread() gives us some bytes that all
+// arrived at the same time. We remember where each such run starts in our
+// buffer, and its timestamp
+#define MAXRUNS			512
+unsigned int RunCount;
+unsigned int RunLength[MAXRUNS];
+unsigned long long RunTime[MAXRUNS];
+
+// For the -t histograms, kept by the reader. The time of the previous message,
+// and the time between the previous two
+unsigned long long LastTime, LastInterval;
+TIMEHIST InterArrival, Jitter;
+
+// The time of the first message the display printed
+unsigned long long FirstTime;
+
+
+
+
+
+
+/****************** wake_reader() *********************
+ * Wakes the reader from its poll(), so it sees "StopFlag".
+ * Safe to call from a signal handler.
+ */
+
+static void wake_reader(void)
+{
+	static const unsigned long long	one = 1;
+
+	if (WakeFd >= 0) write(WakeFd, &one, sizeof(one));
+}
 
 
 
@@ -36,8 +197,10 @@ int StopFlag = 0;
 
 void sighandler(int dummy)
 {
-	// Let main() know that user wants to break out of the loop
+	// Let main() know that user wants to break out of the loop. This signal
+	// may have gone to the display thread, so wake the reader's poll() too
 	StopFlag = 1;
+	wake_reader();
 }
 
 
@@ -139,14 +302,434 @@ out:
 
 
 
+/****************** count_message() *********************
+ * Reader: Counts a message we've parsed, and if -t,
+ * collects the time between it and the previous one, and
+ * how much that differs from the time between the previous
+ * two.
+ */
+
+static void count_message(unsigned long long time)
+{
+	++MessageCount;
+
+	if (ShowTimes)
+	{
+		if (LastTime)
+		{
+			register unsigned long long	interval;
+
+			interval = time - LastTime;
+			time_hist_add(&InterArrival, interval);
+			if (MessageCount > 2)
+				time_hist_add(&Jitter, interval > LastInterval ? interval - LastInterval : LastInterval - interval);
+			LastInterval = interval;
+		}
+		LastTime = time;
+	}
+}
+
+
+
+
+
+/****************** publish() *********************
+ * Reader: Puts one message (or a piece of a SysEx slice, or
+ * a UMP packet) in the broadcast ring for the consumers.
+ */
+
+static void publish(const unsigned char *bytes, unsigned int len, unsigned long long time, unsigned char type, unsigned char flags)
+{
+	register CASTRECORD	*record;
+
+	record = (CASTRECORD *)midi_cast_write_ptr(&Cast);
+	record->Time = time;
+	record->Length = (unsigned short)len;
+	record->Type = type;
+	record->Flags = flags;
+	memcpy(&record->Bytes[0], bytes, len);
+	midi_cast_commit(&Cast);
+}
+
+
+
+
+
+/****************** publish_midi() *********************
+ * Reader: Parses the bytes read from the MIDI input, and
+ * publishes each message to the consumers.
+ *
+ * buffer =		The bytes read from the MIDI input.
+ * len =			How many bytes are in the buffer.
+ * time =		When they arrived, in nanoseconds.
+ *
+ * NOTE: The parser's state is kept in the global "Parser",
+ * since a message may be split across two reads.
+ */
+
+static void publish_midi(const unsigned char *buffer, unsigned int len, unsigned long long time)
+{
+	MIDIEVENT					events[MAXEVENTS];
+	register unsigned int	i, count;
+	unsigned int				used;
+
+	while (len)
+	{
+		count = midi_parse(&Parser, buffer, len, time, &events[0], MAXEVENTS, &used);
+		buffer += used;
+		len -= used;
+
+		for (i = 0; i < count; i++)
+		{
+			register const MIDIEVENT		*event;
+			register const unsigned char	*bytes;
+			register unsigned int			left, piece;
+
+			event = &events[i];
+			if (event->Type != MIDI_TYPE_SYSEX)
+			{
+				count_message(event->Time);
+				publish(&event->Status, event->Length, event->Time, event->Type, 0);
+				continue;
+			}
+
+			// A SysEx counts once, when it ends
+			if (event->Flags & MIDI_SYSEX_END) count_message(event->Time);
+
+			// A SysEx slice points into our buffer, which we're about to reuse,
+			// so we copy its bytes into the records. A long slice takes several.
+			// Only the first gets the START flag, and only the last the END. The
+			// slice that ends an aborted SysEx may be empty (see midiparse.h), but
+			// it still gets a record, so the consumers see the SysEx end
+			bytes = event->SysEx;
+			left = event->Length;
+			do
+			{
+				piece = (left > CASTBYTES ? CASTBYTES : left);
+				publish(bytes, piece, event->Time, MIDI_TYPE_SYSEX,
+					(bytes == event->SysEx ? event->Flags & MIDI_SYSEX_START : 0) | (piece == left ? event->Flags & ~MIDI_SYSEX_START : 0));
+				bytes += piece;
+				left -= piece;
+			} while (left);
+		}
+	}
+}
+
+
+
+
+
+/****************** publish_ump() *********************
+ * Reader: Splits the bytes read from a UMP endpoint into
+ * packets, and publishes each to the consumers.
+ *
+ * NOTE: The parser's state is kept in the global
+ * "UmpParser", since a packet may be split across two
+ * reads.
+ */
+
+static void publish_ump(const unsigned char *buffer, unsigned int len, unsigned long long time)
+{
+	UMPEVENT					events[MAXEVENTS];
+	register unsigned int	i, count;
+	unsigned int				used;
+
+	while (len)
+	{
+		count = ump_parse(&UmpParser, buffer, len, time, &events[0], MAXEVENTS, &used);
+		buffer += used;
+		len -= used;
+
+		for (i = 0; i < count; i++)
+		{
+			count_message(events[i].Time);
+			publish((const unsigned char *)&events[i].Words[0], events[i].Length * 4, events[i].Time, RECORD_UMP, 0);
+		}
+	}
+}
+
+
+
+
+
+/****************** format_record() *********************
+ * Display thread: Formats a message as hex, in "text".
+ *
+ * RETURNS: Where the text ends.
+ */
+
+static char * format_record(register char *ptr, register const CASTRECORD *record)
+{
+	register unsigned int	j;
+
+	// Start each message with its arrival time (in seconds since the first
+	// message) if -t. A SysEx gets the time of its first slice
+	if (ShowTimes && (record->Type != MIDI_TYPE_SYSEX || (record->Flags & MIDI_SYSEX_START)))
+	{
+		if (!FirstTime) FirstTime = record->Time;
+		ptr += sprintf(ptr, "%11.6f: ", (double)(record->Time - FirstTime) / 1000000000.0);
+	}
+
+	// A UMP packet is printed as words
+	if (record->Type == RECORD_UMP)
+	{
+		for (j = 0; j < record->Length; j += 4) ptr += sprintf(ptr, "%08x ", *(const unsigned int *)&record->Bytes[j]);
+	}
+	else for (j = 0; j < record->Length; j++)
+	{
+		*ptr++ = "0123456789abcdef"[record->Bytes[j] >> 4];
+		*ptr++ = "0123456789abcdef"[record->Bytes[j] & 0x0F];
+		*ptr++ = ' ';
+	}
+
+	// Put each message on its own line. A SysEx may arrive in several
+	// slices, so we end its line only after the last one
+	if (record->Type != MIDI_TYPE_SYSEX || (record->Flags & MIDI_SYSEX_END)) *ptr++ = '\n';
+
+	return(ptr);
+}
+
+
+
+
+
+/****************** display_thread() *********************
+ * Prints the messages that the reader publishes. Printing
+ * to a terminal can be slow. If we fall too far behind, we
+ * skip ahead (and say how many we missed). The reader
+ * never waits for us.
+ */
+
+static void * display_thread(void *arg)
+{
+	register MIDICAST_READER	*reader;
+	CASTRECORD						record;
+	register char					*ptr;
+	register int					done;
+	struct timespec				interval;
+	static char						text[65536];
+
+	reader = &DisplayReader;
+	interval.tv_sec = 0;
+	interval.tv_nsec = POLLINTERVAL;
+
+	do
+	{
+		register unsigned long	skipped;
+
+		// Did the reader finish before we looked? Then get what's left
+		done = __atomic_load_n(&ReadDone, __ATOMIC_ACQUIRE);
+
+		// Rather than call printf() per message, format as many as fit in
+		// text[], and write them with one call. A record takes at most 3
+		// chars a byte, plus a newline, and 13 for a timestamp
+		skipped = reader->Skipped;
+		ptr = &text[0];
+		while (ptr < &text[sizeof(text) - (CASTBYTES * 3 + 16)] && midi_cast_read(&Cast, reader, &record))
+			ptr = format_record(ptr, &record);
+		if (reader->Skipped != skipped) printf("\n... skipped %lu messages (the display fell behind) ...\n", reader->Skipped - skipped);
+		if (ptr > &text[0])
+		{
+			fwrite(&text[0], 1, ptr - &text[0], stdout);
+			fflush(stdout);
+		}
+
+		// Nothing new. Check again in a moment
+		else if (!done)
+			nanosleep(&interval, 0);
+	} while (!done || midi_cast_lag(&Cast, reader));
+
+	return(0);
+}
+
+
+
+
+
+/****************** set_input_params() *********************
+ * Enlarges the driver's input buffer, so that it can hold
+ * everything that arrives while we're busy processing the
+ * previous batch.
+ *
+ * midiIn =		The open MIDI input. If we're timestamping, it
+ *					was opened with MIDIDEV_TSTAMP, which asks the
+ *					driver to timestamp the bytes (with the monotonic
+ *					clock) as they arrive. If the driver (or ALSA
+ *					library) can't do that, we fall back to
+ *					timestamping each batch ourselves.
+ *
+ * NOTE: Updates the global "TimestampMode".
+ */
+
+static void set_input_params(MIDIDEV *midiIn)
+{
+	snd_rawmidi_params_t	*params;
+	register int			err;
+
+	// A loopback has no driver buffer to enlarge
+	if (!midiIn->Handle)
+		;
+	else if ((err = snd_rawmidi_params_malloc(&params)) < 0)
+		printf("Can't get a snd_rawmidi_params_t: %s\n", snd_strerror(err));
+	else
+	{
+		// Fill in our snd_rawmidi_params_t with this MIDI input's current parameters,
+		// change the buffer size, and give it back to the driver
+		if ((err = snd_rawmidi_params_current(midiIn->Handle, params)) < 0 ||
+			(err = snd_rawmidi_params_set_buffer_size(midiIn->Handle, params, DRIVERBUFSIZE)) < 0 ||
+			(err = snd_rawmidi_params(midiIn->Handle, params)) < 0)
+		{
+			printf("Can't set MIDI input buffer size: %s\n", snd_strerror(err));
+		}
+
+		snd_rawmidi_params_free(params);
+	}
+
+	// Timestamped reads were added in ALSA 1.2.6 (and Linux 5.14). In this mode,
+	// the driver stores a timestamp with each small group of bytes it receives
+	if (TimestampMode && midiIn->Timestamps) TimestampMode = TSTAMP_DRIVER;
+
+	if (TimestampMode) printf("Timestamping %s\n", TimestampMode == TSTAMP_DRIVER ? "by the driver" : "each batch");
+}
+
+
+
+
+
+/****************** read_midi() *********************
+ * Waits for MIDI bytes to arrive, and then reads all the
+ * bytes that the driver has into the passed buffer.
+ *
+ * midiIn =		The (non-blocking) MIDI input.
+ * pfds =			Its poll descriptors, followed by one for
+ *						"WakeFd".
+ * npfds =			How many poll descriptors (not counting
+ *						WakeFd's).
+ * buffer =			Where to put the bytes.
+ *
+ * RETURNS: How many bytes were read (0 if the wait was
+ * interrupted, for example by CTRL-C or wake_reader()), or
+ * a negative error number.
+ *
+ * NOTE: The bytes are divided into runs that arrived at
+ * the same time. Sets the globals "RunCount", "RunLength",
+ * and "RunTime".
+ */
+
+static int read_midi(MIDIDEV *midiIn, struct pollfd *pfds, unsigned int npfds, unsigned char *buffer)
+{
+	register int			err, len;
+	register unsigned int	i, revents;
+	unsigned long long		now;
+
+	// Sleep until the driver has some bytes for us. A signal (ie, CTRL-C),
+	// or wake_reader(), wakes us up too
+	++PollCount;
+	if ((err = poll(pfds, npfds + 1, -1)) < 0) return(errno == EINTR ? 0 : -errno);
+	if (pfds[npfds].revents) return(0);
+
+	// If the driver isn't timestamping, the best we can do is the time we woke
+	now = (TimestampMode == TSTAMP_BATCH ? get_time_ns() : 0);
+
+	revents = 0;
+	for (i = 0; i < npfds; i++) revents |= pfds[i].revents;
+	if (revents & (POLLERR | POLLHUP)) return(-EIO);
+	if (!(revents & POLLIN)) return(0);
+
+	// Grab everything that's available (up to the size of our buffer).
+	// Since we're non-blocking, the driver returns -EAGAIN once it has
+	// given us all it has
+	len = 0;
+	RunCount = 0;
+	do
+	{
+		++ReadCount;
+
+		// With TSTAMP_DRIVER, each read returns only bytes with the same
+		// timestamp, and sets "now" to it
+		err = midi_dev_read(midiIn, buffer + len, INPUTBUFSIZE - len, &now);
+
+		if (err < 0)
+		{
+			if (err == -EAGAIN) break;
+			return(err);
+		}
+
+		if (err)
+		{
+			// Same time as the previous run? Then just add these bytes to it
+			if (RunCount && RunTime[RunCount - 1] == now)
+				RunLength[RunCount - 1] += err;
+			else
+			{
+				RunLength[RunCount] = err;
+				RunTime[RunCount++] = now;
+			}
+		}
+
+		len += err;
+	} while (err && len < INPUTBUFSIZE && RunCount < MAXRUNS);
+
+	ByteCount += len;
+	return(len);
+}
+
+
+
+
+
 int main(int argc, char** argv)
 {
 	register int		err;
-	snd_rawmidi_t		*midiInHandle;
+	MIDIDEV				midiIn;
+#if SND_LIB_VERSION >= 0x01020a
+	snd_ump_t			*umpHandle;
+#endif
 
 	{
 	char					cardName[64];
 
+	// Did user ask for timestamps, or a log?
+	while (argc > 1 && argv[1][0] == '-')
+	{
+		if (!strcmp(argv[1], "-t"))
+			ShowTimes = 1;
+		else if (!strcmp(argv[1], "-u"))
+			UmpMode = 1;
+		else if (!strcmp(argv[1], "-s"))
+			Showing = 1;
+		else if (!strcmp(argv[1], "-l") && argc > 2)
+		{
+			register unsigned int	keep;
+
+			// How many segments to keep?
+			keep = 0;
+			if (argc > 3 && isdigit(argv[3][0]) && !strchr(argv[3], ','))
+				keep = (unsigned int)atoi(argv[3]);
+
+			if ((err = midi_log_open(&Log, argv[2], 0, keep)) < 0)
+			{
+				printf("Can't create log %s: %s\n", argv[2], strerror(-err));
+				return 1;
+			}
+			Logging = 1;
+			argc -= (keep ? 2 : 1);
+			argv += (keep ? 2 : 1);
+		}
+		else
+		{
+			printf("Usage: rawmidiinput [-t] [-u] [-l logname [segments] [-s]] [card,device]\n");
+			return 1;
+		}
+
+		TimestampMode = TSTAMP_BATCH;
+		--argc;
+		++argv;
+	}
+
+	// Without a log, we print the messages
+	if (!Logging) Showing = 1;
+
 	// Did user supply a MIDI Input? If not, we need to find one	
 	if (argc < 2)
 	{
@@ -158,17 +741,35 @@ int main(int argc, char** argv)
 		}
 	}
 
-	// Use the one he supplied
+	// Use the one he supplied. Any name that ../../common/mididev.h takes
+	// (ie, free:1) is passed as is
 	else
-		sprintf(&cardName[0], "hw:%s", argv[1]);
+		snprintf(&cardName[0], sizeof(cardName), "%s%s", strchr(argv[1], ':') ? "" : "hw:", argv[1]);
 
-	// Open input MIDI device
-	if ((err = snd_rawmidi_open(&midiInHandle, 0, &cardName[0], 0)) < 0)
+	// Open input MIDI device. We open it in non-blocking mode so
+	// that we can drain all available bytes without waiting for more
+	if (UmpMode)
+	{
+#if SND_LIB_VERSION >= 0x01020a
+		// A UMP endpoint is a rawmidi device underneath, so once it's open,
+		// we read it like any other
+		if ((err = snd_ump_open(&umpHandle, 0, &cardName[0], SND_RAWMIDI_NONBLOCK)) >= 0)
+			midi_dev_attach(&midiIn, snd_ump_rawmidi(umpHandle), TimestampMode ? MIDIDEV_INPUT|MIDIDEV_TSTAMP : MIDIDEV_INPUT);
+#else
+		// UMP came with ALSA 1.2.10
+		err = -ENOTSUP;
+#endif
+	}
+	else
+		err = midi_dev_open(&midiIn, &cardName[0], TimestampMode ? MIDIDEV_INPUT|MIDIDEV_NONBLOCK|MIDIDEV_TSTAMP : MIDIDEV_INPUT|MIDIDEV_NONBLOCK);
+	if (err < 0)
 	{
 		printf("Can't open MIDI Input %s: %s\n", &cardName[0], snd_strerror(err));
 		return 1;
 	}
 
+	set_input_params(&midiIn);
+
 	// Trap when user presses CTRL-C
 	signal(SIGINT, sighandler);
 
@@ -176,75 +777,117 @@ int main(int argc, char** argv)
 	}
 
 	{
-	register unsigned char	runningStatus, dataBytesSoFar;
-	unsigned char				inputByte;
-	
-	dataBytesSoFar = StopFlag = 0;
-	runningStatus = 0xF0;
-
-	for (;;)
+	struct pollfd		*pfds;
+	unsigned char		buffer[INPUTBUFSIZE];
+	pthread_t			thread;
+	register int		npfds;
+	unsigned char		started;
+
+	// Get the descriptors that poll() must watch in order to know when
+	// bytes arrive at this MIDI input. Then add our eventfd, so another
+	// thread can wake us
+	if ((WakeFd = eventfd(0, EFD_NONBLOCK)) < 0)
 	{
-		// Read the next incoming MIDI byte. NOTE: Since we didn't specify
-		// the NONBLOCK flag to snd_rawmidi_open, this call will block until
-		// a byte arrives at MIDI in (or there's an error, or user aborts)
-		if (snd_rawmidi_read(midiInHandle, &inputByte, 1) != 1) break;
-
-		if (StopFlag) break;
-
-		// Resolve running status ourselves. Is this a status byte?
-		if (inputByte >= 0x80)
+		printf("Can't create an eventfd: %s\n", strerror(errno));
+		goto close;
+	}
+	npfds = midi_dev_poll_descriptors_count(&midiIn);
+	pfds = (struct pollfd *)alloca((npfds + 1) * sizeof(struct pollfd));
+	midi_dev_poll_descriptors(&midiIn, pfds, npfds);
+	pfds[npfds].fd = WakeFd;
+	pfds[npfds].events = POLLIN;
+	pfds[npfds].revents = 0;
+
+	midi_parse_init(&Parser);
+	ump_parse_init(&UmpParser);
+	time_hist_init(&InterArrival);
+	time_hist_init(&Jitter);
+
+	// Start the display. It gets its own place in the ring before it
+	// starts, so it sees every message from the first
+	if ((err = midi_cast_init(&Cast, sizeof(CASTRECORD), CASTSIZE)) < 0)
+	{
+		printf("Can't allocate the broadcast ring: %s\n", strerror(-err));
+		goto close;
+	}
+	midi_cast_reader_init(&Cast, &DisplayReader);
+	started = 0;
+	if (Showing)
+	{
+		if ((err = pthread_create(&thread, 0, display_thread, 0)))
 		{
-			// Save the new running status (minus any channel)
-			runningStatus = inputByte & 0xF0;
-
-			// Start a new line since this is obviously a new message. We're
-			// going to put each MIDI message on its own line. The exception
-			// will be with SysEx messages, which we'll arbitrarily limit to 40 bytes
-			// per line
-			if (dataBytesSoFar > 1) printf("\n");
-
-			// No data bytes yet received for this message
-			dataBytesSoFar = 1;
+			printf("Can't start the display thread: %s\n", strerror(err));
+			StopFlag = 1;
 		}
+		else
+			started = 1;
+	}
 
-		// Display the byte
-		printf("%02x ", inputByte);
-
-		{
-		register unsigned char	count;
-		
-		// Figure out how many bytes this message should have (so we
-		// can display each message on its own line)
-		switch (runningStatus)
+	while (!StopFlag)
+	{
+		if ((err = read_midi(&midiIn, pfds, npfds, &buffer[0])) < 0)
 		{
-			case 0xC0:
-			case 0xD0:
-				count = 2;
-				break;
-
-			case 0xF0:
-				count = 41;
-				break;
-					
-			default:
-				count = 3;
+			printf("Can't read MIDI input: %s\n", snd_strerror(err));
+			break;
 		}
 
-		// The end of the message?
-		if (dataBytesSoFar++ >= count)
+		// Process the whole batch at once (or at least, each run of bytes with
+		// the same timestamp)
+		if (err)
 		{
-			printf("\n");
-			
-			// Assume next message will be running status, and therefore the
-			// status byte is implicit (ie, won't be received again)
-			dataBytesSoFar = 1;
-		}
+			register unsigned int	i, pos;
+
+			pos = 0;
+			for (i = 0; i < RunCount; i++)
+			{
+				// Log the raw bytes, just as they arrived
+				if (Logging && (err = midi_log_write(&Log, RunTime[i], 0, &buffer[pos], RunLength[i])) < 0)
+				{
+					printf("Can't write log: %s\n", strerror(-err));
+					StopFlag = 1;
+					break;
+				}
+
+				// Hand the messages to the display. We never wait for it
+				if (UmpMode)
+					publish_ump(&buffer[pos], RunLength[i], RunTime[i]);
+				else
+					publish_midi(&buffer[pos], RunLength[i], RunTime[i]);
+				pos += RunLength[i];
+			}
 		}
 	}
+
+	// Let the display finish what's in the ring
+	__atomic_store_n(&ReadDone, 1, __ATOMIC_RELEASE);
+	if (started) pthread_join(thread, 0);
 	}
 
+	printf("\n%lu bytes, %lu messages, %lu polls, %lu reads (%.1f bytes per read)\n",
+		ByteCount, MessageCount, PollCount, ReadCount, ReadCount ? (double)ByteCount / ReadCount : 0.0);
+
+	if (Logging) midi_log_close(&Log);
+
+	if (DisplayReader.Skipped)
+		printf("The display skipped %lu messages, because it fell behind\n", DisplayReader.Skipped);
+
+	if (ShowTimes)
+	{
+		time_hist_print(&InterArrival, "Time between messages");
+		time_hist_print(&Jitter, "Jitter (change in time between messages)");
+	}
+
+close:
+	midi_cast_free(&Cast);
+	if (WakeFd >= 0) close(WakeFd);
+
 	// Close the MIDI Input
-	snd_rawmidi_close(midiInHandle);
+#if SND_LIB_VERSION >= 0x01020a
+	if (UmpMode)
+		snd_ump_close(umpHandle);
+	else
+#endif
+		midi_dev_close(&midiIn);
 
 	return 0;
 }
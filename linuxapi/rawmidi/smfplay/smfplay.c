@@ -0,0 +1,426 @@
+// Plays a Standard MIDI File (format 0 or 1) through the raw
+// MIDI Output that is specified on the command line (ie, 0,0 to
+// play through the first card's first MIDI output). If no output
+// is specified, then it plays through the first MIDI output it
+// finds.
+//
+// The whole file is loaded first (see ../../common/smf.c), which
+// merges all the tracks into one array of events, each with its
+// time in nanoseconds. Then we feed the events, a little ahead of
+// time, to our MIDI scheduler (../../common/midisched.c), whose
+// real-time thread sends each at its time.
+//
+// To start part way into the song, use -s with the number of
+// seconds in. We find the starting event with a binary search,
+// and first send the latest program change, pitch wheel, and
+// controller values on each channel up to that point, so the
+// instruments sound as they should:
+// ./smfplay -s 30 song.mid 1,0
+//
+// Other options:
+// -n			Send note-offs as note-ons with 0 velocity, so that
+//				notes share one running status.
+// -l count	Just load the file this many times, and print how long
+//				it takes. No MIDI output is needed.
+//
+// Compile as:
+// gcc -o smfplay smfplay.c ../../common/smf.c ../../common/midisched.c ../../common/mididev.c ../../common/devalloc.c ../../common/midienc.c ../../common/timing.c -lasound -lpthread -lm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <signal.h>
+#include <time.h>
+#include <alsa/asoundlib.h>
+#include "../../common/smf.h"
+#include "../../common/midisched.h"
+#include "../../common/timing.h"
+
+
+
+// How far ahead of time we queue events with the scheduler, and how
+// often we wake to queue more
+#define LOOKAHEAD		500000000ULL
+#define FEEDINTERVAL	100000000L
+
+// Set to 1 if user wants to abort
+int StopFlag = 0;
+
+// The song
+SMF Smf;
+
+// Controller values we've seen while chasing (0xFF if none)
+unsigned char Controllers[16][120];
+
+
+
+
+
+
+/****************** sighandler() *********************
+ * Called by the operating system when the user presses
+ * CTRL-C to abort this app.
+ */
+
+void sighandler(int dummy)
+{
+	// Let main() know that user wants to break out of the loop
+	StopFlag = 1;
+}
+
+
+
+
+
+/****************** find_midi_out() *********************
+ * Finds the first MIDI output in the system, and copies
+ * its name (for snd_rawmidi_open) to the specified
+ * buffer. If no MIDI output is found, zeroes out the
+ * buffer.
+ */
+
+void find_midi_out(char *cardName)
+{
+	register int			err;
+	int						cardNum;
+	snd_rawmidi_info_t	*rawMidiInfo;
+
+	// Assume no output found
+	cardName[0] = 0;
+
+	// Start with first card
+	cardNum = -1;
+
+	// To get some info about the subdevices of a MIDI device, we need a
+	// snd_rawmidi_info_t, so let's allocate one on the stack
+	snd_rawmidi_info_alloca(&rawMidiInfo);
+	memset(rawMidiInfo, 0, snd_rawmidi_info_sizeof());
+
+	do
+	{
+		// Get next sound card's card number. When "cardNum" == -1, then ALSA
+		// fetches the first card
+		if ((err = snd_card_next(&cardNum)) < 0) break;
+
+		// Another card? ALSA sets "cardNum" to -1 if no more
+		if (cardNum != -1)
+		{
+			snd_ctl_t			*midiHandle;
+
+			// Open this card. We specify only the card number -- not any device nor sub-device too
+			sprintf(cardName, "hw:%i", cardNum);
+			if ((err = snd_ctl_open(&midiHandle, cardName, 0)) >= 0)
+			{
+				int				devNum;
+
+				// Start with the first device on this card, and look for a MIDI output
+				devNum = -1;
+				for (;;)
+				{
+					// Get the number of the next MIDI device on this card
+					if ((err = snd_ctl_rawmidi_next_device(midiHandle, &devNum)) < 0 || devNum < 0) break;
+
+					// Get info on the MIDI out portion of this device's first subdevice
+					snd_rawmidi_info_set_device(rawMidiInfo, devNum);
+					snd_rawmidi_info_set_stream(rawMidiInfo, SND_RAWMIDI_STREAM_OUTPUT);
+					snd_rawmidi_info_set_subdevice(rawMidiInfo, 0);
+					if ((err = snd_ctl_rawmidi_info(midiHandle, rawMidiInfo)) >= 0 && snd_rawmidi_info_get_subdevices_count(rawMidiInfo))
+					{
+						// We found a MIDI Output device. Format its name in the caller's buffer
+						sprintf(cardName, "hw:%i,%i", cardNum, devNum);
+
+						// All done
+						cardNum = -1;
+
+						break;
+					}
+				}
+
+				// Close the card after we're done enumerating its subdevices
+				snd_ctl_close(midiHandle);
+			}
+		}
+
+		// Another card?
+	} while (cardNum != -1);
+
+	// ALSA allocates some mem to load its config file when we call some of the
+	// above functions. Now that we're done getting the info, let's tell ALSA
+	// to unload the info and free up that mem
+	snd_config_update_free_global();
+}
+
+
+
+
+
+/****************** chase() *********************
+ * Queues the latest program change, pitch wheel, and
+ * controller values on each channel, as of the specified
+ * event. We do this when starting part way into the song.
+ *
+ * end =		The first event we'll play.
+ * when =	When to send them.
+ */
+
+static void chase(MIDISCHED *sched, unsigned int end, unsigned long long when)
+{
+	unsigned char				programs[16], bends[16][2];
+	unsigned char				buffer[3];
+	register unsigned int	i, j;
+
+	memset(&programs[0], 0x80, sizeof(programs));
+	memset(&bends[0][0], 0x80, sizeof(bends));
+	memset(&Controllers[0][0], 0xFF, sizeof(Controllers));
+
+	for (i = 0; i < end; i++)
+	{
+		register const SMF_EVENT	*event;
+
+		event = &Smf.Events[i];
+		if (event->Length > 3) continue;
+		j = event->Msg[0] & 0x0F;
+		switch (event->Msg[0] & 0xF0)
+		{
+			// We skip the channel mode messages (120 and up), such as all notes off
+			case 0xB0:
+				if (event->Msg[1] < 120) Controllers[j][event->Msg[1]] = event->Msg[2];
+				break;
+			case 0xC0:
+				programs[j] = event->Msg[1];
+				break;
+			case 0xE0:
+				bends[j][0] = event->Msg[1];
+				bends[j][1] = event->Msg[2];
+		}
+	}
+
+	for (i = 0; i < 16; i++)
+	{
+		if (programs[i] < 0x80)
+		{
+			buffer[0] = 0xC0 | i;
+			buffer[1] = programs[i];
+			midi_sched_add(sched, when, &buffer[0], 2);
+		}
+
+		if (bends[i][1] < 0x80)
+		{
+			buffer[0] = 0xE0 | i;
+			buffer[1] = bends[i][0];
+			buffer[2] = bends[i][1];
+			midi_sched_add(sched, when, &buffer[0], 3);
+		}
+
+		buffer[0] = 0xB0 | i;
+		for (j = 0; j < 120; j++)
+		{
+			if (Controllers[i][j] < 0x80)
+			{
+				buffer[1] = j;
+				buffer[2] = Controllers[i][j];
+				midi_sched_add(sched, when, &buffer[0], 3);
+			}
+		}
+	}
+}
+
+
+
+
+
+/****************** queue_count() *********************
+ * Returns how many events are still in the scheduler's
+ * queue (or being written).
+ */
+
+static unsigned int queue_count(MIDISCHED *sched)
+{
+	register unsigned int	count;
+
+	pthread_mutex_lock(&sched->Lock);
+	count = sched->Count + sched->Busy;
+	pthread_mutex_unlock(&sched->Lock);
+
+	return(count);
+}
+
+
+
+
+
+int main(int argc, char **argv)
+{
+	register int			err;
+	register unsigned int	next;
+	MIDIDEV					midiOut;
+	MIDISCHED				sched;
+	unsigned long long	start, seek;
+	struct timespec		interval;
+	unsigned int			encFlags, loads;
+	char						cardName[64];
+
+	// Get the options
+	seek = 0;
+	loads = 0;
+	encFlags = MIDIENC_RUNNINGSTATUS;
+	while (argc > 1 && argv[1][0] == '-')
+	{
+		if (argv[1][1] == 'n')
+		{
+			encFlags |= MIDIENC_NOTEOFFASNOTEON;
+			--argc;
+			++argv;
+			continue;
+		}
+
+		if (argc < 3) goto usage;
+		if (argv[1][1] == 's')
+			seek = (unsigned long long)(atof(argv[2]) * 1000000000.0);
+		else if (argv[1][1] == 'l')
+			loads = (unsigned int)atoi(argv[2]);
+		else
+			goto usage;
+		argc -= 2;
+		argv += 2;
+	}
+
+	if (argc < 2)
+	{
+usage:
+		printf("Usage: smfplay [-s startsecs] [-n] [-l count] file.mid [card,device]\n");
+		return 1;
+	}
+
+	// Load the song, and time how long that takes
+	{
+	register unsigned long long	time, best;
+
+	best = ~0ULL;
+	next = 0;
+	do
+	{
+		if (next) smf_free(&Smf);
+		time = get_time_ns();
+		if ((err = smf_load(&Smf, argv[1])) < 0)
+		{
+			printf("Can't load %s: %s\n", argv[1], err == -EINVAL ? "Not a format 0 or 1 MIDI file" : strerror(-err));
+			smf_free(&Smf);
+			return 1;
+		}
+		time = get_time_ns() - time;
+		if (time < best) best = time;
+	} while (++next < loads);
+
+	printf("%s: format %u, %u tracks, %u events, %u tempo changes, %.3f secs long\n", argv[1], Smf.Format, Smf.Tracks,
+		Smf.EventCount, Smf.TempoCount, Smf.Duration / 1000000000.0);
+	printf("Loaded in %.3f msecs%s\n", best / 1000000.0, loads > 1 ? " (best of all loads)" : "");
+	}
+
+	if (loads) goto out2;
+
+	// Did user supply a MIDI Output? If not, we need to find one
+	if (argc < 3)
+	{
+		find_midi_out(&cardName[0]);
+		if (!cardName[0])
+		{
+			printf("Can't find a MIDI Output to play through!\n");
+			goto out2;
+		}
+	}
+
+	// Use the one he supplied
+	else
+		sprintf(&cardName[0], "hw:%s", argv[2]);
+
+	// Open output MIDI device
+	if ((err = midi_dev_open(&midiOut, &cardName[0], MIDIDEV_OUTPUT)) < 0)
+	{
+		printf("Can't open MIDI Output %s: %s\n", &cardName[0], snd_strerror(err));
+		goto out2;
+	}
+
+	if ((err = midi_sched_start(&sched, &midiOut, 0, 0, 50, encFlags)) < 0)
+	{
+		printf("Can't start the MIDI scheduler: %s\n", strerror(-err));
+		goto out;
+	}
+
+	// Trap when user presses CTRL-C
+	signal(SIGINT, sighandler);
+
+	printf("Playing on %s...\nPress CTRL-C to abort.\n", &cardName[0]);
+
+	// Find where to start, and set up the channels as they'd be at that point. We
+	// start playing a little in the future, so the scheduler isn't late with the
+	// first events. Each event plays at "start" plus its time
+	next = smf_seek(&Smf, seek);
+	start = get_time_ns() + 100000000ULL;
+	if (next) chase(&sched, next, start - 50000000ULL);
+	start -= seek;
+
+	// Queue the events a bit ahead of time. We don't queue the whole song at once,
+	// since the scheduler's queue needn't be that big, and CTRL-C would then have
+	// to wait for it to be thrown away
+	interval.tv_sec = 0;
+	interval.tv_nsec = FEEDINTERVAL;
+	while (next < Smf.EventCount && !StopFlag)
+	{
+		register unsigned long long	limit;
+
+		limit = get_time_ns() + LOOKAHEAD;
+		while (next < Smf.EventCount && start + Smf.Events[next].Time <= limit)
+		{
+			register const SMF_EVENT	*event;
+
+			event = &Smf.Events[next];
+
+			// The scheduler's queue is full? Wait for it to send some
+			if (event->Length <= 0xFFFF &&
+				midi_sched_add(&sched, start + event->Time, SMF_EVENT_BYTES(&Smf, event), event->Length) == -EAGAIN)
+			{
+				break;
+			}
+			++next;
+		}
+
+		nanosleep(&interval, 0);
+	}
+
+	// Wait for the rest to be sent
+	while (!StopFlag && queue_count(&sched)) nanosleep(&interval, 0);
+	midi_sched_stop(&sched);
+
+	if (sched.Error) printf("Error writing MIDI Output: %s\n", snd_strerror(sched.Error));
+
+	// If we stopped in the middle, some notes may still be on. Send an All Notes
+	// Off controller, and release the sustain pedal, on every MIDI channel
+	if (StopFlag)
+	{
+		unsigned char		buffer[6];
+		register unsigned int	i;
+
+		buffer[1] = 123;
+		buffer[2] = 0;
+		buffer[4] = 64;
+		buffer[5] = 0;
+		for (i = 0; i < 16; i++)
+		{
+			buffer[0] = buffer[3] = 0xB0 | i;
+			midi_dev_write(&midiOut, &buffer[0], 6);
+		}
+	}
+
+	printf("Sent %lu events in %lu writes (%lu status bytes saved)\n", sched.Events, sched.Writes, sched.Encoder.Saved);
+	time_hist_print(&sched.Late, "Send lateness");
+
+	// Wait for the driver to send everything
+	midi_dev_drain(&midiOut);
+out:
+	midi_dev_close(&midiOut);
+out2:
+	smf_free(&Smf);
+
+	return 0;
+}
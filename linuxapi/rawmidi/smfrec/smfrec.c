@@ -0,0 +1,889 @@
+// Records the MIDI input that is specified on the command line
+// (ie, 0,0 to record from the first card's first MIDI input) to a
+// Standard MIDI File (format 0). If no input is specified, then it
+// records from the first MIDI input it finds. Press CTRL-C to stop
+// recording:
+// ./smfrec song.mid 1,0
+//
+// A name with a colon is used as is, so it can be any name that
+// ../../common/mididev.h takes (ie, free:1).
+//
+// The work is split between two threads, so that writing to the
+// disk can never delay reading the MIDI input:
+//
+// The capture thread (at real-time priority if we're allowed)
+// sleeps in poll() until MIDI bytes arrive, timestamps them (or
+// asks the driver to), parses them into messages, and puts each
+// message in a lock-free ring that it broadcasts from
+// (../../common/midicast.h). It never waits for anyone reading
+// the ring.
+//
+// The writer thread reads the messages from the ring, converts
+// each one's time to ticks, and writes it (preceded by its delta
+// time) to the file, with running status. When we stop, we go
+// back and fill in the track's length in its chunk header. (We
+// also do that every few seconds, so that the file is usable
+// even if we're killed.)
+//
+// With -s, a monitor thread also reads every message from the
+// ring, and prints it (in hex), so you can see what's being
+// recorded. Each reader keeps its own place in the ring, so a
+// terminal that scrolls slowly doesn't hold up the writer (nor
+// the capture). If a reader falls so far behind that the capture
+// thread laps it, it skips ahead, and we say how many messages it
+// missed.
+//
+// A third thread (../../common/midistat.c) samples the driver's
+// status every 100 msecs: how full its input buffer is, and its
+// overrun count (ie, bytes lost because we didn't read them in
+// time). Once a second, we check that count, and how full the
+// ring is, and print a warning if anything was lost. With -m, those
+// numbers (and the byte rate) are also kept in shared memory, so
+// ../midistat (or any other program) can watch them while we
+// record.
+//
+// Options:
+// -d division	Ticks per quarter note (default 960).
+// -t bpm		The tempo to store in the file (default 120). This
+//					doesn't affect playback speed, only how the notes
+//					line up with the beats in a sequencer program.
+// -m name		Keep the numbers in shared memory /dev/shm/name.
+// -s				Show the messages as they're recorded.
+//
+// Realtime messages (ie, MIDI clock) aren't recorded. System
+// common messages are recorded as 0xF7 "escapes".
+//
+// Compile as:
+// gcc -o smfrec smfrec.c ../../common/midistat.c ../../common/midiparse.c ../../common/midienc.c ../../common/mididev.c ../../common/devalloc.c ../../common/timing.c -lasound -lpthread -lrt -lm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <alsa/asoundlib.h>
+#include "../../common/midiparse.h"
+#include "../../common/midicast.h"
+#include "../../common/midienc.h"
+#include "../../common/mididev.h"
+#include "../../common/midistat.h"
+#include "../../common/timing.h"
+
+
+
+// How many bytes we read from the driver at a time
+#define INPUTBUFSIZE		8192
+
+// How big we ask the driver to make its own input buffer
+#define DRIVERBUFSIZE	65536
+
+// How many MIDIEVENTs we parse at a time
+#define MAXEVENTS			1024
+
+// How many records the ring holds. With its sequence number, each record
+// takes a 64 byte slot, so that's 8 MB, which is over 2 minutes of MIDI
+// cable bandwidth
+#define RINGSIZE			131072
+
+// One message in the ring. A SysEx is split into as many records as
+// it needs
+typedef struct _RECORD
+{
+	unsigned long long	Time;			// When it arrived, in nanoseconds
+	unsigned short			Length;		// How many bytes in Data[]
+	unsigned char			Type;			// MIDI_TYPE_xxx
+	unsigned char			Flags;		// MIDI_SYSEX_xxx
+	unsigned char			Data[20];
+} RECORD;
+
+// Set to 1 if user wants to stop
+int StopFlag = 0;
+
+// Set to 1 to tell the threads to finish up
+volatile unsigned char CaptureDone = 0;
+
+MIDICAST Cast;
+
+// The writer's, and the monitor's, place in the ring
+MIDICAST_READER WriterReader, MonitorReader;
+
+// Set to 1 if the user wants the messages shown (-s)
+unsigned char Showing = 0;
+
+// Our options
+unsigned int Division = 960;
+unsigned int Tempo = 500000;
+
+// Kept by the capture thread
+unsigned long ByteCount;
+
+// The driver's status, and our byte count, sampled
+MIDISTAT Stat;
+MIDISTAT_PORT *StatPort;
+
+// Kept by the writer thread. RingHigh is the most records it was behind
+FILE *File;
+unsigned long MessageCount, Skipped, TrackLength, RingHigh;
+unsigned long long StartTime;
+unsigned int LastTick;
+MIDIENC Encoder;
+
+// The bytes of the SysEx that the writer is assembling. SysExOpen is 1
+// between its START and END slices
+unsigned char *SysEx;
+unsigned int SysExLen, SysExSize, SysExTick;
+unsigned char SysExOpen;
+
+
+
+
+
+
+/****************** sighandler() *********************
+ * Called by the operating system when the user presses
+ * CTRL-C to stop recording.
+ */
+
+void sighandler(int dummy)
+{
+	// Let main() know that user wants to break out of the loop
+	StopFlag = 1;
+}
+
+
+
+
+
+/****************** find_midi_in() *********************
+ * Finds the first MIDI input in the system, and copies
+ * its name (for snd_rawmidi_open) to the specified
+ * buffer. If no MIDI input is found, zeroes out the
+ * buffer.
+ */
+
+void find_midi_in(char *cardName)
+{
+	register int			err;
+	int						cardNum;
+	snd_rawmidi_info_t	*rawMidiInfo;
+
+	// Assume no input found
+	cardName[0] = 0;
+
+	// Start with first card
+	cardNum = -1;
+
+	// To get some info about the subdevices of a MIDI device, we need a
+	// snd_rawmidi_info_t, so let's allocate one on the stack
+	snd_rawmidi_info_alloca(&rawMidiInfo);
+	memset(rawMidiInfo, 0, snd_rawmidi_info_sizeof());
+
+	do
+	{
+		// Get next sound card's card number. When "cardNum" == -1, then ALSA
+		// fetches the first card
+		if ((err = snd_card_next(&cardNum)) < 0) break;
+
+		// Another card? ALSA sets "cardNum" to -1 if no more
+		if (cardNum != -1)
+		{
+			snd_ctl_t			*midiHandle;
+
+			// Open this card. We specify only the card number -- not any device nor sub-device too
+			sprintf(cardName, "hw:%i", cardNum);
+			if ((err = snd_ctl_open(&midiHandle, cardName, 0)) >= 0)
+			{
+				int				devNum;
+
+				// Start with the first device on this card, and look for a MIDI input
+				devNum = -1;
+				for (;;)
+				{
+					// Get the number of the next MIDI device on this card
+					if ((err = snd_ctl_rawmidi_next_device(midiHandle, &devNum)) < 0 || devNum < 0) break;
+
+					// Get info on the MIDI in portion of this device's first subdevice
+					snd_rawmidi_info_set_device(rawMidiInfo, devNum);
+					snd_rawmidi_info_set_stream(rawMidiInfo, SND_RAWMIDI_STREAM_INPUT);
+					snd_rawmidi_info_set_subdevice(rawMidiInfo, 0);
+					if ((err = snd_ctl_rawmidi_info(midiHandle, rawMidiInfo)) >= 0 && snd_rawmidi_info_get_subdevices_count(rawMidiInfo))
+					{
+						// We found a MIDI Input device. Format its name in the caller's buffer
+						sprintf(cardName, "hw:%i,%i", cardNum, devNum);
+
+						// All done
+						cardNum = -1;
+
+						break;
+					}
+				}
+
+				// Close the card after we're done enumerating its subdevices
+				snd_ctl_close(midiHandle);
+			}
+		}
+
+		// Another card?
+	} while (cardNum != -1);
+
+	// ALSA allocates some mem to load its config file when we call some of the
+	// above functions. Now that we're done getting the info, let's tell ALSA
+	// to unload the info and free up that mem
+	snd_config_update_free_global();
+}
+
+
+
+
+
+/****************** set_input_params() *********************
+ * Enlarges the driver's input buffer. (midi_dev_open() has
+ * already asked the driver to timestamp the bytes as they
+ * arrive, with the monotonic clock, if it can.)
+ */
+
+static void set_input_params(MIDIDEV *midiIn)
+{
+	snd_rawmidi_params_t	*params;
+	register int			err;
+
+	// A loopback has no driver buffer to enlarge
+	if (!midiIn->Handle)
+		;
+	else if ((err = snd_rawmidi_params_malloc(&params)) < 0)
+		printf("Can't get a snd_rawmidi_params_t: %s\n", snd_strerror(err));
+	else
+	{
+		if ((err = snd_rawmidi_params_current(midiIn->Handle, params)) < 0 ||
+			(err = snd_rawmidi_params_set_buffer_size(midiIn->Handle, params, DRIVERBUFSIZE)) < 0 ||
+			(err = snd_rawmidi_params(midiIn->Handle, params)) < 0)
+		{
+			printf("Can't set MIDI input buffer size: %s\n", snd_strerror(err));
+		}
+
+		snd_rawmidi_params_free(params);
+	}
+
+	printf("Timestamping %s\n", midiIn->Timestamps ? "by the driver" : "each batch");
+}
+
+
+
+
+
+/****************** queue_events() *********************
+ * Puts parsed MIDI messages into the ring, for the writer
+ * (and monitor) thread. Called by the capture thread.
+ */
+
+static void queue_events(const MIDIEVENT *event, unsigned int count)
+{
+	while (count--)
+	{
+		register const unsigned char	*bytes;
+		register unsigned int			len;
+		register unsigned char			flags;
+
+		bytes = (event->Type == MIDI_TYPE_SYSEX ? event->SysEx : &event->Status);
+		len = event->Length;
+		flags = event->Flags;
+
+		// A long SysEx slice takes several records. Only the first has the START
+		// flag, and only the last has the END flag
+		do
+		{
+			register RECORD			*record;
+			register unsigned int	chunk;
+
+			chunk = (len > sizeof(record->Data) ? sizeof(record->Data) : len);
+
+			// There's always room. If a reader has fallen a whole ring behind, it
+			// finds out it missed these
+			record = (RECORD *)midi_cast_write_ptr(&Cast);
+			record->Time = event->Time;
+			record->Type = event->Type;
+			record->Length = (unsigned short)chunk;
+			record->Flags = (chunk < len ? flags & MIDI_SYSEX_START : flags);
+			memcpy(&record->Data[0], bytes, chunk);
+			midi_cast_commit(&Cast);
+
+			flags &= ~MIDI_SYSEX_START;
+			bytes += chunk;
+			len -= chunk;
+		} while (len);
+
+		++event;
+	}
+}
+
+
+
+
+
+/****************** capture_thread() *********************
+ * Reads the MIDI input, and puts the messages in the ring.
+ */
+
+static void * capture_thread(void *arg)
+{
+	register MIDIDEV			*midiIn;
+	MIDIPARSER					parser;
+	MIDIEVENT					events[MAXEVENTS];
+	unsigned char				buffer[INPUTBUFSIZE];
+	struct pollfd				*pfds;
+	register int				npfds;
+
+	midiIn = (MIDIDEV *)arg;
+
+	npfds = midi_dev_poll_descriptors_count(midiIn);
+	pfds = (struct pollfd *)alloca(npfds * sizeof(struct pollfd));
+	midi_dev_poll_descriptors(midiIn, pfds, npfds);
+
+	midi_parse_init(&parser);
+
+	while (!StopFlag)
+	{
+		register int			len;
+		unsigned long long		now;
+
+		// Wake up at least every 100 msecs to check whether we should stop
+		if (poll(pfds, npfds, 100) <= 0) continue;
+		now = get_time_ns();
+
+		// Read everything that's available
+		for (;;)
+		{
+			register const unsigned char	*ptr;
+			unsigned int					used, count;
+
+			// If the driver timestamps the bytes, this gets their time
+			if ((len = midi_dev_read(midiIn, &buffer[0], sizeof(buffer), &now)) <= 0) break;
+			ByteCount += len;
+			midi_stat_count(StatPort, len);
+
+			ptr = &buffer[0];
+			while (len)
+			{
+				count = midi_parse(&parser, ptr, len, now, &events[0], MAXEVENTS, &used);
+				ptr += used;
+				len -= used;
+				queue_events(&events[0], count);
+			}
+		}
+	}
+
+	CaptureDone = 1;
+	return(0);
+}
+
+
+
+
+
+/****************** write_vlq() *********************
+ * Writes a variable length quantity to the file.
+ */
+
+static void write_vlq(unsigned int value)
+{
+	unsigned char				buffer[5];
+	register unsigned char	*ptr;
+
+	// Fill the buffer from the end. All bytes but the last have the high bit set
+	ptr = &buffer[4];
+	*ptr = value & 0x7F;
+	while ((value >>= 7)) *--ptr = (value & 0x7F) | 0x80;
+	fwrite(ptr, 1, &buffer[5] - ptr, File);
+	TrackLength += &buffer[5] - ptr;
+}
+
+
+
+
+
+/****************** write_delta() *********************
+ * Writes the delta time from the previous event to an
+ * event at the specified tick.
+ */
+
+static void write_delta(unsigned int tick)
+{
+	write_vlq(tick - LastTick);
+	LastTick = tick;
+}
+
+
+
+
+
+/****************** patch_length() *********************
+ * Writes everything we've buffered to the file, then fills
+ * in the track's length in its chunk header.
+ */
+
+static void patch_length(void)
+{
+	unsigned char	buffer[4];
+
+	fflush(File);
+	buffer[0] = (unsigned char)(TrackLength >> 24);
+	buffer[1] = (unsigned char)(TrackLength >> 16);
+	buffer[2] = (unsigned char)(TrackLength >> 8);
+	buffer[3] = (unsigned char)TrackLength;
+
+	// The length is after the header chunk (14 bytes) and "MTrk"
+	pwrite(fileno(File), &buffer[0], 4, 18);
+}
+
+
+
+
+
+/****************** write_record() *********************
+ * Writes one record from the ring to the file.
+ */
+
+static void write_record(const RECORD *record)
+{
+	register unsigned int	tick;
+
+	// Time starts at the first message. Convert nanoseconds to ticks. There
+	// are Division ticks per Tempo microseconds
+	if (!StartTime) StartTime = record->Time;
+	tick = (unsigned int)((record->Time - StartTime) * Division / (Tempo * 1000ULL));
+
+	switch (record->Type)
+	{
+		case MIDI_TYPE_CHANNEL:
+		{
+			unsigned char				buffer[3];
+			register unsigned int	len;
+
+			// Leave out the status if it's the same as the previous message's
+			write_delta(tick);
+			len = midi_enc_message(&Encoder, &buffer[0], &record->Data[0], record->Length);
+			fwrite(&buffer[0], 1, len, File);
+			TrackLength += len;
+			break;
+		}
+
+		// A SysEx arrives in pieces. Put them together, then write the whole thing
+		case MIDI_TYPE_SYSEX:
+		{
+			if (record->Flags & MIDI_SYSEX_START)
+			{
+				SysExLen = 0;
+				SysExTick = tick;
+				SysExOpen = 1;
+			}
+
+			// If we skipped its start, we can't put it back together
+			else if (!SysExOpen)
+				return;
+
+			if (SysExLen + record->Length + 1 > SysExSize)
+			{
+				register unsigned char	*mem;
+
+				SysExSize = (SysExLen + record->Length + 1) * 2;
+				if (!(mem = (unsigned char *)realloc(SysEx, SysExSize)))
+				{
+					++Skipped;
+					break;
+				}
+				SysEx = mem;
+			}
+			memcpy(SysEx + SysExLen, &record->Data[0], record->Length);
+			SysExLen += record->Length;
+
+			if (record->Flags & MIDI_SYSEX_END)
+			{
+				SysExOpen = 0;
+
+				// An aborted SysEx (some other status came before the 0xF7) gets one
+				if (SysEx[SysExLen - 1] != 0xF7) SysEx[SysExLen++] = 0xF7;
+
+				// In the file, the 0xF0 is followed by the length of the rest
+				write_delta(SysExTick);
+				fputc(0xF0, File);
+				++TrackLength;
+				write_vlq(SysExLen - 1);
+				fwrite(SysEx + 1, 1, SysExLen - 1, File);
+				TrackLength += SysExLen - 1;
+				midi_enc_reset(&Encoder);
+				++MessageCount;
+			}
+			return;
+		}
+
+		// A system common message can only be stored as an "escape"
+		case MIDI_TYPE_COMMON:
+		{
+			write_delta(tick);
+			fputc(0xF7, File);
+			++TrackLength;
+			write_vlq(record->Length);
+			fwrite(&record->Data[0], 1, record->Length, File);
+			TrackLength += record->Length;
+			midi_enc_reset(&Encoder);
+			break;
+		}
+
+		// Realtime messages (clock, active sensing, etc) don't belong in a MIDI file
+		default:
+			++Skipped;
+			return;
+	}
+
+	++MessageCount;
+}
+
+
+
+
+
+/****************** writer_thread() *********************
+ * Reads messages from the ring, and writes them to the
+ * file.
+ *
+ * NOTE: If we fall so far behind that the capture thread
+ * laps us, the messages we missed are counted in
+ * WriterReader.Skipped, and main() warns about them.
+ */
+
+static void * writer_thread(void *arg)
+{
+	struct timespec			interval;
+	register unsigned int	idle;
+
+	interval.tv_sec = 0;
+	interval.tv_nsec = 10000000;
+	idle = 0;
+
+	for (;;)
+	{
+		RECORD						record;
+		register unsigned long	lag, skipped;
+		register unsigned char	done;
+
+		// Check this before we empty the ring, so we don't miss anything the
+		// capture thread adds just before it ends
+		done = CaptureDone;
+
+		if ((lag = (unsigned long)midi_cast_lag(&Cast, &WriterReader)) > RingHigh) RingHigh = lag;
+		skipped = WriterReader.Skipped;
+		while (midi_cast_read(&Cast, &WriterReader, &record))
+		{
+			// Did we miss some? Then whatever SysEx we were putting together is
+			// missing some of its bytes
+			if (WriterReader.Skipped != skipped)
+			{
+				SysExOpen = 0;
+				skipped = WriterReader.Skipped;
+			}
+			write_record(&record);
+		}
+
+		if (done) break;
+
+		// Every 5 seconds, make sure the file is complete up to this point
+		if (++idle >= 500)
+		{
+			patch_length();
+			idle = 0;
+		}
+
+		nanosleep(&interval, 0);
+	}
+
+	return(0);
+}
+
+
+
+
+
+/****************** monitor_thread() *********************
+ * Prints the messages in the ring (in hex), one per line,
+ * for -s. If we fall too far behind, we skip ahead (and say
+ * how many we missed). Nobody waits for us.
+ */
+
+static void * monitor_thread(void *arg)
+{
+	RECORD						record;
+	register char				*ptr;
+	register unsigned char	done;
+	struct timespec			interval;
+	static char					text[65536];
+
+	interval.tv_sec = 0;
+	interval.tv_nsec = 10000000;
+
+	do
+	{
+		register unsigned long	skipped;
+
+		done = CaptureDone;
+
+		// Format as many as fit in text[], and write them with one call. A
+		// record takes at most 3 chars a byte, plus a newline
+		skipped = MonitorReader.Skipped;
+		ptr = &text[0];
+		while (ptr < &text[sizeof(text) - (sizeof(record.Data) * 3 + 1)] && midi_cast_read(&Cast, &MonitorReader, &record))
+		{
+			register unsigned int	i;
+
+			for (i = 0; i < record.Length; i++) ptr += sprintf(ptr, "%02x ", record.Data[i]);
+
+			// A SysEx may take several records. Its line ends after the last
+			if (record.Type != MIDI_TYPE_SYSEX || (record.Flags & MIDI_SYSEX_END)) *ptr++ = '\n';
+		}
+		if (MonitorReader.Skipped != skipped) printf("\n... skipped %lu messages (the display fell behind) ...\n", MonitorReader.Skipped - skipped);
+		if (ptr > &text[0])
+		{
+			fwrite(&text[0], 1, ptr - &text[0], stdout);
+			fflush(stdout);
+		}
+		else if (!done)
+			nanosleep(&interval, 0);
+	} while (!done || midi_cast_lag(&Cast, &MonitorReader));
+
+	return(0);
+}
+
+
+
+
+
+/****************** start_thread() *********************
+ * Starts a thread, at SCHED_FIFO priority if "priority"
+ * is non-zero and we're allowed.
+ *
+ * RETURNS: 0 if success, or an error number.
+ */
+
+static int start_thread(pthread_t *thread, void * (*func)(void *), void *arg, int priority)
+{
+	register int		err;
+
+	if (priority)
+	{
+		pthread_attr_t			attr;
+		struct sched_param	param;
+
+		pthread_attr_init(&attr);
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		param.sched_priority = priority;
+		pthread_attr_setschedparam(&attr, &param);
+		err = pthread_create(thread, &attr, func, arg);
+		pthread_attr_destroy(&attr);
+		if (err != EPERM) return(err);
+		printf("Can't get real-time priority for the capture thread. Run as root for that\n");
+	}
+
+	return(pthread_create(thread, 0, func, arg));
+}
+
+
+
+
+
+int main(int argc, char **argv)
+{
+	register int			err;
+	MIDIDEV					midiIn;
+	pthread_t				capture, writer, monitor;
+	MIDISTAT_PORT			sample;
+	unsigned long long	xruns;
+	const char				*statName;
+	char						cardName[64];
+
+	statName = 0;
+
+	// Get the options
+	while (argc > 2 && argv[1][0] == '-')
+	{
+		if (argv[1][1] == 'd')
+			Division = (unsigned int)atoi(argv[2]);
+		else if (argv[1][1] == 't' && atoi(argv[2]) > 0)
+			Tempo = 60000000 / (unsigned int)atoi(argv[2]);
+		else if (argv[1][1] == 'm')
+			statName = argv[2];
+		else if (argv[1][1] == 's')
+		{
+			Showing = 1;
+			--argc;
+			++argv;
+			continue;
+		}
+		else
+			break;
+		argc -= 2;
+		argv += 2;
+	}
+
+	if (argc < 2 || argv[1][0] == '-' || !Division || Division > 0x7FFF)
+	{
+		printf("Usage: smfrec [-d division] [-t bpm] [-m name] [-s] file.mid [card,device]\n");
+		return 1;
+	}
+
+	// Did user supply a MIDI Input? If not, we need to find one
+	if (argc < 3)
+	{
+		find_midi_in(&cardName[0]);
+		if (!cardName[0])
+		{
+			printf("Can't find a MIDI Input to record from!\n");
+			return 1;
+		}
+	}
+
+	// Use the one he supplied. Any name that ../../common/mididev.h takes
+	// (ie, free:1) is passed as is
+	else
+		snprintf(&cardName[0], sizeof(cardName), "%s%s", strchr(argv[2], ':') ? "" : "hw:", argv[2]);
+
+	if ((err = midi_cast_init(&Cast, sizeof(RECORD), RINGSIZE)) < 0)
+	{
+		printf("Out of memory!\n");
+		return 1;
+	}
+
+	// Each reader starts at the first message
+	midi_cast_reader_init(&Cast, &WriterReader);
+	midi_cast_reader_init(&Cast, &MonitorReader);
+
+	if ((err = midi_stat_open(&Stat, statName, 100)) < 0)
+	{
+		printf("Can't create the status memory %s: %s\n", statName ? statName : "", snd_strerror(err));
+		midi_cast_free(&Cast);
+		return 1;
+	}
+
+	// Create the file, and write the header chunk (format 0, 1 track), and the
+	// start of the track chunk. We fill in the track's length later
+	if (!(File = fopen(argv[1], "wb")))
+	{
+		printf("Can't create %s: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+	setvbuf(File, 0, _IOFBF, 1024 * 1024);
+	{
+	unsigned char	header[] = {'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0, 0, 'M', 'T', 'r', 'k', 0, 0, 0, 0,
+								0, 0xFF, 0x51, 3, 0, 0, 0};
+
+	header[12] = (unsigned char)(Division >> 8);
+	header[13] = (unsigned char)Division;
+	header[26] = (unsigned char)(Tempo >> 16);
+	header[27] = (unsigned char)(Tempo >> 8);
+	header[28] = (unsigned char)Tempo;
+	fwrite(&header[0], 1, sizeof(header), File);
+
+	// The track starts with the tempo event
+	TrackLength = sizeof(header) - 22;
+	}
+	midi_enc_init(&Encoder, MIDIENC_RUNNINGSTATUS, 0, 0);
+
+	// Open input MIDI device. We open it in non-blocking mode so
+	// that we can drain all available bytes without waiting for more
+	if ((err = midi_dev_open(&midiIn, &cardName[0], MIDIDEV_INPUT|MIDIDEV_NONBLOCK|MIDIDEV_TSTAMP)) < 0)
+	{
+		printf("Can't open MIDI Input %s: %s\n", &cardName[0], snd_strerror(err));
+		goto out;
+	}
+
+	set_input_params(&midiIn);
+
+	// From now on, only the sampler reads the driver's status. (That also
+	// clears the driver's overrun count)
+	StatPort = midi_stat_add(&Stat, &cardName[0], midiIn.Handle, 0);
+
+	// Trap when user presses CTRL-C
+	signal(SIGINT, sighandler);
+
+	if ((err = start_thread(&capture, capture_thread, &midiIn, 50)))
+	{
+		printf("Can't start the capture thread: %s\n", strerror(err));
+		midi_stat_remove(&Stat, StatPort);
+		midi_dev_close(&midiIn);
+		goto out;
+	}
+	if ((err = start_thread(&writer, writer_thread, 0, 0)))
+	{
+		printf("Can't start the writer thread: %s\n", strerror(err));
+		StopFlag = 1;
+		pthread_join(capture, 0);
+		midi_stat_remove(&Stat, StatPort);
+		midi_dev_close(&midiIn);
+		goto out;
+	}
+	if (Showing && (err = start_thread(&monitor, monitor_thread, 0, 0)))
+	{
+		printf("Can't start the monitor thread: %s\n", strerror(err));
+		Showing = 0;
+	}
+
+	printf("Recording MIDI from %s to %s...\nPress CTRL-C to stop.\n", &cardName[0], argv[1]);
+
+	// Once a second, check whether anything was lost
+	xruns = 0;
+	while (!StopFlag)
+	{
+		static unsigned long	skipped;
+
+		sleep(1);
+
+		if (!midi_stat_read(StatPort, &sample) && sample.Xruns != xruns)
+		{
+			printf("Warning: The driver's input buffer overflowed %llu times. Some MIDI bytes were lost! (It was at most %u of %u bytes full)\n",
+				sample.Xruns - xruns, sample.MaxFill, sample.BufferSize);
+			xruns = sample.Xruns;
+		}
+
+		if (WriterReader.Skipped != skipped)
+		{
+			printf("Warning: The writer fell behind, and %lu messages were lost! (Is the disk slow?)\n", WriterReader.Skipped - skipped);
+			skipped = WriterReader.Skipped;
+		}
+	}
+
+	pthread_join(capture, 0);
+	pthread_join(writer, 0);
+	if (Showing) pthread_join(monitor, 0);
+
+	// Get the last of the driver's overruns
+	midi_stat_remove(&Stat, StatPort);
+	midi_stat_read(StatPort, &sample);
+	xruns = sample.Xruns;
+	midi_dev_close(&midiIn);
+
+	// End the track, and fill in its length
+	{
+	unsigned char	end[] = {0, 0xFF, 0x2F, 0};
+
+	fwrite(&end[0], 1, sizeof(end), File);
+	TrackLength += sizeof(end);
+	}
+	patch_length();
+
+	printf("\nRecorded %lu messages (%lu MIDI bytes, %lu track bytes). Skipped %lu realtime messages\n",
+		MessageCount, ByteCount, TrackLength, Skipped);
+	printf("The writer was at most %lu of %u records behind. %lu records lost (%lu times), %llu driver overruns\n",
+		RingHigh, RINGSIZE, WriterReader.Skipped, WriterReader.Laps, xruns);
+	if (MonitorReader.Skipped) printf("The display skipped %lu records, because it fell behind\n", MonitorReader.Skipped);
+
+out:
+	fclose(File);
+	midi_stat_close(&Stat);
+	midi_cast_free(&Cast);
+	if (SysEx) free(SysEx);
+
+	return 0;
+}
@@ -0,0 +1,693 @@
+// Sends (or receives) a large SysEx dump, such as a patch bank
+// or a firmware update, through the raw MIDI port that is
+// specified on the command line (ie, 0,0 for the first card's
+// first MIDI port). If no port is specified, then it uses the
+// first one it finds.
+//
+// To send a file of SysEx messages (ie, a .syx file):
+// ./sysexbulk send [options] MyDump.syx 1,0
+//
+// The file is memory-mapped, and passed to the driver in large
+// chunks, rather than a few bytes per snd_rawmidi_write(). We
+// size the driver's buffer to hold two chunks, so one can be
+// going out the MIDI port while we pass it the next. And we pace
+// ourselves so that we don't get ahead of the wire. Options:
+//
+// -r bytes	The port's speed, in bytes per second. The default is
+//				3125, which is a standard 31250 baud MIDI cable (10
+//				bits per byte). Many USB interfaces happily accept
+//				data faster than they can send it on, and then drop
+//				some, so it pays to pace those too.
+// -u			It's a USB (class compliant) MIDI device. We don't pace
+//				the data at all, and compare the speed we achieve against
+//				the most a full speed USB-MIDI link can carry.
+// -d msecs	Wait this long after each SysEx message (ie, its 0xF7).
+//				Many devices need some time to digest each packet of a
+//				dump (for example, to write it to flash).
+// -c bytes	How many bytes to pass per snd_rawmidi_write(). The
+//				default is about 20 milliseconds worth of data.
+// -b bytes	The size of the driver's buffer. The default is 2 chunks.
+// -t bpm		Send MIDI clock (24 per beat) at this tempo while the
+//				dump goes out, and measure how steady it is.
+//
+// With -t, the clock and the dump share the port through separate
+// "lanes" (../../common/midilanes.c). The output is non-blocking, and
+// we pass the dump to the driver only a few bytes at a time, keeping
+// just a few bytes waiting in its buffer. Each clock byte goes to the
+// driver as soon as it's due, ahead of the rest of the dump (MIDI
+// lets a realtime byte go anywhere, even inside a SysEx). So it
+// waits behind only those few bytes, instead of behind a whole chunk.
+// We send a Start (0xFA) before the dump, and a Stop (0xFC) after
+// it, and print a histogram of how late each clock byte went out
+// the port. (We figure that from how many bytes were ahead of it
+// in the driver's buffer. With -c and -b, you can see how much
+// bigger chunks hurt the clock.)
+//
+// To receive a SysEx dump into a file (after you start it on
+// the device). Only the SysEx bytes are saved, so any clock or
+// active sensing bytes mixed in with the dump are ignored:
+// ./sysexbulk recv [-n messages] [-i secs] [-b bytes] MyDump.syx 1,0
+//
+// -n messages	Stop after receiving this many SysEx messages.
+// -i secs		Stop when nothing arrives for this long (after the
+//					first byte). The default is 2 seconds.
+//
+// Either way, when done, we print the achieved bytes per second,
+// and how that compares to the port's theoretical speed.
+//
+// Compile as:
+// gcc -o sysexbulk sysexbulk.c ../../common/midilanes.c ../../common/mididev.c ../../common/devalloc.c ../../common/midiparse.c ../../common/timing.c -lasound -lm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <alsa/asoundlib.h>
+#include "../../common/midiparse.h"
+#include "../../common/midilanes.h"
+#include "../../common/timing.h"
+
+
+
+// Speed of a standard MIDI cable. 31250 baud, with 10 bits (a start bit,
+// 8 data bits, and a stop bit) per byte
+#define DINRATE			3125
+
+// The most MIDI bytes a full speed USB-MIDI link can carry. Each USB-MIDI
+// event packet is 4 bytes holding up to 3 MIDI bytes. A full speed bulk
+// endpoint can move at most 19 64-byte packets per 1 millisecond frame
+#define USBRATE			(19 * 64 * 1000 * 3 / 4)
+
+// How much we read at a time when receiving
+#define INPUTBUFSIZE		65536
+
+// How many MIDIEVENTs we parse at a time when receiving
+#define MAXEVENTS			1024
+
+// Set to 1 if user wants to abort
+int StopFlag = 0;
+
+// Our options
+unsigned int	Rate = DINRATE;
+unsigned char	Usb = 0;
+unsigned int	PacketDelay = 0;
+unsigned int	ChunkSize = 0;
+unsigned int	BufferSize = 0;
+unsigned int	MaxMessages = 0;
+unsigned int	IdleSecs = 2;
+unsigned int	Tempo = 0;
+
+// How many bytes we transferred, and between what times
+unsigned long long	ByteCount, FirstTime, LastTime;
+unsigned long			MessageCount;
+
+
+
+
+
+
+/****************** sighandler() *********************
+ * Called by the operating system when the user presses
+ * CTRL-C to abort this app.
+ */
+
+void sighandler(int dummy)
+{
+	// Let main() know that user wants to break out of the loop
+	StopFlag = 1;
+}
+
+
+
+
+
+/****************** find_midi_port() *********************
+ * Finds the first MIDI input or output in the system, and
+ * copies its name (for snd_rawmidi_open) to the specified
+ * buffer. If none is found, zeroes out the buffer.
+ *
+ * type =	SND_RAWMIDI_STREAM_OUTPUT to find an output, or
+ *				SND_RAWMIDI_STREAM_INPUT for an input.
+ */
+
+void find_midi_port(char *cardName, int type)
+{
+	register int			err;
+	int						cardNum;
+	snd_rawmidi_info_t	*rawMidiInfo;
+
+	// Assume none found
+	cardName[0] = 0;
+
+	// Start with first card
+	cardNum = -1;
+
+	// To get some info about the subdevices of a MIDI device, we need a
+	// snd_rawmidi_info_t, so let's allocate one on the stack
+	snd_rawmidi_info_alloca(&rawMidiInfo);
+	memset(rawMidiInfo, 0, snd_rawmidi_info_sizeof());
+
+	do
+	{
+		// Get next sound card's card number. When "cardNum" == -1, then ALSA
+		// fetches the first card
+		if ((err = snd_card_next(&cardNum)) < 0) break;
+
+		// Another card? ALSA sets "cardNum" to -1 if no more
+		if (cardNum != -1)
+		{
+			snd_ctl_t			*midiHandle;
+
+			// Open this card. We specify only the card number -- not any device nor sub-device too
+			sprintf(cardName, "hw:%i", cardNum);
+			if ((err = snd_ctl_open(&midiHandle, cardName, 0)) >= 0)
+			{
+				int				devNum;
+
+				// Start with the first device on this card, and look for a MIDI port
+				devNum = -1;
+				for (;;)
+				{
+					// Get the number of the next MIDI device on this card
+					if ((err = snd_ctl_rawmidi_next_device(midiHandle, &devNum)) < 0 || devNum < 0) break;
+
+					// Get info on the wanted portion of this device's first subdevice
+					snd_rawmidi_info_set_device(rawMidiInfo, devNum);
+					snd_rawmidi_info_set_stream(rawMidiInfo, type);
+					snd_rawmidi_info_set_subdevice(rawMidiInfo, 0);
+					if ((err = snd_ctl_rawmidi_info(midiHandle, rawMidiInfo)) >= 0 && snd_rawmidi_info_get_subdevices_count(rawMidiInfo))
+					{
+						// We found one. Format its name in the caller's buffer
+						sprintf(cardName, "hw:%i,%i", cardNum, devNum);
+
+						// All done
+						cardNum = -1;
+
+						break;
+					}
+				}
+
+				// Close the card after we're done enumerating its subdevices
+				snd_ctl_close(midiHandle);
+			}
+		}
+
+		// Another card?
+	} while (cardNum != -1);
+
+	// ALSA allocates some mem to load its config file when we call some of the
+	// above functions. Now that we're done getting the info, let's tell ALSA
+	// to unload the info and free up that mem
+	snd_config_update_free_global();
+}
+
+
+
+
+
+/****************** set_buffer_size() *********************
+ * Sets the size of the driver's buffer for the open MIDI
+ * port.
+ *
+ * RETURNS: The size the driver actually uses.
+ */
+
+static unsigned int set_buffer_size(snd_rawmidi_t *midiHandle, unsigned int size)
+{
+	snd_rawmidi_params_t	*params;
+	register int			err;
+
+	if ((err = snd_rawmidi_params_malloc(&params)) < 0)
+		printf("Can't get a snd_rawmidi_params_t: %s\n", snd_strerror(err));
+	else
+	{
+		if ((err = snd_rawmidi_params_current(midiHandle, params)) < 0 ||
+			(err = snd_rawmidi_params_set_buffer_size(midiHandle, params, size)) < 0 ||
+			(err = snd_rawmidi_params(midiHandle, params)) < 0)
+		{
+			printf("Can't set MIDI buffer size to %u: %s\n", size, snd_strerror(err));
+		}
+
+		// Get the size the driver settled on
+		snd_rawmidi_params_current(midiHandle, params);
+		size = (unsigned int)snd_rawmidi_params_get_buffer_size(params);
+		snd_rawmidi_params_free(params);
+	}
+
+	return(size);
+}
+
+
+
+
+
+/****************** sleep_until() *********************
+ * Sleeps until the specified (monotonic clock) time.
+ */
+
+static void sleep_until(unsigned long long time)
+{
+	struct timespec	due;
+
+	ns_to_timespec(time, &due);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, 0) == EINTR && !StopFlag);
+}
+
+
+
+
+
+/****************** send_dump() *********************
+ * Sends the SysEx in a memory-mapped file.
+ *
+ * midiOut =			The MIDI output.
+ * data =				The file's contents.
+ * size =				The file's size.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+static int send_dump(MIDIDEV *midiOut, const unsigned char *data, unsigned long long size)
+{
+	register unsigned long long	pos, due;
+	register int					err;
+
+	// Default to about 20 msecs worth of data per chunk. Any smaller, and
+	// we spend our time in syscalls. Any bigger, and our pacing gets coarse
+	if (!ChunkSize) ChunkSize = (Usb ? 4096 : (Rate / 50 < 64 ? 64 : Rate / 50));
+
+	// Size the driver's buffer to hold 2 chunks. A bigger buffer only adds to how
+	// much is queued in the driver (which we can't take back if the user aborts)
+	if (!BufferSize) BufferSize = ChunkSize * 2;
+	if (midiOut->Handle) BufferSize = set_buffer_size(midiOut->Handle, BufferSize);
+	if (ChunkSize > BufferSize) ChunkSize = BufferSize;
+	printf("Sending %llu bytes in %u byte chunks, driver buffer %u bytes\n", size, ChunkSize, BufferSize);
+
+	FirstTime = due = get_time_ns();
+	pos = 0;
+	while (pos < size && !StopFlag)
+	{
+		register unsigned int	len;
+		register unsigned char	endOfMessage;
+
+		len = (size - pos > ChunkSize ? ChunkSize : (unsigned int)(size - pos));
+		endOfMessage = 0;
+
+		// If we need to pause after each SysEx message, then end the chunk at the 0xF7
+		if (PacketDelay)
+		{
+			register const unsigned char	*eox;
+
+			if ((eox = (const unsigned char *)memchr(data + pos, 0xF7, len)))
+			{
+				len = (unsigned int)(eox - (data + pos)) + 1;
+				endOfMessage = 1;
+			}
+		}
+
+		// Don't get ahead of the wire. We schedule each chunk at the time the
+		// previous chunk should be finished going out the port. NOTE: We use
+		// absolute times, so any lateness doesn't accumulate
+		if (!Usb) sleep_until(due);
+
+		if ((err = midi_dev_write(midiOut, data + pos, len)) < 0) return(err);
+		pos += err;
+		ByteCount += err;
+		due += (unsigned long long)err * 1000000000ULL / Rate;
+
+		if (endOfMessage)
+		{
+			++MessageCount;
+
+			// Wait for the message to actually go out the port, then give the device
+			// its breather
+			midi_dev_drain(midiOut);
+			due = get_time_ns() + (unsigned long long)PacketDelay * 1000000ULL;
+			if (!Usb) sleep_until(due);
+		}
+	}
+
+	// Wait for the last of it to go out the port
+	midi_dev_drain(midiOut);
+	LastTime = get_time_ns();
+
+	return(0);
+}
+
+
+
+
+
+/****************** send_clocked() *********************
+ * Sends the SysEx in a memory-mapped file, along with MIDI
+ * clock, through separate lanes.
+ *
+ * midiOut =			The MIDI output.
+ * data =				The file's contents.
+ * size =				The file's size.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+static int send_clocked(MIDIDEV *midiOut, const unsigned char *data, unsigned long long size)
+{
+	MIDILANES						lanes;
+	register unsigned long long	pos, tick, interval, hold;
+	register unsigned long		ticks;
+	register int					err;
+
+	if ((err = midi_dev_nonblock(midiOut, 1)) < 0) return(err);
+
+	// The driver's buffer needs to hold only the few bytes we let wait in it
+	// (plus any clock bytes), so keep it small
+	if (!ChunkSize) ChunkSize = MIDILANES_CHUNK;
+	if (!BufferSize) BufferSize = 64;
+	if (midiOut->Handle) BufferSize = set_buffer_size(midiOut->Handle, BufferSize);
+	midi_lanes_init(&lanes, midiOut, Rate, ChunkSize, ChunkSize * 2);
+	printf("Sending %llu bytes in %u byte chunks, at most %u bytes waiting in the driver's %u byte buffer, with clock at %u bpm\n",
+		size, lanes.Chunk, lanes.Window, BufferSize, Tempo);
+
+	interval = 60000000000ULL / (Tempo * 24);
+	FirstTime = tick = get_time_ns();
+	if ((err = midi_lanes_realtime(&lanes, 0xFA, tick)) < 0) return(err);
+
+	pos = hold = ticks = 0;
+	while (!StopFlag)
+	{
+		register unsigned long long	now, wake, due;
+
+		now = get_time_ns();
+
+		// Queue any clock ticks that are due. Each goes out ahead of the dump
+		while (now >= tick)
+		{
+			if ((err = midi_lanes_realtime(&lanes, 0xF8, tick)) < 0 && err != -ENOBUFS) return(err);
+			++ticks;
+			tick += interval;
+		}
+
+		// Is the bulk lane done with what we gave it? Give it the next SysEx
+		// message (or, if there's no pause between messages, the rest of the
+		// file). But first, give the device its breather, if needed, once the
+		// last message is out the port
+		if (!lanes.BulkLen && pos < size)
+		{
+			register unsigned long long	len;
+
+			if (PacketDelay && pos && !hold) hold = midi_lanes_idle(&lanes) + (unsigned long long)PacketDelay * 1000000ULL;
+			if (now >= hold)
+			{
+				len = size - pos;
+				if (PacketDelay)
+				{
+					register const unsigned char	*eox;
+
+					if ((eox = (const unsigned char *)memchr(data + pos, 0xF7, len))) len = (unsigned long long)(eox - (data + pos)) + 1;
+				}
+				midi_lanes_bulk(&lanes, data + pos, len);
+				pos += len;
+				hold = 0;
+			}
+		}
+
+		if ((err = midi_lanes_service(&lanes, now)) < 0) return(err);
+
+		// Done when it has all gone out the port
+		if (pos >= size && !midi_lanes_busy(&lanes) && now >= midi_lanes_idle(&lanes)) break;
+
+		// Sleep until the next tick, or until the lanes have room for more
+		wake = tick;
+		if ((due = midi_lanes_due(&lanes)) && due < wake) wake = due;
+		if (hold && hold < wake) wake = hold;
+		if (!midi_lanes_busy(&lanes) && pos >= size && (due = midi_lanes_idle(&lanes)) < wake) wake = due;
+		sleep_until(wake);
+	}
+
+	midi_lanes_realtime(&lanes, 0xFC, get_time_ns());
+	midi_dev_nonblock(midiOut, 0);
+	midi_dev_drain(midiOut);
+	LastTime = get_time_ns();
+
+	// Count the SysEx messages that went out
+	{
+	register const unsigned char	*end, *ptr;
+
+	end = data + lanes.Bytes[MIDILANES_BULK];
+	for (ptr = data; (ptr = (const unsigned char *)memchr(ptr, 0xF7, end - ptr)); ptr++) ++MessageCount;
+	}
+	ByteCount = lanes.Bytes[MIDILANES_BULK];
+
+	printf("Sent %lu clock ticks", ticks);
+	if (lanes.Dropped) printf(" (%lu dropped because the driver was full)", lanes.Dropped);
+	printf("\n");
+	time_hist_print(&lanes.RTDelay, "How late each clock byte went out the port");
+
+	return(0);
+}
+
+
+
+
+
+/****************** receive_dump() *********************
+ * Receives SysEx, and writes it to a file.
+ *
+ * midiIn =		The (non-blocking) MIDI input.
+ * outHandle =		File handle to write to.
+ *
+ * RETURNS: 0 if success, or a negative error number.
+ */
+
+static int receive_dump(MIDIDEV *midiIn, int outHandle)
+{
+	MIDIPARSER				parser;
+	MIDIEVENT				events[MAXEVENTS];
+	struct pollfd			*pfds;
+	unsigned char			*buffer;
+	register int			err, npfds;
+
+	if (!(buffer = (unsigned char *)malloc(INPUTBUFSIZE))) return(-ENOMEM);
+
+	// A big driver buffer, so that nothing is lost while we're writing to the disk
+	if (!BufferSize) BufferSize = INPUTBUFSIZE;
+	if (midiIn->Handle) BufferSize = set_buffer_size(midiIn->Handle, BufferSize);
+	printf("Waiting for SysEx, driver buffer %u bytes...\n", BufferSize);
+
+	npfds = midi_dev_poll_descriptors_count(midiIn);
+	pfds = (struct pollfd *)alloca(npfds * sizeof(struct pollfd));
+	midi_dev_poll_descriptors(midiIn, pfds, npfds);
+
+	midi_parse_init(&parser);
+	err = 0;
+	while (!StopFlag && (!MaxMessages || MessageCount < MaxMessages))
+	{
+		register int			len;
+
+		// Wait for more bytes. Once the dump has started, give up if it stalls
+		if ((err = poll(pfds, npfds, FirstTime ? (int)(IdleSecs * 1000) : -1)) < 0)
+		{
+			if (errno == EINTR) continue;
+			err = -errno;
+			break;
+		}
+		if (!err) break;
+
+		// Grab all that's available
+		if ((len = midi_dev_read(midiIn, buffer, INPUTBUFSIZE, 0)) < 0)
+		{
+			if (len == -EAGAIN) continue;
+			err = len;
+			break;
+		}
+
+		LastTime = get_time_ns();
+
+		// Pick out the SysEx bytes. These are slices of our buffer, so there's
+		// no copying until we write them to the file
+		{
+		register const unsigned char	*ptr;
+		unsigned int						used, count, i;
+
+		ptr = buffer;
+		while (len)
+		{
+			count = midi_parse(&parser, ptr, len, LastTime, &events[0], MAXEVENTS, &used);
+			ptr += used;
+			len -= used;
+
+			for (i = 0; i < count; i++)
+			{
+				if (events[i].Type == MIDI_TYPE_SYSEX)
+				{
+					if (!FirstTime) FirstTime = LastTime;
+					if (write(outHandle, events[i].SysEx, events[i].Length) != events[i].Length)
+					{
+						err = -errno;
+						goto out;
+					}
+					ByteCount += events[i].Length;
+					if (events[i].Flags & MIDI_SYSEX_END) ++MessageCount;
+				}
+			}
+		}
+		}
+
+		err = 0;
+	}
+out:
+	free(buffer);
+	return(err);
+}
+
+
+
+
+
+int main(int argc, char **argv)
+{
+	register int			err;
+	register unsigned char	receiving;
+	char						cardName[64];
+
+	if (argc < 3 || (strcmp(argv[1], "send") && strcmp(argv[1], "recv")))
+	{
+usage:
+		printf("Usage: sysexbulk send [-r bytespersec] [-u] [-d msecs] [-c chunkbytes] [-b bufferbytes] [-t bpm] file.syx [card,device]\n");
+		printf("       sysexbulk recv [-n messages] [-i idlesecs] [-b bufferbytes] file.syx [card,device]\n");
+		return 1;
+	}
+	receiving = (argv[1][0] == 'r');
+	argc -= 1;
+	argv += 1;
+
+	// Get the options
+	while (argc > 1 && argv[1][0] == '-')
+	{
+		if (argv[1][1] == 'u')
+		{
+			Usb = 1;
+			Rate = USBRATE;
+			--argc;
+			++argv;
+			continue;
+		}
+
+		if (argc < 3) goto usage;
+		switch (argv[1][1])
+		{
+			case 'r':
+				if (!(Rate = (unsigned int)atoi(argv[2]))) goto usage;
+				break;
+			case 'd':
+				PacketDelay = (unsigned int)atoi(argv[2]);
+				break;
+			case 'c':
+				ChunkSize = (unsigned int)atoi(argv[2]);
+				break;
+			case 'b':
+				BufferSize = (unsigned int)atoi(argv[2]);
+				break;
+			case 'n':
+				MaxMessages = (unsigned int)atoi(argv[2]);
+				break;
+			case 'i':
+				IdleSecs = (unsigned int)atoi(argv[2]);
+				break;
+			case 't':
+				if (!(Tempo = (unsigned int)atoi(argv[2]))) goto usage;
+				break;
+			default:
+				goto usage;
+		}
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc < 2) goto usage;
+
+	// Did user supply a MIDI port? If not, we need to find one
+	if (argc < 3)
+	{
+		find_midi_port(&cardName[0], receiving ? SND_RAWMIDI_STREAM_INPUT : SND_RAWMIDI_STREAM_OUTPUT);
+		if (!cardName[0])
+		{
+			printf("Can't find a MIDI %s!\n", receiving ? "Input" : "Output");
+			return 1;
+		}
+	}
+
+	// Use the one he supplied
+	else
+		sprintf(&cardName[0], strchr(argv[2], ':') ? "%s" : "hw:%s", argv[2]);
+
+	// Trap when user presses CTRL-C
+	signal(SIGINT, sighandler);
+
+	if (receiving)
+	{
+		MIDIDEV			midiIn;
+		register int	outHandle;
+
+		if ((outHandle = open(argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+		{
+			printf("Can't create %s: %s\n", argv[1], strerror(errno));
+			return 1;
+		}
+
+		if ((err = midi_dev_open(&midiIn, &cardName[0], MIDIDEV_INPUT|MIDIDEV_NONBLOCK)) < 0)
+			printf("Can't open MIDI Input %s: %s\n", &cardName[0], snd_strerror(err));
+		else
+		{
+			if ((err = receive_dump(&midiIn, outHandle)) < 0)
+				printf("Receive error: %s\n", snd_strerror(err));
+			midi_dev_close(&midiIn);
+		}
+
+		close(outHandle);
+	}
+	else
+	{
+		struct stat						info;
+		MIDIDEV							midiOut;
+		register const unsigned char	*data;
+		register int					inHandle;
+
+		// Map the whole file into memory. The driver copies straight out of the mapping
+		if ((inHandle = open(argv[1], O_RDONLY)) == -1 || fstat(inHandle, &info) || !info.st_size ||
+			(data = (const unsigned char *)mmap(0, info.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, inHandle, 0)) == MAP_FAILED)
+		{
+			printf("Can't load %s: %s\n", argv[1], strerror(errno ? errno : EINVAL));
+			return 1;
+		}
+		madvise((void *)data, info.st_size, MADV_SEQUENTIAL);
+
+		if (data[0] != 0xF0)
+			printf("%s is not a SysEx file\n", argv[1]);
+		else if ((err = midi_dev_open(&midiOut, &cardName[0], MIDIDEV_OUTPUT)) < 0)
+			printf("Can't open MIDI Output %s: %s\n", &cardName[0], snd_strerror(err));
+		else
+		{
+			if ((err = (Tempo ? send_clocked(&midiOut, data, info.st_size) : send_dump(&midiOut, data, info.st_size))) < 0)
+				printf("Send error: %s\n", snd_strerror(err));
+			midi_dev_close(&midiOut);
+		}
+
+		munmap((void *)data, info.st_size);
+		close(inHandle);
+	}
+
+	// Report how fast it went, compared to how fast the port can go
+	if (ByteCount && LastTime > FirstTime)
+	{
+		double	rate;
+
+		rate = (double)ByteCount * 1000000000.0 / (LastTime - FirstTime);
+		printf("%s %llu bytes (%lu SysEx messages) in %.3f secs: %.0f bytes/sec, %.1f%% of the %s rate (%u bytes/sec)\n",
+			receiving ? "Received" : "Sent", ByteCount, MessageCount, (LastTime - FirstTime) / 1000000000.0, rate,
+			rate * 100.0 / Rate, Usb ? "full speed USB-MIDI" : "MIDI cable", Rate);
+	}
+
+	return 0;
+}
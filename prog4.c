@@ -177,18 +177,47 @@ snd_rawmidi_nonblock(midiOutHandle, 1);
 // Open output MIDI device hw:0,0,0 in non-blocking mode
 if ((err = snd_rawmidi_open(0, &midiOutHandle, "hw:0,0,0", SND_RAWMIDI_NONBLOCK)) < 0)
 {
-   // Is someone else using this MIDI output?
+   // Is someone else using this MIDI output? Then try any free subdevice
+   // of card 0's MIDI devices (see common/devalloc.c)
    if (err == -EBUSY)
-   {
-      // Here you may wish to try opening a different MIDI output
-   }
-   printf("Can't open MIDI output: %s\n", snd_strerror(err));
+      err = dev_alloc_rawmidi(&midiOutHandle, 0, "0", 1, SND_RAWMIDI_NONBLOCK);
+   if (err < 0)
+      printf("Can't open MIDI output: %s\n", snd_strerror(err));
 }
 // Here you may wish to turn off non-blocking mode
-else
+if (err >= 0)
    snd_rawmidi_nonblock(midiOutHandle, 0);
 
 
 
 snd_rawmidi_drain(midiOutHandle);
 
+
+
+struct pollfd pfds[4];
+register int  npfds, len;
+
+// Get the descriptors that poll() can wait on, for room in the output buffer
+npfds = snd_rawmidi_poll_descriptors(midiOutHandle, pfds, 4);
+
+// Write "count" bytes at "ptr", in non-blocking mode
+while (count)
+{
+   // The driver may take all of them, some of them, or (if its buffer
+   // is full) none. In that last case, it returns -EAGAIN
+   if ((len = snd_rawmidi_write(midiOutHandle, ptr, count)) == -EAGAIN) len = 0;
+   if (len < 0)
+   {
+      printf("Can't write MIDI output: %s\n", snd_strerror(len));
+      break;
+   }
+   ptr += len;
+   count -= len;
+
+   // Wait until the driver has room for more. Here you may wish to instead
+   // keep the rest in your own queue, and go do something else. Just
+   // add these descriptors to the poll() you already do, and when
+   // one gets POLLOUT, write more
+   if (count) poll(pfds, npfds, -1);
+}
+
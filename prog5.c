@@ -43,6 +43,37 @@ else
    snd_rawmidi_status_free(ptr);
 }
 
+
+
+MIDISTAT      stat;
+MIDISTAT_PORT *port, sample;
+register int  err;
+
+// Start a thread that gets the status of our ports every 100 milliseconds.
+// Pass a name instead of 0 to let rawmidi/midistat watch them too
+if ((err = midi_stat_open(&stat, 0, 100)) < 0)
+   printf("Can't start the status sampler: %s\n", strerror(-err));
+else
+{
+   // Add our MIDI input. From now on, only the sampler calls snd_rawmidi_status for it
+   if (!(port = midi_stat_add(&stat, "hw:0,0,0", midiInHandle, 0)))
+      printf("No room for another port\n");
+   else
+   {
+      // Each time we read, we count the bytes
+      if ((err = snd_rawmidi_read(midiInHandle, &buffer[0], sizeof(buffer))) > 0)
+         midi_stat_count(port, err);
+
+      // Whenever we like, get a copy of what the sampler found
+      if (!midi_stat_read(port, &sample))
+         printf("There have been %llu errors\n", sample.Xruns);
+
+      midi_stat_remove(&stat, port);
+   }
+
+   midi_stat_close(&stat);
+}
+
 snd_rawmidi_close(midiInHandle);
 
 unsigned char buffer[10];
@@ -57,14 +88,14 @@ snd_rawmidi_nonblock(midiInHandle, 1);
 // Open input MIDI device hw:0,0,0 in non-blocking mode
 if ((err = snd_rawmidi_open(&midiInHandle, 0, "hw:0,0,0", SND_RAWMIDI_NONBLOCK)) < 0)
 {
-   // Is someone else using this MIDI input?
+   // Is someone else using this MIDI input? Then try any free subdevice
+   // of card 0's MIDI devices (see common/devalloc.c)
    if (err == -EBUSY)
-   {
-      // Here you may wish to try opening a different MIDI input
-   }
-   printf("Can't open MIDI input: %s\n", snd_strerror(err));
+      err = dev_alloc_rawmidi(&midiInHandle, 0, "0", 0, SND_RAWMIDI_NONBLOCK);
+   if (err < 0)
+      printf("Can't open MIDI input: %s\n", snd_strerror(err));
 }
 // Here you may wish to turn off non-blocking mode
-else
+if (err >= 0)
    snd_rawmidi_nonblock(midiInHandle, 0);
 